@@ -69,20 +69,142 @@ int rx888_open(rx888_dev_t **dev, uint32_t index);
 
 int rx888_close(rx888_dev_t *dev);
 
+typedef struct rx888_replay_config {
+    uint32_t sample_rate;       /* required for raw files, overrides the
+                                   SigMF metadata otherwise, 0 to keep it */
+    int fast;                   /* 1 to deliver as fast as possible instead
+                                   of at the recorded sample rate */
+    int loop;                   /* 1 to start over at the end of the file */
+} rx888_replay_config_t;
+
+/*!
+ * Open a recording as a device. rx888_read_async() and rx888_read_async_ex()
+ * then deliver the file in transfer sized buffers through the same callbacks
+ * and metadata as live data, on the calling thread, and return at the end of
+ * the file unless looping. Raw int16 files are delivered in place from a
+ * private mapping; SigMF recordings may also be cf32_le, as written by
+ * rx888_rec, and are converted back to int16. Device controls have no
+ * effect, except that rx888_set_sample_rate() changes the replay pace.
+ * Synchronous reads are not supported.
+ *
+ * \param out_dev replay device handle
+ * \param path raw file (.cf32 for float I/Q), .sigmf-meta or .sigmf-data
+ * \param config replay options, may be NULL for SigMF files
+ * \return 0 on success, negative errno on failure
+ */
+int rx888_open_replay(rx888_dev_t **out_dev, const char *path,
+                      const rx888_replay_config_t *config);
+
 enum rx888_device {
     RX888_DEVICE = 0
 };
 
+/*!
+ * Set the HF attenuator.
+ *
+ * While streaming, the first buffer after the change is flagged with
+ * RX888_BUF_ATTENUATION_CHANGED, see rx888_read_async_ex().
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param rf_gain attenuation in dB, one of 0, -10 or -20
+ * \return 0 on success
+ */
 int rx888_set_hf_attenuation(rx888_dev_t *dev, double rf_gain);
 
+/*!
+ * Get the current HF attenuation in dB, as set by the user or the AGC.
+ */
+double rx888_get_hf_attenuation(rx888_dev_t *dev);
+
+/*!
+ * Enable the LTC2208 output randomizer. The library undoes it on every
+ * streamed buffer, and in rx888_read_sync(), before the data is handed out.
+ * Buffers that were in flight while switching are decoded with the new
+ * setting.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_adc_randomizer(rx888_dev_t *dev, int on);
+
+/*!
+ * Enable the LTC2208 internal dither.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_adc_dither(rx888_dev_t *dev, int on);
+
+/*!
+ * Undo the ADC output randomizer in place, every sample with the LSB set has
+ * bits 1 - 15 inverted.
+ *
+ * \return 0 on success
+ */
+int rx888_adc_derandomize(int16_t *samples, uint32_t count);
+
+typedef struct rx888_adc_health {
+    int32_t peak;               /* largest sample magnitude */
+    uint32_t clipped;           /* samples at either end of the ADC range */
+    float peak_dbfs;
+    float rms;                  /* relative to full scale */
+    float dc;                   /* mean, relative to full scale */
+} rx888_adc_health_t;
+
+/*!
+ * Compute the ADC health figures of a block of samples.
+ *
+ * \return 0 on success
+ */
+int rx888_adc_health(const int16_t *samples, uint32_t count,
+                     rx888_adc_health_t *health);
+
+/*!
+ * Compute the ADC health of every streamed buffer and pass it along with the
+ * buffer metadata, see rx888_read_async_ex(). Always on while the AGC runs.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_adc_health(rx888_dev_t *dev, int on);
+
+typedef struct rx888_agc_config {
+    float high_dbfs;            /* add attenuation above this peak level */
+    float low_dbfs;             /* remove attenuation below this peak level,
+                                   at least 10 dB under high_dbfs */
+    uint32_t hold_ms;           /* time spent below low_dbfs before
+                                   attenuation is removed */
+} rx888_agc_config_t;
+
+/*!
+ * Run an automatic HF attenuation loop on the streamed buffers. Clipping or
+ * a peak above high_dbfs steps the attenuator up by 10 dB right away, a peak
+ * below low_dbfs for hold_ms steps it back down. Every step is reported
+ * in-band with RX888_BUF_ATTENUATION_CHANGED.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param config loop configuration, NULL to disable the loop
+ * \return 0 on success, -EINVAL on invalid configuration
+ */
+int rx888_set_hf_agc(rx888_dev_t *dev, const rx888_agc_config_t *config);
+
 /*!
  * Set the sample rate for the device.
  *
+ * May be called while streaming. The transfers that were in flight when the
+ * ADC clock changed are dropped, the first buffer at the new rate is flagged
+ * with RX888_BUF_RATE_CHANGED and carries the number of dropped samples, see
+ * rx888_read_async_ex().
+ *
  * \param dev the device handle given by rx888_open()
  * \param samp_rate the sample rate to be set, possible values are:
  * 		    10000 - 150000000 Hz
  * 		    sample loss is to be expected for rates > 150000000
- * \return 0 on success, -EINVAL on invalid rate
+ * \return 0 on success, -EINVAL on invalid rate, -1 if the device did not
+ *         take the command, the rate is then left unchanged
  */
 int rx888_set_sample_rate(rx888_dev_t *dev, uint32_t rate);
 
@@ -94,8 +216,68 @@ int rx888_set_sample_rate(rx888_dev_t *dev, uint32_t rate);
  */
 uint32_t rx888_get_sample_rate(rx888_dev_t *dev);
 
+/*!
+ * Read samples from the device synchronously.
+ *
+ * Without readahead this is a single bulk transfer and nothing is captured
+ * between calls. With rx888_start_readahead() the call is served from the
+ * transfers completed in the background and blocks until len bytes were
+ * copied.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf buffer to fill, len should be a multiple of 512
+ * \param len buffer length in bytes
+ * \param n_read bytes actually read
+ * \return 0 on success
+ */
 int rx888_read_sync(rx888_dev_t *dev, void *buf, int len, int *n_read);
 
+/*!
+ * Same as rx888_read_sync(), but gives up after timeout_ms milliseconds.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf buffer to fill
+ * \param len buffer length in bytes
+ * \param n_read bytes actually read, also on timeout
+ * \param timeout_ms timeout in milliseconds, 0 to wait forever
+ * \return 0 on success, LIBUSB_ERROR_TIMEOUT (-7) on timeout
+ */
+int rx888_read_sync_timeout(rx888_dev_t *dev, void *buf, int len, int *n_read,
+                            unsigned int timeout_ms);
+
+/*!
+ * Keep a pool of transfers streaming behind rx888_read_sync(), so that
+ * samples keep arriving between calls. Completed transfers are held until
+ * they were read out and only then resubmitted; the stream is lossless as
+ * long as the reader keeps up on average and falls behind by less than the
+ * pool. USB events are handled by the thread calling rx888_read_sync(), no
+ * thread is started.
+ *
+ * When the pool runs full the device overflows. The next buffer is flagged
+ * with RX888_BUF_OVERRUN, sample indices skip the lost samples and the
+ * overrun is counted in rx888_get_stream_stats(). Lost samples are
+ * estimated from the time nothing was in flight and are a lower bound.
+ *
+ * rx888_cancel_async() makes pending and later reads fail.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf_num transfer count, see rx888_read_async()
+ * \param buf_len transfer length, see rx888_read_async()
+ * \return 0 on success
+ */
+int rx888_start_readahead(rx888_dev_t *dev, uint32_t buf_num,
+                          uint32_t buf_len);
+
+/*!
+ * Stop the readahead and return rx888_read_sync() to direct transfers.
+ * Buffered samples that were not read are dropped, as are buffers still
+ * held from rx888_read_next().
+ *
+ * \param dev the device handle given by rx888_open()
+ * \return 0 on success
+ */
+int rx888_stop_readahead(rx888_dev_t *dev);
+
 typedef void(*rx888_read_async_cb_t)(unsigned char *buf, uint32_t len, void *ctx);
 
 /*!
@@ -110,6 +292,9 @@ typedef void(*rx888_read_async_cb_t)(unsigned char *buf, uint32_t len, void *ctx
  * \param buf_len optional buffer length, must be multiple of 512,
  *		  should be a multiple of 16384 (URB size), set to 0
  *		  for default buffer length (16 * 32 * 512)
+ *
+ * With both buf_num and buf_len 0 and rx888_set_auto_buffers() enabled, the
+ * geometry is derived from the sample rate instead.
  * \return 0 on success
  */
 int rx888_read_async(rx888_dev_t *dev,
@@ -118,6 +303,547 @@ int rx888_read_async(rx888_dev_t *dev,
                  uint32_t buf_num,
                  uint32_t buf_len);
 
+typedef struct rx888_buffer_config {
+    uint32_t latency_us;        /* target time to fill one transfer */
+    uint32_t headroom_ms;       /* data to keep in flight, how long the
+                                   event loop may stall without loss */
+} rx888_buffer_config_t;
+
+/*!
+ * Let rx888_read_async() size the transfers from the sample rate when it is
+ * called with buf_num and buf_len both 0. Transfers are rounded to 16 KiB
+ * and the queue depth is kept within the usbfs memory limit. While
+ * streaming, the queue is deepened when transfer completions arrive late and
+ * slowly shrunk back when they are steady again.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param config sizing goals, NULL for the fixed default geometry
+ * \return 0 on success, -EINVAL on invalid configuration
+ */
+int rx888_set_auto_buffers(rx888_dev_t *dev,
+                           const rx888_buffer_config_t *config);
+
+enum rx888_stream_profile {
+    RX888_PROFILE_DEFAULT = 0,  /* fixed 16 x 128 KiB transfers */
+    RX888_PROFILE_LOW_LATENCY   /* ~100 us transfers, 20 ms in flight,
+                                   busy polling event loop */
+};
+
+/*!
+ * Select a set of streaming defaults, applied to the next
+ * rx888_read_async() called with buf_num and buf_len both 0.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param profile one of enum rx888_stream_profile
+ * \return 0 on success
+ */
+int rx888_set_stream_profile(rx888_dev_t *dev,
+                             enum rx888_stream_profile profile);
+
+/*!
+ * Spin on the USB events instead of sleeping in the kernel between
+ * completions. Lowers the wakeup latency at the cost of one busy core.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_busy_poll(rx888_dev_t *dev, int on);
+
+/*!
+ * Let rx888_read_async() ride out a lost device instead of returning. When
+ * the device drops off the bus or keeps failing transfers, it is closed and
+ * looked for by its serial number until it is back or the timeout passed.
+ * The sample rate and GPIO state are then set again and streaming resumes
+ * into the same callback. The first buffer after the gap is flagged with
+ * RX888_BUF_DISCONTINUITY, sample indices skip the samples estimated lost
+ * and recoveries are counted in rx888_get_stream_stats().
+ *
+ * The device has to come back with its firmware running. Not available
+ * with rx888_set_ring_buffer() or while a session from rx888_session_open()
+ * is open, the stream then ends as without recovery.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param timeout_ms how long to wait for the device, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_auto_recovery(rx888_dev_t *dev, unsigned int timeout_ms);
+
+/*!
+ * Get the NUMA node of the USB host controller the device is attached to,
+ * as found in sysfs when the device was opened. Transfer and ring buffers
+ * are placed on this node unless changed with rx888_set_numa_node().
+ *
+ * \param dev the device handle given by rx888_open()
+ * \return the node, -1 if unknown or not a NUMA system
+ */
+int rx888_get_numa_node(rx888_dev_t *dev);
+
+/*!
+ * Place the transfer and ring buffers of the next stream on another node.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param node NUMA node, -1 to leave the placement to the kernel
+ * \return 0 on success, -2 while streaming or with a session open
+ */
+int rx888_set_numa_node(rx888_dev_t *dev, int node);
+
+/*!
+ * Run the calling thread on the CPUs of a NUMA node only, typically the one
+ * of rx888_get_numa_node() for the thread handling the USB events. Threads
+ * it creates later inherit the placement, including the workers of the
+ * DSP engines, which then start one worker per CPU of the node.
+ *
+ * \param node NUMA node
+ * \return 0 on success, -ENODEV for a node without CPUs, -ENOSYS where
+ *         not supported
+ */
+int rx888_pin_thread_to_node(int node);
+
+typedef struct rx888_latency_stats {
+    uint64_t count;             /* buffers measured */
+    uint32_t min_us;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t p999_us;
+    uint32_t max_us;
+} rx888_latency_stats_t;
+
+/*!
+ * Measure the latency from the ADC sampling the first sample of every buffer
+ * to the callback receiving it. The ADC time base is derived from the sample
+ * counter and the earliest transfer completions, so the constant delay of
+ * the USB path in front of the fastest completion is not included. Values
+ * have a resolution of about 3%.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable
+ * \return 0 on success
+ */
+int rx888_set_latency_stats(rx888_dev_t *dev, int on);
+
+int rx888_get_latency_stats(rx888_dev_t *dev, rx888_latency_stats_t *stats);
+
+int rx888_reset_latency_stats(rx888_dev_t *dev);
+
+enum rx888_buffer_flags {
+    RX888_BUF_RATE_CHANGED = 1U << 0, /* first buffer after a rate change */
+    RX888_BUF_ATTENUATION_CHANGED = 1U << 1, /* attenuator switched during
+                                                or right before the buffer */
+    RX888_BUF_OVERRUN = 1U << 2,      /* samples were lost right before the
+                                         buffer */
+    RX888_BUF_DISCONTINUITY = 1U << 3, /* first buffer after the device was
+                                          lost and recovered */
+};
+
+/*!
+ * Per buffer stream metadata, see rx888_read_async_ex().
+ */
+typedef struct rx888_buffer_info {
+    uint64_t sample_index;      /* stream index of the first sample */
+    uint32_t sample_rate;       /* rate the buffer was captured at */
+    uint32_t flags;             /* RX888_BUF_* */
+    uint64_t discarded_samples; /* samples dropped right before this buffer */
+    uint64_t lost_samples;      /* samples lost to an overrun or a device
+                                   loss, estimated */
+    float attenuation_db;       /* HF attenuation, 0, -10 or -20 */
+    const rx888_adc_health_t *health; /* NULL unless enabled */
+} rx888_buffer_info_t;
+
+typedef void(*rx888_read_async_ex_cb_t)(unsigned char *buf, uint32_t len,
+                                        const rx888_buffer_info_t *info,
+                                        void *ctx);
+
+/*!
+ * Same as rx888_read_async(), but the callback additionally receives the
+ * stream metadata of every buffer.
+ *
+ * Sample indices count every sample since the start of the stream,
+ * including the ones dropped during a sample rate change.
+ *
+ * \return 0 on success
+ */
+int rx888_read_async_ex(rx888_dev_t *dev,
+                 rx888_read_async_ex_cb_t cb,
+                 void *ctx,
+                 uint32_t buf_num,
+                 uint32_t buf_len);
+
+/*!
+ * One completed transfer of a batch, see rx888_read_async_batch().
+ */
+typedef struct rx888_iovec {
+    unsigned char *buf;
+    uint32_t len;
+    const rx888_buffer_info_t *info;
+} rx888_iovec_t;
+
+typedef void(*rx888_read_async_batch_cb_t)(const rx888_iovec_t *iov,
+                                           uint32_t count, void *ctx);
+
+/*!
+ * Same as rx888_read_async_ex(), but the transfers completed within one
+ * event loop iteration are passed to a single callback, in stream order,
+ * and only resubmitted once it returns. This amortizes the per call cost
+ * for consumers that process data in large vectors.
+ *
+ * Held transfers are not in flight, so a large batch shortens the time
+ * the device can buffer ahead. Replay devices pass one buffer per call.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param cb callback function to return received samples
+ * \param ctx user specific context to pass via the callback function
+ * \param buf_num optional buffer count, buf_num * buf_len = overall buffer size
+ *		  set to 0 for default buffer count (15)
+ * \param buf_len optional buffer length, must be multiple of 512,
+ *		  should be a multiple of 16384 (URB size), set to 0
+ *		  for default buffer length (16 * 32 * 512)
+ * \param max_batch most transfers per call, 0 for half of the transfers
+ * \return 0 on success
+ */
+int rx888_read_async_batch(rx888_dev_t *dev,
+                 rx888_read_async_batch_cb_t cb,
+                 void *ctx,
+                 uint32_t buf_num,
+                 uint32_t buf_len,
+                 uint32_t max_batch);
+
+typedef struct rx888_session rx888_session_t;
+
+/*!
+ * Allocate the transfers and buffers of one geometry once and keep them
+ * across streams, for applications that stop and restart often. While the
+ * session is open every rx888_read_async() variant and
+ * rx888_start_readahead() streams through the session pool, whatever
+ * geometry they are called with. Where libusb supports it the buffers are
+ * usbfs memory, which the controller fills without a copy. Bursts and the
+ * ring buffer are not available while a session is open.
+ *
+ * \param out set to the session
+ * \param dev the device handle given by rx888_open()
+ * \param buf_num transfer count, see rx888_read_async()
+ * \param buf_len transfer length, see rx888_read_async()
+ * \return 0 on success, -2 while streaming
+ */
+int rx888_session_open(rx888_session_t **out, rx888_dev_t *dev,
+                       uint32_t buf_num, uint32_t buf_len);
+
+/*!
+ * Stream into the callback until rx888_session_stop(),
+ * rx888_session_cancel() or rx888_cancel_async(), like rx888_read_async_ex().
+ *
+ * \param session session handle given by rx888_session_open()
+ * \param cb callback function to return received samples
+ * \param ctx user specific context to pass via the callback function
+ * \return 0 on success
+ */
+int rx888_session_run(rx888_session_t *session, rx888_read_async_ex_cb_t cb,
+                      void *ctx);
+
+/*!
+ * Stop the stream of rx888_session_run() and wait for it to end. Waiting
+ * is woken by the stream going inactive, not polled. Not from within the
+ * callback, see rx888_session_cancel().
+ *
+ * \param session session handle given by rx888_session_open()
+ * \param timeout_ms how long to wait for the stream to end, 0 to wait
+ *        forever
+ * \return 0 on success, LIBUSB_ERROR_TIMEOUT (-7) on timeout
+ */
+int rx888_session_stop(rx888_session_t *session, unsigned int timeout_ms);
+
+/*!
+ * Request the stream of rx888_session_run() to stop and return right away,
+ * as needed from within the callback.
+ *
+ * \param session session handle given by rx888_session_open()
+ * \return 0 on success
+ */
+int rx888_session_cancel(rx888_session_t *session);
+
+/*!
+ * Stop the stream of rx888_session_run() if any, wait for it and free the
+ * pool. rx888_close() closes a session left open.
+ *
+ * \param session session handle given by rx888_session_open()
+ * \return 0 on success, -2 while rx888_start_readahead() is active
+ */
+int rx888_session_close(rx888_session_t *session);
+
+/*!
+ * Carve the transfer buffers of rx888_read_async() and rx888_read_async_ex()
+ * from one ring whose pages are mapped twice, back to back. Data between
+ * the read cursor and the end of the latest buffer is then contiguous in
+ * memory across transfer boundaries, so filters and FFTs can keep their
+ * history in place instead of copying it.
+ *
+ * With the ring enabled, transfers are only resubmitted once the read
+ * cursor has passed them: the callback has to advance it with
+ * rx888_ring_consume(), or the stream stalls and overruns. Every buffer
+ * passed to the callback is preceded by the data still unconsumed. A rate
+ * change drops it. buf_num * buf_len must be a multiple of the page size,
+ * and automatic buffer sizing is not applied. Not for replay devices.
+ * Not supported on Windows.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param on 1 to enable, 0 to disable, before streaming starts
+ * \return 0 on success, -ENOSYS if not supported
+ */
+int rx888_set_ring_buffer(rx888_dev_t *dev, int on);
+
+/*!
+ * Get the unconsumed data of the ring, from the read cursor to the end of
+ * the latest buffer, as one contiguous block. Only from the callback.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param data set to the data at the read cursor
+ * \param len set to the length in bytes
+ * \return 0 on success, -1 if the ring is not in use
+ */
+int rx888_ring_peek(rx888_dev_t *dev, const unsigned char **data,
+                    uint32_t *len);
+
+/*!
+ * Advance the read cursor. Transfers the cursor has passed are resubmitted
+ * right away, so their data must not be used afterwards. Only from the
+ * callback.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param len bytes to advance by, at most what rx888_ring_peek() returns
+ * \return 0 on success, -1 if the ring is not in use, -EINVAL if len
+ *         exceeds the unconsumed data
+ */
+int rx888_ring_consume(rx888_dev_t *dev, uint32_t len);
+
+/*!
+ * Take the next completed buffer of the readahead pool without blocking and
+ * without copying. Pending USB events are handled first. The buffer stays
+ * valid, and its transfer out of the pool, until it is given back with
+ * rx888_release_buffer(); several buffers may be held at once. Do not mix
+ * with rx888_read_sync() while buffers are held.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf set to the sample data
+ * \param len set to the data length in bytes
+ * \param info optional, set to the buffer metadata, valid until release
+ * \return 1 if a buffer was returned, 0 if none is ready, negative on error,
+ *         canceled stream or missing readahead
+ */
+int rx888_read_next(rx888_dev_t *dev, unsigned char **buf, uint32_t *len,
+                    const rx888_buffer_info_t **info);
+
+/*!
+ * Give back the oldest buffer taken with rx888_read_next() and resubmit its
+ * transfer.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \return 0 on success, -1 if no buffer is held
+ */
+int rx888_release_buffer(rx888_dev_t *dev);
+
+/*!
+ * Get a file descriptor for an epoll, poll or io_uring based event loop. It
+ * is readable while the USB side has events to handle or rx888_read_next()
+ * has buffers left to hand out, so a reader that stops early is woken again
+ * for the rest. rx888_read_next() should be called until it returns 0. The
+ * descriptor is owned by the device and closed by rx888_close(). Linux only.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \return the descriptor, -1 on error or if not supported
+ */
+int rx888_get_poll_fd(rx888_dev_t *dev);
+
+/* start_index values of rx888_burst_queue() and rx888_capture_burst() */
+#define RX888_BURST_NOW  UINT64_MAX         /* with the next transfer */
+#define RX888_BURST_NEXT (UINT64_MAX - 1)   /* right after the last burst */
+
+typedef struct rx888_burst_info {
+    int16_t *data;              /* the burst buffer */
+    uint64_t samples;
+    uint64_t sample_index;      /* stream index of the first sample */
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC time of the first
+                                   sample, estimated from its transfer */
+    uint32_t gaps;              /* discontinuities within the burst */
+    uint64_t lost_samples;      /* samples missing or zeroed at them,
+                                   estimated */
+} rx888_burst_info_t;
+
+/*!
+ * Start streaming for burst capture. Transfers are pointed straight into
+ * the buffers of queued bursts, so samples land in place without a copy;
+ * in between they go to the transfers' own buffers and are dropped. The
+ * stream is driven from the calling thread by rx888_burst_wait().
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf_num optional transfer count, 0 for the default
+ * \param buf_len optional transfer length, a multiple of 512, 0 for the
+ *        default
+ * \return 0 on success
+ */
+int rx888_burst_start(rx888_dev_t *dev, uint32_t buf_num, uint32_t buf_len);
+
+/*!
+ * Queue a burst. Up to 16 bursts may be queued, which keeps back to back
+ * bursts contiguous at full rate when the next one is queued with
+ * RX888_BURST_NEXT before the previous one completes.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf buffer for the samples, from rx888_burst_alloc() for zero copy
+ *        DMA on Linux, or any memory
+ * \param samples burst length, a multiple of one bulk packet of the device,
+ *        512 samples on SuperSpeed
+ * \param start_index stream index of the first sample, rounded up to a
+ *        packet, or RX888_BURST_NOW or RX888_BURST_NEXT. A start
+ *        that has already passed begins with the next transfer.
+ * \return 0 on success, -EINVAL on a bad length, -EBUSY if the queue is full
+ */
+int rx888_burst_queue(rx888_dev_t *dev, int16_t *buf, uint64_t samples,
+                      uint64_t start_index);
+
+/*!
+ * Handle USB events until the oldest queued burst is complete, and dequeue
+ * it.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param info set to where and when the burst was taken
+ * \param timeout_ms timeout in milliseconds, 0 to wait forever
+ * \return 0 on success, LIBUSB_ERROR_TIMEOUT (-7) on timeout, -2 if no
+ *         burst is queued, -1 if the stream stopped
+ */
+int rx888_burst_wait(rx888_dev_t *dev, rx888_burst_info_t *info,
+                     unsigned int timeout_ms);
+
+/*!
+ * Stop the burst stream, bursts still queued are dropped.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \return 0 on success
+ */
+int rx888_burst_stop(rx888_dev_t *dev);
+
+/*!
+ * Capture one burst without a callback. Starts and stops the burst stream
+ * around it unless it is already running, in which case no other burst may
+ * be queued.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param buf buffer for the samples, see rx888_burst_queue()
+ * \param samples burst length, see rx888_burst_queue()
+ * \param start_index see rx888_burst_queue()
+ * \param info set to where and when the burst was taken
+ * \return 0 on success
+ */
+int rx888_capture_burst(rx888_dev_t *dev, int16_t *buf, uint64_t samples,
+                        uint64_t start_index, rx888_burst_info_t *info);
+
+/*!
+ * Allocate a burst buffer. On Linux it comes from the USB device memory of
+ * usbfs where possible, which the controller writes to directly; that pool
+ * is small, larger buffers fall back to normal memory.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param samples buffer length
+ * \return the buffer, NULL on failure
+ */
+int16_t *rx888_burst_alloc(rx888_dev_t *dev, uint64_t samples);
+
+/*!
+ * Free a burst buffer. Device memory belongs to the USB handle, so every
+ * buffer has to be freed before rx888_close() of its device.
+ *
+ * \param dev the device handle the buffer was allocated with
+ * \param buf buffer from rx888_burst_alloc()
+ */
+void rx888_burst_free(rx888_dev_t *dev, int16_t *buf);
+
+typedef struct rx888_stream_stats {
+    uint64_t buffers;           /* buffers passed to the callback */
+    uint64_t samples;           /* samples passed to the callback */
+    uint64_t discarded_samples; /* samples dropped during rate changes */
+    uint32_t rate_changes;      /* rate changes applied while streaming */
+    uint32_t xfer_errors;       /* failed transfers */
+    uint64_t clipped_samples;   /* clipped samples, with health enabled */
+    uint32_t attenuation_changes; /* attenuator steps while streaming */
+    uint32_t transfer_size;     /* bytes per transfer */
+    uint32_t transfers_in_flight; /* current queue depth */
+    uint32_t max_completion_gap_us; /* worst completion gap of the last
+                                       second, automatic buffers only */
+    uint32_t overruns;          /* readahead pool ran full */
+    uint64_t lost_samples;      /* estimated samples lost to overruns and
+                                   device losses */
+    uint32_t device_losses;     /* device lost while streaming */
+    uint32_t recoveries;        /* of those, streaming again */
+    uint32_t last_recovery_us;  /* loss to resubmission, last recovery */
+    uint32_t max_recovery_us;   /* worst of those */
+} rx888_stream_stats_t;
+
+/*!
+ * Get the streaming counters of the device. Safe to call from any thread.
+ *
+ * \param dev the device handle given by rx888_open()
+ * \param stats counters since the device was opened
+ * \return 0 on success
+ */
+int rx888_get_stream_stats(rx888_dev_t *dev, rx888_stream_stats_t *stats);
+
+typedef struct rx888_metrics rx888_metrics_t;
+
+/* called on every scrape to append application metrics */
+typedef void(*rx888_metrics_cb_t)(rx888_metrics_t *metrics, void *ctx);
+
+/*!
+ * Serve the device counters in Prometheus text format from a thread of its
+ * own. Values are read from the counters the data path keeps anyway, so
+ * scrapes add no locks or system calls to the USB callback path.
+ *
+ * \param metrics exporter handle
+ * \param dev the device handle given by rx888_open()
+ * \param listen_addr "port" or "host:port" for HTTP over TCP, the host
+ *        defaulting to 127.0.0.1, or "unix:/path" for a Unix socket
+ * \param extra optional callback adding metrics with rx888_metrics_value()
+ * \param ctx user context passed to extra
+ * \return 0 on success, negative errno on failure
+ */
+int rx888_metrics_start(rx888_metrics_t **metrics, rx888_dev_t *dev,
+                        const char *listen_addr, rx888_metrics_cb_t extra,
+                        void *ctx);
+
+/*!
+ * Add one sample to the scrape in progress, only from within the extra
+ * callback.
+ *
+ * \param metrics handle passed to the callback
+ * \param name metric name
+ * \param type "counter" or "gauge", NULL to leave out the TYPE line
+ * \param help description, NULL to leave out the HELP line
+ * \param value current value
+ */
+void rx888_metrics_value(rx888_metrics_t *metrics, const char *name,
+                         const char *type, const char *help, double value);
+
+void rx888_metrics_stop(rx888_metrics_t *metrics);
+
+/*!
+ * Start or stop recording the hot path trace points. Only available when
+ * the library is built with -DENABLE_TRACING=ON, each thread then records
+ * its last 65536 events.
+ *
+ * \param on 1 to record, 0 to stop
+ * \return 0 on success, -ENOSYS if tracing is compiled out
+ */
+int rx888_trace_enable(int on);
+
+/*!
+ * Write the recorded events as Chrome trace JSON, for chrome://tracing or
+ * ui.perfetto.dev. Best called after streaming has stopped.
+ *
+ * \param path output file
+ * \return 0 on success, -EINVAL if tracing was never enabled, -ENOSYS if
+ *         tracing is compiled out, negative errno on write errors
+ */
+int rx888_trace_dump(const char *path);
+
 /*!
  * Cancel all pending asynchronous operations on the device.
  *
@@ -0,0 +1,404 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRX888_HPP
+#define LIBRX888_HPP
+
+/*
+ * Header only C++20 layer over librx888.h: an owning device handle, buffers
+ * as spans of the raw 16 bit ADC samples and conversion of those samples to
+ * float, std::complex<float> and int8_t. Nothing on the streaming path
+ * copies or allocates; the spans point into the transfer buffers and are
+ * only valid until the callback returns or the buffer is released.
+ *
+ * Errors of the C API are thrown as rx888::error, except on the streaming
+ * path, which does not throw.
+ */
+
+#include <algorithm>
+#include <complex>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "librx888.h"
+
+namespace rx888 {
+
+class error : public std::runtime_error {
+public:
+    error(const char *what, int code)
+        : std::runtime_error(std::string(what) + " failed: " +
+                             std::to_string(code)),
+          code_(code)
+    {
+    }
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+
+inline int check(int r, const char *what)
+{
+    if (r < 0)
+        throw error(what, r);
+    return r;
+}
+
+} // namespace detail
+
+using samples = std::span<const int16_t>;
+
+/* view a transfer buffer as samples, in place */
+inline samples view(const unsigned char *buf, uint32_t len) noexcept
+{
+    return { reinterpret_cast<const int16_t *>(buf), len / sizeof(int16_t) };
+}
+
+struct buffer {
+    samples data;
+    const rx888_buffer_info_t *info;
+};
+
+/*
+ * Sample conversion. converter<T>::run() converts n samples to T, full
+ * scale maps to +-1.0 for the float types and to +-127 for int8_t. The real
+ * ADC samples go to the I part of std::complex<float>, Q is zero. The SIMD
+ * variant is chosen at compile time from the target flags (-mavx2, SSE2 on
+ * x86-64), with a plain loop as fallback and for the tail.
+ */
+template <typename T>
+struct converter;
+
+template <>
+struct converter<float> {
+    static void run(const int16_t *in, float *out, std::size_t n) noexcept
+    {
+        const float scale = 1.0f / 32768.0f;
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 s = _mm256_set1_ps(scale);
+        for (; i + 16 <= n; i += 16) {
+            __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(in + i));
+            __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+            __m256i hi = _mm256_cvtepi16_epi32(
+                _mm256_extracti128_si256(v, 1));
+            _mm256_storeu_ps(out + i,
+                             _mm256_mul_ps(_mm256_cvtepi32_ps(lo), s));
+            _mm256_storeu_ps(out + i + 8,
+                             _mm256_mul_ps(_mm256_cvtepi32_ps(hi), s));
+        }
+#elif defined(__SSE2__)
+        const __m128 s = _mm_set1_ps(scale);
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(in + i));
+            /* sign extend by shifting down from the upper half */
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = in[i] * scale;
+    }
+};
+
+template <>
+struct converter<std::complex<float>> {
+    static void run(const int16_t *in, std::complex<float> *out,
+                    std::size_t n) noexcept
+    {
+        const float scale = 1.0f / 32768.0f;
+        /* std::complex<float> is laid out as float[2] */
+        float *f = reinterpret_cast<float *>(out);
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 s = _mm256_set1_ps(scale);
+        const __m256 zero = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(in + i));
+            __m256 x = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), s);
+            /* unpack works per 128 bit lane, put the halves back in order */
+            __m256 lo = _mm256_unpacklo_ps(x, zero);
+            __m256 hi = _mm256_unpackhi_ps(x, zero);
+            _mm256_storeu_ps(f + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(f + 2 * i + 8,
+                             _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+#elif defined(__SSE2__)
+        const __m128 s = _mm_set1_ps(scale);
+        const __m128 zero = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(in + i));
+            __m128 x = _mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)),
+                s);
+            _mm_storeu_ps(f + 2 * i, _mm_unpacklo_ps(x, zero));
+            _mm_storeu_ps(f + 2 * i + 4, _mm_unpackhi_ps(x, zero));
+        }
+#endif
+        for (; i < n; i++) {
+            f[2 * i] = in[i] * scale;
+            f[2 * i + 1] = 0.0f;
+        }
+    }
+};
+
+template <>
+struct converter<int8_t> {
+    static void run(const int16_t *in, int8_t *out, std::size_t n) noexcept
+    {
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 32 <= n; i += 32) {
+            __m256i a = _mm256_srai_epi16(_mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(in + i)), 8);
+            __m256i b = _mm256_srai_epi16(_mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(in + i + 16)), 8);
+            /* packs interleaves the 128 bit lanes of a and b */
+            __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b),
+                                                 0xd8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), p);
+        }
+#elif defined(__SSE2__)
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_srai_epi16(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(in + i)), 8);
+            __m128i b = _mm_srai_epi16(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(in + i + 8)), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                             _mm_packs_epi16(a, b));
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = static_cast<int8_t>(in[i] >> 8);
+    }
+};
+
+template <typename T>
+concept convertible = requires(const int16_t *in, T *out, std::size_t n) {
+    converter<T>::run(in, out, n);
+};
+
+/* convert as many samples as fit, returns the count converted */
+template <convertible T>
+std::size_t convert(samples in, std::span<T> out) noexcept
+{
+    std::size_t n = std::min(in.size(), out.size());
+
+    converter<T>::run(in.data(), out.data(), n);
+
+    return n;
+}
+
+class device {
+public:
+    device() noexcept = default;
+
+    explicit device(uint32_t index)
+    {
+        detail::check(rx888_open(&dev_, index), "rx888_open");
+    }
+
+    explicit device(const char *serial)
+        : device(static_cast<uint32_t>(
+              detail::check(rx888_get_index_by_serial(serial),
+                            "rx888_get_index_by_serial")))
+    {
+    }
+
+    device(const device &) = delete;
+    device &operator=(const device &) = delete;
+
+    device(device &&other) noexcept : dev_(std::exchange(other.dev_, nullptr))
+    {
+    }
+
+    device &operator=(device &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            dev_ = std::exchange(other.dev_, nullptr);
+        }
+        return *this;
+    }
+
+    ~device() { reset(); }
+
+    void reset() noexcept
+    {
+        if (dev_)
+            rx888_close(std::exchange(dev_, nullptr));
+    }
+
+    rx888_dev_t *get() const noexcept { return dev_; }
+    explicit operator bool() const noexcept { return dev_ != nullptr; }
+
+    static uint32_t count() noexcept { return rx888_get_device_count(); }
+
+    void set_sample_rate(uint32_t rate)
+    {
+        detail::check(rx888_set_sample_rate(dev_, rate),
+                      "rx888_set_sample_rate");
+    }
+
+    uint32_t sample_rate() const noexcept
+    {
+        return rx888_get_sample_rate(dev_);
+    }
+
+    void set_hf_attenuation(double db)
+    {
+        detail::check(rx888_set_hf_attenuation(dev_, db),
+                      "rx888_set_hf_attenuation");
+    }
+
+    rx888_stream_stats_t stats() const
+    {
+        rx888_stream_stats_t s;
+        detail::check(rx888_get_stream_stats(dev_, &s),
+                      "rx888_get_stream_stats");
+        return s;
+    }
+
+    /*
+     * Stream until cancel() is called. fn is called with the samples, and
+     * the buffer metadata if it takes a second argument. An exception
+     * thrown by fn cancels the stream and is rethrown from here.
+     */
+    template <typename F>
+        requires std::invocable<F &, samples> ||
+                 std::invocable<F &, samples, const rx888_buffer_info_t &>
+    void read_async(F &&fn, uint32_t buf_num = 0, uint32_t buf_len = 0)
+    {
+        using fn_type = std::remove_reference_t<F>;
+        struct context {
+            fn_type *fn;
+            rx888_dev_t *dev;
+            std::exception_ptr exception;
+        } ctx = { &fn, dev_, nullptr };
+        int r;
+
+        if constexpr (std::invocable<F &, samples,
+                                     const rx888_buffer_info_t &>) {
+            auto cb = [](unsigned char *buf, uint32_t len,
+                         const rx888_buffer_info_t *info, void *p) {
+                auto *c = static_cast<context *>(p);
+                if (c->exception)
+                    return;
+                try {
+                    (*c->fn)(view(buf, len), *info);
+                } catch (...) {
+                    c->exception = std::current_exception();
+                    rx888_cancel_async(c->dev);
+                }
+            };
+            r = rx888_read_async_ex(dev_, cb, &ctx, buf_num, buf_len);
+        } else {
+            auto cb = [](unsigned char *buf, uint32_t len, void *p) {
+                auto *c = static_cast<context *>(p);
+                if (c->exception)
+                    return;
+                try {
+                    (*c->fn)(view(buf, len));
+                } catch (...) {
+                    c->exception = std::current_exception();
+                    rx888_cancel_async(c->dev);
+                }
+            };
+            r = rx888_read_async(dev_, cb, &ctx, buf_num, buf_len);
+        }
+
+        if (ctx.exception)
+            std::rethrow_exception(ctx.exception);
+        detail::check(r, "rx888_read_async");
+    }
+
+    void cancel() noexcept { rx888_cancel_async(dev_); }
+
+    /* pull mode, see rx888_start_readahead() */
+    void start_readahead(uint32_t buf_num = 0, uint32_t buf_len = 0)
+    {
+        detail::check(rx888_start_readahead(dev_, buf_num, buf_len),
+                      "rx888_start_readahead");
+    }
+
+    void stop_readahead() noexcept { rx888_stop_readahead(dev_); }
+
+    /* fill out, returns the samples read, fewer on timeout */
+    std::size_t read(std::span<int16_t> out, unsigned int timeout_ms = 0)
+    {
+        int n = 0;
+        int r = rx888_read_sync_timeout(dev_, out.data(),
+                                        static_cast<int>(out.size_bytes()),
+                                        &n, timeout_ms);
+        if (r != LIBUSB_ERROR_TIMEOUT_CODE)
+            detail::check(r, "rx888_read_sync");
+        return n / sizeof(int16_t);
+    }
+
+    /* the next completed buffer, held until release() */
+    std::optional<buffer> next()
+    {
+        unsigned char *buf;
+        uint32_t len;
+        const rx888_buffer_info_t *info;
+
+        if (!detail::check(rx888_read_next(dev_, &buf, &len, &info),
+                           "rx888_read_next"))
+            return std::nullopt;
+
+        return buffer{ view(buf, len), info };
+    }
+
+    void release() noexcept { rx888_release_buffer(dev_); }
+
+    int poll_fd() const noexcept { return rx888_get_poll_fd(dev_); }
+
+private:
+    /* libusb.h is not part of the public headers */
+    static constexpr int LIBUSB_ERROR_TIMEOUT_CODE = -7;
+
+    rx888_dev_t *dev_ = nullptr;
+};
+
+} // namespace rx888
+
+#endif /* LIBRX888_HPP */
@@ -0,0 +1,236 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRX888_CORO_HPP
+#define LIBRX888_CORO_HPP
+
+/*
+ * C++20 coroutine interface on top of the readahead pool of librx888.hpp.
+ *
+ *     rx888::task consume(rx888::stream<> &s)
+ *     {
+ *         for (;;) {
+ *             rx888::buffer b = co_await s.next();
+ *             ...
+ *         }
+ *     }
+ *
+ *     rx888::stream<> s(dev);
+ *     rx888::task t = consume(s);
+ *     s.run();
+ *
+ * A buffer stays in place in its transfer until the next co_await on
+ * next(), so a consumer that falls behind holds transfers back from the
+ * device, which is the backpressure: once the pool is exhausted the device
+ * overflows and the next buffer carries RX888_BUF_OVERRUN.
+ *
+ * Waiting coroutines are resumed through the executor, which must run them
+ * on the thread that drives the stream, either with run() or by calling
+ * dispatch() whenever poll_fd() becomes readable in an existing event
+ * loop. Linux only, like rx888_get_poll_fd().
+ */
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include <poll.h>
+
+#include "librx888.hpp"
+
+namespace rx888 {
+
+template <typename E>
+concept executor = requires(E &e, std::coroutine_handle<> h) {
+    e.execute(h);
+};
+
+/* resumes right away, from within dispatch() */
+struct inline_executor {
+    void execute(std::coroutine_handle<> h) const { h.resume(); }
+};
+
+/* eagerly started coroutine, keeps its exception for get() */
+class task {
+public:
+    struct promise_type {
+        std::exception_ptr exception;
+
+        task get_return_object()
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(
+                *this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+
+    void get()
+    {
+        if (h_ && h_.promise().exception)
+            std::rethrow_exception(h_.promise().exception);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <executor E = inline_executor>
+class stream {
+public:
+    class awaiter {
+    public:
+        explicit awaiter(stream &s) noexcept : s_(s) {}
+
+        bool await_ready()
+        {
+            s_.release();
+            buf_ = s_.try_next();
+            return buf_.has_value() || s_.error_;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            s_.waiter_ = h;
+            s_.awaiter_ = this;
+        }
+
+        buffer await_resume()
+        {
+            if (!buf_)
+                throw error("rx888_read_next", s_.error_);
+            s_.held_ = true;
+            return *buf_;
+        }
+
+    private:
+        friend class stream;
+
+        stream &s_;
+        std::optional<buffer> buf_;
+    };
+
+    explicit stream(device &dev, E ex = E(), uint32_t buf_num = 0,
+                    uint32_t buf_len = 0)
+        : dev_(dev), ex_(std::move(ex))
+    {
+        dev_.start_readahead(buf_num, buf_len);
+    }
+
+    stream(const stream &) = delete;
+    stream &operator=(const stream &) = delete;
+
+    ~stream()
+    {
+        release();
+        dev_.stop_readahead();
+    }
+
+    /* awaitable for the next buffer, gives back the previous one */
+    awaiter next() noexcept { return awaiter(*this); }
+
+    /* give back the current buffer early */
+    void release() noexcept
+    {
+        if (held_) {
+            dev_.release();
+            held_ = false;
+        }
+    }
+
+    int poll_fd() const noexcept { return dev_.poll_fd(); }
+
+    /* true while a coroutine waits for a buffer */
+    bool waiting() const noexcept { return static_cast<bool>(waiter_); }
+
+    /*
+     * Hand a completed buffer to the waiting coroutine, if there are both.
+     * On a stream error the coroutine is resumed to throw from its
+     * co_await.
+     */
+    void dispatch()
+    {
+        if (!waiter_)
+            return;
+
+        awaiter_->buf_ = try_next();
+        if (!awaiter_->buf_ && !error_)
+            return;
+
+        awaiter_ = nullptr;
+        ex_.execute(std::exchange(waiter_, nullptr));
+    }
+
+    /* drive the stream from this thread while a coroutine waits on it */
+    void run()
+    {
+        struct pollfd pfd = { poll_fd(), POLLIN, 0 };
+
+        if (pfd.fd < 0)
+            throw error("rx888_get_poll_fd", pfd.fd);
+
+        while (waiter_) {
+            dispatch();
+            if (waiter_ && poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+                throw error("poll", -errno);
+        }
+    }
+
+private:
+    std::optional<buffer> try_next()
+    {
+        try {
+            return dev_.next();
+        } catch (const error &e) {
+            error_ = e.code();
+            return std::nullopt;
+        }
+    }
+
+    device &dev_;
+    E ex_;
+    std::coroutine_handle<> waiter_;
+    awaiter *awaiter_ = nullptr;
+    bool held_ = false;
+    int error_ = 0;
+};
+
+} // namespace rx888
+
+#endif /* LIBRX888_CORO_HPP */
@@ -0,0 +1,366 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRX888_DSP_H
+#define LIBRX888_DSP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Streaming DSP engines working on the raw 16 bit ADC samples as delivered
+ * by rx888_read_async(). The engines keep their own history, so buffers can
+ * be passed in straight from the callback.
+ */
+
+enum rx888_window {
+    RX888_WINDOW_RECT = 0,
+    RX888_WINDOW_HANN,
+    RX888_WINDOW_HAMMING,
+    RX888_WINDOW_BLACKMAN,
+    RX888_WINDOW_BLACKMAN_HARRIS
+};
+
+typedef struct rx888_spectrum rx888_spectrum_t;
+
+typedef struct rx888_spectrum_config {
+    uint32_t fft_size;          /* power of two, 1024 - 1048576 */
+    enum rx888_window window;
+    float overlap;              /* segment overlap 0.0 - 0.9, 0.5 for Welch */
+    uint32_t averages;          /* segments averaged into one spectrum */
+    unsigned int threads;       /* worker threads, 0 for one per CPU */
+    int blocking;               /* wait for the workers instead of dropping */
+} rx888_spectrum_config_t;
+
+/*!
+ * Spectrum output callback, called in order from the thread that feeds
+ * rx888_spectrum_process().
+ *
+ * \param power_db fft_size / 2 bins from DC to just below nyquist, in dB
+ *		   relative to a full scale sine
+ * \param bins number of bins
+ * \param sample_index stream index of the first sample of the spectrum
+ * \param ctx user specific context
+ */
+typedef void(*rx888_spectrum_cb_t)(const float *power_db, uint32_t bins,
+                                   uint64_t sample_index, void *ctx);
+
+/*!
+ * Create an averaged power spectrum engine.
+ *
+ * \param spec returned engine handle
+ * \param config engine configuration
+ * \param cb spectrum output callback
+ * \param ctx user specific context to pass via the callback function
+ * \return 0 on success, -EINVAL on invalid configuration
+ */
+int rx888_spectrum_create(rx888_spectrum_t **spec,
+                          const rx888_spectrum_config_t *config,
+                          rx888_spectrum_cb_t cb, void *ctx);
+
+/*!
+ * Feed samples into the engine. Unless the engine was created blocking, this
+ * never waits for the workers: when all of them are busy the samples are
+ * dropped and counted, see rx888_spectrum_dropped().
+ *
+ * \return 0 on success
+ */
+int rx888_spectrum_process(rx888_spectrum_t *spec, const int16_t *samples,
+                           uint32_t count);
+
+/*!
+ * Wait for the spectra in progress and deliver them.
+ */
+int rx888_spectrum_flush(rx888_spectrum_t *spec);
+
+/*!
+ * Number of samples dropped because the workers could not keep up.
+ */
+uint64_t rx888_spectrum_dropped(rx888_spectrum_t *spec);
+
+void rx888_spectrum_destroy(rx888_spectrum_t *spec);
+
+typedef struct rx888_detector rx888_detector_t;
+
+typedef struct rx888_detector_config {
+    uint32_t fft_size;          /* analysis block, power of two 256 - 65536 */
+    uint32_t bands;             /* equal width bands up to nyquist,
+                                   0 for one band per FFT bin */
+    float threshold_db;         /* start level above the noise floor */
+    float hysteresis_db;        /* stop at threshold_db - hysteresis_db */
+    uint32_t hold_blocks;       /* quiet blocks before a stop is reported */
+    float floor_rise;           /* noise floor rise per block, 0 for default */
+} rx888_detector_config_t;
+
+enum rx888_detector_event {
+    RX888_DETECT_START = 0,
+    RX888_DETECT_STOP
+};
+
+/*!
+ * Detector event callback, called from rx888_detector_process().
+ *
+ * \param event start or stop of activity
+ * \param sample_index stream index of the first active sample for a start,
+ *		       of the first quiet sample for a stop
+ * \param level_db strongest band level above its noise floor
+ * \param band index of the strongest band
+ * \param ctx user specific context
+ */
+typedef void(*rx888_detector_cb_t)(enum rx888_detector_event event,
+                                   uint64_t sample_index, float level_db,
+                                   uint32_t band, void *ctx);
+
+/*!
+ * Create an energy detector comparing the band powers of every analysis
+ * block against an adaptive per band noise floor.
+ *
+ * \return 0 on success, -EINVAL on invalid configuration
+ */
+int rx888_detector_create(rx888_detector_t **det,
+                          const rx888_detector_config_t *config,
+                          rx888_detector_cb_t cb, void *ctx);
+
+int rx888_detector_process(rx888_detector_t *det, const int16_t *samples,
+                           uint32_t count);
+
+/*!
+ * \return 1 while activity is detected, 0 otherwise
+ */
+int rx888_detector_active(rx888_detector_t *det);
+
+void rx888_detector_destroy(rx888_detector_t *det);
+
+typedef struct rx888_rfi rx888_rfi_t;
+
+enum rx888_rfi_action {
+    RX888_RFI_FLAG = 0,         /* only report the masks */
+    RX888_RFI_BLANK,            /* zero contaminated bins and samples */
+    RX888_RFI_REPLACE           /* scale them down to the local noise floor */
+};
+
+typedef struct rx888_rfi_config {
+    uint32_t fft_size;          /* power of two 64 - 65536,
+                                   0 without the spectral kurtosis stage */
+    uint32_t sk_frames;         /* hops per kurtosis estimate, 8 - 4096,
+                                   0 for 64, the estimate takes every
+                                   other of the half overlapping spectra */
+    float sk_sigma;             /* kurtosis threshold above the noise
+                                   expectation in standard deviations,
+                                   0 for 4 */
+    uint32_t pulse_block;       /* power of two 8 - fft_size / 2 samples per
+                                   pulse statistics block, 0 without the
+                                   pulse stage */
+    float pulse_db;             /* block power above the median of its chunk
+                                   that marks a pulse, 0 for 10 dB */
+    enum rx888_rfi_action action;
+    unsigned int threads;       /* worker threads, 0 for one per CPU */
+} rx888_rfi_config_t;
+
+/*
+ * Contamination masks of one chunk of sk_frames * fft_size / 2 samples, or
+ * of sk_frames pulse blocks without the spectral stage.
+ */
+typedef struct rx888_rfi_mask {
+    uint64_t sample_index;      /* stream index of the first sample */
+    uint32_t samples;
+    uint32_t bins;              /* fft_size / 2, 0 without spectral stage */
+    const uint8_t *bin_mask;    /* 1 for a contaminated bin */
+    const float *kurtosis;      /* spectral kurtosis of every bin */
+    uint32_t flagged_bins;
+    uint32_t blocks;            /* samples / pulse_block, 0 without pulse
+                                   stage */
+    uint32_t block_len;
+    const uint8_t *block_mask;  /* 1 for a block holding a pulse */
+    uint32_t flagged_blocks;
+} rx888_rfi_mask_t;
+
+/*!
+ * Mask callback, called in stream order from rx888_rfi_process() when the
+ * cleaned samples of the chunk are handed out.
+ *
+ * \param mask masks of the chunk, valid during the call only
+ * \param ctx user specific context
+ */
+typedef void(*rx888_rfi_cb_t)(const rx888_rfi_mask_t *mask, void *ctx);
+
+/*!
+ * Create an RFI excision stage. Every chunk is checked for impulsive time
+ * domain pulses against the median block power, and for FFT bins whose
+ * spectral kurtosis over the chunk is above that of Gaussian noise.
+ * Contaminated bins are removed by subtracting their 50% overlap-add of
+ * Hann windowed spectra from the input, so clean chunks pass through bit
+ * exact. Steady carriers have a low kurtosis and are kept. DC and the bins
+ * next to DC and nyquist are never flagged.
+ *
+ * \param rfi returned engine handle
+ * \param config engine configuration
+ * \param cb mask callback, may be NULL
+ * \param ctx user specific context to pass via the callback function
+ * \return 0 on success, -EINVAL on invalid configuration
+ */
+int rx888_rfi_create(rx888_rfi_t **rfi, const rx888_rfi_config_t *config,
+                     rx888_rfi_cb_t cb, void *ctx);
+
+/*!
+ * Clean samples in place. The chunks are processed by the workers while
+ * the stream goes on, so the samples handed back are those that went in
+ * rx888_rfi_delay() samples earlier, starting out with zeros. Waits for the
+ * workers when they fall behind.
+ *
+ * \return 0 on success
+ */
+int rx888_rfi_process(rx888_rfi_t *rfi, int16_t *samples, uint32_t count);
+
+/*!
+ * \return delay of the cleaned samples in samples
+ */
+uint32_t rx888_rfi_delay(rx888_rfi_t *rfi);
+
+void rx888_rfi_destroy(rx888_rfi_t *rfi);
+
+typedef struct rx888_demod rx888_demod_t;
+
+enum rx888_demod_mode {
+    RX888_DEMOD_AM = 0,
+    RX888_DEMOD_FM,
+    RX888_DEMOD_USB,
+    RX888_DEMOD_LSB
+};
+
+typedef struct rx888_channel {
+    double frequency;           /* carrier, Hz */
+    float bandwidth;            /* Hz, audio bandwidth for USB and LSB */
+    enum rx888_demod_mode mode;
+} rx888_channel_t;
+
+typedef struct rx888_demod_config {
+    uint32_t sample_rate;       /* ADC rate, Hz */
+    uint32_t fft_size;          /* shared front end FFT, power of two
+                                   4096 - 4194304, 0 for 262144 */
+    uint32_t audio_rate;        /* lowest acceptable audio rate,
+                                   0 for 48000 */
+} rx888_demod_config_t;
+
+/*!
+ * Audio callback, called from rx888_demod_process().
+ *
+ * \param audio frames of one sample per channel, in the order the channels
+ *		were given, around +-1.0
+ * \param channels number of channels
+ * \param frames number of frames
+ * \param sample_index stream index of the ADC sample of the first frame
+ * \param ctx user specific context
+ */
+typedef void(*rx888_demod_cb_t)(const float *audio, uint32_t channels,
+                                uint32_t frames, uint64_t sample_index,
+                                void *ctx);
+
+/*!
+ * Create a demodulator for many channels of one stream. A single FFT of the
+ * stream is shared by all channels, each channel is filtered and decimated
+ * by picking its bins and transforming them back (fast convolution), and
+ * the demodulators then run over all channels of a mode at once.
+ *
+ * \param demod returned engine handle
+ * \param config engine configuration
+ * \param channels channel definitions
+ * \param count number of channels, 1 - 4096
+ * \param cb audio callback
+ * \param ctx user specific context to pass via the callback function
+ * \return 0 on success, -EINVAL on invalid configuration or a channel
+ *	    outside the stream or wider than the audio rate allows
+ */
+int rx888_demod_create(rx888_demod_t **demod,
+                       const rx888_demod_config_t *config,
+                       const rx888_channel_t *channels, uint32_t count,
+                       rx888_demod_cb_t cb, void *ctx);
+
+int rx888_demod_process(rx888_demod_t *demod, const int16_t *samples,
+                        uint32_t count);
+
+/*!
+ * \return audio rate in Hz, the ADC rate divided by a power of two
+ */
+double rx888_demod_rate(rx888_demod_t *demod);
+
+void rx888_demod_destroy(rx888_demod_t *demod);
+
+typedef struct rx888_resampler rx888_resampler_t;
+
+typedef struct rx888_resampler_config {
+    double in_rate;             /* Hz */
+    double out_rate;            /* Hz, any ratio to in_rate */
+    float passband;             /* flat fraction of the lower nyquist
+                                   frequency, 0 for 0.9 */
+    float stopband_db;          /* alias rejection 40 - 150, 0 for 90 */
+} rx888_resampler_config_t;
+
+/*!
+ * Create a streaming polyphase resampler. Ratios of two integer rates that
+ * reduce to a small interpolation factor are resampled exactly, any other
+ * ratio interpolates linearly between the nearest two of 512 filter phases.
+ * Large decimations run an integer decimator first. Filter banks are shared
+ * between resamplers of the same ratio and kept for reuse once released.
+ *
+ * \param rs returned resampler handle
+ * \param config resampler configuration
+ * \return 0 on success, -EINVAL on invalid configuration, -ENOMEM if the
+ *	    filters are too long
+ */
+int rx888_resampler_create(rx888_resampler_t **rs,
+                           const rx888_resampler_config_t *config);
+
+/*!
+ * Resample the next part of the stream, the filter state is carried over
+ * between calls so the stream may be split anywhere.
+ *
+ * \param rs resampler handle
+ * \param in input samples
+ * \param count number of input samples
+ * \param out room for at least rx888_resampler_max_output() samples,
+ *	      rounded and saturated
+ * \return number of output samples
+ */
+uint32_t rx888_resampler_process(rx888_resampler_t *rs, const int16_t *in,
+                                 uint32_t count, int16_t *out);
+
+uint32_t rx888_resampler_process_float(rx888_resampler_t *rs,
+                                       const float *in, uint32_t count,
+                                       float *out);
+
+/*!
+ * \return most output samples for count input samples
+ */
+uint32_t rx888_resampler_max_output(rx888_resampler_t *rs, uint32_t count);
+
+/*!
+ * \return group delay of the filters in output samples
+ */
+double rx888_resampler_delay(rx888_resampler_t *rs);
+
+void rx888_resampler_destroy(rx888_resampler_t *rs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBRX888_DSP_H */
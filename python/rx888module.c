@@ -0,0 +1,1033 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * rx888 Python module, streaming without a copy per transfer
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffers are the transfers of the readahead pool of rx888_read_next(),
+ * exported through the buffer protocol, so numpy.frombuffer(buf, 'int16')
+ * or memoryview(buf) see the samples in place:
+ *
+ *     with rx888.Device(0) as dev:
+ *         dev.sample_rate = 64000000
+ *         dev.start()
+ *         while True:
+ *             for buf in dev.read_batch(8):
+ *                 x = numpy.frombuffer(buf, numpy.int16)
+ *                 ...
+ *                 del x
+ *                 buf.release()
+ *
+ * A held buffer keeps its transfer out of the pool, so buffers have to be
+ * released once done with, explicitly or by a with block; like mmap,
+ * release() refuses while views of the samples are alive. The library gives
+ * transfers back in the order they were taken, buffers released out of
+ * order are given back once all older ones are.
+ *
+ * The GIL is dropped around every library call and while waiting for
+ * transfers, a device lock serializes the library calls instead.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "librx888.h"
+
+/* signals are checked between slices of a wait */
+#define WAIT_SLICE_MS 100
+#define DEFAULT_BATCH 16
+
+typedef struct {
+    PyObject_HEAD
+    rx888_dev_t *dev;
+    pthread_mutex_t lock;       /* library calls, taken without the GIL */
+    int streaming;
+    int poll_fd;
+    uint64_t taken;             /* buffers handed out */
+    uint64_t returned;          /* buffers given back to the library */
+    uint64_t *early;            /* released ahead of older buffers */
+    size_t n_early;
+    size_t cap_early;
+} DeviceObject;
+
+typedef struct {
+    PyObject_HEAD
+    DeviceObject *device;       /* NULL once released */
+    uint64_t seq;
+    int16_t *data;
+    Py_ssize_t samples;
+    Py_ssize_t exports;
+    /* copied, the library only keeps its own until the release */
+    unsigned long long sample_index;
+    unsigned long long lost_samples;
+    unsigned long long discarded_samples;
+    unsigned long sample_rate;
+    unsigned long flags;
+    double attenuation_db;
+} BufferObject;
+
+static PyTypeObject DeviceType;
+static PyTypeObject BufferType;
+static PyObject *Rx888Error;
+
+static PyObject *rx888_error(const char *what, int code)
+{
+    PyObject *args = Py_BuildValue("(is)", code, what);
+
+    if (args) {
+        PyErr_SetObject(Rx888Error, args);
+        Py_DECREF(args);
+    }
+
+    return NULL;
+}
+
+static int device_check(DeviceObject *self)
+{
+    if (!self->dev) {
+        PyErr_SetString(PyExc_ValueError, "device is closed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* buffers handed out and not released */
+static uint64_t device_held(DeviceObject *self)
+{
+    return self->taken - self->returned - self->n_early;
+}
+
+/* with the device lock, room for early was made when the buffer was taken */
+static void device_give_back(DeviceObject *self, uint64_t seq)
+{
+    if (seq != self->returned) {
+        self->early[self->n_early++] = seq;
+        return;
+    }
+
+    rx888_release_buffer(self->dev);
+    self->returned++;
+
+    for (size_t i = 0; i < self->n_early; ) {
+        if (self->early[i] == self->returned) {
+            self->early[i] = self->early[--self->n_early];
+            rx888_release_buffer(self->dev);
+            self->returned++;
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * Buffer
+ */
+
+static void buffer_give_back(BufferObject *self)
+{
+    DeviceObject *dev = self->device;
+
+    if (!dev)
+        return;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&dev->lock);
+    device_give_back(dev, self->seq);
+    pthread_mutex_unlock(&dev->lock);
+    Py_END_ALLOW_THREADS
+
+    self->device = NULL;
+    self->data = NULL;
+    Py_DECREF(dev);
+}
+
+static void Buffer_dealloc(BufferObject *self)
+{
+    /* views hold a reference, none is left */
+    buffer_give_back(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Buffer_release(BufferObject *self, PyObject *unused)
+{
+    (void)unused;
+
+    if (self->exports) {
+        PyErr_SetString(PyExc_BufferError,
+                        "cannot release, views of the samples exist");
+        return NULL;
+    }
+
+    buffer_give_back(self);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Buffer_enter(BufferObject *self, PyObject *unused)
+{
+    (void)unused;
+    Py_INCREF(self);
+
+    return (PyObject *)self;
+}
+
+static PyObject *Buffer_exit(BufferObject *self, PyObject *args)
+{
+    (void)args;
+
+    return Buffer_release(self, NULL);
+}
+
+static Py_ssize_t Buffer_length(BufferObject *self)
+{
+    return self->device ? self->samples : 0;
+}
+
+static int Buffer_getbuffer(BufferObject *self, Py_buffer *view, int flags)
+{
+    if (!self->device) {
+        PyErr_SetString(PyExc_BufferError, "buffer was released");
+        view->obj = NULL;
+        return -1;
+    }
+
+    if (PyBuffer_FillInfo(view, (PyObject *)self, self->data,
+                          self->samples * (Py_ssize_t)sizeof(int16_t), 0,
+                          flags) < 0)
+        return -1;
+
+    /* int16 samples rather than bytes */
+    view->itemsize = sizeof(int16_t);
+    view->format = (flags & PyBUF_FORMAT) ? "h" : NULL;
+    if (flags & PyBUF_ND)
+        view->shape = &self->samples;
+    self->exports++;
+
+    return 0;
+}
+
+static void Buffer_releasebuffer(BufferObject *self, Py_buffer *view)
+{
+    (void)view;
+    self->exports--;
+}
+
+static PyObject *Buffer_get_released(BufferObject *self, void *closure)
+{
+    (void)closure;
+
+    return PyBool_FromLong(!self->device);
+}
+
+static PyBufferProcs Buffer_as_buffer = {
+    .bf_getbuffer = (getbufferproc)Buffer_getbuffer,
+    .bf_releasebuffer = (releasebufferproc)Buffer_releasebuffer,
+};
+
+static PySequenceMethods Buffer_as_sequence = {
+    .sq_length = (lenfunc)Buffer_length,
+};
+
+static PyMethodDef Buffer_methods[] = {
+    { "release", (PyCFunction)Buffer_release, METH_NOARGS,
+      "Give the transfer back to the device. Raises BufferError while\n"
+      "views of the samples exist." },
+    { "__enter__", (PyCFunction)Buffer_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction)Buffer_exit, METH_VARARGS, NULL },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyMemberDef Buffer_members[] = {
+    { "sample_index", T_ULONGLONG, offsetof(BufferObject, sample_index),
+      READONLY, "stream index of the first sample" },
+    { "sample_rate", T_ULONG, offsetof(BufferObject, sample_rate),
+      READONLY, "rate the buffer was captured at" },
+    { "flags", T_ULONG, offsetof(BufferObject, flags), READONLY,
+      "BUF_* flags" },
+    { "lost_samples", T_ULONGLONG, offsetof(BufferObject, lost_samples),
+      READONLY, "samples lost right before the buffer, estimated" },
+    { "discarded_samples", T_ULONGLONG,
+      offsetof(BufferObject, discarded_samples), READONLY,
+      "samples dropped right before the buffer" },
+    { "attenuation_db", T_DOUBLE, offsetof(BufferObject, attenuation_db),
+      READONLY, "HF attenuation, 0, -10 or -20" },
+    { NULL, 0, 0, 0, NULL }
+};
+
+static PyGetSetDef Buffer_getset[] = {
+    { "released", (getter)Buffer_get_released, NULL,
+      "True once the transfer was given back", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "rx888.Buffer",
+    .tp_doc = "Samples of one transfer, int16 through the buffer protocol",
+    .tp_basicsize = sizeof(BufferObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)Buffer_dealloc,
+    .tp_as_buffer = &Buffer_as_buffer,
+    .tp_as_sequence = &Buffer_as_sequence,
+    .tp_methods = Buffer_methods,
+    .tp_members = Buffer_members,
+    .tp_getset = Buffer_getset,
+};
+
+/*
+ * Device
+ */
+
+static int Device_init(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "index", NULL };
+    unsigned int index = 0;
+    rx888_dev_t *dev = NULL;
+    int r;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &index))
+        return -1;
+
+    if (self->dev) {
+        PyErr_SetString(PyExc_RuntimeError, "device is already open");
+        return -1;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    r = rx888_open(&dev, index);
+    Py_END_ALLOW_THREADS
+
+    if (r < 0) {
+        rx888_error("rx888_open", r);
+        return -1;
+    }
+
+    self->dev = dev;
+    self->poll_fd = -1;
+
+    return 0;
+}
+
+static PyObject *Device_new(PyTypeObject *type, PyObject *args,
+                            PyObject *kwds)
+{
+    DeviceObject *self;
+
+    (void)args;
+    (void)kwds;
+
+    self = (DeviceObject *)type->tp_alloc(type, 0);
+    if (self)
+        pthread_mutex_init(&self->lock, NULL);
+
+    return (PyObject *)self;
+}
+
+/* with the device lock, returns the buffers still held if any */
+static uint64_t device_stop(DeviceObject *self)
+{
+    uint64_t held = device_held(self);
+
+    if (!self->streaming || held)
+        return held;
+
+    rx888_stop_readahead(self->dev);
+    self->streaming = 0;
+    self->poll_fd = -1;
+    self->taken = 0;
+    self->returned = 0;
+    self->n_early = 0;
+
+    return 0;
+}
+
+static PyObject *buffers_held(uint64_t held)
+{
+    PyErr_Format(PyExc_BufferError, "%llu buffers are still held",
+                 (unsigned long long)held);
+
+    return NULL;
+}
+
+static PyObject *Device_close(DeviceObject *self, PyObject *unused)
+{
+    uint64_t held = 0;
+
+    (void)unused;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    if (self->dev) {
+        held = device_stop(self);
+        if (!held) {
+            rx888_close(self->dev);
+            self->dev = NULL;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (held)
+        return buffers_held(held);
+
+    Py_RETURN_NONE;
+}
+
+static void Device_dealloc(DeviceObject *self)
+{
+    /* buffers hold a reference, none is left */
+    if (self->dev) {
+        if (self->streaming)
+            rx888_stop_readahead(self->dev);
+        rx888_close(self->dev);
+    }
+    pthread_mutex_destroy(&self->lock);
+    PyMem_RawFree(self->early);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Device_start(DeviceObject *self, PyObject *args,
+                              PyObject *kwds)
+{
+    static char *kwlist[] = { "buf_num", "buf_len", NULL };
+    unsigned int buf_num = 0, buf_len = 0;
+    int r;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|II", kwlist, &buf_num,
+                                     &buf_len))
+        return NULL;
+    if (device_check(self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    r = self->streaming ? -EALREADY :
+        rx888_start_readahead(self->dev, buf_num, buf_len);
+    if (r >= 0) {
+        self->poll_fd = rx888_get_poll_fd(self->dev);
+        self->streaming = 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (r == -EALREADY) {
+        PyErr_SetString(PyExc_RuntimeError, "already streaming");
+        return NULL;
+    }
+    if (r < 0)
+        return rx888_error("rx888_start_readahead", r);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_stop(DeviceObject *self, PyObject *unused)
+{
+    uint64_t held;
+
+    (void)unused;
+
+    if (device_check(self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    held = device_stop(self);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (held)
+        return buffers_held(held);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_cancel(DeviceObject *self, PyObject *unused)
+{
+    int open;
+
+    (void)unused;
+
+    /* a read_batch() of another thread waits without the lock, a close()
+     * of another thread holds it */
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    open = self->dev != NULL;
+    if (open)
+        rx888_cancel_async(self->dev);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (!open) {
+        PyErr_SetString(PyExc_ValueError, "device is closed");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* without the GIL, for up to ms milliseconds or until transfers complete;
+ * fd is a duplicate of the poll descriptor, closed here */
+static void device_wait(int fd, int ms)
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        poll(&pfd, 1, ms);
+        close(fd);
+        return;
+    }
+#endif
+    struct timespec ts = { 0, 1000000 };
+
+    (void)fd;
+    (void)ms;
+    nanosleep(&ts, NULL);
+}
+
+static double monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* up to max buffers into list, waiting up to timeout seconds for the first */
+static int device_read(DeviceObject *self, Py_ssize_t max, double timeout,
+                       PyObject *list)
+{
+    double deadline = timeout >= 0 ? monotonic() + timeout : 0.0;
+    struct taken {
+        unsigned char *buf;
+        uint32_t len;
+        const rx888_buffer_info_t *info;
+    } *items;
+    Py_ssize_t n = 0, i;
+    uint64_t first = 0;
+    int r = 0, failed = 0;
+
+    items = PyMem_Malloc(max * sizeof(struct taken));
+    if (!items) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (;;) {
+        int ms = WAIT_SLICE_MS;
+        int grown = 1, streaming, wait_fd = -1;
+
+        if (timeout >= 0) {
+            double left = deadline - monotonic();
+
+            ms = left <= 0 ? 0 : left * 1e3 < ms ? (int)(left * 1e3) : ms;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->lock);
+
+        /* stopped or closed from another thread while waiting */
+        streaming = self->dev && self->streaming;
+
+        /* every buffer may be released out of order */
+        size_t need = (size_t)(self->taken - self->returned) + max;
+        if (streaming && need > self->cap_early) {
+            uint64_t *early = PyMem_RawRealloc(self->early,
+                                               need * sizeof(uint64_t));
+            if (early) {
+                self->early = early;
+                self->cap_early = need;
+            } else {
+                grown = 0;
+            }
+        }
+
+        first = self->taken;
+        while (streaming && grown && n < max) {
+            r = rx888_read_next(self->dev, &items[n].buf, &items[n].len,
+                                &items[n].info);
+            if (r <= 0)
+                break;
+            n++;
+            self->taken++;
+        }
+
+#ifdef __linux__
+        /* a stop() or close() of another thread closes the descriptor, a
+         * duplicate keeps the epoll set alive while waiting on it */
+        if (streaming && grown && n == 0 && r == 0 && ms > 0 &&
+            self->poll_fd >= 0)
+            wait_fd = fcntl(self->poll_fd, F_DUPFD_CLOEXEC, 0);
+#endif
+
+        pthread_mutex_unlock(&self->lock);
+
+        if (streaming && grown && n == 0 && r == 0 && ms > 0)
+            device_wait(wait_fd, ms);
+        Py_END_ALLOW_THREADS
+
+        if (!streaming) {
+            PyMem_Free(items);
+            if (device_check(self) == 0)
+                PyErr_SetString(PyExc_RuntimeError,
+                                "not streaming, call start()");
+            return -1;
+        }
+        if (!grown) {
+            PyMem_Free(items);
+            PyErr_NoMemory();
+            return -1;
+        }
+        /* an error after some buffers is raised by the next call */
+        if (n > 0)
+            break;
+        if (r < 0) {
+            PyMem_Free(items);
+            rx888_error("rx888_read_next", r);
+            return -1;
+        }
+        if (PyErr_CheckSignals() < 0 ||
+            (timeout >= 0 && monotonic() >= deadline)) {
+            PyMem_Free(items);
+            return PyErr_Occurred() ? -1 : 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        BufferObject *b = PyObject_New(BufferObject, &BufferType);
+
+        if (!b)
+            break;
+
+        /* filled before anything can fail, the dealloc gives it back */
+        Py_INCREF(self);
+        b->device = self;
+        b->seq = first + i;
+        b->data = (int16_t *)items[i].buf;
+        b->samples = items[i].len / sizeof(int16_t);
+        b->exports = 0;
+        b->sample_index = items[i].info->sample_index;
+        b->lost_samples = items[i].info->lost_samples;
+        b->discarded_samples = items[i].info->discarded_samples;
+        b->sample_rate = items[i].info->sample_rate;
+        b->flags = items[i].info->flags;
+        b->attenuation_db = items[i].info->attenuation_db;
+        failed = PyList_Append(list, (PyObject *)b) < 0;
+        Py_DECREF(b);
+        if (failed) {
+            i++;
+            break;
+        }
+    }
+
+    PyMem_Free(items);
+
+    if (i < n || failed) {
+        /* the rest never made it into a Buffer */
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->lock);
+        for (Py_ssize_t k = i; k < n; k++)
+            device_give_back(self, first + k);
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_timeout(PyObject *obj, double *timeout)
+{
+    *timeout = -1.0;
+    if (obj == Py_None)
+        return 0;
+
+    *timeout = PyFloat_AsDouble(obj);
+    if (*timeout == -1.0 && PyErr_Occurred())
+        return -1;
+    if (*timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+        return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *Device_read(DeviceObject *self, PyObject *args,
+                             PyObject *kwds)
+{
+    static char *kwlist[] = { "timeout", NULL };
+    PyObject *timeout_obj = Py_None, *list, *buf = Py_None;
+    double timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj) ||
+        parse_timeout(timeout_obj, &timeout) < 0)
+        return NULL;
+
+    list = PyList_New(0);
+    if (!list)
+        return NULL;
+
+    if (device_read(self, 1, timeout, list) < 0) {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    if (PyList_GET_SIZE(list))
+        buf = PyList_GET_ITEM(list, 0);
+    Py_INCREF(buf);
+    Py_DECREF(list);
+
+    return buf;
+}
+
+static PyObject *Device_read_batch(DeviceObject *self, PyObject *args,
+                                   PyObject *kwds)
+{
+    static char *kwlist[] = { "max", "timeout", NULL };
+    PyObject *timeout_obj = Py_None, *list;
+    Py_ssize_t max = DEFAULT_BATCH;
+    double timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nO", kwlist, &max,
+                                     &timeout_obj) ||
+        parse_timeout(timeout_obj, &timeout) < 0)
+        return NULL;
+    if (max < 1) {
+        PyErr_SetString(PyExc_ValueError, "max must be at least 1");
+        return NULL;
+    }
+
+    list = PyList_New(0);
+    if (!list)
+        return NULL;
+
+    if (device_read(self, max, timeout, list) < 0) {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+static PyObject *Device_fileno(DeviceObject *self, PyObject *unused)
+{
+    (void)unused;
+
+    if (device_check(self) < 0)
+        return NULL;
+    if (self->poll_fd < 0) {
+        PyErr_SetString(PyExc_OSError, "no poll descriptor, call start()");
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->poll_fd);
+}
+
+static PyObject *Device_enter(DeviceObject *self, PyObject *unused)
+{
+    (void)unused;
+    Py_INCREF(self);
+
+    return (PyObject *)self;
+}
+
+static PyObject *Device_exit(DeviceObject *self, PyObject *args)
+{
+    (void)args;
+
+    return Device_close(self, NULL);
+}
+
+static PyObject *Device_get_sample_rate(DeviceObject *self, void *closure)
+{
+    uint32_t rate;
+
+    (void)closure;
+
+    if (device_check(self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    rate = rx888_get_sample_rate(self->dev);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    return PyLong_FromUnsignedLong(rate);
+}
+
+static int Device_set_sample_rate(DeviceObject *self, PyObject *value,
+                                  void *closure)
+{
+    unsigned long rate;
+    int r;
+
+    (void)closure;
+
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError, "cannot delete sample_rate");
+        return -1;
+    }
+    rate = PyLong_AsUnsignedLong(value);
+    if (rate == (unsigned long)-1 && PyErr_Occurred())
+        return -1;
+    if (device_check(self) < 0)
+        return -1;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    r = rx888_set_sample_rate(self->dev, (uint32_t)rate);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (r < 0) {
+        rx888_error("rx888_set_sample_rate", r);
+        return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *Device_get_hf_attenuation(DeviceObject *self, void *closure)
+{
+    double db;
+
+    (void)closure;
+
+    if (device_check(self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    db = rx888_get_hf_attenuation(self->dev);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    return PyFloat_FromDouble(db);
+}
+
+static int Device_set_hf_attenuation(DeviceObject *self, PyObject *value,
+                                     void *closure)
+{
+    double db;
+    int r;
+
+    (void)closure;
+
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError,
+                        "cannot delete hf_attenuation");
+        return -1;
+    }
+    db = PyFloat_AsDouble(value);
+    if (db == -1.0 && PyErr_Occurred())
+        return -1;
+    if (device_check(self) < 0)
+        return -1;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    r = rx888_set_hf_attenuation(self->dev, db);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (r < 0) {
+        rx888_error("rx888_set_hf_attenuation", r);
+        return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *Device_get_held(DeviceObject *self, void *closure)
+{
+    (void)closure;
+
+    return PyLong_FromUnsignedLongLong(device_held(self));
+}
+
+static PyMethodDef Device_methods[] = {
+    { "close", (PyCFunction)Device_close, METH_NOARGS,
+      "Stop streaming and close the device." },
+    { "start", (PyCFunction)(void (*)(void))Device_start,
+      METH_VARARGS | METH_KEYWORDS,
+      "start(buf_num=0, buf_len=0)\n\n"
+      "Start streaming into a pool of buf_num transfers of buf_len bytes,\n"
+      "0 for the defaults." },
+    { "stop", (PyCFunction)Device_stop, METH_NOARGS,
+      "Stop streaming. Raises BufferError while buffers are held." },
+    { "cancel", (PyCFunction)Device_cancel, METH_NOARGS,
+      "Make pending and later reads fail, from any thread." },
+    { "read", (PyCFunction)(void (*)(void))Device_read,
+      METH_VARARGS | METH_KEYWORDS,
+      "read(timeout=None) -> Buffer or None\n\n"
+      "The next transfer, waiting up to timeout seconds, None on timeout." },
+    { "read_batch", (PyCFunction)(void (*)(void))Device_read_batch,
+      METH_VARARGS | METH_KEYWORDS,
+      "read_batch(max=16, timeout=None) -> list of Buffer\n\n"
+      "Every completed transfer up to max, waiting up to timeout seconds\n"
+      "for the first one, an empty list on timeout." },
+    { "fileno", (PyCFunction)Device_fileno, METH_NOARGS,
+      "Descriptor that becomes readable when transfers may have\n"
+      "completed, for select and asyncio. Linux only." },
+    { "__enter__", (PyCFunction)Device_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction)Device_exit, METH_VARARGS, NULL },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef Device_getset[] = {
+    { "sample_rate", (getter)Device_get_sample_rate,
+      (setter)Device_set_sample_rate, "sample rate in Hz", NULL },
+    { "hf_attenuation", (getter)Device_get_hf_attenuation,
+      (setter)Device_set_hf_attenuation, "HF attenuation in dB", NULL },
+    { "held", (getter)Device_get_held, NULL,
+      "buffers handed out and not released", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject DeviceType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "rx888.Device",
+    .tp_doc = "Device(index=0)\n\nAn opened RX888.",
+    .tp_basicsize = sizeof(DeviceObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = Device_new,
+    .tp_init = (initproc)Device_init,
+    .tp_dealloc = (destructor)Device_dealloc,
+    .tp_methods = Device_methods,
+    .tp_getset = Device_getset,
+};
+
+/*
+ * Module
+ */
+
+static PyObject *rx888_device_count(PyObject *module, PyObject *unused)
+{
+    uint32_t count;
+
+    (void)module;
+    (void)unused;
+
+    Py_BEGIN_ALLOW_THREADS
+    count = rx888_get_device_count();
+    Py_END_ALLOW_THREADS
+
+    return PyLong_FromUnsignedLong(count);
+}
+
+static PyObject *rx888_device_name(PyObject *module, PyObject *args)
+{
+    unsigned int index;
+    const char *name;
+
+    (void)module;
+
+    if (!PyArg_ParseTuple(args, "I", &index))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    name = rx888_get_device_name(index);
+    Py_END_ALLOW_THREADS
+
+    return PyUnicode_FromString(name ? name : "");
+}
+
+static PyMethodDef rx888_methods[] = {
+    { "device_count", rx888_device_count, METH_NOARGS,
+      "Number of RX888 devices attached." },
+    { "device_name", rx888_device_name, METH_VARARGS,
+      "device_name(index) -> str" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef rx888_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "rx888",
+    .m_doc = "RX888 streaming with the samples of every transfer exported\n"
+             "in place through the buffer protocol.",
+    .m_size = -1,
+    .m_methods = rx888_methods,
+};
+
+PyMODINIT_FUNC PyInit_rx888(void)
+{
+    PyObject *m;
+
+    if (PyType_Ready(&DeviceType) < 0 || PyType_Ready(&BufferType) < 0)
+        return NULL;
+
+    m = PyModule_Create(&rx888_module);
+    if (!m)
+        return NULL;
+
+    /* args are (code, function) like OSError, so e.errno is the code */
+    Rx888Error = PyErr_NewExceptionWithDoc("rx888.Error",
+        "A library call failed, errno holds its return code.",
+        PyExc_OSError, NULL);
+    if (!Rx888Error)
+        goto err;
+
+    Py_INCREF(Rx888Error);
+    if (PyModule_AddObject(m, "Error", Rx888Error) < 0) {
+        Py_DECREF(Rx888Error);
+        goto err;
+    }
+
+    Py_INCREF(&DeviceType);
+    if (PyModule_AddObject(m, "Device", (PyObject *)&DeviceType) < 0) {
+        Py_DECREF(&DeviceType);
+        goto err;
+    }
+
+    Py_INCREF(&BufferType);
+    if (PyModule_AddObject(m, "Buffer", (PyObject *)&BufferType) < 0) {
+        Py_DECREF(&BufferType);
+        goto err;
+    }
+
+    if (PyModule_AddIntConstant(m, "BUF_RATE_CHANGED",
+                                RX888_BUF_RATE_CHANGED) < 0 ||
+        PyModule_AddIntConstant(m, "BUF_ATTENUATION_CHANGED",
+                                RX888_BUF_ATTENUATION_CHANGED) < 0 ||
+        PyModule_AddIntConstant(m, "BUF_OVERRUN", RX888_BUF_OVERRUN) < 0 ||
+        PyModule_AddIntConstant(m, "BUF_DISCONTINUITY",
+                                RX888_BUF_DISCONTINUITY) < 0)
+        goto err;
+
+    return m;
+err:
+    Py_DECREF(m);
+
+    return NULL;
+}
@@ -0,0 +1,603 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "librx888_dsp.h"
+#include "fft.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIN_FFT_SIZE (1U << 12)
+#define MAX_FFT_SIZE (1U << 22)
+#define DEFAULT_FFT_SIZE (1U << 18)
+#define DEFAULT_AUDIO_RATE 48000
+#define MIN_CHANNEL_SIZE 16
+#define MAX_CHANNELS 4096
+#define FULL_SCALE 32768.0
+
+/* a quarter of every block is overlap, it holds the channel filters */
+#define OVERLAP 4
+#define KAISER_BETA 6.0
+#define STOPBAND_DB (KAISER_BETA / 0.1102 + 8.7)
+/* passband of the channel filters relative to the audio rate */
+#define MAX_BANDWIDTH 0.8
+
+#define AM_CARRIER_TIME 0.05    /* s, carrier level average */
+#define SSB_AGC_DECAY 0.5       /* s, peak level decay */
+
+/*
+ * Per channel state is kept as structure of arrays with the channels sorted
+ * by mode, so every demodulator loop runs over a contiguous range of
+ * channels and vectorizes across them.
+ */
+struct rx888_demod {
+    uint32_t n;                 /* front end FFT size */
+    uint32_t nc;                /* channel FFT size */
+    uint32_t advance;           /* new samples per block */
+    uint32_t frames;            /* audio frames per block */
+    uint32_t nch;
+    double rate;
+
+    rx888_fft_t *fft;
+    rx888_fft_t *cfft;
+    int16_t *block;             /* n samples */
+    uint32_t fill;
+    uint64_t block_index;       /* stream index of the first new sample */
+    float *re;                  /* n / 2 work arrays */
+    float *im;
+    float *xr;                  /* spectrum of the block */
+    float *xi;
+    float *cr;                  /* nc work arrays */
+    float *ci;
+    float *zr;
+    float *zi;
+
+    /* per channel, sorted order */
+    uint32_t *order;            /* index the channel was given at */
+    int32_t *bin;               /* FFT bin nearest to the carrier */
+    float *h_re;                /* nc filter bins each, FFT order */
+    float *h_im;
+    double *rot_re;             /* phase advance of the bin per block */
+    double *rot_im;
+    double *ph_re;              /* accumulated block phase */
+    double *ph_im;
+
+    float *nco_re;              /* fine tuning of the carrier offset */
+    float *nco_im;
+    float *step_re;
+    float *step_im;
+    float *prev_re;             /* FM discriminator */
+    float *prev_im;
+    float *fm_scale;
+    float *level;               /* AM carrier or SSB peak level */
+
+    /* first channel of every mode, plus the end */
+    uint32_t mode_start[RX888_DEMOD_LSB + 2];
+    float am_alpha;
+    float ssb_decay;
+
+    float *bb_re;               /* frames * nch, channels innermost */
+    float *bb_im;
+    float *audio;               /* frames * nch, sorted order */
+    float *out;                 /* frames * nch, given order */
+
+    rx888_demod_cb_t cb;
+    void *cb_ctx;
+};
+
+/* zeroth order modified Bessel function, for the Kaiser window */
+static double demod_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/* branch free atan2, about 1e-5 rad, so the discriminator loop vectorizes */
+static inline float demod_atan2(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float mx = ax > ay ? ax : ay;
+    float mn = ax > ay ? ay : ax;
+    float a = mn / (mx + 1e-30f);
+    float s = a * a;
+    float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) *
+              s * a + a;
+
+    r = ay > ax ? 1.57079637f - r : r;
+    r = x < 0.0f ? 3.14159274f - r : r;
+
+    return copysignf(r, y);
+}
+
+/*
+ * Kaiser windowed lowpass of half the channel bandwidth, moved onto the
+ * passband relative to the bin of the channel, as nc frequency samples.
+ */
+static void demod_filter(rx888_demod_t *d, uint32_t c,
+                         const rx888_channel_t *ch, double offset)
+{
+    const uint32_t taps = d->nc / OVERLAP + 1;
+    const double mid = (taps - 1) / 2.0;
+    /* Kaiser's transition width, AM and FM stay flat up to half the
+     * bandwidth */
+    const double trans = (STOPBAND_DB - 8.0) /
+                         (2.285 * 2.0 * M_PI * (taps - 1));
+    /* sidebands need every bit of rejection, so their edges stay at the
+     * half amplitude point */
+    const double fc = ch->bandwidth / 2.0 / d->rate +
+        (ch->mode == RX888_DEMOD_AM || ch->mode == RX888_DEMOD_FM ?
+         trans / 2.0 : 0.0);
+    /* extracted bins are X[k] * n / 2 for a full scale cosine */
+    const double scale = 2.0 / (d->n * FULL_SCALE);
+    double sum = 0.0;
+    float *hr = d->h_re + (size_t)c * d->nc;
+    float *hi = d->h_im + (size_t)c * d->nc;
+
+    if (ch->mode == RX888_DEMOD_USB)
+        offset += ch->bandwidth / 2.0;
+    else if (ch->mode == RX888_DEMOD_LSB)
+        offset -= ch->bandwidth / 2.0;
+
+    memset(d->cr, 0, d->nc * sizeof(float));
+    memset(d->ci, 0, d->nc * sizeof(float));
+
+    for (uint32_t t = 0; t < taps; t++) {
+        double x = t - mid;
+        double r = x / mid;
+        double v = x ? sin(2.0 * M_PI * fc * x) / (M_PI * x) : 2.0 * fc;
+
+        v *= demod_i0(KAISER_BETA * sqrt(1.0 - r * r)) /
+             demod_i0(KAISER_BETA);
+        d->cr[t] = (float)v;
+        sum += v;
+    }
+
+    for (uint32_t t = 0; t < taps; t++) {
+        double v = d->cr[t] / sum * scale;
+        double a = 2.0 * M_PI * offset / d->rate * t;
+
+        d->cr[t] = (float)(v * cos(a));
+        d->ci[t] = (float)(v * sin(a));
+    }
+
+    rx888_fft_complex(d->cfft, d->cr, d->ci, hr, hi, 0);
+}
+
+/* X[k] of the real input for any k */
+static inline void demod_bin(const rx888_demod_t *d, int32_t k,
+                             float *r, float *i)
+{
+    const int32_t half = (int32_t)d->n / 2;
+    float sign = 1.0f;
+
+    k %= (int32_t)d->n;
+    if (k < 0)
+        k += (int32_t)d->n;
+    if (k > half) {
+        k = (int32_t)d->n - k;
+        sign = -1.0f;
+    }
+
+    if (k == 0) {
+        *r = d->xr[0];
+        *i = 0.0f;
+    } else if (k == half) {
+        /* nyquist is packed into xi[0] */
+        *r = d->xi[0];
+        *i = 0.0f;
+    } else {
+        *r = d->xr[k];
+        *i = sign * d->xi[k];
+    }
+}
+
+/* filter and decimate one channel out of the block spectrum */
+static void demod_channel(rx888_demod_t *d, uint32_t c)
+{
+    const uint32_t nc = d->nc;
+    const int32_t first = d->bin[c] - (int32_t)nc / 2;
+    const float *hr = d->h_re + (size_t)c * nc;
+    const float *hi = d->h_im + (size_t)c * nc;
+    const float pr = (float)d->ph_re[c], pi = (float)d->ph_im[c];
+
+    for (uint32_t j = 0; j < nc; j++) {
+        /* FFT order, negative frequencies in the upper half */
+        uint32_t s = j < nc / 2 ? j + nc / 2 : j - nc / 2;
+        int32_t k = first + (int32_t)s;
+        float xr, xi;
+
+        if (k > 0 && k < (int32_t)d->n / 2) {
+            xr = d->xr[k];
+            xi = d->xi[k];
+        } else {
+            demod_bin(d, k, &xr, &xi);
+        }
+
+        float gr = hr[j] * pr - hi[j] * pi;
+        float gi = hr[j] * pi + hi[j] * pr;
+        d->cr[j] = xr * gr - xi * gi;
+        d->ci[j] = xr * gi + xi * gr;
+    }
+
+    rx888_fft_complex(d->cfft, d->cr, d->ci, d->zr, d->zi, 1);
+
+    /* the first quarter wrapped around the filter, the rest is new */
+    for (uint32_t i = 0; i < d->frames; i++) {
+        d->bb_re[(size_t)i * d->nch + c] = d->zr[nc / OVERLAP + i];
+        d->bb_im[(size_t)i * d->nch + c] = d->zi[nc / OVERLAP + i];
+    }
+
+    /* the bins move by bin * advance / n cycles between blocks */
+    double r = d->ph_re[c] * d->rot_re[c] - d->ph_im[c] * d->rot_im[c];
+    double i = d->ph_re[c] * d->rot_im[c] + d->ph_im[c] * d->rot_re[c];
+    d->ph_re[c] = r;
+    d->ph_im[c] = i;
+}
+
+/*
+ * The per frame kernels below run across the channels of one mode. Keeping
+ * them as functions with restrict parameters is what lets the compiler
+ * vectorize them.
+ */
+static void demod_tune(float *restrict br, float *restrict bi,
+                       float *restrict nr, float *restrict ni,
+                       const float *restrict sr, const float *restrict si,
+                       uint32_t n)
+{
+    for (uint32_t c = 0; c < n; c++) {
+        float r = br[c] * nr[c] - bi[c] * ni[c];
+        float i = br[c] * ni[c] + bi[c] * nr[c];
+        float tr = nr[c] * sr[c] - ni[c] * si[c];
+        float ti = nr[c] * si[c] + ni[c] * sr[c];
+        br[c] = r;
+        bi[c] = i;
+        nr[c] = tr;
+        ni[c] = ti;
+    }
+}
+
+static void demod_am(const float *restrict br, const float *restrict bi,
+                     float *restrict level, float *restrict out,
+                     float alpha, uint32_t n)
+{
+    for (uint32_t c = 0; c < n; c++) {
+        float env = sqrtf(br[c] * br[c] + bi[c] * bi[c]);
+        /* start from the first envelope instead of settling */
+        float l = level[c] > 0.0f ? level[c] : env;
+        l += alpha * (env - l);
+        level[c] = l;
+        out[c] = (env - l) / (l + 1e-9f);
+    }
+}
+
+static void demod_fm(const float *restrict br, const float *restrict bi,
+                     float *restrict pr, float *restrict pi,
+                     const float *restrict scale, float *restrict out,
+                     uint32_t n)
+{
+    for (uint32_t c = 0; c < n; c++) {
+        float dr = br[c] * pr[c] + bi[c] * pi[c];
+        float di = bi[c] * pr[c] - br[c] * pi[c];
+        out[c] = demod_atan2(di, dr) * scale[c];
+        pr[c] = br[c];
+        pi[c] = bi[c];
+    }
+}
+
+/* the filter left only one sideband, its real part is the audio */
+static void demod_ssb(const float *restrict br, const float *restrict bi,
+                      float *restrict level, float *restrict out,
+                      float decay, uint32_t n)
+{
+    for (uint32_t c = 0; c < n; c++) {
+        float env = sqrtf(br[c] * br[c] + bi[c] * bi[c]);
+        float l = level[c] * decay;
+        l = env > l ? env : l;
+        level[c] = l;
+        out[c] = 0.5f * br[c] / (l + 1e-9f);
+    }
+}
+
+static void demod_frames(rx888_demod_t *d)
+{
+    const uint32_t nch = d->nch;
+    const uint32_t am = d->mode_start[RX888_DEMOD_AM];
+    const uint32_t fm = d->mode_start[RX888_DEMOD_FM];
+    const uint32_t ssb = d->mode_start[RX888_DEMOD_USB];
+    const uint32_t end = d->mode_start[RX888_DEMOD_LSB + 1];
+
+    for (uint32_t f = 0; f < d->frames; f++) {
+        float *br = d->bb_re + (size_t)f * nch;
+        float *bi = d->bb_im + (size_t)f * nch;
+        float *out = d->audio + (size_t)f * nch;
+
+        demod_tune(br, bi, d->nco_re, d->nco_im, d->step_re, d->step_im,
+                   nch);
+        demod_am(br + am, bi + am, d->level + am, out + am, d->am_alpha,
+                 fm - am);
+        demod_fm(br + fm, bi + fm, d->prev_re + fm, d->prev_im + fm,
+                 d->fm_scale + fm, out + fm, ssb - fm);
+        demod_ssb(br + ssb, bi + ssb, d->level + ssb, out + ssb,
+                  d->ssb_decay, end - ssb);
+    }
+
+    /* keep the oscillators on the unit circle */
+    for (uint32_t c = 0; c < nch; c++) {
+        float g = 1.0f / sqrtf(d->nco_re[c] * d->nco_re[c] +
+                               d->nco_im[c] * d->nco_im[c]);
+        d->nco_re[c] *= g;
+        d->nco_im[c] *= g;
+    }
+}
+
+static void demod_block(rx888_demod_t *d)
+{
+    rx888_fft_load(d->fft, d->block, NULL, d->re, d->im);
+    rx888_fft_execute(d->fft, d->re, d->im);
+    rx888_fft_spectrum(d->fft, d->re, d->im, d->xr, d->xi);
+
+    for (uint32_t c = 0; c < d->nch; c++)
+        demod_channel(d, c);
+
+    demod_frames(d);
+
+    for (uint32_t f = 0; f < d->frames; f++) {
+        const float *in = d->audio + (size_t)f * d->nch;
+        float *out = d->out + (size_t)f * d->nch;
+
+        for (uint32_t c = 0; c < d->nch; c++)
+            out[d->order[c]] = in[c];
+    }
+
+    if (d->cb)
+        d->cb(d->out, d->nch, d->frames, d->block_index, d->cb_ctx);
+
+    d->block_index += d->advance;
+}
+
+int rx888_demod_create(rx888_demod_t **out,
+                       const rx888_demod_config_t *config,
+                       const rx888_channel_t *channels, uint32_t count,
+                       rx888_demod_cb_t cb, void *ctx)
+{
+    rx888_demod_t *d;
+    uint32_t n, nc, audio_rate;
+    double fs;
+
+    if (!out || !config || !channels || !count || count > MAX_CHANNELS ||
+        !config->sample_rate)
+        return -EINVAL;
+
+    n = config->fft_size ? config->fft_size : DEFAULT_FFT_SIZE;
+    if (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1)))
+        return -EINVAL;
+
+    fs = config->sample_rate;
+    audio_rate = config->audio_rate ? config->audio_rate : DEFAULT_AUDIO_RATE;
+    nc = MIN_CHANNEL_SIZE;
+    while (nc < n / 2 && fs * nc / n < audio_rate)
+        nc *= 2;
+    if (fs * nc / n < audio_rate)
+        return -EINVAL;
+
+    for (uint32_t c = 0; c < count; c++) {
+        const rx888_channel_t *ch = &channels[c];
+        double rate = fs * nc / n;
+        double width = ch->mode == RX888_DEMOD_USB ||
+                       ch->mode == RX888_DEMOD_LSB ? 2.0 * ch->bandwidth
+                                                   : ch->bandwidth;
+
+        if (ch->mode > RX888_DEMOD_LSB || !(ch->bandwidth > 0.0f) ||
+            width > MAX_BANDWIDTH * rate ||
+            !(ch->frequency > 0.0) || ch->frequency >= fs / 2)
+            return -EINVAL;
+    }
+
+    d = calloc(1, sizeof(rx888_demod_t));
+    if (!d)
+        return -ENOMEM;
+
+    d->n = n;
+    d->nc = nc;
+    d->advance = n - n / OVERLAP;
+    d->frames = nc - nc / OVERLAP;
+    d->nch = count;
+    d->rate = fs * nc / n;
+    d->cb = cb;
+    d->cb_ctx = ctx;
+    d->am_alpha = (float)(1.0 - exp(-1.0 / (AM_CARRIER_TIME * d->rate)));
+    d->ssb_decay = (float)exp(-1.0 / (SSB_AGC_DECAY * d->rate));
+
+    d->fft = rx888_fft_plan(n);
+    d->cfft = rx888_fft_plan(2 * nc);
+    d->block = calloc(n, sizeof(int16_t));
+    d->re = malloc(n / 2 * sizeof(float));
+    d->im = malloc(n / 2 * sizeof(float));
+    d->xr = malloc(n / 2 * sizeof(float));
+    d->xi = malloc(n / 2 * sizeof(float));
+    d->cr = malloc(nc * sizeof(float));
+    d->ci = malloc(nc * sizeof(float));
+    d->zr = malloc(nc * sizeof(float));
+    d->zi = malloc(nc * sizeof(float));
+    if (!d->fft || !d->cfft || !d->block || !d->re || !d->im || !d->xr ||
+        !d->xi || !d->cr || !d->ci || !d->zr || !d->zi)
+        goto err;
+
+    d->order = malloc(count * sizeof(uint32_t));
+    d->bin = malloc(count * sizeof(int32_t));
+    d->h_re = malloc((size_t)count * nc * sizeof(float));
+    d->h_im = malloc((size_t)count * nc * sizeof(float));
+    d->rot_re = malloc(count * sizeof(double));
+    d->rot_im = malloc(count * sizeof(double));
+    d->ph_re = malloc(count * sizeof(double));
+    d->ph_im = malloc(count * sizeof(double));
+    d->nco_re = malloc(count * sizeof(float));
+    d->nco_im = malloc(count * sizeof(float));
+    d->step_re = malloc(count * sizeof(float));
+    d->step_im = malloc(count * sizeof(float));
+    d->prev_re = calloc(count, sizeof(float));
+    d->prev_im = calloc(count, sizeof(float));
+    d->fm_scale = calloc(count, sizeof(float));
+    d->level = calloc(count, sizeof(float));
+    d->bb_re = malloc((size_t)d->frames * count * sizeof(float));
+    d->bb_im = malloc((size_t)d->frames * count * sizeof(float));
+    d->audio = calloc((size_t)d->frames * count, sizeof(float));
+    d->out = malloc((size_t)d->frames * count * sizeof(float));
+    if (!d->order || !d->bin || !d->h_re || !d->h_im || !d->rot_re ||
+        !d->rot_im || !d->ph_re || !d->ph_im || !d->nco_re ||
+        !d->nco_im || !d->step_re || !d->step_im || !d->prev_re ||
+        !d->prev_im || !d->fm_scale || !d->level || !d->bb_re ||
+        !d->bb_im || !d->audio || !d->out)
+        goto err;
+
+    /* sort by mode, keeping the given order within a mode */
+    uint32_t c = 0;
+    for (int mode = RX888_DEMOD_AM; mode <= RX888_DEMOD_LSB; mode++) {
+        d->mode_start[mode] = c;
+        for (uint32_t i = 0; i < count; i++) {
+            if ((int)channels[i].mode == mode)
+                d->order[c++] = i;
+        }
+    }
+    d->mode_start[RX888_DEMOD_LSB + 1] = c;
+
+    for (c = 0; c < count; c++) {
+        const rx888_channel_t *ch = &channels[d->order[c]];
+        double bins = ch->frequency * n / fs;
+        int32_t k = (int32_t)floor(bins + 0.5);
+        /* carrier offset from the bin, removed after decimation */
+        double offset = (bins - k) * fs / n;
+        double a;
+
+        d->bin[c] = k;
+        demod_filter(d, c, ch, offset);
+
+        a = -2.0 * M_PI * fmod((double)k * d->advance, n) / n;
+        d->rot_re[c] = cos(a);
+        d->rot_im[c] = sin(a);
+        d->ph_re[c] = 1.0;
+        d->ph_im[c] = 0.0;
+
+        a = -2.0 * M_PI * offset / d->rate;
+        d->nco_re[c] = 1.0f;
+        d->nco_im[c] = 0.0f;
+        d->step_re[c] = (float)cos(a);
+        d->step_im[c] = (float)sin(a);
+
+        /* full deviation of half the bandwidth gives +-1 */
+        d->fm_scale[c] = (float)(d->rate / (M_PI * ch->bandwidth));
+    }
+
+    /* the first block starts with the overlap of silence */
+    d->fill = n / OVERLAP;
+
+    *out = d;
+    return 0;
+err:
+    rx888_demod_destroy(d);
+    return -ENOMEM;
+}
+
+int rx888_demod_process(rx888_demod_t *d, const int16_t *samples,
+                        uint32_t count)
+{
+    if (!d || (!samples && count))
+        return -EINVAL;
+
+    while (count) {
+        uint32_t n = d->n - d->fill;
+        if (n > count)
+            n = count;
+
+        memcpy(d->block + d->fill, samples, n * sizeof(int16_t));
+        d->fill += n;
+        samples += n;
+        count -= n;
+
+        if (d->fill < d->n)
+            continue;
+
+        demod_block(d);
+
+        memmove(d->block, d->block + d->advance,
+                (d->n - d->advance) * sizeof(int16_t));
+        d->fill = d->n - d->advance;
+    }
+
+    return 0;
+}
+
+double rx888_demod_rate(rx888_demod_t *d)
+{
+    if (!d)
+        return 0.0;
+
+    return d->rate;
+}
+
+void rx888_demod_destroy(rx888_demod_t *d)
+{
+    if (!d)
+        return;
+
+    rx888_fft_free(d->fft);
+    rx888_fft_free(d->cfft);
+    free(d->block);
+    free(d->re);
+    free(d->im);
+    free(d->xr);
+    free(d->xi);
+    free(d->cr);
+    free(d->ci);
+    free(d->zr);
+    free(d->zi);
+
+    free(d->order);
+    free(d->bin);
+    free(d->h_re);
+    free(d->h_im);
+    free(d->rot_re);
+    free(d->rot_im);
+    free(d->ph_re);
+    free(d->ph_im);
+    free(d->nco_re);
+    free(d->nco_im);
+    free(d->step_re);
+    free(d->step_im);
+    free(d->prev_re);
+    free(d->prev_im);
+    free(d->fm_scale);
+    free(d->level);
+    free(d->bb_re);
+    free(d->bb_im);
+    free(d->audio);
+    free(d->out);
+    free(d);
+}
@@ -0,0 +1,239 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "librx888_dsp.h"
+#include "fft.h"
+
+#define MIN_FFT_SIZE (1U << 8)
+#define MAX_FFT_SIZE (1U << 16)
+
+/* blocks used to seed the noise floor before detecting */
+#define FLOOR_WARMUP 16
+/* band power smoothing, tames the exponential spread of single bins */
+#define POWER_SMOOTHING 0.25f
+/* falling noise floor follows quickly */
+#define FLOOR_FALL 0.02f
+#define DEFAULT_FLOOR_RISE 0.002f
+
+struct rx888_detector {
+    rx888_detector_config_t config;
+    rx888_fft_t *fft;
+    float *window;
+    float *re;
+    float *im;
+    float *power;
+
+    uint32_t bands;
+    uint32_t bins_per_band;
+    float *level;               /* smoothed band power */
+    float *floor;               /* band noise floor */
+    float start_ratio;
+    float stop_ratio;
+
+    int16_t *block;
+    uint32_t fill;
+    uint64_t block_index;       /* stream index of the buffered block */
+    uint32_t blocks;
+    uint32_t quiet;
+    bool active;
+
+    rx888_detector_cb_t cb;
+    void *cb_ctx;
+};
+
+int rx888_detector_create(rx888_detector_t **out,
+                          const rx888_detector_config_t *config,
+                          rx888_detector_cb_t cb, void *ctx)
+{
+    rx888_detector_t *det;
+    uint32_t n;
+
+    if (!out || !config)
+        return -EINVAL;
+
+    n = config->fft_size;
+    if (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1)))
+        return -EINVAL;
+    if (config->bands > n / 2 || config->threshold_db <= 0.0f ||
+        config->hysteresis_db < 0.0f ||
+        config->hysteresis_db >= config->threshold_db)
+        return -EINVAL;
+
+    det = calloc(1, sizeof(rx888_detector_t));
+    if (!det)
+        return -ENOMEM;
+
+    det->config = *config;
+    if (det->config.floor_rise <= 0.0f)
+        det->config.floor_rise = DEFAULT_FLOOR_RISE;
+    det->cb = cb;
+    det->cb_ctx = ctx;
+
+    det->bands = config->bands ? config->bands : n / 2;
+    det->bins_per_band = (n / 2) / det->bands;
+    det->start_ratio = powf(10.0f, config->threshold_db / 10.0f);
+    det->stop_ratio = powf(10.0f,
+        (config->threshold_db - config->hysteresis_db) / 10.0f);
+
+    det->fft = rx888_fft_plan(n);
+    det->window = malloc(n * sizeof(float));
+    det->re = malloc(n * sizeof(float));
+    det->power = malloc(n / 2 * sizeof(float));
+    det->level = calloc(det->bands, sizeof(float));
+    det->floor = calloc(det->bands, sizeof(float));
+    det->block = malloc(n * sizeof(int16_t));
+    if (!det->fft || !det->window || !det->re || !det->power ||
+        !det->level || !det->floor || !det->block) {
+        rx888_detector_destroy(det);
+        return -ENOMEM;
+    }
+    det->im = det->re + n / 2;
+
+    rx888_fft_window(RX888_WINDOW_HANN, det->window, n);
+
+    *out = det;
+    return 0;
+}
+
+static void detector_block(rx888_detector_t *det)
+{
+    const uint32_t bpb = det->bins_per_band;
+    float best = 0.0f;
+    uint32_t best_band = 0;
+    bool above = false, quiet = true;
+
+    rx888_fft_load(det->fft, det->block, det->window, det->re, det->im);
+    rx888_fft_execute(det->fft, det->re, det->im);
+    rx888_fft_power(det->fft, det->re, det->im, det->power);
+
+    for (uint32_t b = 0; b < det->bands; b++) {
+        const float *p = det->power + b * bpb;
+        float sum = 0.0f;
+
+        for (uint32_t k = 0; k < bpb; k++)
+            sum += p[k];
+
+        if (det->blocks < FLOOR_WARMUP) {
+            /* seed the floor with the plain average */
+            det->level[b] += (sum - det->level[b]) / (det->blocks + 1);
+            det->floor[b] = det->level[b];
+            continue;
+        }
+
+        det->level[b] += POWER_SMOOTHING * (sum - det->level[b]);
+
+        float ratio = det->level[b] / (det->floor[b] + 1e-20f);
+        if (ratio > best) {
+            best = ratio;
+            best_band = b;
+        }
+        if (ratio > det->start_ratio)
+            above = true;
+        if (ratio > det->stop_ratio)
+            quiet = false;
+
+        /* signals must not lift the floor, so it only rises while idle */
+        if (det->level[b] < det->floor[b])
+            det->floor[b] += FLOOR_FALL * (det->level[b] - det->floor[b]);
+        else if (!det->active)
+            det->floor[b] += det->config.floor_rise *
+                             (det->level[b] - det->floor[b]);
+    }
+
+    if (det->blocks < FLOOR_WARMUP) {
+        det->blocks++;
+        return;
+    }
+
+    float level_db = 10.0f * log10f(best + 1e-20f);
+
+    if (!det->active && above) {
+        det->active = true;
+        det->quiet = 0;
+        if (det->cb)
+            det->cb(RX888_DETECT_START, det->block_index, level_db,
+                    best_band, det->cb_ctx);
+    } else if (det->active) {
+        det->quiet = quiet ? det->quiet + 1 : 0;
+        if (det->quiet > det->config.hold_blocks) {
+            det->active = false;
+            if (det->cb)
+                det->cb(RX888_DETECT_STOP,
+                        det->block_index - (uint64_t)det->config.hold_blocks *
+                        det->config.fft_size,
+                        level_db, best_band, det->cb_ctx);
+        }
+    }
+}
+
+int rx888_detector_process(rx888_detector_t *det, const int16_t *samples,
+                           uint32_t count)
+{
+    const uint32_t n = det ? det->config.fft_size : 0;
+
+    if (!det || (!samples && count))
+        return -EINVAL;
+
+    while (count) {
+        uint32_t c = n - det->fill;
+        if (c > count)
+            c = count;
+
+        memcpy(det->block + det->fill, samples, c * sizeof(int16_t));
+        det->fill += c;
+        samples += c;
+        count -= c;
+
+        if (det->fill == n) {
+            detector_block(det);
+            det->fill = 0;
+            det->block_index += n;
+        }
+    }
+
+    return 0;
+}
+
+int rx888_detector_active(rx888_detector_t *det)
+{
+    if (!det)
+        return 0;
+
+    return det->active;
+}
+
+void rx888_detector_destroy(rx888_detector_t *det)
+{
+    if (!det)
+        return;
+
+    rx888_fft_free(det->fft);
+    free(det->window);
+    free(det->re);
+    free(det->power);
+    free(det->level);
+    free(det->floor);
+    free(det->block);
+    free(det);
+}
@@ -0,0 +1,301 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct rx888_fft {
+    uint32_t n;         /* real input size */
+    uint32_t m;         /* complex transform size, n / 2 */
+    uint32_t *bitrev;   /* m entries */
+    float *tw_re;       /* stage twiddles, stage of half size h at [h] */
+    float *tw_im;
+    float *post_re;     /* real untangling twiddles, m entries */
+    float *post_im;
+};
+
+rx888_fft_t *rx888_fft_plan(uint32_t n)
+{
+    rx888_fft_t *fft;
+    uint32_t bits = 0;
+
+    /* power of two, at least 8 */
+    if (n < 8 || (n & (n - 1)))
+        return NULL;
+
+    fft = calloc(1, sizeof(rx888_fft_t));
+    if (!fft)
+        return NULL;
+
+    fft->n = n;
+    fft->m = n / 2;
+    while ((1U << bits) < fft->m)
+        bits++;
+
+    fft->bitrev = malloc(fft->m * sizeof(uint32_t));
+    fft->tw_re = malloc(fft->m * sizeof(float));
+    fft->tw_im = malloc(fft->m * sizeof(float));
+    fft->post_re = malloc(fft->m * sizeof(float));
+    fft->post_im = malloc(fft->m * sizeof(float));
+    if (!fft->bitrev || !fft->tw_re || !fft->tw_im ||
+        !fft->post_re || !fft->post_im) {
+        rx888_fft_free(fft);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < fft->m; i++) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; b++)
+            r |= ((i >> b) & 1U) << (bits - 1 - b);
+        fft->bitrev[i] = r;
+    }
+
+    /* twiddles of a stage with half size h live at [h, 2h) */
+    for (uint32_t h = 1; h < fft->m; h <<= 1) {
+        for (uint32_t k = 0; k < h; k++) {
+            double a = -M_PI * k / h;
+            fft->tw_re[h + k] = (float)cos(a);
+            fft->tw_im[h + k] = (float)sin(a);
+        }
+    }
+
+    for (uint32_t k = 0; k < fft->m; k++) {
+        double a = -2.0 * M_PI * k / n;
+        fft->post_re[k] = (float)cos(a);
+        fft->post_im[k] = (float)sin(a);
+    }
+
+    return fft;
+}
+
+void rx888_fft_free(rx888_fft_t *fft)
+{
+    if (!fft)
+        return;
+
+    free(fft->bitrev);
+    free(fft->tw_re);
+    free(fft->tw_im);
+    free(fft->post_re);
+    free(fft->post_im);
+    free(fft);
+}
+
+uint32_t rx888_fft_size(const rx888_fft_t *fft)
+{
+    return fft->n;
+}
+
+void rx888_fft_load(const rx888_fft_t *fft, const int16_t *x,
+                    const float *window, float *re, float *im)
+{
+    const uint32_t *bitrev = fft->bitrev;
+
+    /* even samples go to the real, odd samples to the imaginary part */
+    if (window) {
+        for (uint32_t i = 0; i < fft->m; i++) {
+            uint32_t r = bitrev[i];
+            re[r] = x[2 * i] * window[2 * i];
+            im[r] = x[2 * i + 1] * window[2 * i + 1];
+        }
+    } else {
+        for (uint32_t i = 0; i < fft->m; i++) {
+            uint32_t r = bitrev[i];
+            re[r] = x[2 * i];
+            im[r] = x[2 * i + 1];
+        }
+    }
+}
+
+void rx888_fft_execute(const rx888_fft_t *fft, float *re, float *im)
+{
+    const uint32_t m = fft->m;
+
+    /* first stage has only trivial twiddles */
+    for (uint32_t j = 0; j < m; j += 2) {
+        float ar = re[j], ai = im[j];
+        float br = re[j + 1], bi = im[j + 1];
+        re[j] = ar + br;
+        im[j] = ai + bi;
+        re[j + 1] = ar - br;
+        im[j + 1] = ai - bi;
+    }
+
+    for (uint32_t h = 2; h < m; h <<= 1) {
+        const float *wr = fft->tw_re + h;
+        const float *wi = fft->tw_im + h;
+
+        for (uint32_t j = 0; j < m; j += 2 * h) {
+            float *restrict ar = re + j;
+            float *restrict ai = im + j;
+            float *restrict br = re + j + h;
+            float *restrict bi = im + j + h;
+
+            /* contiguous inner loop, vectorized by the compiler */
+            for (uint32_t k = 0; k < h; k++) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+void rx888_fft_power(const rx888_fft_t *fft, const float *re,
+                     const float *im, float *power)
+{
+    const uint32_t m = fft->m;
+
+    /* X[0] = Re(Z[0]) + Im(Z[0]) */
+    power[0] = (re[0] + im[0]) * (re[0] + im[0]);
+
+    for (uint32_t k = 1; k < m; k++) {
+        /* even part E = (Z[k] + conj(Z[m-k])) / 2,
+         * odd part  O = (Z[k] - conj(Z[m-k])) / 2i,
+         * X[k] = E + W^k O */
+        float zr = re[k], zi = im[k];
+        float cr = re[m - k], ci = -im[m - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float dr = 0.5f * (zr - cr), di = 0.5f * (zi - ci);
+        float or_ = di, oi = -dr;
+        float wr = fft->post_re[k], wi = fft->post_im[k];
+        float xr = er + or_ * wr - oi * wi;
+        float xi = ei + or_ * wi + oi * wr;
+        power[k] = xr * xr + xi * xi;
+    }
+}
+
+void rx888_fft_spectrum(const rx888_fft_t *fft, const float *re,
+                        const float *im, float *xr, float *xi)
+{
+    const uint32_t m = fft->m;
+
+    /* X[0] = Re(Z[0]) + Im(Z[0]), X[m] = Re(Z[0]) - Im(Z[0]) */
+    xr[0] = re[0] + im[0];
+    xi[0] = re[0] - im[0];
+
+    for (uint32_t k = 1; k < m; k++) {
+        float zr = re[k], zi = im[k];
+        float cr = re[m - k], ci = -im[m - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float dr = 0.5f * (zr - cr), di = 0.5f * (zi - ci);
+        float or_ = di, oi = -dr;
+        float wr = fft->post_re[k], wi = fft->post_im[k];
+        xr[k] = er + or_ * wr - oi * wi;
+        xi[k] = ei + or_ * wi + oi * wr;
+    }
+}
+
+void rx888_fft_inverse(const rx888_fft_t *fft, const float *xr,
+                       const float *xi, float *re, float *im, float *out)
+{
+    const uint32_t m = fft->m;
+    const float scale = 1.0f / m;
+
+    for (uint32_t k = 0; k < m; k++) {
+        /* X[m-k] for k = 0 is the packed nyquist bin */
+        float ar = xr[k], ai = k ? xi[k] : 0.0f;
+        float cr = k ? xr[m - k] : xi[0], ci = k ? -xi[m - k] : 0.0f;
+        /* E = (X[k] + conj(X[m-k])) / 2,
+         * O = (X[k] - conj(X[m-k])) / 2 * conj(W^k),
+         * Z[k] = E + i O */
+        float er = 0.5f * (ar + cr), ei = 0.5f * (ai + ci);
+        float dr = 0.5f * (ar - cr), di = 0.5f * (ai - ci);
+        float wr = fft->post_re[k], wi = fft->post_im[k];
+        float or_ = dr * wr + di * wi;
+        float oi = di * wr - dr * wi;
+        uint32_t r = fft->bitrev[k];
+
+        /* the forward transform of conj(Z) is conj(m z) */
+        re[r] = er - oi;
+        im[r] = -(ei + or_);
+    }
+
+    rx888_fft_execute(fft, re, im);
+
+    for (uint32_t i = 0; i < m; i++) {
+        out[2 * i] = re[i] * scale;
+        out[2 * i + 1] = -im[i] * scale;
+    }
+}
+
+void rx888_fft_complex(const rx888_fft_t *fft, const float *xr,
+                       const float *xi, float *re, float *im, int inverse)
+{
+    const uint32_t m = fft->m;
+    const float sign = inverse ? -1.0f : 1.0f;
+
+    /* the inverse is the conjugate of the forward transform of the
+     * conjugate */
+    for (uint32_t i = 0; i < m; i++) {
+        uint32_t r = fft->bitrev[i];
+        re[r] = xr[i];
+        im[r] = sign * xi[i];
+    }
+
+    rx888_fft_execute(fft, re, im);
+
+    if (inverse) {
+        for (uint32_t i = 0; i < m; i++)
+            im[i] = -im[i];
+    }
+}
+
+double rx888_fft_window(enum rx888_window type, float *w, uint32_t n)
+{
+    double sum = 0.0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        double x = 2.0 * M_PI * i / n;
+        double v;
+
+        switch (type) {
+        case RX888_WINDOW_HANN:
+            v = 0.5 - 0.5 * cos(x);
+            break;
+        case RX888_WINDOW_HAMMING:
+            v = 0.54 - 0.46 * cos(x);
+            break;
+        case RX888_WINDOW_BLACKMAN:
+            v = 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+            break;
+        case RX888_WINDOW_BLACKMAN_HARRIS:
+            v = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x)
+                - 0.01168 * cos(3 * x);
+            break;
+        case RX888_WINDOW_RECT:
+        default:
+            v = 1.0;
+            break;
+        }
+
+        w[i] = (float)v;
+        sum += v;
+    }
+
+    return sum;
+}
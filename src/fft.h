@@ -0,0 +1,69 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_FFT_H
+#define RX888_FFT_H
+
+#include <stdint.h>
+
+#include "librx888_dsp.h"
+
+/*
+ * Real input FFT, computed as a half size complex FFT on split re/im arrays
+ * followed by the usual even/odd untangling step. Plans are read only once
+ * created and can be shared between threads, the work arrays can not.
+ */
+typedef struct rx888_fft rx888_fft_t;
+
+rx888_fft_t *rx888_fft_plan(uint32_t n);
+
+void rx888_fft_free(rx888_fft_t *fft);
+
+uint32_t rx888_fft_size(const rx888_fft_t *fft);
+
+/* multiply n samples with the window (may be NULL) and store them bit
+ * reversed into the n/2 sized work arrays */
+void rx888_fft_load(const rx888_fft_t *fft, const int16_t *x,
+                    const float *window, float *re, float *im);
+
+/* in place complex transform of the loaded work arrays */
+void rx888_fft_execute(const rx888_fft_t *fft, float *re, float *im);
+
+/* |X[k]|^2 for the n/2 bins below nyquist */
+void rx888_fft_power(const rx888_fft_t *fft, const float *re,
+                     const float *im, float *power);
+
+/* X[k] for the n/2 bins below nyquist, with the purely real nyquist bin
+ * packed into xi[0] */
+void rx888_fft_spectrum(const rx888_fft_t *fft, const float *re,
+                        const float *im, float *xr, float *xi);
+
+/* n real samples back from a spectrum packed like rx888_fft_spectrum(),
+ * re/im are clobbered as work arrays */
+void rx888_fft_inverse(const rx888_fft_t *fft, const float *xr,
+                       const float *xi, float *re, float *im, float *out);
+
+/* plain complex transform of the n/2 points xr/xi into re/im, inverse
+ * without the 2/n scaling */
+void rx888_fft_complex(const rx888_fft_t *fft, const float *xr,
+                       const float *xi, float *re, float *im, int inverse);
+
+/* fill n window coefficients, returns their sum */
+double rx888_fft_window(enum rx888_window type, float *w, uint32_t n);
+
+#endif /* RX888_FFT_H */
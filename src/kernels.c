@@ -0,0 +1,476 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include "librx888.h"
+#include "kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+enum kernel_isa {
+    ISA_UNKNOWN = 0,
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2
+};
+
+static enum kernel_isa kernel_isa;
+
+static enum kernel_isa detect_isa(void)
+{
+    /* benign race: every thread computes the same answer */
+    if (kernel_isa != ISA_UNKNOWN)
+        return kernel_isa;
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel_isa = ISA_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        kernel_isa = ISA_SSE2;
+    else
+#endif
+        kernel_isa = ISA_SCALAR;
+
+    return kernel_isa;
+}
+
+const char *rx888_kernel_isa(void)
+{
+    switch (detect_isa()) {
+    case ISA_AVX2:
+        return "avx2";
+    case ISA_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+static void health_scalar(const int16_t *x, uint32_t n,
+                          struct rx888_health_sums *s)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t v = x[i];
+
+        if (v < s->min)
+            s->min = (int16_t)v;
+        if (v > s->max)
+            s->max = (int16_t)v;
+        s->clipped += (v == INT16_MAX) | (v == INT16_MIN);
+        s->sum += v;
+        s->sum_sq += (uint64_t)(v * v);
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+/* madd of x * x can reach 2^31, so the pairs are widened as unsigned */
+TARGET("sse2")
+static void health_sse2(const int16_t *x, uint32_t n,
+                        struct rx888_health_sums *s)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i hi = _mm_set1_epi16(INT16_MAX);
+    const __m128i lo = _mm_set1_epi16(INT16_MIN);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vmin = _mm_set1_epi16(s->min);
+    __m128i vmax = _mm_set1_epi16(s->max);
+    __m128i vsum = zero, vsq = zero, vclip = zero;
+    uint32_t i = 0;
+
+    while (i + 8 <= n) {
+        /* 16 bit clip and 32 bit sum lanes are flushed every 2^14 rounds */
+        uint32_t end = n - (n - i) % 8;
+        if (end - i > 8 * 16384)
+            end = i + 8 * 16384;
+
+        __m128i csum = zero, cclip = zero;
+        for (; i < end; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            cclip = _mm_sub_epi16(cclip, _mm_or_si128(
+                _mm_cmpeq_epi16(v, hi), _mm_cmpeq_epi16(v, lo)));
+            csum = _mm_add_epi32(csum, _mm_madd_epi16(v, ones));
+            __m128i sq = _mm_madd_epi16(v, v);
+            vsq = _mm_add_epi64(vsq, _mm_unpacklo_epi32(sq, zero));
+            vsq = _mm_add_epi64(vsq, _mm_unpackhi_epi32(sq, zero));
+        }
+
+        /* sign extend the partial sums into the 64 bit accumulator */
+        __m128i sign = _mm_cmpgt_epi32(zero, csum);
+        vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(csum, sign));
+        vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(csum, sign));
+        vclip = _mm_add_epi32(vclip, _mm_madd_epi16(cclip, ones));
+    }
+
+    int16_t mins[8], maxs[8];
+    int64_t sums[2];
+    uint64_t sqs[2];
+    uint32_t clips[4];
+    _mm_storeu_si128((__m128i *)mins, vmin);
+    _mm_storeu_si128((__m128i *)maxs, vmax);
+    _mm_storeu_si128((__m128i *)sums, vsum);
+    _mm_storeu_si128((__m128i *)sqs, vsq);
+    _mm_storeu_si128((__m128i *)clips, vclip);
+
+    for (int k = 0; k < 8; k++) {
+        if (mins[k] < s->min)
+            s->min = mins[k];
+        if (maxs[k] > s->max)
+            s->max = maxs[k];
+    }
+    s->sum += sums[0] + sums[1];
+    s->sum_sq += sqs[0] + sqs[1];
+    s->clipped += clips[0] + clips[1] + clips[2] + clips[3];
+
+    health_scalar(x + i, n - i, s);
+}
+
+TARGET("avx2")
+static void health_avx2(const int16_t *x, uint32_t n,
+                        struct rx888_health_sums *s)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i hi = _mm256_set1_epi16(INT16_MAX);
+    const __m256i lo = _mm256_set1_epi16(INT16_MIN);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vmin = _mm256_set1_epi16(s->min);
+    __m256i vmax = _mm256_set1_epi16(s->max);
+    __m256i vsum = zero, vsq = zero, vclip = zero;
+    uint32_t i = 0;
+
+    while (i + 16 <= n) {
+        uint32_t end = n - (n - i) % 16;
+        if (end - i > 16 * 16384)
+            end = i + 16 * 16384;
+
+        __m256i csum = zero, cclip = zero;
+        for (; i < end; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+            vmin = _mm256_min_epi16(vmin, v);
+            vmax = _mm256_max_epi16(vmax, v);
+            cclip = _mm256_sub_epi16(cclip, _mm256_or_si256(
+                _mm256_cmpeq_epi16(v, hi), _mm256_cmpeq_epi16(v, lo)));
+            csum = _mm256_add_epi32(csum, _mm256_madd_epi16(v, ones));
+            __m256i sq = _mm256_madd_epi16(v, v);
+            vsq = _mm256_add_epi64(vsq, _mm256_unpacklo_epi32(sq, zero));
+            vsq = _mm256_add_epi64(vsq, _mm256_unpackhi_epi32(sq, zero));
+        }
+
+        __m256i sign = _mm256_cmpgt_epi32(zero, csum);
+        vsum = _mm256_add_epi64(vsum, _mm256_unpacklo_epi32(csum, sign));
+        vsum = _mm256_add_epi64(vsum, _mm256_unpackhi_epi32(csum, sign));
+        vclip = _mm256_add_epi32(vclip, _mm256_madd_epi16(cclip, ones));
+    }
+
+    int16_t mins[16], maxs[16];
+    int64_t sums[4];
+    uint64_t sqs[4];
+    uint32_t clips[8];
+    _mm256_storeu_si256((__m256i *)mins, vmin);
+    _mm256_storeu_si256((__m256i *)maxs, vmax);
+    _mm256_storeu_si256((__m256i *)sums, vsum);
+    _mm256_storeu_si256((__m256i *)sqs, vsq);
+    _mm256_storeu_si256((__m256i *)clips, vclip);
+
+    for (int k = 0; k < 16; k++) {
+        if (mins[k] < s->min)
+            s->min = mins[k];
+        if (maxs[k] > s->max)
+            s->max = maxs[k];
+    }
+    for (int k = 0; k < 4; k++) {
+        s->sum += sums[k];
+        s->sum_sq += sqs[k];
+    }
+    for (int k = 0; k < 8; k++)
+        s->clipped += clips[k];
+
+    health_scalar(x + i, n - i, s);
+}
+#endif
+
+static void derandomize_scalar(int16_t *x, uint32_t n)
+{
+    uint16_t *u = (uint16_t *)x;
+
+    for (uint32_t i = 0; i < n; i++)
+        u[i] ^= (uint16_t)(-(u[i] & 1U)) & 0xFFFEU;
+}
+
+#ifdef HAVE_X86_KERNELS
+TARGET("sse2")
+static void derandomize_sse2(int16_t *x, uint32_t n)
+{
+    const __m128i bits = _mm_set1_epi16((int16_t)0xFFFE);
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        /* broadcast the LSB into all bits */
+        __m128i lsb = _mm_srai_epi16(_mm_slli_epi16(v, 15), 15);
+        v = _mm_xor_si128(v, _mm_and_si128(lsb, bits));
+        _mm_storeu_si128((__m128i *)(x + i), v);
+    }
+
+    derandomize_scalar(x + i, n - i);
+}
+
+TARGET("avx2")
+static void derandomize_avx2(int16_t *x, uint32_t n)
+{
+    const __m256i bits = _mm256_set1_epi16((int16_t)0xFFFE);
+    uint32_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i lsb = _mm256_srai_epi16(_mm256_slli_epi16(v, 15), 15);
+        v = _mm256_xor_si256(v, _mm256_and_si256(lsb, bits));
+        _mm256_storeu_si256((__m256i *)(x + i), v);
+    }
+
+    derandomize_scalar(x + i, n - i);
+}
+#endif
+
+static uint64_t energy_scalar(const int16_t *x, uint32_t n)
+{
+    uint64_t sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += (uint64_t)((int32_t)x[i] * x[i]);
+
+    return sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+TARGET("sse2")
+static uint64_t energy_sse2(const int16_t *x, uint32_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vsq = zero;
+    uint64_t sqs[2];
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i sq = _mm_madd_epi16(v, v);
+        vsq = _mm_add_epi64(vsq, _mm_unpacklo_epi32(sq, zero));
+        vsq = _mm_add_epi64(vsq, _mm_unpackhi_epi32(sq, zero));
+    }
+
+    _mm_storeu_si128((__m128i *)sqs, vsq);
+
+    return sqs[0] + sqs[1] + energy_scalar(x + i, n - i);
+}
+
+TARGET("avx2")
+static uint64_t energy_avx2(const int16_t *x, uint32_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vsq = zero;
+    uint64_t sqs[4];
+    uint32_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i sq = _mm256_madd_epi16(v, v);
+        vsq = _mm256_add_epi64(vsq, _mm256_unpacklo_epi32(sq, zero));
+        vsq = _mm256_add_epi64(vsq, _mm256_unpackhi_epi32(sq, zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)sqs, vsq);
+
+    return sqs[0] + sqs[1] + sqs[2] + sqs[3] + energy_scalar(x + i, n - i);
+}
+#endif
+
+void rx888_kernel_block_power(const int16_t *x, uint32_t blocks,
+                              uint32_t len, float *power)
+{
+    uint64_t (*energy)(const int16_t *, uint32_t);
+
+    switch (detect_isa()) {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX2:
+        energy = energy_avx2;
+        break;
+    case ISA_SSE2:
+        energy = energy_sse2;
+        break;
+#endif
+    default:
+        energy = energy_scalar;
+        break;
+    }
+
+    for (uint32_t b = 0; b < blocks; b++)
+        power[b] = (float)((double)energy(x + (size_t)b * len, len) / len);
+}
+
+static float dot_scalar(const float *a, const float *b, uint32_t n)
+{
+    float sum = 0.0f;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+TARGET("sse2")
+static float dot_sse2(const float *a, const float *b, uint32_t n)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    float sums[4];
+    uint32_t i = 0;
+
+    /* two accumulators hide the add latency */
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+    }
+
+    _mm_storeu_ps(sums, _mm_add_ps(s0, s1));
+
+    return sums[0] + sums[1] + sums[2] + sums[3] +
+           dot_scalar(a + i, b + i, n - i);
+}
+
+TARGET("avx2")
+static float dot_avx2(const float *a, const float *b, uint32_t n)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    float sums[8];
+    uint32_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                             _mm256_loadu_ps(b + i)));
+        s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8),
+                                             _mm256_loadu_ps(b + i + 8)));
+    }
+
+    _mm256_storeu_ps(sums, _mm256_add_ps(s0, s1));
+
+    float sum = 0.0f;
+    for (int k = 0; k < 8; k++)
+        sum += sums[k];
+
+    return sum + dot_scalar(a + i, b + i, n - i);
+}
+#endif
+
+float rx888_kernel_dot(const float *a, const float *b, uint32_t n)
+{
+    switch (detect_isa()) {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX2:
+        return dot_avx2(a, b, n);
+    case ISA_SSE2:
+        return dot_sse2(a, b, n);
+#endif
+    default:
+        return dot_scalar(a, b, n);
+    }
+}
+
+void rx888_kernel_derandomize(int16_t *x, uint32_t n)
+{
+    switch (detect_isa()) {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX2:
+        derandomize_avx2(x, n);
+        break;
+    case ISA_SSE2:
+        derandomize_sse2(x, n);
+        break;
+#endif
+    default:
+        derandomize_scalar(x, n);
+        break;
+    }
+}
+
+int rx888_adc_derandomize(int16_t *samples, uint32_t count)
+{
+    if (!samples && count)
+        return -1;
+
+    rx888_kernel_derandomize(samples, count);
+
+    return 0;
+}
+
+void rx888_kernel_health(const int16_t *x, uint32_t n,
+                         struct rx888_health_sums *sums)
+{
+    sums->min = INT16_MAX;
+    sums->max = INT16_MIN;
+    sums->clipped = 0;
+    sums->sum = 0;
+    sums->sum_sq = 0;
+
+    switch (detect_isa()) {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX2:
+        health_avx2(x, n, sums);
+        break;
+    case ISA_SSE2:
+        health_sse2(x, n, sums);
+        break;
+#endif
+    default:
+        health_scalar(x, n, sums);
+        break;
+    }
+}
+
+int rx888_adc_health(const int16_t *samples, uint32_t count,
+                     rx888_adc_health_t *health)
+{
+    struct rx888_health_sums sums;
+
+    if (!samples || !count || !health)
+        return -1;
+
+    rx888_kernel_health(samples, count, &sums);
+
+    double mean = (double)sums.sum / count;
+    double power = (double)sums.sum_sq / count;
+
+    health->peak = -(int32_t)sums.min > sums.max ? -(int32_t)sums.min
+                                                 : sums.max;
+    health->clipped = sums.clipped;
+    health->dc = (float)(mean / 32768.0);
+    health->rms = (float)(sqrt(power) / 32768.0);
+    health->peak_dbfs = health->peak ?
+        (float)(20.0 * log10(health->peak / 32768.0)) : -100.0f;
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_KERNELS_H
+#define RX888_KERNELS_H
+
+#include <stdint.h>
+
+/*
+ * Per buffer sample kernels of the streaming path. Each kernel has AVX2 and
+ * SSE2 versions on x86, picked once at run time, and a portable fallback.
+ */
+
+struct rx888_health_sums {
+    int16_t min;
+    int16_t max;
+    uint32_t clipped;           /* samples at either end of the ADC range */
+    int64_t sum;
+    uint64_t sum_sq;
+};
+
+void rx888_kernel_health(const int16_t *x, uint32_t n,
+                         struct rx888_health_sums *sums);
+
+/* undo the LTC2208 output randomizer in place: bits 1-15 are XORed with
+ * the LSB */
+void rx888_kernel_derandomize(int16_t *x, uint32_t n);
+
+/* mean power of consecutive blocks of len samples */
+void rx888_kernel_block_power(const int16_t *x, uint32_t blocks,
+                              uint32_t len, float *power);
+
+/* sum of a[i] * b[i] */
+float rx888_kernel_dot(const float *a, const float *b, uint32_t n);
+
+/* name of the instruction set the kernels run on */
+const char *rx888_kernel_isa(void);
+
+#endif /* RX888_KERNELS_H */
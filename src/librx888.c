@@ -21,7 +21,7 @@
  */
 
 
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200112L
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
@@ -32,9 +32,21 @@
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 #include <libusb.h>
 #include "librx888.h"
+#include "kernels.h"
+#include "numa.h"
+#include "replay.h"
+#include "ring.h"
+#include "trace.h"
 
 enum rx888_async_status {
     RX888_INACTIVE = 0,
@@ -74,18 +86,203 @@ enum GPIOPin {
 };
 
 
+#define DEFAULT_BUF_NUMBER	16
+#define DEFAULT_BUF_LENGTH  (1024 * 16 * 8)
+#define CTRL_TIMEOUT 0
+
+/* automatic transfer sizing limits, lengths are multiples of 16 KiB */
+#define AUTO_MIN_BUF_LENGTH (1024 * 16)
+#define AUTO_MAX_BUF_LENGTH (1024 * 16 * 256)
+#define AUTO_MIN_BUF_NUMBER 4
+#define AUTO_MAX_BUF_NUMBER 512
+#define AUTO_WINDOW_NS 1000000000ULL
+#define AUTO_SHRINK_WINDOWS 10
+#define USBFS_DEFAULT_MB 16
+
+/* low latency profile: transfers of about 100 us, 20 ms in flight */
+#define LOW_LATENCY_US 100
+#define LOW_LATENCY_HEADROOM_MS 20
+
+/* latency histogram: 32 linear sub buckets per octave of microseconds */
+#define LAT_SUB_BITS 5
+#define LAT_SUB (1U << LAT_SUB_BITS)
+#define LAT_BUCKETS ((32 - LAT_SUB_BITS + 1) * LAT_SUB)
+/* the ADC time base is the lowest offset seen in the last two windows */
+#define LAT_WINDOW_NS 1000000000ULL
+
+/* a completed transfer waiting for rx888_read_sync() or the batch
+ * callback */
+struct rx888_ready {
+    struct libusb_transfer *xfer;
+    rx888_buffer_info_t info;
+    rx888_adc_health_t health;
+};
+
+#define BURST_QUEUE 16
+#define BURST_PACKET 1024       /* bytes, SuperSpeed bulk packets */
+#define BURST_MEM_HEADER 4096   /* keeps burst buffers page aligned */
+
+/* a queued burst, stream offsets in bytes */
+struct rx888_burst_req {
+    uint64_t start_index;       /* as requested */
+    bool resolved;
+    uint64_t start;
+    uint64_t end;
+    uint64_t done;              /* bytes completed */
+    rx888_burst_info_t info;
+};
+
+/* where a transfer of the burst stream lands */
+struct rx888_burst_xfer {
+    rx888_dev_t *dev;
+    uint32_t index;
+    struct rx888_burst_req *req; /* NULL while between bursts */
+    uint64_t pos;
+    uint64_t lost;              /* samples lost right before it */
+};
+
+/* in front of every rx888_burst_alloc() buffer */
+struct rx888_burst_mem {
+    size_t size;
+    bool dev_mem;
+};
+
+struct rx888_session {
+    rx888_dev_t *dev;
+    uint32_t buf_num;
+    uint32_t buf_len;
+};
+
 struct rx888_dev {
     libusb_context *ctx;
     struct libusb_device_handle *dev_handle;
     uint32_t xfer_buf_num;
     uint32_t xfer_buf_len;
+    uint32_t xfer_target;       /* transfers to keep in flight */
+    uint32_t xfer_inflight;
+    uint32_t xfer_idle_num;
+    struct libusb_transfer **xfer_idle; /* parked, not submitted */
     struct libusb_transfer **xfer;
     unsigned char **xfer_buf;
     rx888_read_async_cb_t cb;
+    rx888_read_async_ex_cb_t cb_ex;
+    rx888_read_async_batch_cb_t cb_batch;
+    uint32_t batch_req;         /* rx888_read_async_batch() max_batch */
+    uint32_t batch_max;
+    rx888_iovec_t *batch_iov;   /* xfer_buf_num entries */
     void *cb_ctx;
-    enum rx888_async_status async_status;
+    _Atomic enum rx888_async_status async_status;
+    pthread_mutex_t status_lock; /* with status_cond, signals RX888_INACTIVE */
+    pthread_cond_t status_cond;
+    /* dev_handle, replaced by the event thread while recovering */
+    pthread_mutex_t handle_lock;
     int async_cancel;
+    /* transfer pool kept across streams, see rx888_session_open() */
+    struct rx888_session *session;
+    bool xfer_dev_mem;          /* buffers from libusb_dev_mem_alloc() */
+    int numa_node;              /* buffer placement, -1 for none */
+    bool xfer_numa;             /* buffers from rx888_numa_alloc() */
     uint32_t sample_rate;
+    /* live retune, requested by rx888_set_sample_rate() while streaming */
+    atomic_uint retune_rate;
+    atomic_bool retune_pending;
+    uint32_t stream_rate;
+    uint32_t discard_xfers;
+    uint32_t discard_bytes;
+    uint64_t discarded;
+    uint32_t next_flags;
+    uint64_t sample_index;
+    /* statistics, written by the event thread only */
+    atomic_uint_least64_t stat_buffers;
+    atomic_uint_least64_t stat_samples;
+    atomic_uint_least64_t stat_discarded;
+    atomic_uint stat_rate_changes;
+    atomic_uint stat_xfer_errors;
+    atomic_uint_least64_t stat_clipped;
+    atomic_uint stat_att_changes;
+    /* HF attenuation, health and AGC */
+    atomic_int attenuation;
+    atomic_bool att_changed;
+    int stream_att;
+    atomic_bool health_on;
+    rx888_adc_health_t health;
+    atomic_bool agc_on;
+    pthread_mutex_t agc_lock;   /* agc, copied once per buffer */
+    rx888_agc_config_t agc;
+    bool agc_busy;
+    uint32_t agc_settle;
+    uint64_t agc_low;
+    /* automatic transfer sizing */
+    bool auto_buffers;
+    rx888_buffer_config_t auto_config;
+    uint32_t auto_initial;
+    uint64_t auto_last_ns;
+    uint64_t auto_window_ns;
+    uint64_t auto_max_gap_ns;
+    uint32_t auto_calm;
+    atomic_uint stat_max_gap_us;
+    /* ADC to callback latency */
+    bool busy_poll;
+    atomic_bool latency_on;
+    atomic_bool latency_reset;
+    bool latency_valid;
+    int64_t lat_base_cur;
+    int64_t lat_base_prev;
+    uint64_t lat_window_ns;
+    uint32_t lat_windows;
+    atomic_uint lat_hist[LAT_BUCKETS];
+    atomic_uint_least64_t lat_count;
+    atomic_uint lat_max_us;
+    /* readahead behind rx888_read_sync(), run from the reading thread */
+    bool readahead;
+    struct rx888_ready *ready;  /* xfer_buf_num entries */
+    uint32_t ready_head;
+    uint32_t ready_num;
+    uint32_t ready_off;         /* bytes of the head buffer handed out */
+    uint32_t ready_out;         /* held by rx888_read_next() callers */
+    int poll_fd;                /* epoll set over the libusb pollfds */
+    int ready_fd;               /* in poll_fd, readable while buffers wait */
+    bool ready_signaled;
+    uint64_t dry_ns;            /* last transfer completed, none in flight */
+    uint64_t lost;
+    atomic_uint stat_overruns;
+    atomic_uint_least64_t stat_lost;
+    /* double mapped transfer ring, see rx888_set_ring_buffer() */
+    bool ring_on;
+    struct rx888_ring ring;
+    uint64_t ring_done;         /* transfers completed into the ring */
+    uint64_t ring_freed;        /* of those, resubmitted */
+    uint64_t ring_read;         /* read cursor, bytes since stream start */
+    /* burst capture, driven by rx888_burst_wait() */
+    bool burst;
+    struct rx888_burst_xfer *burst_xfer; /* xfer_buf_num entries */
+    struct rx888_burst_req burst_q[BURST_QUEUE];
+    uint32_t burst_head;
+    uint32_t burst_num;
+    uint32_t burst_sub;         /* first queued burst not fully submitted */
+    uint64_t burst_pos;         /* stream bytes submitted */
+    uint64_t burst_last_end;    /* end of the last burst, 0 if none */
+    uint64_t burst_inflight;    /* bytes */
+    uint64_t burst_skew;        /* samples lost before the completed data */
+    uint64_t burst_lost;        /* samples lost before the next submission */
+    uint64_t burst_idle_ns;     /* events last handled */
+    uint32_t burst_align;       /* samples, one bulk packet of the endpoint */
+    /* replay of a recording instead of the USB device */
+    bool replay;
+    struct rx888_replay_file replay_file;
+    bool replay_fast;
+    bool replay_loop;
+    size_t replay_pos;          /* next sample of the file */
+    /* ADC output randomizer, undone in the data path */
+    atomic_bool randomizer;
+    /* device loss recovery, see rx888_set_auto_recovery() */
+    unsigned int recover_ms;
+    char serial[256];
+    uint64_t lost_ns;           /* device lost while running, 0 if not */
+    atomic_uint stat_losses;
+    atomic_uint stat_recoveries;
+    atomic_uint stat_last_recovery_us;
+    atomic_uint stat_max_recovery_us;
     /* status */
     int dev_lost;
     int driver_active;
@@ -104,18 +301,38 @@ static rx888_t known_devices[] = {
 
 };
 
-#define DEFAULT_BUF_NUMBER	16
-#define DEFAULT_BUF_LENGTH  (1024 * 16 * 8)
-#define CTRL_TIMEOUT 0
+/* bytes dropped after STARTADC on top of the transfers already in flight.
+ * The SDDC_FX3 firmware streams through a DMA channel of four 16 KiB
+ * buffers, all of which may have been filled at the old clock when the
+ * command arrives; at the lowest rates that also covers the Si5351 lock. */
+#define RETUNE_SETTLE_BYTES (64 * 1024)
+
+/* samples the FX3 holds on its own while no transfer is in flight before
+ * it overflows: the four 16 KiB DMA buffers of the SDDC_FX3 firmware */
+#define FX3_BUFFER_BYTES (4 * 16 * 1024)
+
+/* single writer counters: avoid locked read-modify-write on the hot path */
+#define STAT_ADD(var, n) \
+    atomic_store_explicit(&(var), \
+        atomic_load_explicit(&(var), memory_order_relaxed) + (n), \
+        memory_order_relaxed)
 
 static int rx888_send_command(struct libusb_device_handle *dev_handle,
                                  enum rx888_command cmd,uint32_t data)
 {
+  /* replay devices have nothing to send to */
+  if (!dev_handle)
+    return -1;
+
+  RX888_TRACE_BEGIN("control", cmd);
+
   /* Send the control message. */
   int ret = libusb_control_transfer(
       dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, cmd, 0, 0,
       (unsigned char *)&data, sizeof(data), CTRL_TIMEOUT);
 
+  RX888_TRACE_END("control", cmd);
+
   if (ret < 0) {
     fprintf(stderr, "Could not send command: 0x%X with data: %d. Error : %s.\n",
             cmd, data, libusb_error_name(ret));
@@ -125,6 +342,91 @@ static int rx888_send_command(struct libusb_device_handle *dev_handle,
   return 0;
 }
 
+static uint32_t _rx888_att_gpio(uint32_t gpio_state, int att)
+{
+    if (att == 0) {
+        gpio_state &= ~ATT_SEL0; // Clear the bit 13
+        gpio_state |= ATT_SEL1; // Set the bit 14
+        }
+    else if (att == -10) {
+        gpio_state |= ATT_SEL0; // Set the bit 13
+        gpio_state |= ATT_SEL1; // Set the bit 14
+        }
+    else if (att == -20) {
+        gpio_state |= ATT_SEL0; // Set the bit 13
+        gpio_state &= ~ATT_SEL1; // Clear the bit 14
+        }
+
+    return gpio_state;
+}
+
+static void LIBUSB_CALL _libusb_ctrl_callback(struct libusb_transfer *xfer)
+{
+    rx888_dev_t *dev = (rx888_dev_t *)xfer->user_data;
+
+    if (LIBUSB_TRANSFER_COMPLETED == xfer->status)
+        atomic_store(&dev->att_changed, true);
+    else
+        fprintf(stderr, "Could not send command: 0x%X. Status : %d.\n",
+                xfer->buffer[1], xfer->status);
+
+    dev->agc_busy = false;
+}
+
+/* non blocking variant for use from within the event thread */
+static int _rx888_send_command_async(rx888_dev_t *dev,
+                                     enum rx888_command cmd, uint32_t data)
+{
+    struct libusb_transfer *xfer;
+    unsigned char *buf;
+    int r;
+
+    if (!dev->dev_handle)
+        return -1;
+
+    xfer = libusb_alloc_transfer(0);
+    buf = malloc(LIBUSB_CONTROL_SETUP_SIZE + sizeof(data));
+    if (!xfer || !buf) {
+        libusb_free_transfer(xfer);
+        free(buf);
+        return -ENOMEM;
+    }
+
+    libusb_fill_control_setup(buf,
+        LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, cmd, 0, 0,
+        sizeof(data));
+    memcpy(buf + LIBUSB_CONTROL_SETUP_SIZE, &data, sizeof(data));
+    libusb_fill_control_transfer(xfer, dev->dev_handle, buf,
+                                 _libusb_ctrl_callback, dev, CTRL_TIMEOUT);
+    xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+    r = libusb_submit_transfer(xfer);
+    if (r < 0) {
+        libusb_free_transfer(xfer);
+        return r;
+    }
+
+    return 0;
+}
+
+/* commands from API calls, which may run while the event thread recovers
+ * the device; without a handle the command only updates the state that the
+ * recovery sends again */
+static int _rx888_command(rx888_dev_t *dev, enum rx888_command cmd,
+                          uint32_t data)
+{
+    int r;
+
+    pthread_mutex_lock(&dev->handle_lock);
+    if (dev->dev_handle)
+        r = rx888_send_command(dev->dev_handle, cmd, data);
+    else
+        r = dev->replay ? -1 : 0;
+    pthread_mutex_unlock(&dev->handle_lock);
+
+    return r;
+}
+
 int rx888_set_hf_attenuation(rx888_dev_t *dev, double rf_gain)
 {
     if (!dev)
@@ -135,20 +437,83 @@ int rx888_set_hf_attenuation(rx888_dev_t *dev, double rf_gain)
         return -1;
 
     // Set the HF attenuation
-    if (rf_gain == 0.0) {
-        dev->gpio_state &= ~ATT_SEL0; // Clear the bit 13
-        dev->gpio_state |= ATT_SEL1; // Set the bit 14
-        } 
-    else if (rf_gain == -10.0) {
-        dev->gpio_state |= ATT_SEL0; // Set the bit 13
-        dev->gpio_state |= ATT_SEL1; // Set the bit 14
-        }
-    else if (rf_gain == -20.0) {
-        dev->gpio_state |= ATT_SEL0; // Set the bit 13
-        dev->gpio_state &= ~ATT_SEL1; // Clear the bit 14
-        }
+    dev->gpio_state = _rx888_att_gpio(dev->gpio_state, (int)rf_gain);
 
-    rx888_send_command(dev->dev_handle, GPIOFX3, dev->gpio_state);
+    _rx888_command(dev, GPIOFX3, dev->gpio_state);
+
+    atomic_store(&dev->attenuation, (int)rf_gain);
+    if (RX888_RUNNING == dev->async_status)
+        atomic_store(&dev->att_changed, true);
+
+    return 0;
+}
+
+double rx888_get_hf_attenuation(rx888_dev_t *dev)
+{
+    if (!dev)
+        return 0.0;
+
+    return atomic_load(&dev->attenuation);
+}
+
+static int _rx888_set_gpio_bit(rx888_dev_t *dev, uint32_t bit, int on)
+{
+    if (on)
+        dev->gpio_state |= bit;
+    else
+        dev->gpio_state &= ~bit;
+
+    return _rx888_command(dev, GPIOFX3, dev->gpio_state);
+}
+
+int rx888_set_adc_randomizer(rx888_dev_t *dev, int on)
+{
+    if (!dev)
+        return -1;
+
+    /* decode from the next buffer on, in either direction */
+    atomic_store(&dev->randomizer, on != 0);
+
+    return _rx888_set_gpio_bit(dev, RAND, on);
+}
+
+int rx888_set_adc_dither(rx888_dev_t *dev, int on)
+{
+    if (!dev)
+        return -1;
+
+    return _rx888_set_gpio_bit(dev, DITH, on);
+}
+
+int rx888_set_adc_health(rx888_dev_t *dev, int on)
+{
+    if (!dev)
+        return -1;
+
+    atomic_store(&dev->health_on, on != 0);
+
+    return 0;
+}
+
+int rx888_set_hf_agc(rx888_dev_t *dev, const rx888_agc_config_t *config)
+{
+    if (!dev)
+        return -1;
+
+    if (!config) {
+        atomic_store(&dev->agc_on, false);
+        return 0;
+    }
+
+    /* one step down must not bring the peak straight back above high */
+    if (config->high_dbfs > 0.0f ||
+        config->low_dbfs > config->high_dbfs - 10.0f)
+        return -EINVAL;
+
+    pthread_mutex_lock(&dev->agc_lock);
+    dev->agc = *config;
+    pthread_mutex_unlock(&dev->agc_lock);
+    atomic_store(&dev->agc_on, true);
 
     return 0;
 }
@@ -164,9 +529,20 @@ int rx888_set_sample_rate(rx888_dev_t *dev, uint32_t samp_rate)
         return -EINVAL;
     }
 
+    /* the discard window starts with the first buffer after the request,
+     * so the clock has to be switched before */
+    if (!dev->replay &&
+        _rx888_command(dev, STARTADC, samp_rate) < 0)
+        return -1;
+
     dev->sample_rate = samp_rate;
 
-    rx888_send_command(dev->dev_handle, STARTADC, samp_rate);
+    /* while streaming, let the data path drop everything that may have been
+     * captured around the clock switch and flag the first clean buffer */
+    if (RX888_RUNNING == dev->async_status) {
+        atomic_store(&dev->retune_rate, samp_rate);
+        atomic_store(&dev->retune_pending, true);
+    }
 
     return 0;
 }
@@ -179,13 +555,50 @@ uint32_t rx888_get_sample_rate(rx888_dev_t *dev)
     return dev->sample_rate;
 }
 
-int rx888_get_usb_strings(rx888_dev_t *dev, char *manufact, char *product,
-                char *serial)
+int rx888_get_stream_stats(rx888_dev_t *dev, rx888_stream_stats_t *stats)
 {
-    if (!dev || !dev->dev_handle)
+    if (!dev || !stats)
         return -1;
 
-    libusb_device *device = libusb_get_device(dev->dev_handle);
+    memset(stats, 0, sizeof(*stats));
+    stats->buffers = atomic_load_explicit(&dev->stat_buffers,
+                                          memory_order_relaxed);
+    stats->samples = atomic_load_explicit(&dev->stat_samples,
+                                          memory_order_relaxed);
+    stats->discarded_samples = atomic_load_explicit(&dev->stat_discarded,
+                                                    memory_order_relaxed);
+    stats->rate_changes = atomic_load_explicit(&dev->stat_rate_changes,
+                                               memory_order_relaxed);
+    stats->xfer_errors = atomic_load_explicit(&dev->stat_xfer_errors,
+                                              memory_order_relaxed);
+    stats->clipped_samples = atomic_load_explicit(&dev->stat_clipped,
+                                                  memory_order_relaxed);
+    stats->attenuation_changes = atomic_load_explicit(&dev->stat_att_changes,
+                                                      memory_order_relaxed);
+    stats->transfer_size = dev->xfer_buf_len;
+    stats->transfers_in_flight = dev->xfer_target;
+    stats->max_completion_gap_us = atomic_load_explicit(&dev->stat_max_gap_us,
+                                                        memory_order_relaxed);
+    stats->overruns = atomic_load_explicit(&dev->stat_overruns,
+                                           memory_order_relaxed);
+    stats->lost_samples = atomic_load_explicit(&dev->stat_lost,
+                                               memory_order_relaxed);
+    stats->device_losses = atomic_load_explicit(&dev->stat_losses,
+                                                memory_order_relaxed);
+    stats->recoveries = atomic_load_explicit(&dev->stat_recoveries,
+                                             memory_order_relaxed);
+    stats->last_recovery_us = atomic_load_explicit(&dev->stat_last_recovery_us,
+                                                   memory_order_relaxed);
+    stats->max_recovery_us = atomic_load_explicit(&dev->stat_max_recovery_us,
+                                                  memory_order_relaxed);
+
+    return 0;
+}
+
+static int _rx888_usb_strings(struct libusb_device_handle *dev_handle,
+                              char *manufact, char *product, char *serial)
+{
+    libusb_device *device = libusb_get_device(dev_handle);
 
     struct libusb_device_descriptor dd;
     int r = libusb_get_device_descriptor(device, &dd);
@@ -195,21 +608,21 @@ int rx888_get_usb_strings(rx888_dev_t *dev, char *manufact, char *product,
     const int buf_max = 256;
     if (manufact) {
         memset(manufact, 0, buf_max);
-        libusb_get_string_descriptor_ascii(dev->dev_handle, dd.iManufacturer,
+        libusb_get_string_descriptor_ascii(dev_handle, dd.iManufacturer,
                            (unsigned char *)manufact,
                            buf_max);
     }
 
     if (product) {
         memset(product, 0, buf_max);
-        libusb_get_string_descriptor_ascii(dev->dev_handle, dd.iProduct,
+        libusb_get_string_descriptor_ascii(dev_handle, dd.iProduct,
                            (unsigned char *)product,
                            buf_max);
     }
 
     if (serial) {
         memset(serial, 0, buf_max);
-        libusb_get_string_descriptor_ascii(dev->dev_handle, dd.iSerialNumber,
+        libusb_get_string_descriptor_ascii(dev_handle, dd.iSerialNumber,
                            (unsigned char *)serial,
                            buf_max);
     }
@@ -217,6 +630,22 @@ int rx888_get_usb_strings(rx888_dev_t *dev, char *manufact, char *product,
     return 0;
 }
 
+int rx888_get_usb_strings(rx888_dev_t *dev, char *manufact, char *product,
+                char *serial)
+{
+    int r = -1;
+
+    if (!dev)
+        return -1;
+
+    pthread_mutex_lock(&dev->handle_lock);
+    if (dev->dev_handle)
+        r = _rx888_usb_strings(dev->dev_handle, manufact, product, serial);
+    pthread_mutex_unlock(&dev->handle_lock);
+
+    return r;
+}
+
 static rx888_t *find_known_device(uint16_t vid, uint16_t pid)
 {
     unsigned int i;
@@ -320,7 +749,7 @@ int rx888_get_device_usb_strings(uint32_t index, char *manufact,
             if (index == device_count - 1) {
                 r = libusb_open(list[i], &devt.dev_handle);
                 if (!r) {
-                    r = rx888_get_usb_strings(&devt,
+                    r = _rx888_usb_strings(devt.dev_handle,
                                    manufact,
                                    product,
                                    serial);
@@ -359,15 +788,105 @@ int rx888_get_index_by_serial(const char *serial)
     return -3;
 }
 
-int rx888_open(rx888_dev_t **out_dev, uint32_t index)
+/* status_cond deadlines are taken on this clock, so that they do not move
+ * with the wall clock where the condition variable can be told so */
+#if defined(__APPLE__) || defined(_WIN32)
+#define STATUS_CLOCK CLOCK_REALTIME
+#else
+#define STATUS_CLOCK CLOCK_MONOTONIC
+#define STATUS_CLOCK_ATTR
+#endif
+
+static rx888_dev_t *_rx888_dev_alloc(void)
 {
     rx888_dev_t *dev = calloc(1, sizeof(rx888_dev_t));
+
+    if (dev) {
+        pthread_condattr_t attr;
+
+        pthread_condattr_init(&attr);
+#ifdef STATUS_CLOCK_ATTR
+        pthread_condattr_setclock(&attr, STATUS_CLOCK);
+#endif
+        pthread_mutex_init(&dev->status_lock, NULL);
+        pthread_cond_init(&dev->status_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&dev->agc_lock, NULL);
+        pthread_mutex_init(&dev->handle_lock, NULL);
+        dev->numa_node = -1;
+    }
+
+    return dev;
+}
+
+static void _rx888_dev_free(rx888_dev_t *dev)
+{
+    pthread_cond_destroy(&dev->status_cond);
+    pthread_mutex_destroy(&dev->status_lock);
+    pthread_mutex_destroy(&dev->agc_lock);
+    pthread_mutex_destroy(&dev->handle_lock);
+    free(dev);
+}
+
+/* the stream going inactive goes through here, so that threads waiting for
+ * it are woken instead of polling */
+static void _rx888_set_status(rx888_dev_t *dev,
+                              enum rx888_async_status status)
+{
+    pthread_mutex_lock(&dev->status_lock);
+    dev->async_status = status;
+    pthread_cond_broadcast(&dev->status_cond);
+    pthread_mutex_unlock(&dev->status_lock);
+}
+
+/* wait for the stream to go inactive, timeout_ms 0 to wait forever */
+static int _rx888_wait_inactive(rx888_dev_t *dev, unsigned int timeout_ms)
+{
+    struct timespec ts;
+    int r = 0;
+
+    clock_gettime(STATUS_CLOCK, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&dev->status_lock);
+    while (RX888_INACTIVE != dev->async_status && !r) {
+        if (timeout_ms)
+            r = pthread_cond_timedwait(&dev->status_cond, &dev->status_lock,
+                                       &ts);
+        else
+            r = pthread_cond_wait(&dev->status_cond, &dev->status_lock);
+    }
+    r = RX888_INACTIVE == dev->async_status ? 0 : LIBUSB_ERROR_TIMEOUT;
+    pthread_mutex_unlock(&dev->status_lock);
+
+    return r;
+}
+
+/* node of the host controller the device hangs off */
+static int _rx888_usb_numa_node(rx888_dev_t *dev)
+{
+    libusb_device *device = libusb_get_device(dev->dev_handle);
+    uint8_t ports[8];
+    int num_ports = libusb_get_port_numbers(device, ports, sizeof(ports));
+
+    return rx888_numa_usb_node(libusb_get_bus_number(device), ports,
+                               num_ports);
+}
+
+int rx888_open(rx888_dev_t **out_dev, uint32_t index)
+{
+    rx888_dev_t *dev = _rx888_dev_alloc();
     if (!dev)
         return -ENOMEM;
 
     int r = libusb_init(&dev->ctx);
     if(r < 0) {
-        free(dev);
+        _rx888_dev_free(dev);
         return -1;
     }
 
@@ -435,6 +954,9 @@ int rx888_open(rx888_dev_t **out_dev, uint32_t index)
     }
 
     dev->dev_lost = false;
+    dev->poll_fd = -1;
+    dev->ready_fd = -1;
+    dev->numa_node = _rx888_usb_numa_node(dev);
 
     dev->gpio_state = BIAS_HF;
     *out_dev = dev;
@@ -451,274 +973,2335 @@ err:
         if (dev->ctx)
             libusb_exit(dev->ctx);
 
-        free(dev);
+        _rx888_dev_free(dev);
     }
 
     return r;
     
 }
 
+int rx888_open_replay(rx888_dev_t **out_dev, const char *path,
+                      const rx888_replay_config_t *config)
+{
+    rx888_dev_t *dev;
+    int r;
+
+    if (!out_dev || !path)
+        return -1;
+
+    dev = _rx888_dev_alloc();
+    if (!dev)
+        return -ENOMEM;
+
+    r = rx888_replay_map(&dev->replay_file, path);
+    if (r < 0) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(-r));
+        _rx888_dev_free(dev);
+        return r;
+    }
+
+    dev->replay = true;
+    dev->poll_fd = -1;
+    dev->ready_fd = -1;
+    dev->sample_rate = dev->replay_file.sample_rate;
+    if (config) {
+        if (config->sample_rate)
+            dev->sample_rate = config->sample_rate;
+        dev->replay_fast = config->fast;
+        dev->replay_loop = config->loop;
+    }
+
+    if (!dev->sample_rate) {
+        fprintf(stderr, "No sample rate given for %s\n", path);
+        rx888_replay_unmap(&dev->replay_file);
+        _rx888_dev_free(dev);
+        return -EINVAL;
+    }
+
+    *out_dev = dev;
+
+    return 0;
+}
+
 int rx888_close(rx888_dev_t *dev)
 {
     if (!dev)
         return -1;
 
+    if (dev->replay) {
+        rx888_replay_unmap(&dev->replay_file);
+        _rx888_dev_free(dev);
+        return 0;
+    }
+
+    if (dev->readahead)
+        rx888_stop_readahead(dev);
+
+    if (dev->burst)
+        rx888_burst_stop(dev);
+
+    if (dev->session)
+        rx888_session_close(dev->session);
+
     if(!dev->dev_lost) {
         /* block until all async operations have been completed (if any) */
-        while (RX888_INACTIVE != dev->async_status) {
-#ifdef _WIN32
-            Sleep(1);
-#else
-            nanosleep((const struct timespec[]){{0, 1000000L}}, NULL);
-#endif
-        }
+        _rx888_wait_inactive(dev, 0);
         rx888_send_command(dev->dev_handle, STOPFX3, 0);
 
 
     }
 
-    libusb_release_interface(dev->dev_handle, 0);
+    /* a device that did not come back has no handle left */
+    if (dev->dev_handle) {
+        libusb_release_interface(dev->dev_handle, 0);
 
 #ifdef DETACH_KERNEL_DRIVER
-    if (dev->driver_active) {
-        if (!libusb_attach_kernel_driver(dev->dev_handle, 0))
-            fprintf(stderr, "Reattached kernel driver\n");
-        else
-            fprintf(stderr, "Reattaching kernel driver failed!\n");
-    }
+        if (dev->driver_active) {
+            if (!libusb_attach_kernel_driver(dev->dev_handle, 0))
+                fprintf(stderr, "Reattached kernel driver\n");
+            else
+                fprintf(stderr, "Reattaching kernel driver failed!\n");
+        }
 #endif
 
-    libusb_close(dev->dev_handle);
+        libusb_close(dev->dev_handle);
+    }
+
+#ifdef __linux__
+    if (dev->poll_fd >= 0) {
+        libusb_set_pollfd_notifiers(dev->ctx, NULL, NULL, NULL);
+        close(dev->poll_fd);
+        close(dev->ready_fd);
+    }
+#endif
 
     libusb_exit(dev->ctx);
 
-    free(dev);
+    _rx888_dev_free(dev);
 
     return 0;
 }
 
-int rx888_read_sync(rx888_dev_t *dev, void *buf, int len, int *n_read)
+static int _rx888_readahead_read(rx888_dev_t *dev, unsigned char *buf,
+                                 int len, int *n_read,
+                                 unsigned int timeout_ms);
+
+int rx888_read_sync_timeout(rx888_dev_t *dev, void *buf, int len, int *n_read,
+                            unsigned int timeout_ms)
 {
-    if (!dev)
+    int r;
+
+    if (!dev || !n_read)
         return -1;
 
-    return libusb_bulk_transfer(dev->dev_handle, 0x81,
-             buf, len, n_read, 0);
-}
+    *n_read = 0;
 
-static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
-{
-    rx888_dev_t *dev = (rx888_dev_t *)xfer->user_data;
+    if (dev->replay)
+        return -1;
 
-    if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
-        if (dev->cb)
-            dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
+    if (dev->readahead)
+        return _rx888_readahead_read(dev, buf, len, n_read, timeout_ms);
 
-        libusb_submit_transfer(xfer); /* resubmit transfer */
-        dev->xfer_errors = 0;
-    } else if (LIBUSB_TRANSFER_CANCELLED != xfer->status) {
-#ifndef _WIN32
-        if (LIBUSB_TRANSFER_ERROR == xfer->status)
-            dev->xfer_errors++;
+    r = libusb_bulk_transfer(dev->dev_handle, 0x81,
+             buf, len, n_read, timeout_ms);
 
-        if (dev->xfer_errors >= dev->xfer_buf_num ||
-            LIBUSB_TRANSFER_NO_DEVICE == xfer->status) {
-#endif
-            dev->dev_lost = true;
-            rx888_cancel_async(dev);
-            fprintf(stderr, "cb transfer status: %d, "
-                "canceling...\n", xfer->status);
-#ifndef _WIN32
-        }
-#endif
-    }
+    if (*n_read > 0 && atomic_load(&dev->randomizer))
+        rx888_kernel_derandomize(buf, *n_read / sizeof(int16_t));
+
+    return r;
 }
 
-static int _rx888_alloc_async_buffers(rx888_dev_t *dev)
+int rx888_read_sync(rx888_dev_t *dev, void *buf, int len, int *n_read)
 {
-    unsigned int i;
+    return rx888_read_sync_timeout(dev, buf, len, n_read, 0);
+}
 
+int rx888_set_auto_buffers(rx888_dev_t *dev,
+                           const rx888_buffer_config_t *config)
+{
     if (!dev)
         return -1;
 
-    if (!dev->xfer) {
-        dev->xfer = malloc(dev->xfer_buf_num *
-                   sizeof(struct libusb_transfer *));
-
-        for(i = 0; i < dev->xfer_buf_num; ++i)
-            dev->xfer[i] = libusb_alloc_transfer(0);
+    if (!config) {
+        dev->auto_buffers = false;
+        return 0;
     }
 
-    if (dev->xfer_buf)
-        return -2;
+    if (!config->latency_us || config->headroom_ms * 1000 < config->latency_us)
+        return -EINVAL;
 
-    dev->xfer_buf = calloc(dev->xfer_buf_num, sizeof(unsigned char *));
-    
+    dev->auto_config = *config;
+    dev->auto_buffers = true;
+
+    return 0;
+}
+
+/* usbfs caps the memory of all submitted transfers, 0 lifts the cap */
+static uint64_t _rx888_usbfs_limit(void)
+{
+    uint64_t mb = USBFS_DEFAULT_MB;
+#ifdef __linux__
+    FILE *f = fopen("/sys/module/usbcore/parameters/usbfs_memory_mb", "r");
+    if (f) {
+        unsigned long long v;
+        if (fscanf(f, "%llu", &v) == 1)
+            mb = v;
+        fclose(f);
+    }
+#endif
+    if (!mb)
+        return UINT64_MAX;
+
+    return mb * 1024 * 1024;
+}
+
+/* pick transfer size and queue depth from the rate and the latency goal */
+static void _rx888_auto_geometry(rx888_dev_t *dev)
+{
+    uint64_t bytes_per_sec = (uint64_t)dev->sample_rate * sizeof(int16_t);
+    uint64_t limit = _rx888_usbfs_limit();
+    uint64_t len, num, max;
+
+    if (!bytes_per_sec)
+        bytes_per_sec = (uint64_t)DEFAULT_BUF_LENGTH * 1000;
+
+    len = bytes_per_sec * dev->auto_config.latency_us / 1000000;
+    len = (len + AUTO_MIN_BUF_LENGTH - 1) / AUTO_MIN_BUF_LENGTH *
+          AUTO_MIN_BUF_LENGTH;
+    if (len < AUTO_MIN_BUF_LENGTH)
+        len = AUTO_MIN_BUF_LENGTH;
+    if (len > AUTO_MAX_BUF_LENGTH)
+        len = AUTO_MAX_BUF_LENGTH;
+
+    /* shrink the transfers if the minimum depth does not fit into usbfs */
+    while (len > AUTO_MIN_BUF_LENGTH && len * AUTO_MIN_BUF_NUMBER > limit)
+        len -= AUTO_MIN_BUF_LENGTH;
+
+    num = (bytes_per_sec * dev->auto_config.headroom_ms / 1000 + len - 1) /
+          len;
+    if (num < AUTO_MIN_BUF_NUMBER)
+        num = AUTO_MIN_BUF_NUMBER;
+
+    /* room to deepen the queue at run time, within the usbfs budget */
+    max = limit / len;
+    if (max > AUTO_MAX_BUF_NUMBER)
+        max = AUTO_MAX_BUF_NUMBER;
+    if (max < AUTO_MIN_BUF_NUMBER)
+        max = AUTO_MIN_BUF_NUMBER;
+    if (num > max)
+        num = max;
+    if (max > 4 * num)
+        max = 4 * num;
+
+    dev->xfer_buf_len = (uint32_t)len;
+    dev->xfer_buf_num = (uint32_t)max;
+    dev->xfer_target = (uint32_t)num;
+}
+
+static uint64_t _rx888_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* deepen the queue when completions arrive late, shrink it back slowly */
+static void _rx888_auto_update(rx888_dev_t *dev)
+{
+    uint64_t now = _rx888_now_ns();
+
+    if (dev->auto_last_ns) {
+        uint64_t gap = now - dev->auto_last_ns;
+        if (gap > dev->auto_max_gap_ns)
+            dev->auto_max_gap_ns = gap;
+    } else {
+        dev->auto_window_ns = now;
+    }
+    dev->auto_last_ns = now;
+
+    if (now - dev->auto_window_ns < AUTO_WINDOW_NS || !dev->stream_rate)
+        return;
+
+    uint64_t period = (uint64_t)dev->xfer_buf_len * 1000000000ULL /
+                      (dev->stream_rate * sizeof(int16_t));
+    uint64_t need = 2 * dev->auto_max_gap_ns + period;
+    uint64_t have = (uint64_t)dev->xfer_target * period;
+
+    if (have < need && dev->xfer_target < dev->xfer_buf_num) {
+        uint64_t target = (need + period - 1) / period;
+        dev->xfer_target = target < dev->xfer_buf_num ?
+                           (uint32_t)target : dev->xfer_buf_num;
+        dev->auto_calm = 0;
+    } else if (have > 4 * need && dev->xfer_target > dev->auto_initial) {
+        if (++dev->auto_calm >= AUTO_SHRINK_WINDOWS) {
+            dev->xfer_target--;
+            dev->auto_calm = 0;
+        }
+    } else {
+        dev->auto_calm = 0;
+    }
+
+    atomic_store_explicit(&dev->stat_max_gap_us,
+                          (unsigned)(dev->auto_max_gap_ns / 1000),
+                          memory_order_relaxed);
+    dev->auto_window_ns = now;
+    dev->auto_max_gap_ns = 0;
+}
+
+int rx888_set_busy_poll(rx888_dev_t *dev, int on)
+{
+    if (!dev)
+        return -1;
+
+    dev->busy_poll = on != 0;
+
+    return 0;
+}
+
+int rx888_set_auto_recovery(rx888_dev_t *dev, unsigned int timeout_ms)
+{
+    if (!dev || dev->replay)
+        return -1;
+
+    /* the serial is what finds the device again after it re-enumerated */
+    if (timeout_ms && !dev->serial[0] &&
+        rx888_get_usb_strings(dev, NULL, NULL, dev->serial) < 0)
+        return -1;
+
+    dev->recover_ms = timeout_ms;
+
+    return 0;
+}
+
+int rx888_get_numa_node(rx888_dev_t *dev)
+{
+    if (!dev)
+        return -1;
+
+    return dev->numa_node;
+}
+
+int rx888_set_numa_node(rx888_dev_t *dev, int node)
+{
+    if (!dev || node < -1)
+        return -1;
+
+    /* the pool of an open session stays where it is */
+    if (RX888_INACTIVE != dev->async_status || dev->session)
+        return -2;
+
+    dev->numa_node = node;
+
+    return 0;
+}
+
+int rx888_pin_thread_to_node(int node)
+{
+    if (node < 0)
+        return -EINVAL;
+
+    return rx888_numa_pin(node);
+}
+
+int rx888_set_stream_profile(rx888_dev_t *dev, enum rx888_stream_profile profile)
+{
+    rx888_buffer_config_t low_latency = {
+        .latency_us = LOW_LATENCY_US,
+        .headroom_ms = LOW_LATENCY_HEADROOM_MS,
+    };
+
+    if (!dev)
+        return -1;
+
+    switch (profile) {
+    case RX888_PROFILE_DEFAULT:
+        rx888_set_auto_buffers(dev, NULL);
+        rx888_set_busy_poll(dev, 0);
+        break;
+    case RX888_PROFILE_LOW_LATENCY:
+        rx888_set_auto_buffers(dev, &low_latency);
+        rx888_set_busy_poll(dev, 1);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static unsigned int _rx888_lat_bucket(uint64_t us)
+{
+    if (us < LAT_SUB)
+        return (unsigned int)us;
+
+    if (us > UINT32_MAX)
+        us = UINT32_MAX;
+
+    unsigned int e = 63 - __builtin_clzll(us);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB +
+           (unsigned int)(us >> (e - LAT_SUB_BITS)) - LAT_SUB;
+}
+
+/* upper bound of a bucket in microseconds */
+static uint32_t _rx888_lat_value(unsigned int bucket)
+{
+    if (bucket < LAT_SUB)
+        return bucket;
+
+    unsigned int e = bucket / LAT_SUB + LAT_SUB_BITS - 1;
+    uint64_t m = bucket % LAT_SUB + LAT_SUB;
+
+    return (uint32_t)(((m + 1) << (e - LAT_SUB_BITS)) - 1);
+}
+
+/*
+ * Sample k left the ADC at t0 + k / rate. The host only sees completions, so
+ * t0 is estimated as the earliest completion offset seen recently, which
+ * also absorbs the clock drift between ADC and host. The constant part of
+ * the USB path in front of that earliest completion is not observable.
+ */
+static void _rx888_latency_update(rx888_dev_t *dev, uint32_t samples)
+{
+    uint64_t now = _rx888_now_ns();
+    uint64_t first = dev->sample_index;
+    uint64_t last = first + samples;
+    int64_t offset;
+
+    if (atomic_exchange(&dev->latency_reset, false) ||
+        (dev->next_flags & RX888_BUF_RATE_CHANGED) || !dev->stream_rate) {
+        dev->latency_valid = false;
+    }
+
+    offset = (int64_t)now - (int64_t)(last * 1e9 / dev->stream_rate);
+
+    if (!dev->latency_valid) {
+        dev->latency_valid = true;
+        dev->lat_base_cur = offset;
+        dev->lat_base_prev = offset;
+        dev->lat_window_ns = now;
+        dev->lat_windows = 0;
+    }
+
+    if (offset < dev->lat_base_cur)
+        dev->lat_base_cur = offset;
+
+    if (now - dev->lat_window_ns >= LAT_WINDOW_NS) {
+        dev->lat_base_prev = dev->lat_base_cur;
+        dev->lat_base_cur = offset;
+        dev->lat_window_ns = now;
+        dev->lat_windows++;
+    }
+
+    /* the time base is still settling during the first window */
+    if (!dev->lat_windows)
+        return;
+
+    int64_t base = dev->lat_base_cur < dev->lat_base_prev ?
+                   dev->lat_base_cur : dev->lat_base_prev;
+    int64_t lat = (int64_t)now - base - (int64_t)(first * 1e9 /
+                                                  dev->stream_rate);
+    uint64_t us = lat > 0 ? (uint64_t)lat / 1000 : 0;
+
+    unsigned int bucket = _rx888_lat_bucket(us);
+
+    /* not STAT_ADD, rx888_reset_latency_stats() clears them from other
+     * threads and a load and store would write the old count back */
+    atomic_fetch_add_explicit(&dev->lat_hist[bucket], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&dev->lat_count, 1, memory_order_relaxed);
+    if (us > atomic_load_explicit(&dev->lat_max_us, memory_order_relaxed))
+        atomic_store_explicit(&dev->lat_max_us, (unsigned int)us,
+                              memory_order_relaxed);
+}
+
+int rx888_set_latency_stats(rx888_dev_t *dev, int on)
+{
+    if (!dev)
+        return -1;
+
+    atomic_store(&dev->latency_on, on != 0);
+
+    return 0;
+}
+
+int rx888_get_latency_stats(rx888_dev_t *dev, rx888_latency_stats_t *stats)
+{
+    static const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint32_t *out[4];
+    uint64_t count = 0, seen = 0;
+    unsigned int p = 0;
+
+    if (!dev || !stats)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    out[0] = &stats->p50_us;
+    out[1] = &stats->p90_us;
+    out[2] = &stats->p99_us;
+    out[3] = &stats->p999_us;
+
+    for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+        count += atomic_load_explicit(&dev->lat_hist[i],
+                                      memory_order_relaxed);
+    if (!count)
+        return 0;
+
+    for (unsigned int i = 0; i < LAT_BUCKETS && p < 4; i++) {
+        uint64_t n = atomic_load_explicit(&dev->lat_hist[i],
+                                          memory_order_relaxed);
+        if (n && !seen)
+            stats->min_us = _rx888_lat_value(i);
+        seen += n;
+        while (p < 4 && seen >= pct[p] * count)
+            *out[p++] = _rx888_lat_value(i);
+    }
+
+    stats->count = count;
+    stats->max_us = atomic_load_explicit(&dev->lat_max_us,
+                                         memory_order_relaxed);
+
+    return 0;
+}
+
+int rx888_reset_latency_stats(rx888_dev_t *dev)
+{
+    if (!dev)
+        return -1;
+
+    for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+        atomic_store_explicit(&dev->lat_hist[i], 0, memory_order_relaxed);
+    atomic_store(&dev->lat_count, 0);
+    atomic_store(&dev->lat_max_us, 0);
+    atomic_store(&dev->latency_reset, true);
+
+    return 0;
+}
+
+/* keep xfer_target transfers in flight, park the rest */
+static void _rx888_requeue(rx888_dev_t *dev, struct libusb_transfer *xfer)
+{
+    RX888_TRACE_BEGIN("submit", dev->xfer_inflight);
+
+    if (xfer) {
+        if (dev->xfer_inflight >= dev->xfer_target) {
+            dev->xfer_idle[dev->xfer_idle_num++] = xfer;
+        } else if (libusb_submit_transfer(xfer) == 0) {
+            dev->xfer_inflight++;
+        }
+    }
+
+    while (dev->xfer_inflight < dev->xfer_target && dev->xfer_idle_num) {
+        xfer = dev->xfer_idle[--dev->xfer_idle_num];
+        if (libusb_submit_transfer(xfer) < 0) {
+            dev->xfer_idle[dev->xfer_idle_num++] = xfer;
+            break;
+        }
+        dev->xfer_inflight++;
+    }
+
+    RX888_TRACE_END("submit", dev->xfer_inflight);
+}
+
+/* returns true if the buffer has to be dropped because of a pending
+ * sample rate change */
+static bool _rx888_retune_discard(rx888_dev_t *dev, uint32_t len)
+{
+    if (atomic_exchange(&dev->retune_pending, false)) {
+        /* every transfer in flight was queued before STARTADC */
+        dev->discard_xfers = dev->xfer_inflight + 1;
+        dev->discard_bytes = RETUNE_SETTLE_BYTES;
+        dev->stream_rate = atomic_load(&dev->retune_rate);
+        dev->next_flags |= RX888_BUF_RATE_CHANGED;
+        STAT_ADD(dev->stat_rate_changes, 1);
+    }
+
+    if (!dev->discard_xfers && !dev->discard_bytes)
+        return false;
+
+    if (dev->discard_xfers)
+        dev->discard_xfers--;
+    else
+        dev->discard_bytes = len < dev->discard_bytes ?
+                             dev->discard_bytes - len : 0;
+
+    dev->discarded += len / sizeof(int16_t);
+
+    return true;
+}
+
+/* one AGC step per call at most, waits for the attenuator to settle */
+static void _rx888_agc_update(rx888_dev_t *dev, const rx888_adc_health_t *h,
+                              uint32_t samples)
+{
+    int att = atomic_load(&dev->attenuation);
+    int next = att;
+    rx888_agc_config_t agc;
+
+    if (dev->agc_busy)
+        return;
+
+    /* buffers in flight during the switch still show the old level */
+    if (dev->agc_settle) {
+        dev->agc_settle--;
+        return;
+    }
+
+    /* rx888_set_hf_agc() may rewrite the config from another thread */
+    pthread_mutex_lock(&dev->agc_lock);
+    agc = dev->agc;
+    pthread_mutex_unlock(&dev->agc_lock);
+
+    if ((h->clipped || h->peak_dbfs > agc.high_dbfs) && att > -20) {
+        next = att - 10;
+    } else if (h->peak_dbfs < agc.low_dbfs && att < 0) {
+        dev->agc_low += samples;
+        if (dev->agc_low * 1000 >= (uint64_t)agc.hold_ms *
+                                   dev->stream_rate)
+            next = att + 10;
+    } else {
+        dev->agc_low = 0;
+    }
+
+    if (next == att)
+        return;
+
+    uint32_t gpio_state = _rx888_att_gpio(dev->gpio_state, next);
+    if (_rx888_send_command_async(dev, GPIOFX3, gpio_state) < 0)
+        return;
+
+    dev->gpio_state = gpio_state;
+    atomic_store(&dev->attenuation, next);
+    dev->agc_busy = true;
+    dev->agc_settle = dev->xfer_inflight + 1;
+    dev->agc_low = 0;
+}
+
+/* metadata of the next buffer, consumes the pending flags and counts */
+static void _rx888_fill_info(rx888_dev_t *dev, rx888_buffer_info_t *info)
+{
+    info->sample_index = dev->sample_index;
+    info->sample_rate = dev->stream_rate;
+    info->flags = dev->next_flags;
+    info->discarded_samples = dev->discarded;
+    info->lost_samples = dev->lost;
+    info->attenuation_db = (float)dev->stream_att;
+    info->health = NULL;
+    dev->next_flags = 0;
+    dev->discarded = 0;
+    dev->lost = 0;
+}
+
+/* keep the ready eventfd readable while rx888_read_next() has buffers to
+ * hand out, the libusb descriptors alone go quiet once events are handled */
+static void _rx888_ready_notify(rx888_dev_t *dev)
+{
+#ifdef __linux__
+    bool waiting = dev->readahead && dev->ready_num > dev->ready_out;
+    uint64_t v = 1;
+
+    if (dev->ready_fd < 0 || waiting == dev->ready_signaled)
+        return;
+
+    if (waiting ? write(dev->ready_fd, &v, sizeof(v)) == sizeof(v) :
+                  read(dev->ready_fd, &v, sizeof(v)) == sizeof(v))
+        dev->ready_signaled = waiting;
+#else
+    (void)dev;
+#endif
+}
+
+/* hold a completed transfer for rx888_read_sync(), it is resubmitted once
+ * read out */
+static bool _rx888_ready_push(rx888_dev_t *dev, struct libusb_transfer *xfer,
+                              const rx888_buffer_info_t *info)
+{
+    struct rx888_ready *slot;
+
+    if (dev->ready_num >= dev->xfer_buf_num)
+        return false;
+
+    slot = &dev->ready[(dev->ready_head + dev->ready_num) % dev->xfer_buf_num];
+    slot->xfer = xfer;
+    slot->info = *info;
+    if (info->health) {
+        slot->health = *info->health;
+        slot->info.health = &slot->health;
+    }
+    dev->ready_num++;
+    _rx888_ready_notify(dev);
+
+    /* top up from parked transfers while the reader is behind */
+    _rx888_requeue(dev, NULL);
+
+    return true;
+}
+
+/* resubmit a transfer that was held back from the device */
+static void _rx888_held_release(rx888_dev_t *dev, struct libusb_transfer *xfer)
+{
+    /* nothing was in flight, the FX3 ran out of buffer space once the time
+     * since the last completion exceeds its own buffering. The completion
+     * is only seen when events are handled, so this is a lower bound. */
+    if (!dev->xfer_inflight && RX888_RUNNING == dev->async_status) {
+        uint64_t dry = (_rx888_now_ns() - dev->dry_ns) *
+                       dev->stream_rate / 1000000000ULL;
+        uint64_t buffered = FX3_BUFFER_BYTES / sizeof(int16_t);
+
+        if (dry > buffered) {
+            dev->lost += dry - buffered;
+            dev->sample_index += dry - buffered;
+            dev->next_flags |= RX888_BUF_OVERRUN;
+            STAT_ADD(dev->stat_overruns, 1);
+            STAT_ADD(dev->stat_lost, dry - buffered);
+        }
+    }
+
+    /* a stopping stream gets no new transfers */
+    if (RX888_RUNNING == dev->async_status)
+        _rx888_requeue(dev, xfer);
+}
+
+static void _rx888_ready_release(rx888_dev_t *dev)
+{
+    struct libusb_transfer *xfer = dev->ready[dev->ready_head].xfer;
+
+    dev->ready_head = (dev->ready_head + 1) % dev->xfer_buf_num;
+    dev->ready_num--;
+    dev->ready_off = 0;
+    _rx888_ready_notify(dev);
+
+    _rx888_held_release(dev, xfer);
+}
+
+/* resubmit the ring transfers the read cursor has passed, in ring order so
+ * that they keep completing in it */
+static void _rx888_ring_release(rx888_dev_t *dev)
+{
+    while (dev->ring_freed < dev->ring_done &&
+           (dev->ring_freed + 1) * dev->xfer_buf_len <= dev->ring_read) {
+        uint32_t i = dev->ring_freed++ % dev->xfer_buf_num;
+
+        _rx888_held_release(dev, dev->xfer[i]);
+    }
+}
+
+/* account a completed transfer in the ring, returns the data in the upper
+ * mapping so that the unconsumed data right before it is contiguous */
+static unsigned char *_rx888_ring_complete(rx888_dev_t *dev,
+                                           struct libusb_transfer *xfer)
+{
+    uint32_t len = xfer->actual_length;
+
+    /* bulk transfers on one endpoint complete in submission order */
+    if (xfer != dev->xfer[dev->ring_done % dev->xfer_buf_num]) {
+        fprintf(stderr, "Transfer completed out of ring order, "
+                "canceling...\n");
+        rx888_cancel_async(dev);
+    }
+    dev->ring_done++;
+
+    /* short transfers only happen around stops, keep the ring dense */
+    if (len < dev->xfer_buf_len)
+        memset(xfer->buffer + len, 0, dev->xfer_buf_len - len);
+
+    return xfer->buffer + dev->ring.size;
+}
+
+/* pass every held transfer to the batch callback, then resubmit them */
+static void _rx888_batch_flush(rx888_dev_t *dev)
+{
+    uint32_t n = dev->ready_num;
+
+    if (!n)
+        return;
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct rx888_ready *slot =
+            &dev->ready[(dev->ready_head + i) % dev->xfer_buf_num];
+
+        dev->batch_iov[i].buf = slot->xfer->buffer;
+        dev->batch_iov[i].len = slot->xfer->actual_length;
+        dev->batch_iov[i].info = &slot->info;
+    }
+
+    RX888_TRACE_BEGIN("user callback", n);
+    dev->cb_batch(dev->batch_iov, n, dev->cb_ctx);
+    RX888_TRACE_END("user callback", n);
+
+    while (n--)
+        _rx888_ready_release(dev);
+}
+
+static int _rx888_readahead_read(rx888_dev_t *dev, unsigned char *buf,
+                                 int len, int *n_read,
+                                 unsigned int timeout_ms)
+{
+    uint64_t deadline = _rx888_now_ns() + timeout_ms * 1000000ULL;
+    int r;
+
+    /* buffers from rx888_read_next() have to be released first */
+    if (dev->ready_out)
+        return -2;
+
+    while (*n_read < len) {
+        struct timeval tv = { 1, 0 };
+
+        if (dev->ready_num) {
+            struct libusb_transfer *xfer = dev->ready[dev->ready_head].xfer;
+            uint32_t n = xfer->actual_length - dev->ready_off;
+
+            if (n > (uint32_t)(len - *n_read))
+                n = len - *n_read;
+
+            memcpy(buf + *n_read, xfer->buffer + dev->ready_off, n);
+            *n_read += n;
+            dev->ready_off += n;
+
+            if (dev->ready_off >= (uint32_t)xfer->actual_length)
+                _rx888_ready_release(dev);
+            continue;
+        }
+
+        /* canceled or device lost */
+        if (RX888_RUNNING != dev->async_status)
+            return -1;
+
+        if (timeout_ms) {
+            uint64_t now = _rx888_now_ns();
+
+            if (now >= deadline)
+                return LIBUSB_ERROR_TIMEOUT;
+
+            if (deadline - now < 1000000000ULL) {
+                tv.tv_sec = 0;
+                tv.tv_usec = (deadline - now) / 1000;
+            }
+        }
+
+        if (dev->busy_poll) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+        }
+
+        r = libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+        if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED)
+            return r;
+    }
+
+    return 0;
+}
+
+static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
+{
+    rx888_dev_t *dev = (rx888_dev_t *)xfer->user_data;
+
+    RX888_TRACE_BEGIN("completion", xfer->actual_length);
+
+    dev->xfer_inflight--;
+
+    if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
+        bool queued = false;
+        uint32_t len = xfer->actual_length;
+        uint32_t samples = len / sizeof(int16_t);
+        unsigned char *buf = xfer->buffer;
+
+        if (dev->auto_buffers && !dev->ring_on)
+            _rx888_auto_update(dev);
+
+        if (dev->ring_on) {
+            buf = _rx888_ring_complete(dev, xfer);
+            queued = true;
+        }
+
+        if (_rx888_retune_discard(dev, len)) {
+            STAT_ADD(dev->stat_discarded, samples);
+
+            /* history from before a rate change is of no use */
+            if (dev->ring_on) {
+                dev->ring_read = dev->ring_done * dev->xfer_buf_len;
+                _rx888_ring_release(dev);
+            }
+        } else {
+            rx888_buffer_info_t info;
+            bool agc = atomic_load_explicit(&dev->agc_on,
+                                            memory_order_relaxed);
+
+            if (atomic_load_explicit(&dev->randomizer, memory_order_relaxed))
+                rx888_kernel_derandomize((int16_t *)buf, samples);
+
+            if (atomic_exchange(&dev->att_changed, false)) {
+                dev->stream_att = atomic_load(&dev->attenuation);
+                dev->next_flags |= RX888_BUF_ATTENUATION_CHANGED;
+                STAT_ADD(dev->stat_att_changes, 1);
+            }
+
+            if (atomic_load_explicit(&dev->latency_on, memory_order_relaxed))
+                _rx888_latency_update(dev, samples);
+
+            _rx888_fill_info(dev, &info);
+
+            if (samples && (agc || atomic_load_explicit(&dev->health_on,
+                                               memory_order_relaxed))) {
+                rx888_adc_health((const int16_t *)buf, samples,
+                                 &dev->health);
+                info.health = &dev->health;
+                STAT_ADD(dev->stat_clipped, dev->health.clipped);
+            }
+
+            if (dev->readahead || dev->cb_batch) {
+                queued = _rx888_ready_push(dev, xfer, &info);
+            } else {
+                RX888_TRACE_BEGIN("user callback", len);
+                if (dev->cb_ex)
+                    dev->cb_ex(buf, len, &info, dev->cb_ctx);
+                else if (dev->cb)
+                    dev->cb(buf, len, dev->cb_ctx);
+                RX888_TRACE_END("user callback", len);
+            }
+
+            if (agc && info.health)
+                _rx888_agc_update(dev, info.health, samples);
+
+            STAT_ADD(dev->stat_buffers, 1);
+            STAT_ADD(dev->stat_samples, samples);
+        }
+        dev->sample_index += samples;
+
+        if (!queued)
+            _rx888_requeue(dev, xfer); /* resubmit transfer */
+        else if (!dev->xfer_inflight)
+            dev->dry_ns = _rx888_now_ns();
+
+        if (dev->cb_batch && dev->ready_num >= dev->batch_max)
+            _rx888_batch_flush(dev);
+
+        dev->xfer_errors = 0;
+    } else if (LIBUSB_TRANSFER_CANCELLED != xfer->status) {
+#ifndef _WIN32
+        if (LIBUSB_TRANSFER_ERROR == xfer->status) {
+            dev->xfer_errors++;
+            STAT_ADD(dev->stat_xfer_errors, 1);
+        }
+
+        if (dev->xfer_errors >= dev->xfer_buf_num ||
+            LIBUSB_TRANSFER_NO_DEVICE == xfer->status) {
+#endif
+            dev->dev_lost = true;
+            if (RX888_RUNNING == dev->async_status) {
+                dev->lost_ns = _rx888_now_ns();
+                STAT_ADD(dev->stat_losses, 1);
+            }
+            rx888_cancel_async(dev);
+            fprintf(stderr, "cb transfer status: %d, "
+                "canceling...\n", xfer->status);
+#ifndef _WIN32
+        }
+#endif
+    }
+
+    RX888_TRACE_END("completion", xfer->actual_length);
+}
+
+static int _rx888_alloc_async_buffers(rx888_dev_t *dev)
+{
+    unsigned int i;
+
+    if (!dev)
+        return -1;
+
+    if (!dev->xfer) {
+        dev->xfer = malloc(dev->xfer_buf_num *
+                   sizeof(struct libusb_transfer *));
+
+        for(i = 0; i < dev->xfer_buf_num; ++i)
+            dev->xfer[i] = libusb_alloc_transfer(0);
+
+        dev->xfer_idle = malloc(dev->xfer_buf_num *
+                   sizeof(struct libusb_transfer *));
+
+        dev->ready = malloc(dev->xfer_buf_num * sizeof(struct rx888_ready));
+        dev->batch_iov = malloc(dev->xfer_buf_num * sizeof(rx888_iovec_t));
+    }
+
+    dev->xfer_idle_num = 0;
+    dev->ready_head = 0;
+    dev->ready_num = 0;
+    dev->ready_off = 0;
+    _rx888_ready_notify(dev);
+
+    /* a session keeps the pool of the previous stream */
+    if (dev->xfer_buf)
+        return dev->session ? 0 : -2;
+
+    dev->xfer_buf = calloc(dev->xfer_buf_num, sizeof(unsigned char *));
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+    /* a pool that lives on may as well be usbfs memory, which the
+     * controller writes to without the copy of a user buffer */
+    if (dev->session) {
+        dev->xfer_dev_mem = true;
+        for (i = 0; i < dev->xfer_buf_num && dev->xfer_dev_mem; ++i) {
+            dev->xfer_buf[i] = libusb_dev_mem_alloc(dev->dev_handle,
+                                                    dev->xfer_buf_len);
+            dev->xfer_dev_mem = dev->xfer_buf[i] != NULL;
+        }
+
+        if (dev->xfer_dev_mem)
+            return 0;
+
+        for (i = 0; i < dev->xfer_buf_num && dev->xfer_buf[i]; ++i) {
+            libusb_dev_mem_free(dev->dev_handle, dev->xfer_buf[i],
+                                dev->xfer_buf_len);
+            dev->xfer_buf[i] = NULL;
+        }
+    }
+#endif
+
+    if (dev->ring_on) {
+        int r = rx888_ring_map(&dev->ring,
+                               (size_t)dev->xfer_buf_num * dev->xfer_buf_len,
+                               dev->numa_node);
+        if (r < 0)
+            return r;
+
+        for (i = 0; i < dev->xfer_buf_num; ++i)
+            dev->xfer_buf[i] = dev->ring.base + (size_t)i * dev->xfer_buf_len;
+
+        return 0;
+    }
+
+    /* next to the host controller that writes them */
+    dev->xfer_numa = dev->numa_node >= 0;
     for (i = 0; i < dev->xfer_buf_num; ++i) {
-        dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
+        if (dev->xfer_numa)
+            dev->xfer_buf[i] = rx888_numa_alloc(dev->xfer_buf_len,
+                                                dev->numa_node);
+        else
+            dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
         if (!dev->xfer_buf[i])
             return -ENOMEM;
     }
-    
+    
+
+    return 0;
+}
+
+static int _rx888_free_async_buffers(rx888_dev_t *dev)
+{
+    unsigned int i;
+
+    if (!dev)
+        return -1;
+
+    if (dev->xfer) {
+        for(i = 0; i < dev->xfer_buf_num; ++i) {
+            if (dev->xfer[i]) {
+                libusb_free_transfer(dev->xfer[i]);
+            }
+        }
+
+        free(dev->xfer);
+        dev->xfer = NULL;
+        free(dev->xfer_idle);
+        dev->xfer_idle = NULL;
+        free(dev->ready);
+        dev->ready = NULL;
+        free(dev->batch_iov);
+        dev->batch_iov = NULL;
+    }
+
+    if (dev->xfer_buf) {
+        for (i = 0; i < dev->xfer_buf_num && !dev->ring.base; ++i) {
+            if (!dev->xfer_buf[i])
+                continue;
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+            if (dev->xfer_dev_mem) {
+                libusb_dev_mem_free(dev->dev_handle, dev->xfer_buf[i],
+                                    dev->xfer_buf_len);
+                continue;
+            }
+#endif
+            if (dev->xfer_numa)
+                rx888_numa_free(dev->xfer_buf[i], dev->xfer_buf_len);
+            else
+                free(dev->xfer_buf[i]);
+        }
+
+        free(dev->xfer_buf);
+        dev->xfer_buf = NULL;
+        dev->xfer_dev_mem = false;
+        dev->xfer_numa = false;
+    }
+
+    rx888_ring_unmap(&dev->ring);
+
+    return 0;
+}
+
+/* end of a stream, the pool stays with an open session */
+static void _rx888_release_async_buffers(rx888_dev_t *dev)
+{
+    if (!dev->session)
+        _rx888_free_async_buffers(dev);
+}
+
+/* reset the stream state and pick the transfer geometry */
+static void _rx888_stream_reset(rx888_dev_t *dev, rx888_read_async_cb_t cb,
+                  rx888_read_async_ex_cb_t cb_ex, void *ctx,
+                  uint32_t buf_num, uint32_t buf_len)
+{
+    dev->async_status = RX888_RUNNING;
+    dev->async_cancel = false;
+
+    dev->cb = cb;
+    dev->cb_ex = cb_ex;
+    dev->cb_ctx = ctx;
+
+    atomic_store(&dev->retune_pending, false);
+    dev->stream_rate = dev->sample_rate;
+    dev->discard_xfers = 0;
+    dev->discard_bytes = 0;
+    dev->discarded = 0;
+    dev->lost = 0;
+    dev->next_flags = 0;
+    dev->sample_index = 0;
+    dev->lost_ns = 0;
+    atomic_store(&dev->att_changed, false);
+    dev->stream_att = atomic_load(&dev->attenuation);
+    dev->agc_busy = false;
+    dev->agc_settle = 0;
+    dev->agc_low = 0;
+
+    dev->ring_done = 0;
+    dev->ring_freed = 0;
+    dev->ring_read = 0;
+
+    if (dev->session) {
+        buf_num = dev->session->buf_num;
+        buf_len = dev->session->buf_len;
+    }
+
+    /* the ring needs every transfer in flight to stay in order */
+    if (dev->auto_buffers && !dev->ring_on && !buf_num && !buf_len) {
+        _rx888_auto_geometry(dev);
+    } else {
+        if (buf_num > 0)
+            dev->xfer_buf_num = buf_num;
+        else
+            dev->xfer_buf_num = DEFAULT_BUF_NUMBER;
+
+        if (buf_len > 0 && buf_len % 512 == 0) /* len must be multiple of 512 */
+            dev->xfer_buf_len = buf_len;
+        else
+            dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
+
+        dev->xfer_target = dev->xfer_buf_num;
+    }
+    /* batches are bounded by the ready ring, which holds every transfer */
+    if (!dev->batch_req)
+        dev->batch_max = (dev->xfer_buf_num + 1) / 2;
+    else if (dev->batch_req > dev->xfer_buf_num)
+        dev->batch_max = dev->xfer_buf_num;
+    else
+        dev->batch_max = dev->batch_req;
+    dev->auto_initial = dev->xfer_target;
+    dev->auto_last_ns = 0;
+    dev->auto_max_gap_ns = 0;
+    dev->auto_calm = 0;
+    dev->xfer_inflight = 0;
+}
+
+/* submit the transfers of the current geometry, leaves the status at
+ * RX888_CANCELING if not all of them could be submitted */
+static int _rx888_stream_submit(rx888_dev_t *dev)
+{
+    int r = 0;
+
+    r = _rx888_alloc_async_buffers(dev);
+    if (r < 0) {
+        _rx888_set_status(dev, RX888_INACTIVE);
+        return r;
+    }
+
+    for(uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
+        libusb_fill_bulk_transfer(dev->xfer[i],
+                      dev->dev_handle,
+                      0x81,
+                      dev->xfer_buf[i],
+                      dev->xfer_buf_len,
+                      _libusb_callback,
+                      (void *)dev,
+                      0);
+        /* libusb keeps the status of the last completion on submit, a
+         * session reuses transfers that were canceled by the last stop,
+         * and the cancel loop takes those for not in flight */
+        dev->xfer[i]->status = LIBUSB_TRANSFER_COMPLETED;
+
+        if (i >= dev->xfer_target) {
+            dev->xfer_idle[dev->xfer_idle_num++] = dev->xfer[i];
+            continue;
+        }
+
+        r = libusb_submit_transfer(dev->xfer[i]);
+        if (r == 0)
+            dev->xfer_inflight++;
+        if (r < 0) {
+            fprintf(stderr, "Failed to submit transfer %i\n"
+                    "Please increase your allowed " 
+                    "usbfs buffer size with the "
+                    "following command:\n"
+                    "echo 0 > /sys/module/usbcore"
+                    "/parameters/usbfs_memory_mb\n", i);
+            dev->async_status = RX888_CANCELING;
+            break;
+        }
+    }
+    
+    //rx888_send_command(dev->dev_handle, STARTADC, dev->sample_rate);
+    //rx888_send_command(dev->dev_handle, STARTFX3, 0);
+
+    dev->latency_valid = false;
+
+    return r;
+}
+
+/* reset the stream state and submit the transfers */
+static int _rx888_stream_start(rx888_dev_t *dev, rx888_read_async_cb_t cb,
+                  rx888_read_async_ex_cb_t cb_ex, void *ctx,
+                  uint32_t buf_num, uint32_t buf_len)
+{
+    _rx888_stream_reset(dev, cb, cb_ex, ctx, buf_num, buf_len);
+
+    return _rx888_stream_submit(dev);
+}
+
+static void _rx888_sleep_until(uint64_t ns)
+{
+    uint64_t now = _rx888_now_ns();
+
+    if (ns > now) {
+#ifdef _WIN32
+        Sleep((DWORD)((ns - now) / 1000000ULL));
+#else
+        struct timespec ts = { (time_t)((ns - now) / 1000000000ULL),
+                               (long)((ns - now) % 1000000000ULL) };
+        nanosleep(&ts, NULL);
+#endif
+    }
+}
+
+/* the data path of a replay device, on the calling thread */
+static int _rx888_replay_async(rx888_dev_t *dev)
+{
+    struct rx888_replay_file *file = &dev->replay_file;
+    size_t total = file->size / file->bytes_per_sample;
+    uint32_t chunk = dev->xfer_buf_len / sizeof(int16_t);
+    int16_t *scratch = NULL;
+    uint64_t start_ns = _rx888_now_ns();
+    uint64_t paced = 0;
+
+    if (RX888_REPLAY_CF32 == file->format) {
+        scratch = malloc(dev->xfer_buf_len);
+        if (!scratch) {
+            _rx888_set_status(dev, RX888_INACTIVE);
+            return -ENOMEM;
+        }
+    }
+
+    while (RX888_RUNNING == dev->async_status) {
+        rx888_buffer_info_t info;
+        int16_t *buf;
+        uint32_t n;
+
+        if (dev->replay_pos >= total) {
+            if (!dev->replay_loop)
+                break;
+            dev->replay_pos = 0;
+        }
+
+        n = total - dev->replay_pos < chunk ?
+            (uint32_t)(total - dev->replay_pos) : chunk;
+
+        if (scratch) {
+            rx888_replay_convert(file, dev->replay_pos, n, scratch);
+            buf = scratch;
+        } else {
+            buf = (int16_t *)file->data + dev->replay_pos;
+        }
+
+        /* a new rate changes the pace from here on */
+        if (atomic_exchange(&dev->retune_pending, false)) {
+            dev->stream_rate = atomic_load(&dev->retune_rate);
+            dev->next_flags |= RX888_BUF_RATE_CHANGED;
+            STAT_ADD(dev->stat_rate_changes, 1);
+            start_ns = _rx888_now_ns();
+            paced = 0;
+        }
+
+        /* hand the buffer out when its last sample would have been taken,
+         * whole seconds apart so paced * 1e9 cannot overflow */
+        paced += n;
+        if (!dev->replay_fast)
+            _rx888_sleep_until(start_ns +
+                               paced / dev->stream_rate * 1000000000ULL +
+                               paced % dev->stream_rate * 1000000000ULL /
+                               dev->stream_rate);
+
+        _rx888_fill_info(dev, &info);
+        if (n && atomic_load_explicit(&dev->health_on, memory_order_relaxed)) {
+            rx888_adc_health(buf, n, &dev->health);
+            info.health = &dev->health;
+            STAT_ADD(dev->stat_clipped, dev->health.clipped);
+        }
+
+        RX888_TRACE_BEGIN("user callback", n * sizeof(int16_t));
+        if (dev->cb_batch) {
+            rx888_iovec_t iov = { (unsigned char *)buf, n * sizeof(int16_t),
+                                  &info };
+
+            dev->cb_batch(&iov, 1, dev->cb_ctx);
+        } else if (dev->cb_ex)
+            dev->cb_ex((unsigned char *)buf, n * sizeof(int16_t), &info,
+                       dev->cb_ctx);
+        else if (dev->cb)
+            dev->cb((unsigned char *)buf, n * sizeof(int16_t), dev->cb_ctx);
+        RX888_TRACE_END("user callback", n * sizeof(int16_t));
+
+        STAT_ADD(dev->stat_buffers, 1);
+        STAT_ADD(dev->stat_samples, n);
+        dev->sample_index += n;
+        dev->replay_pos += n;
+    }
+
+    free(scratch);
+    _rx888_set_status(dev, RX888_INACTIVE);
+
+    return 0;
+}
+
+/* open the known device with the serial of the lost one, if it is back */
+static int _rx888_reopen(rx888_dev_t *dev)
+{
+    libusb_device **list;
+    ssize_t num_of_devs = libusb_get_device_list(dev->ctx, &list);
+    char serial[256];
+    int r = -1;
+
+    for (ssize_t i = 0; i < num_of_devs && r < 0; i++) {
+        struct libusb_device_descriptor dd;
+        struct libusb_device_handle *dev_handle;
+
+        libusb_get_device_descriptor(list[i], &dd);
+        if (!find_known_device(dd.idVendor, dd.idProduct))
+            continue;
+
+        if (libusb_open(list[i], &dev_handle) < 0)
+            continue;
+
+        if (_rx888_usb_strings(dev_handle, NULL, NULL, serial) == 0 &&
+            !strcmp(serial, dev->serial)) {
+#ifdef DETACH_KERNEL_DRIVER
+            if (libusb_kernel_driver_active(dev_handle, 0) == 1)
+                libusb_detach_kernel_driver(dev_handle, 0);
+#endif
+            r = libusb_claim_interface(dev_handle, 0);
+        }
+
+        if (r < 0) {
+            libusb_close(dev_handle);
+        } else {
+            pthread_mutex_lock(&dev->handle_lock);
+            dev->dev_handle = dev_handle;
+            pthread_mutex_unlock(&dev->handle_lock);
+        }
+    }
+
+    if (num_of_devs >= 0)
+        libusb_free_device_list(list, 1);
+
+    return r;
+}
+
+/* the device was lost while streaming: wait for it to come back under the
+ * same serial, restore its configuration and submit the transfers again,
+ * 0 once streaming */
+static int _rx888_recover(rx888_dev_t *dev)
+{
+    uint64_t deadline = dev->lost_ns + dev->recover_ms * 1000000ULL;
+    uint64_t now, lost, us;
+
+    /* the failed transfers have to come back before they can be freed */
+    for (int i = 0; i < 100 && dev->xfer_inflight; i++) {
+        struct timeval tv = { 0, 10000 };
+        libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+    }
+    if (dev->xfer_inflight)
+        return -1;
+
+    _rx888_free_async_buffers(dev);
+    pthread_mutex_lock(&dev->handle_lock);
+    libusb_release_interface(dev->dev_handle, 0);
+    libusb_close(dev->dev_handle);
+    dev->dev_handle = NULL;
+    pthread_mutex_unlock(&dev->handle_lock);
+
+    /* running again, so that rx888_cancel_async() ends the wait */
+    dev->async_status = RX888_RUNNING;
+    dev->async_cancel = false;
+    fprintf(stderr, "Device lost, waiting for serial %s\n", dev->serial);
+
+    while (_rx888_reopen(dev) < 0) {
+        now = _rx888_now_ns();
+        if (RX888_RUNNING != dev->async_status || now >= deadline)
+            return -1;
+        _rx888_sleep_until(now + 100000000ULL);
+    }
+    dev->dev_lost = false;
+
+    if (RX888_RUNNING != dev->async_status)
+        return -1;
+
+    /* everything set through the API while the device was gone is in the
+     * device state and applied here as well */
+    pthread_mutex_lock(&dev->handle_lock);
+    rx888_send_command(dev->dev_handle, STOPFX3, 0);
+    rx888_send_command(dev->dev_handle, GPIOFX3, dev->gpio_state);
+    rx888_send_command(dev->dev_handle, STARTADC, dev->sample_rate);
+    rx888_send_command(dev->dev_handle, STARTFX3, 0);
+    pthread_mutex_unlock(&dev->handle_lock);
+
+    /* samples the ADC would have produced while the device was gone, at
+     * the rate it ran at then */
+    now = _rx888_now_ns();
+    us = (now - dev->lost_ns) / 1000;
+    lost = (uint64_t)((double)(now - dev->lost_ns) * dev->stream_rate * 1e-9);
+    dev->sample_index += lost;
+    dev->lost += lost;
+    dev->next_flags |= RX888_BUF_DISCONTINUITY;
+    dev->lost_ns = 0;
+    dev->xfer_errors = 0;
+    STAT_ADD(dev->stat_lost, lost);
+
+    if (atomic_exchange(&dev->retune_pending, false) ||
+        dev->stream_rate != dev->sample_rate) {
+        dev->stream_rate = dev->sample_rate;
+        dev->next_flags |= RX888_BUF_RATE_CHANGED;
+    }
+
+    atomic_store_explicit(&dev->stat_last_recovery_us, (unsigned int)us,
+                          memory_order_relaxed);
+    if (us > atomic_load_explicit(&dev->stat_max_recovery_us,
+                                  memory_order_relaxed))
+        atomic_store_explicit(&dev->stat_max_recovery_us, (unsigned int)us,
+                              memory_order_relaxed);
+    STAT_ADD(dev->stat_recoveries, 1);
+    fprintf(stderr, "Device back after %.3f s, resuming\n", us * 1e-6);
+
+    /* a failed submission is canceled by the event loop as at the start */
+    _rx888_stream_submit(dev);
+
+    return 0;
+}
+
+static int _rx888_read_async(rx888_dev_t *dev, rx888_read_async_cb_t cb,
+                  rx888_read_async_ex_cb_t cb_ex, void *ctx,
+                  uint32_t buf_num, uint32_t buf_len)
+{
+    int r = 0;
+    struct timeval tv = { 1, 0 };
+    struct timeval zerotv = { 0, 0 };
+    enum rx888_async_status next_status = RX888_INACTIVE;
+
+    if (!dev)
+        return -1;
+
+    if (RX888_INACTIVE != dev->async_status)
+        return -2;
+
+    if (dev->replay) {
+        _rx888_stream_reset(dev, cb, cb_ex, ctx, buf_num, buf_len);
+        return _rx888_replay_async(dev);
+    }
+
+    r = _rx888_stream_start(dev, cb, cb_ex, ctx, buf_num, buf_len);
+
+recover:
+    while (RX888_INACTIVE != dev->async_status) {
+        /* busy polling trades a core for wakeup latency */
+        RX888_TRACE_BEGIN("handle events", dev->xfer_inflight);
+        r = libusb_handle_events_timeout_completed(dev->ctx,
+                               dev->busy_poll ? &zerotv : &tv,
+                               &dev->async_cancel);
+        RX888_TRACE_END("handle events", dev->xfer_inflight);
+
+        if (dev->cb_batch)
+            _rx888_batch_flush(dev);
+
+        if (r < 0) {
+            /*fprintf(stderr, "handle_events returned: %d\n", r);*/
+            if (r == LIBUSB_ERROR_INTERRUPTED) /* stray signal */
+                continue;
+            break;
+        }
+
+        if (RX888_CANCELING == dev->async_status) {
+            next_status = RX888_INACTIVE;
+
+            if (!dev->xfer)
+                break;
+
+            for(uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
+                if (!dev->xfer[i])
+                    continue;
+
+                if (LIBUSB_TRANSFER_CANCELLED !=
+                        dev->xfer[i]->status) {
+                    RX888_TRACE_INSTANT("cancel transfer", i);
+                    r = libusb_cancel_transfer(dev->xfer[i]);
+                    /* handle events after canceling
+                     * to allow transfer status to
+                     * propagate */
+#ifdef _WIN32
+                    Sleep(1);
+#endif
+                    libusb_handle_events_timeout_completed(dev->ctx,
+                                           &zerotv, NULL);
+                    if (r < 0)
+                        continue;
+
+                    next_status = RX888_CANCELING;
+                }
+            }
+
+            if (dev->dev_lost || RX888_INACTIVE == next_status) {
+                /* handle any events that still need to
+                 * be handled before exiting after we
+                 * just cancelled all transfers */
+                libusb_handle_events_timeout_completed(dev->ctx,
+                                       &zerotv, NULL);
+                break;
+            }
+        }
+    }
+
+    /* transfers that completed while canceling */
+    if (dev->cb_batch)
+        _rx888_batch_flush(dev);
+
+    /* the ring and a session hand out buffers that must not move or be
+     * freed under the reader */
+    if (dev->dev_lost && dev->lost_ns && dev->recover_ms && !dev->ring_on &&
+        !dev->session) {
+        next_status = RX888_INACTIVE;
+        r = _rx888_recover(dev);
+        if (r == 0)
+            goto recover;
+    }
+
+    _rx888_release_async_buffers(dev);
+
+    _rx888_set_status(dev, next_status);
+
+    return r;
+}
+
+int rx888_read_async(rx888_dev_t *dev, rx888_read_async_cb_t cb, void *ctx,
+              uint32_t buf_num, uint32_t buf_len)
+{
+    return _rx888_read_async(dev, cb, NULL, ctx, buf_num, buf_len);
+}
+
+int rx888_read_async_ex(rx888_dev_t *dev, rx888_read_async_ex_cb_t cb,
+                 void *ctx, uint32_t buf_num, uint32_t buf_len)
+{
+    return _rx888_read_async(dev, NULL, cb, ctx, buf_num, buf_len);
+}
+
+int rx888_read_async_batch(rx888_dev_t *dev, rx888_read_async_batch_cb_t cb,
+                 void *ctx, uint32_t buf_num, uint32_t buf_len,
+                 uint32_t max_batch)
+{
+    int r;
+
+    if (!dev || !cb || dev->ring_on)
+        return -1;
+
+    if (RX888_INACTIVE != dev->async_status)
+        return -2;
+
+    dev->cb_batch = cb;
+    dev->batch_req = max_batch;
+    r = _rx888_read_async(dev, NULL, NULL, ctx, buf_num, buf_len);
+    dev->cb_batch = NULL;
+
+    return r;
+}
+
+int rx888_session_open(rx888_session_t **out, rx888_dev_t *dev,
+                       uint32_t buf_num, uint32_t buf_len)
+{
+    rx888_session_t *session;
+    int r;
+
+    if (!out || !dev || dev->replay || dev->ring_on)
+        return -1;
+
+    if (RX888_INACTIVE != dev->async_status || dev->session)
+        return -2;
+
+    session = calloc(1, sizeof(*session));
+    if (!session)
+        return -ENOMEM;
+
+    if (dev->auto_buffers && !buf_num && !buf_len) {
+        _rx888_auto_geometry(dev);
+        buf_num = dev->xfer_buf_num;
+        buf_len = dev->xfer_buf_len;
+    }
+
+    session->dev = dev;
+    session->buf_num = buf_num > 0 ? buf_num : DEFAULT_BUF_NUMBER;
+    session->buf_len = buf_len > 0 && buf_len % 512 == 0 ?
+                       buf_len : DEFAULT_BUF_LENGTH;
+
+    dev->xfer_buf_num = session->buf_num;
+    dev->xfer_buf_len = session->buf_len;
+    dev->session = session;
+
+    r = _rx888_alloc_async_buffers(dev);
+    if (r < 0) {
+        dev->session = NULL;
+        _rx888_free_async_buffers(dev);
+        free(session);
+        return r;
+    }
+
+    *out = session;
+
+    return 0;
+}
+
+int rx888_session_run(rx888_session_t *session, rx888_read_async_ex_cb_t cb,
+                      void *ctx)
+{
+    if (!session || !cb)
+        return -1;
+
+    return _rx888_read_async(session->dev, NULL, cb, ctx, 0, 0);
+}
+
+int rx888_session_stop(rx888_session_t *session, unsigned int timeout_ms)
+{
+    if (!session)
+        return -1;
+
+    rx888_cancel_async(session->dev);
+
+    return _rx888_wait_inactive(session->dev, timeout_ms);
+}
+
+int rx888_session_cancel(rx888_session_t *session)
+{
+    if (!session)
+        return -1;
+
+    return rx888_cancel_async(session->dev);
+}
+
+int rx888_session_close(rx888_session_t *session)
+{
+    rx888_dev_t *dev;
+
+    if (!session)
+        return -1;
+
+    dev = session->dev;
+
+    /* streams driven by the reading thread have to be stopped there */
+    if (dev->readahead || dev->burst)
+        return -2;
+
+    rx888_cancel_async(dev);
+    if (!dev->dev_lost)
+        _rx888_wait_inactive(dev, 0);
+
+    dev->session = NULL;
+    _rx888_free_async_buffers(dev);
+    free(session);
+
+    return 0;
+}
+
+int rx888_start_readahead(rx888_dev_t *dev, uint32_t buf_num,
+                          uint32_t buf_len)
+{
+    if (!dev)
+        return -1;
+
+    if (RX888_INACTIVE != dev->async_status)
+        return -2;
+
+    if (dev->replay || dev->ring_on)
+        return -1;
+
+    dev->readahead = true;
+    _rx888_stream_start(dev, NULL, NULL, NULL, buf_num, buf_len);
+    dev->dry_ns = _rx888_now_ns();
+
+    if (RX888_RUNNING != dev->async_status) {
+        rx888_stop_readahead(dev);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* cancel every transfer and wait for them, for the streams driven by the
+ * reading thread */
+static void _rx888_stream_stop(rx888_dev_t *dev)
+{
+    struct timeval tv = { 1, 0 };
+
+    dev->async_status = RX888_CANCELING;
+
+    /* queued and parked transfers are not submitted, cancel fails on them */
+    for (uint32_t i = 0; i < dev->xfer_buf_num; ++i)
+        libusb_cancel_transfer(dev->xfer[i]);
+
+    while (dev->xfer_inflight) {
+        int r = libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+        if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED)
+            break;
+    }
+
+    _rx888_release_async_buffers(dev);
+
+    _rx888_set_status(dev, RX888_INACTIVE);
+}
+
+int rx888_stop_readahead(rx888_dev_t *dev)
+{
+    if (!dev)
+        return -1;
+
+    if (!dev->readahead)
+        return -2;
+
+    _rx888_stream_stop(dev);
+
+    dev->readahead = false;
+    dev->ready_out = 0;
+    _rx888_ready_notify(dev);
+
+    return 0;
+}
+
+int rx888_set_ring_buffer(rx888_dev_t *dev, int on)
+{
+    if (!dev || dev->replay)
+        return -1;
+
+    if (RX888_INACTIVE != dev->async_status || dev->session)
+        return -2;
+
+#ifdef _WIN32
+    if (on)
+        return -ENOSYS;
+#endif
+
+    dev->ring_on = on != 0;
+
+    return 0;
+}
+
+int rx888_ring_peek(rx888_dev_t *dev, const unsigned char **data,
+                    uint32_t *len)
+{
+    if (!dev || !dev->ring.base || !data || !len)
+        return -1;
+
+    *data = dev->ring.base + dev->ring_read % dev->ring.size;
+    *len = (uint32_t)(dev->ring_done * dev->xfer_buf_len - dev->ring_read);
+
+    return 0;
+}
+
+int rx888_ring_consume(rx888_dev_t *dev, uint32_t len)
+{
+    if (!dev || !dev->ring.base)
+        return -1;
+
+    if (len > dev->ring_done * dev->xfer_buf_len - dev->ring_read)
+        return -EINVAL;
+
+    dev->ring_read += len;
+    _rx888_ring_release(dev);
+
+    return 0;
+}
+
+/* resolve the start of a burst once the stream has reached it */
+static void _rx888_burst_resolve(rx888_dev_t *dev, struct rx888_burst_req *b)
+{
+    uint64_t samples = b->info.samples;
+    uint64_t start = dev->burst_pos;
+
+    if (RX888_BURST_NEXT == b->start_index) {
+        if (dev->burst_last_end > start)
+            start = dev->burst_last_end;
+    } else if (RX888_BURST_NOW != b->start_index) {
+        /* stream indices count the lost samples too */
+        uint64_t skew = dev->burst_skew + dev->burst_lost;
+        uint64_t index = b->start_index > skew ? b->start_index - skew : 0;
+
+        index = (index + dev->burst_align - 1) / dev->burst_align *
+                dev->burst_align;
+        if (index * sizeof(int16_t) > start)
+            start = index * sizeof(int16_t);
+    }
+
+    b->start = start;
+    b->end = start + samples * sizeof(int16_t);
+    b->resolved = true;
+    dev->burst_last_end = b->end;
+}
+
+/* point a transfer at the next stretch of the stream and submit it */
+static int _rx888_burst_submit(rx888_dev_t *dev, struct rx888_burst_xfer *bx)
+{
+    struct libusb_transfer *xfer = dev->xfer[bx->index];
+    unsigned char *buf = dev->xfer_buf[bx->index];
+    uint64_t len = dev->xfer_buf_len;
+    int r;
+
+    bx->req = NULL;
+    while (dev->burst_sub < dev->burst_num) {
+        struct rx888_burst_req *b =
+            &dev->burst_q[(dev->burst_head + dev->burst_sub) % BURST_QUEUE];
+
+        if (!b->resolved)
+            _rx888_burst_resolve(dev, b);
+
+        /* dropped up to the start of the burst */
+        if (b->start > dev->burst_pos) {
+            if (b->start - dev->burst_pos < len)
+                len = b->start - dev->burst_pos;
+            break;
+        }
+
+        if (dev->burst_pos < b->end) {
+            if (b->end - dev->burst_pos < len)
+                len = b->end - dev->burst_pos;
+            buf = (unsigned char *)b->info.data + (dev->burst_pos - b->start);
+            bx->req = b;
+            break;
+        }
+
+        dev->burst_sub++;
+    }
+
+    xfer->buffer = buf;
+    xfer->length = (int)len;
+    bx->pos = dev->burst_pos;
+    bx->lost = dev->burst_lost;
+
+    r = libusb_submit_transfer(xfer);
+    if (r < 0)
+        return r;
+
+    dev->burst_pos += len;
+    dev->burst_lost = 0;
+    dev->burst_inflight += len;
+    dev->xfer_inflight++;
 
     return 0;
 }
 
-static int _rx888_free_async_buffers(rx888_dev_t *dev)
+/* samples within a burst that never arrived or were settling */
+static void _rx888_burst_gap(struct rx888_burst_req *b, unsigned char *buf,
+                             uint32_t len)
 {
-    unsigned int i;
+    memset(buf, 0, len);
+    b->info.gaps++;
+    b->info.lost_samples += len / sizeof(int16_t);
+}
 
-    if (!dev)
-        return -1;
+static void LIBUSB_CALL _rx888_burst_callback(struct libusb_transfer *xfer)
+{
+    struct rx888_burst_xfer *bx = (struct rx888_burst_xfer *)xfer->user_data;
+    struct rx888_burst_req *b = bx->req;
+    rx888_dev_t *dev = bx->dev;
+    uint32_t len = xfer->actual_length;
 
-    if (dev->xfer) {
-        for(i = 0; i < dev->xfer_buf_num; ++i) {
-            if (dev->xfer[i]) {
-                libusb_free_transfer(dev->xfer[i]);
-            }
+    dev->xfer_inflight--;
+    dev->burst_inflight -= xfer->length;
+
+    if (LIBUSB_TRANSFER_CANCELLED == xfer->status)
+        return;
+
+    if (LIBUSB_TRANSFER_COMPLETED != xfer->status) {
+        len = 0;
+#ifndef _WIN32
+        if (LIBUSB_TRANSFER_ERROR == xfer->status) {
+            dev->xfer_errors++;
+            STAT_ADD(dev->stat_xfer_errors, 1);
         }
 
-        free(dev->xfer);
-        dev->xfer = NULL;
+        if (dev->xfer_errors >= dev->xfer_buf_num ||
+            LIBUSB_TRANSFER_NO_DEVICE == xfer->status) {
+#endif
+            dev->dev_lost = true;
+            if (RX888_RUNNING == dev->async_status)
+                STAT_ADD(dev->stat_losses, 1);
+            rx888_cancel_async(dev);
+            fprintf(stderr, "cb transfer status: %d, "
+                "canceling...\n", xfer->status);
+#ifndef _WIN32
+        }
+#endif
+    } else {
+        dev->xfer_errors = 0;
     }
 
-    if (dev->xfer_buf) {
-        for (i = 0; i < dev->xfer_buf_num; ++i) {
-            if (dev->xfer_buf[i]) {
-                free(dev->xfer_buf[i]);
+    if (len && _rx888_retune_discard(dev, len)) {
+        STAT_ADD(dev->stat_discarded, len / sizeof(int16_t));
+        len = 0;
+    } else if (len) {
+        if (atomic_load_explicit(&dev->randomizer, memory_order_relaxed))
+            rx888_kernel_derandomize((int16_t *)xfer->buffer,
+                                     len / sizeof(int16_t));
+        STAT_ADD(dev->stat_buffers, 1);
+        STAT_ADD(dev->stat_samples, len / sizeof(int16_t));
+    }
+
+    dev->burst_skew += bx->lost;
+
+    if (b) {
+        RX888_TRACE_INSTANT("burst transfer", len);
+
+        if (bx->pos == b->start) {
+            uint32_t rate = dev->stream_rate ? dev->stream_rate : 1;
+
+            b->info.sample_index = b->start / sizeof(int16_t) +
+                                   dev->burst_skew;
+            b->info.timestamp_ns = _rx888_now_ns() -
+                (uint64_t)len / sizeof(int16_t) * 1000000000ULL / rate;
+        } else if (bx->lost) {
+            b->info.gaps++;
+            b->info.lost_samples += bx->lost;
+        }
+
+        if (len < (uint32_t)xfer->length)
+            _rx888_burst_gap(b, xfer->buffer + len, xfer->length - len);
+
+        b->done += xfer->length;
+    }
+
+    if (RX888_RUNNING == dev->async_status &&
+        _rx888_burst_submit(dev, bx) < 0) {
+        fprintf(stderr, "Failed to resubmit burst transfer, "
+                "canceling...\n");
+        rx888_cancel_async(dev);
+    }
+}
+
+/* the device overflowed once more samples arrived while events were not
+ * handled than the transfers in flight and the FX3 could take */
+static void _rx888_burst_overrun(rx888_dev_t *dev)
+{
+    uint64_t now = _rx888_now_ns();
+    uint64_t arrived = (now - dev->burst_idle_ns) * dev->stream_rate /
+                       1000000000ULL;
+    uint64_t room = (dev->burst_inflight + FX3_BUFFER_BYTES) /
+                    sizeof(int16_t);
+
+    if (arrived > room) {
+        dev->burst_lost += arrived - room;
+        STAT_ADD(dev->stat_overruns, 1);
+        STAT_ADD(dev->stat_lost, arrived - room);
+    }
+}
+
+static int _rx888_burst_submit_all(rx888_dev_t *dev)
+{
+    for (uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
+        int r = _rx888_burst_submit(dev, &dev->burst_xfer[i]);
+
+        if (r < 0) {
+            fprintf(stderr, "Failed to submit transfer %u\n", i);
+            rx888_burst_stop(dev);
+            return r;
+        }
+    }
+
+    dev->burst_idle_ns = _rx888_now_ns();
+
+    return 0;
+}
+
+/* set up the burst stream, submit only when asked to so that a first burst
+ * can be queued before */
+static int _rx888_burst_start(rx888_dev_t *dev, uint32_t buf_num,
+                              uint32_t buf_len, bool submit)
+{
+    uint32_t packet;
+    int r;
+
+    if (!dev || dev->replay || dev->ring_on)
+        return -1;
+
+    /* bursts size their own transfers */
+    if (RX888_INACTIVE != dev->async_status || dev->session)
+        return -2;
+
+    _rx888_stream_reset(dev, NULL, NULL, NULL, buf_num, buf_len);
+    dev->xfer_target = dev->xfer_buf_num;
+
+    /* a transfer ending inside a packet overflows, so every split of the
+     * stream falls on a packet boundary */
+    r = libusb_get_max_packet_size(libusb_get_device(dev->dev_handle), 0x81);
+    packet = r > 0 ? (uint32_t)r : BURST_PACKET;
+    dev->burst_align = packet / sizeof(int16_t);
+    dev->xfer_buf_len -= dev->xfer_buf_len % packet;
+    if (!dev->xfer_buf_len)
+        dev->xfer_buf_len = packet;
+
+    r = _rx888_alloc_async_buffers(dev);
+    dev->burst_xfer = calloc(dev->xfer_buf_num,
+                             sizeof(struct rx888_burst_xfer));
+    if (r < 0 || !dev->burst_xfer) {
+        _rx888_free_async_buffers(dev);
+        free(dev->burst_xfer);
+        dev->burst_xfer = NULL;
+        _rx888_set_status(dev, RX888_INACTIVE);
+        return r < 0 ? r : -ENOMEM;
+    }
+
+    dev->burst = true;
+    dev->burst_head = 0;
+    dev->burst_num = 0;
+    dev->burst_sub = 0;
+    dev->burst_pos = 0;
+    dev->burst_last_end = 0;
+    dev->burst_inflight = 0;
+    dev->burst_skew = 0;
+    dev->burst_lost = 0;
+
+    for (uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
+        struct rx888_burst_xfer *bx = &dev->burst_xfer[i];
+
+        bx->dev = dev;
+        bx->index = i;
+        libusb_fill_bulk_transfer(dev->xfer[i], dev->dev_handle, 0x81,
+                                  dev->xfer_buf[i], dev->xfer_buf_len,
+                                  _rx888_burst_callback, bx, 0);
+    }
+
+    return submit ? _rx888_burst_submit_all(dev) : 0;
+}
+
+int rx888_burst_start(rx888_dev_t *dev, uint32_t buf_num, uint32_t buf_len)
+{
+    return _rx888_burst_start(dev, buf_num, buf_len, true);
+}
+
+int rx888_burst_queue(rx888_dev_t *dev, int16_t *buf, uint64_t samples,
+                      uint64_t start_index)
+{
+    struct rx888_burst_req *b;
+
+    if (!dev || !dev->burst || !buf)
+        return -1;
+
+    if (!samples || samples % dev->burst_align)
+        return -EINVAL;
+
+    if (dev->burst_num >= BURST_QUEUE)
+        return -EBUSY;
+
+    b = &dev->burst_q[(dev->burst_head + dev->burst_num) % BURST_QUEUE];
+    memset(b, 0, sizeof(*b));
+    b->start_index = start_index;
+    b->info.data = buf;
+    b->info.samples = samples;
+    dev->burst_num++;
+
+    return 0;
+}
+
+int rx888_burst_wait(rx888_dev_t *dev, rx888_burst_info_t *info,
+                     unsigned int timeout_ms)
+{
+    uint64_t deadline = _rx888_now_ns() + timeout_ms * 1000000ULL;
+    struct rx888_burst_req *b;
+
+    if (!dev || !dev->burst)
+        return -1;
+
+    if (!dev->burst_num)
+        return -2;
+
+    b = &dev->burst_q[dev->burst_head];
+
+    while (!b->resolved || b->done < b->end - b->start) {
+        struct timeval tv = { 1, 0 };
+        int r;
+
+        if (RX888_RUNNING != dev->async_status)
+            return -1;
+
+        if (timeout_ms) {
+            uint64_t now = _rx888_now_ns();
+
+            if (now >= deadline)
+                return LIBUSB_ERROR_TIMEOUT;
+            if (deadline - now < 1000000000ULL) {
+                tv.tv_sec = 0;
+                tv.tv_usec = (deadline - now) / 1000;
             }
         }
 
-        free(dev->xfer_buf);
-        dev->xfer_buf = NULL;
+        _rx888_burst_overrun(dev);
+
+        RX888_TRACE_BEGIN("handle events", dev->xfer_inflight);
+        r = libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+        RX888_TRACE_END("handle events", dev->xfer_inflight);
+        dev->burst_idle_ns = _rx888_now_ns();
+
+        if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED)
+            return r;
     }
 
+    if (info)
+        *info = b->info;
+
+    dev->burst_head = (dev->burst_head + 1) % BURST_QUEUE;
+    dev->burst_num--;
+    if (dev->burst_sub)
+        dev->burst_sub--;
+
     return 0;
 }
 
+int rx888_burst_stop(rx888_dev_t *dev)
+{
+    if (!dev)
+        return -1;
 
-int rx888_read_async(rx888_dev_t *dev, rx888_read_async_cb_t cb, void *ctx,
-              uint32_t buf_num, uint32_t buf_len)
+    if (!dev->burst)
+        return -2;
+
+    _rx888_stream_stop(dev);
+
+    free(dev->burst_xfer);
+    dev->burst_xfer = NULL;
+    dev->burst = false;
+
+    return 0;
+}
+
+int rx888_capture_burst(rx888_dev_t *dev, int16_t *buf, uint64_t samples,
+                        uint64_t start_index, rx888_burst_info_t *info)
 {
-    int r = 0;
-    struct timeval tv = { 1, 0 };
-    struct timeval zerotv = { 0, 0 };
-    enum rx888_async_status next_status = RX888_INACTIVE;
+    bool oneshot;
+    int r;
 
     if (!dev)
         return -1;
 
-    if (RX888_INACTIVE != dev->async_status)
+    oneshot = !dev->burst;
+    if (oneshot) {
+        r = _rx888_burst_start(dev, 0, 0, false);
+        if (r < 0)
+            return r;
+    } else if (dev->burst_num) {
         return -2;
+    }
 
-    dev->async_status = RX888_RUNNING;
-    dev->async_cancel = false;
+    /* queued first, a one shot burst starts with the stream */
+    r = rx888_burst_queue(dev, buf, samples, start_index);
+    if (r == 0 && oneshot)
+        r = _rx888_burst_submit_all(dev);
+    if (r == 0)
+        r = rx888_burst_wait(dev, info, 0);
 
-    dev->cb = cb;
-    dev->cb_ctx = ctx;
+    if (oneshot)
+        rx888_burst_stop(dev);
 
-    if (buf_num > 0)
-        dev->xfer_buf_num = buf_num;
-    else
-        dev->xfer_buf_num = DEFAULT_BUF_NUMBER;
+    return r;
+}
 
-    if (buf_len > 0 && buf_len % 512 == 0) /* len must be multiple of 512 */
-        dev->xfer_buf_len = buf_len;
-    else
-        dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
+int16_t *rx888_burst_alloc(rx888_dev_t *dev, uint64_t samples)
+{
+    size_t size = BURST_MEM_HEADER + samples * sizeof(int16_t);
+    struct rx888_burst_mem *mem = NULL;
+    bool dev_mem = false;
+
+    if (!dev || !samples)
+        return NULL;
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+    if (dev->dev_handle) {
+        mem = (struct rx888_burst_mem *)libusb_dev_mem_alloc(dev->dev_handle,
+                                                             size);
+        dev_mem = mem != NULL;
+    }
+#endif
+    if (!mem)
+        mem = malloc(size);
+    if (!mem)
+        return NULL;
 
-    _rx888_alloc_async_buffers(dev);
+    mem->size = size;
+    mem->dev_mem = dev_mem;
 
-    for(uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
-        libusb_fill_bulk_transfer(dev->xfer[i],
-                      dev->dev_handle,
-                      0x81,
-                      dev->xfer_buf[i],
-                      dev->xfer_buf_len,
-                      _libusb_callback,
-                      (void *)dev,
-                      0);
+    return (int16_t *)((unsigned char *)mem + BURST_MEM_HEADER);
+}
 
-        r = libusb_submit_transfer(dev->xfer[i]);
-        if (r < 0) {
-            fprintf(stderr, "Failed to submit transfer %i\n"
-                    "Please increase your allowed " 
-                    "usbfs buffer size with the "
-                    "following command:\n"
-                    "echo 0 > /sys/module/usbcore"
-                    "/parameters/usbfs_memory_mb\n", i);
-            dev->async_status = RX888_CANCELING;
-            break;
-        }
+void rx888_burst_free(rx888_dev_t *dev, int16_t *buf)
+{
+    struct rx888_burst_mem *mem;
+
+    if (!dev || !buf)
+        return;
+
+    mem = (struct rx888_burst_mem *)((unsigned char *)buf - BURST_MEM_HEADER);
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+    if (mem->dev_mem) {
+        libusb_dev_mem_free(dev->dev_handle, (unsigned char *)mem, mem->size);
+        return;
     }
-    
-    //rx888_send_command(dev->dev_handle, STARTADC, dev->sample_rate);
-    //rx888_send_command(dev->dev_handle, STARTFX3, 0);
+#endif
+    free(mem);
+}
 
-    while (RX888_INACTIVE != dev->async_status) {
-        r = libusb_handle_events_timeout_completed(dev->ctx, &tv,
-                               &dev->async_cancel);
-        if (r < 0) {
-            /*fprintf(stderr, "handle_events returned: %d\n", r);*/
-            if (r == LIBUSB_ERROR_INTERRUPTED) /* stray signal */
-                continue;
-            break;
-        }
+int rx888_read_next(rx888_dev_t *dev, unsigned char **buf, uint32_t *len,
+                    const rx888_buffer_info_t **info)
+{
+    struct timeval zerotv = { 0, 0 };
+    struct rx888_ready *slot;
+    uint32_t off;
 
-        if (RX888_CANCELING == dev->async_status) {
-            next_status = RX888_INACTIVE;
+    if (!dev || !buf || !len)
+        return -1;
 
-            if (!dev->xfer)
-                break;
+    if (!dev->readahead)
+        return -2;
 
-            for(uint32_t i = 0; i < dev->xfer_buf_num; ++i) {
-                if (!dev->xfer[i])
-                    continue;
+    if (dev->ready_num <= dev->ready_out) {
+        if (RX888_RUNNING != dev->async_status)
+            return -1;
 
-                if (LIBUSB_TRANSFER_CANCELLED !=
-                        dev->xfer[i]->status) {
-                    r = libusb_cancel_transfer(dev->xfer[i]);
-                    /* handle events after canceling
-                     * to allow transfer status to
-                     * propagate */
-#ifdef _WIN32
-                    Sleep(1);
+        int r = libusb_handle_events_timeout_completed(dev->ctx, &zerotv,
+                                                       NULL);
+        if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED)
+            return r;
+
+        if (dev->ready_num <= dev->ready_out)
+            return 0;
+    }
+
+    slot = &dev->ready[(dev->ready_head + dev->ready_out) % dev->xfer_buf_num];
+    /* the head may have been partly read by rx888_read_sync() */
+    off = dev->ready_out ? 0 : dev->ready_off;
+    *buf = slot->xfer->buffer + off;
+    *len = slot->xfer->actual_length - off;
+    if (info)
+        *info = &slot->info;
+    dev->ready_out++;
+    _rx888_ready_notify(dev);
+
+    return 1;
+}
+
+int rx888_release_buffer(rx888_dev_t *dev)
+{
+    if (!dev || !dev->ready_out)
+        return -1;
+
+    dev->ready_out--;
+    _rx888_ready_release(dev);
+
+    return 0;
+}
+
+#ifdef __linux__
+/* libusb pollfd events use the poll() bits, which match the epoll ones */
+static void LIBUSB_CALL _rx888_pollfd_added(int fd, short events,
+                                            void *user_data)
+{
+    rx888_dev_t *dev = (rx888_dev_t *)user_data;
+    struct epoll_event ev = { .events = (uint32_t)events, .data.fd = fd };
+
+    epoll_ctl(dev->poll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void LIBUSB_CALL _rx888_pollfd_removed(int fd, void *user_data)
+{
+    rx888_dev_t *dev = (rx888_dev_t *)user_data;
+
+    epoll_ctl(dev->poll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
 #endif
-                    libusb_handle_events_timeout_completed(dev->ctx,
-                                           &zerotv, NULL);
-                    if (r < 0)
-                        continue;
 
-                    next_status = RX888_CANCELING;
-                }
-            }
+int rx888_get_poll_fd(rx888_dev_t *dev)
+{
+#ifdef __linux__
+    const struct libusb_pollfd **fds;
 
-            if (dev->dev_lost || RX888_INACTIVE == next_status) {
-                /* handle any events that still need to
-                 * be handled before exiting after we
-                 * just cancelled all transfers */
-                libusb_handle_events_timeout_completed(dev->ctx,
-                                       &zerotv, NULL);
-                break;
-            }
-        }
+    if (!dev || dev->replay)
+        return -1;
+
+    if (dev->poll_fd >= 0)
+        return dev->poll_fd;
+
+    dev->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (dev->poll_fd < 0)
+        return -1;
+
+    dev->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    fds = dev->ready_fd >= 0 ? libusb_get_pollfds(dev->ctx) : NULL;
+    if (!fds) {
+        if (dev->ready_fd >= 0)
+            close(dev->ready_fd);
+        close(dev->poll_fd);
+        dev->poll_fd = -1;
+        dev->ready_fd = -1;
+        return -1;
     }
 
-    _rx888_free_async_buffers(dev);
+    /* buffers already read ahead do not show on the libusb descriptors */
+    _rx888_pollfd_added(dev->ready_fd, EPOLLIN, dev);
+    dev->ready_signaled = false;
+    _rx888_ready_notify(dev);
 
-    dev->async_status = next_status;
+    for (int i = 0; fds[i]; i++)
+        _rx888_pollfd_added(fds[i]->fd, fds[i]->events, dev);
+    libusb_free_pollfds(fds);
 
-    return r;
+    libusb_set_pollfd_notifiers(dev->ctx, _rx888_pollfd_added,
+                                _rx888_pollfd_removed, dev);
+
+    return dev->poll_fd;
+#else
+    (void)dev;
+    return -1;
+#endif
 }
 
 int rx888_cancel_async(rx888_dev_t *dev)
 {
+    enum rx888_async_status running = RX888_RUNNING;
+
     if (!dev)
         return -1;
 
     /* if streaming, try to cancel gracefully */
-    if (RX888_RUNNING == dev->async_status) {
-        dev->async_status = RX888_CANCELING;
+    if (atomic_compare_exchange_strong(&dev->async_status, &running,
+                                       RX888_CANCELING)) {
+        RX888_TRACE_INSTANT("cancel", 0);
         dev->async_cancel = true;
         //rx888_send_command(dev->dev_handle, STOPFX3, 0);
         return 0;
@@ -727,7 +3310,7 @@ int rx888_cancel_async(rx888_dev_t *dev)
     /* if called while in pending state, change the state forcefully */
 #if 0
     if (RX888_INACTIVE != dev->async_status) {
-        dev->async_status = RX888_INACTIVE;
+        _rx888_set_status(dev, RX888_INACTIVE);
         return 0;
     }
 #endif
@@ -0,0 +1,425 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "librx888.h"
+
+#ifdef _WIN32
+int rx888_metrics_start(rx888_metrics_t **out, rx888_dev_t *dev,
+                        const char *listen_addr, rx888_metrics_cb_t extra,
+                        void *ctx)
+{
+    (void)out;
+    (void)dev;
+    (void)listen_addr;
+    (void)extra;
+    (void)ctx;
+    return -ENOSYS;
+}
+
+void rx888_metrics_stop(rx888_metrics_t *m)
+{
+    (void)m;
+}
+
+void rx888_metrics_value(rx888_metrics_t *m, const char *name,
+                         const char *type, const char *help, double value)
+{
+    (void)m;
+    (void)name;
+    (void)type;
+    (void)help;
+    (void)value;
+}
+#else
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_DEFAULT_HOST "127.0.0.1"
+#define METRICS_POLL_MS 250
+#define METRICS_IO_TIMEOUT_MS 1000
+#define METRICS_BODY_SIZE 8192
+
+/*
+ * Prometheus text exporter. Everything is read from the relaxed atomic
+ * counters the data path keeps anyway, from a thread of its own, so a
+ * scrape never touches the USB callback.
+ */
+struct rx888_metrics {
+    rx888_dev_t *dev;
+    rx888_metrics_cb_t extra;
+    void *extra_ctx;
+    int fd;
+    char *unix_path;
+    pthread_t thread;
+    atomic_bool stop;
+    /* throughput between two scrapes */
+    uint64_t last_samples;
+    double last_time;
+    /* response being built */
+    char *body;
+    size_t len;
+    size_t size;
+};
+
+static double _metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void _metrics_printf(rx888_metrics_t *m, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(m->body + m->len, m->size - m->len, fmt, ap);
+        va_end(ap);
+
+        if (n < 0)
+            return;
+        if ((size_t)n < m->size - m->len)
+            break;
+
+        char *body = realloc(m->body, m->size * 2 + n);
+        if (!body)
+            return;
+        m->body = body;
+        m->size = m->size * 2 + n;
+    }
+
+    m->len += n;
+}
+
+void rx888_metrics_value(rx888_metrics_t *m, const char *name,
+                         const char *type, const char *help, double value)
+{
+    if (!m || !name)
+        return;
+
+    if (help)
+        _metrics_printf(m, "# HELP %s %s\n", name, help);
+    if (type)
+        _metrics_printf(m, "# TYPE %s %s\n", name, type);
+    _metrics_printf(m, "%s %.17g\n", name, value);
+}
+
+static void _metrics_build(rx888_metrics_t *m)
+{
+    rx888_stream_stats_t st;
+    rx888_latency_stats_t lat;
+    double now = _metrics_now();
+
+    m->len = 0;
+    m->body[0] = '\0';
+
+    if (rx888_get_stream_stats(m->dev, &st) == 0) {
+        double dt = now - m->last_time;
+
+        rx888_metrics_value(m, "rx888_samples_total", "counter",
+                            "Samples delivered to the application.",
+                            st.samples);
+        rx888_metrics_value(m, "rx888_buffers_total", "counter",
+                            "Buffers delivered to the application.",
+                            st.buffers);
+        rx888_metrics_value(m, "rx888_throughput_samples_per_second",
+                            "gauge", "Sample rate delivered since the "
+                            "previous scrape.",
+                            m->last_time > 0 && dt > 0 ?
+                            (st.samples - m->last_samples) / dt : 0);
+        rx888_metrics_value(m, "rx888_transfer_errors_total", "counter",
+                            "Failed USB transfers.", st.xfer_errors);
+        rx888_metrics_value(m, "rx888_overruns_total", "counter",
+                            "Readahead pool overruns.", st.overruns);
+        rx888_metrics_value(m, "rx888_lost_samples_total", "counter",
+                            "Samples lost to overruns and device losses, "
+                            "estimated.", st.lost_samples);
+        rx888_metrics_value(m, "rx888_device_losses_total", "counter",
+                            "Device lost while streaming.",
+                            st.device_losses);
+        rx888_metrics_value(m, "rx888_recoveries_total", "counter",
+                            "Streaming resumed after a device loss.",
+                            st.recoveries);
+        rx888_metrics_value(m, "rx888_last_recovery_seconds", "gauge",
+                            "Device loss to resumed streaming, last "
+                            "recovery.", st.last_recovery_us * 1e-6);
+        rx888_metrics_value(m, "rx888_discarded_samples_total", "counter",
+                            "Samples dropped around sample rate changes.",
+                            st.discarded_samples);
+        rx888_metrics_value(m, "rx888_clipped_samples_total", "counter",
+                            "Clipped ADC samples, with health enabled.",
+                            st.clipped_samples);
+        rx888_metrics_value(m, "rx888_queue_depth", "gauge",
+                            "Transfers kept in flight.",
+                            st.transfers_in_flight);
+        rx888_metrics_value(m, "rx888_transfer_size_bytes", "gauge",
+                            "Bytes per transfer.", st.transfer_size);
+        rx888_metrics_value(m, "rx888_max_completion_gap_seconds", "gauge",
+                            "Worst transfer completion gap of the last "
+                            "second, automatic buffers only.",
+                            st.max_completion_gap_us * 1e-6);
+
+        m->last_samples = st.samples;
+        m->last_time = now;
+    }
+
+    if (rx888_get_latency_stats(m->dev, &lat) == 0 && lat.count) {
+        static const char *q[] = { "0.5", "0.9", "0.99", "0.999" };
+        uint32_t v[] = { lat.p50_us, lat.p90_us, lat.p99_us, lat.p999_us };
+
+        _metrics_printf(m, "# HELP rx888_callback_latency_seconds ADC to "
+                        "callback latency.\n"
+                        "# TYPE rx888_callback_latency_seconds summary\n");
+        for (int i = 0; i < 4; i++)
+            _metrics_printf(m, "rx888_callback_latency_seconds"
+                            "{quantile=\"%s\"} %.6f\n", q[i], v[i] * 1e-6);
+        _metrics_printf(m, "rx888_callback_latency_seconds_count %llu\n",
+                        (unsigned long long)lat.count);
+    }
+
+    rx888_metrics_value(m, "rx888_sample_rate_hz", "gauge",
+                        "Configured sample rate.",
+                        rx888_get_sample_rate(m->dev));
+    rx888_metrics_value(m, "rx888_hf_attenuation_db", "gauge",
+                        "Current HF attenuation.",
+                        rx888_get_hf_attenuation(m->dev));
+
+    if (m->extra)
+        m->extra(m, m->extra_ctx);
+}
+
+static void _metrics_write_all(int fd, const char *buf, size_t len)
+{
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+
+    while (len) {
+        /* a scraper hanging up must not raise SIGPIPE in the application */
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN &&
+            poll(&pfd, 1, METRICS_IO_TIMEOUT_MS) > 0)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void _metrics_serve(rx888_metrics_t *m, int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char req[1024], head[160];
+    ssize_t n;
+
+    /* the request line is all that matters, every path gets the metrics */
+    if (poll(&pfd, 1, METRICS_IO_TIMEOUT_MS) <= 0)
+        return;
+    n = read(fd, req, sizeof(req) - 1);
+    if (n <= 0)
+        return;
+    req[n] = '\0';
+
+    if (strncmp(req, "GET ", 4)) {
+        static const char bad[] = "HTTP/1.0 405 Method Not Allowed\r\n"
+                                  "Content-Length: 0\r\n\r\n";
+        _metrics_write_all(fd, bad, sizeof(bad) - 1);
+        return;
+    }
+
+    _metrics_build(m);
+
+    n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n\r\n", m->len);
+    _metrics_write_all(fd, head, n);
+    _metrics_write_all(fd, m->body, m->len);
+}
+
+static void *_metrics_thread(void *arg)
+{
+    rx888_metrics_t *m = arg;
+    struct pollfd pfd = { m->fd, POLLIN, 0 };
+
+    while (!atomic_load(&m->stop)) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+            continue;
+
+        int fd = accept(m->fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        _metrics_serve(m, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int _metrics_listen_unix(rx888_metrics_t *m, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -EINVAL;
+    strcpy(addr.sun_path, path);
+
+    m->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m->fd < 0)
+        return -errno;
+
+    unlink(path);
+    if (bind(m->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -errno;
+
+    m->unix_path = malloc(strlen(path) + 1);
+    if (m->unix_path)
+        strcpy(m->unix_path, path);
+
+    return 0;
+}
+
+static int _metrics_listen_tcp(rx888_metrics_t *m, const char *listen_addr)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM,
+                              .ai_flags = AI_PASSIVE };
+    struct addrinfo *res;
+    const char *colon = strrchr(listen_addr, ':');
+    const char *port = colon ? colon + 1 : listen_addr;
+    char host[256] = METRICS_DEFAULT_HOST;
+    int one = 1, r;
+
+    /* "port", ":port" or "host:port", IPv6 hosts in brackets */
+    if (colon && colon != listen_addr) {
+        size_t n = colon - listen_addr;
+
+        if (listen_addr[0] == '[' && listen_addr[n - 1] == ']') {
+            listen_addr++;
+            n -= 2;
+        }
+        if (n >= sizeof(host))
+            return -EINVAL;
+        memcpy(host, listen_addr, n);
+        host[n] = '\0';
+    }
+
+    r = getaddrinfo(host, port, &hints, &res);
+    if (r)
+        return -EINVAL;
+
+    m->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (m->fd < 0) {
+        freeaddrinfo(res);
+        return -errno;
+    }
+
+    setsockopt(m->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    r = bind(m->fd, res->ai_addr, res->ai_addrlen) < 0 ? -errno : 0;
+    freeaddrinfo(res);
+
+    return r;
+}
+
+int rx888_metrics_start(rx888_metrics_t **out, rx888_dev_t *dev,
+                        const char *listen_addr, rx888_metrics_cb_t extra,
+                        void *ctx)
+{
+    rx888_metrics_t *m;
+    int r;
+
+    if (!out || !dev || !listen_addr)
+        return -EINVAL;
+
+    m = calloc(1, sizeof(*m));
+    if (!m)
+        return -ENOMEM;
+
+    m->dev = dev;
+    m->extra = extra;
+    m->extra_ctx = ctx;
+    m->fd = -1;
+    m->size = METRICS_BODY_SIZE;
+    m->body = malloc(m->size);
+    if (!m->body) {
+        free(m);
+        return -ENOMEM;
+    }
+
+    if (!strncmp(listen_addr, "unix:", 5))
+        r = _metrics_listen_unix(m, listen_addr + 5);
+    else
+        r = _metrics_listen_tcp(m, listen_addr);
+
+    if (!r && listen(m->fd, 8) < 0)
+        r = -errno;
+
+    if (!r) {
+        r = -pthread_create(&m->thread, NULL, _metrics_thread, m);
+    }
+
+    if (r) {
+        if (m->fd >= 0)
+            close(m->fd);
+        if (m->unix_path)
+            unlink(m->unix_path);
+        free(m->unix_path);
+        free(m->body);
+        free(m);
+        return r;
+    }
+
+    *out = m;
+
+    return 0;
+}
+
+void rx888_metrics_stop(rx888_metrics_t *m)
+{
+    if (!m)
+        return;
+
+    atomic_store(&m->stop, true);
+    pthread_join(m->thread, NULL);
+
+    close(m->fd);
+    if (m->unix_path)
+        unlink(m->unix_path);
+    free(m->unix_path);
+    free(m->body);
+    free(m);
+}
+#endif /* _WIN32 */
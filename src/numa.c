@@ -0,0 +1,193 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "numa.h"
+
+#ifdef __linux__
+/* from <numaif.h>, which would pull in libnuma for one system call */
+#define MPOL_PREFERRED 1
+#define NUMA_MAX_NODES 1024
+
+static int _numa_read_int(const char *path, int *value)
+{
+    FILE *f = fopen(path, "r");
+    int r;
+
+    if (!f)
+        return -errno;
+
+    r = fscanf(f, "%d", value) == 1 ? 0 : -EINVAL;
+    fclose(f);
+
+    return r;
+}
+
+int rx888_numa_usb_node(uint8_t bus, const uint8_t *ports, int num_ports)
+{
+    char path[PATH_MAX], *dir, *slash;
+    int len, node = -1;
+
+    if (num_ports <= 0)
+        return -1;
+
+    /* the device as the kernel names it, 1-4.2 for port 2 of a hub on
+     * port 4 of bus 1 */
+    len = snprintf(path, sizeof(path), "/sys/bus/usb/devices/%u-%u", bus,
+                   ports[0]);
+    for (int i = 1; i < num_ports && len < (int)sizeof(path); i++)
+        len += snprintf(path + len, sizeof(path) - len, ".%u", ports[i]);
+
+    dir = realpath(path, NULL);
+    if (!dir)
+        return -1;
+
+    /* up the hubs to the PCI function of the host controller, the first
+     * one that has a node at all */
+    while ((slash = strrchr(dir, '/')) && slash != dir) {
+        *slash = '\0';
+        if (snprintf(path, sizeof(path), "%s/numa_node", dir) <
+            (int)sizeof(path) && _numa_read_int(path, &node) == 0)
+            break;
+    }
+    free(dir);
+
+    return node >= 0 ? node : -1;
+}
+
+int rx888_numa_bind(void *addr, size_t len, int node)
+{
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    const size_t bits = 8 * sizeof(unsigned long);
+
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        return -EINVAL;
+
+    mask[node / bits] = 1UL << (node % bits);
+
+    /* preferred, not bound: a full node falls back instead of failing */
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+                NUMA_MAX_NODES + 1, 0) < 0)
+        return -errno;
+
+    return 0;
+}
+
+void *rx888_numa_alloc(size_t len, int node)
+{
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == addr)
+        return NULL;
+
+    rx888_numa_bind(addr, len, node);
+
+    return addr;
+}
+
+void rx888_numa_free(void *addr, size_t len)
+{
+    if (addr)
+        munmap(addr, len);
+}
+
+int rx888_numa_pin(int node)
+{
+    char path[64], list[4096], *p = list;
+    cpu_set_t set;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    f = fopen(path, "r");
+    if (!f)
+        return -ENODEV;
+    if (!fgets(list, sizeof(list), f))
+        list[0] = '\0';
+    fclose(f);
+
+    /* 0-7,16-23 */
+    CPU_ZERO(&set);
+    while (*p >= '0' && *p <= '9') {
+        long first = strtol(p, &p, 10), last = first;
+
+        if (*p == '-')
+            last = strtol(p + 1, &p, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &set);
+        if (*p == ',')
+            p++;
+    }
+
+    if (!CPU_COUNT(&set))
+        return -ENODEV;
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        return -errno;
+
+    return 0;
+}
+#else
+int rx888_numa_usb_node(uint8_t bus, const uint8_t *ports, int num_ports)
+{
+    (void)bus;
+    (void)ports;
+    (void)num_ports;
+    return -1;
+}
+
+int rx888_numa_bind(void *addr, size_t len, int node)
+{
+    (void)addr;
+    (void)len;
+    (void)node;
+    return -ENOSYS;
+}
+
+void *rx888_numa_alloc(size_t len, int node)
+{
+    (void)len;
+    (void)node;
+    return NULL;
+}
+
+void rx888_numa_free(void *addr, size_t len)
+{
+    (void)addr;
+    (void)len;
+}
+
+int rx888_numa_pin(int node)
+{
+    (void)node;
+    return -ENOSYS;
+}
+#endif
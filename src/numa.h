@@ -0,0 +1,45 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_NUMA_H
+#define RX888_NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Placement of the data path next to the USB host controller, read from
+ * sysfs and applied with mbind() and the scheduler affinity. Linux only,
+ * elsewhere there is no node and the calls fail with -ENOSYS.
+ */
+
+/* node of the host controller behind a device, -1 if unknown */
+int rx888_numa_usb_node(uint8_t bus, const uint8_t *ports, int num_ports);
+
+/* prefer the node for the pages of a mapping, before they are touched */
+int rx888_numa_bind(void *addr, size_t len, int node);
+
+/* page aligned anonymous memory preferring the node */
+void *rx888_numa_alloc(size_t len, int node);
+
+void rx888_numa_free(void *addr, size_t len);
+
+/* run the calling thread on the CPUs of the node only */
+int rx888_numa_pin(int node);
+
+#endif /* RX888_NUMA_H */
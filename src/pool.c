@@ -0,0 +1,186 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "pool.h"
+
+#define MAX_THREADS 256
+
+struct pool_job {
+    rx888_pool_fn_t fn;
+    void *arg;
+};
+
+struct pool_worker {
+    rx888_pool_t *pool;
+    pthread_t thread;
+    unsigned int index;
+};
+
+struct rx888_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct pool_job *queue;
+    unsigned int queue_len;
+    unsigned int head;
+    unsigned int count;
+    bool stop;
+    struct pool_worker *workers;
+    unsigned int threads;
+};
+
+static void *pool_thread(void *arg)
+{
+    struct pool_worker *w = arg;
+    rx888_pool_t *pool = w->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->count && !pool->stop)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+
+        if (!pool->count)
+            break;
+
+        struct pool_job job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->queue_len;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+
+        pthread_mutex_unlock(&pool->lock);
+        job.fn(job.arg, w->index);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+rx888_pool_t *rx888_pool_create(unsigned int threads, unsigned int queue_len)
+{
+    rx888_pool_t *pool;
+
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __linux__
+        /* workers inherit the affinity of this thread, a creator pinned
+         * to one node gets as many workers as the node has CPUs */
+        cpu_set_t set;
+        if (!sched_getaffinity(0, sizeof(set), &set))
+            cpus = CPU_COUNT(&set);
+#endif
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if (!queue_len)
+        queue_len = 2 * threads;
+
+    pool = calloc(1, sizeof(rx888_pool_t));
+    if (!pool)
+        return NULL;
+
+    pool->queue = calloc(queue_len, sizeof(struct pool_job));
+    pool->workers = calloc(threads, sizeof(struct pool_worker));
+    if (!pool->queue || !pool->workers) {
+        free(pool->queue);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pool->queue_len = queue_len;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for (unsigned int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL,
+                           pool_thread, &pool->workers[i]))
+            break;
+        pool->threads++;
+    }
+
+    if (!pool->threads) {
+        rx888_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+unsigned int rx888_pool_threads(const rx888_pool_t *pool)
+{
+    return pool->threads;
+}
+
+int rx888_pool_submit(rx888_pool_t *pool, rx888_pool_fn_t fn, void *arg)
+{
+    if (!pool || !fn)
+        return -EINVAL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == pool->queue_len)
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+
+    unsigned int tail = (pool->head + pool->count) % pool->queue_len;
+    pool->queue[tail].fn = fn;
+    pool->queue[tail].arg = arg;
+    pool->count++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void rx888_pool_destroy(rx888_pool_t *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&pool->not_full);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool->queue);
+    free(pool);
+}
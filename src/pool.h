@@ -0,0 +1,42 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_POOL_H
+#define RX888_POOL_H
+
+/*
+ * Fixed size worker pool shared by the DSP engines. Jobs run in submission
+ * order on whichever worker is free, the worker index lets jobs use
+ * preallocated per worker scratch memory.
+ */
+typedef struct rx888_pool rx888_pool_t;
+
+typedef void (*rx888_pool_fn_t)(void *arg, unsigned int worker);
+
+/* threads = 0 starts one worker per CPU the calling thread may run on */
+rx888_pool_t *rx888_pool_create(unsigned int threads, unsigned int queue_len);
+
+unsigned int rx888_pool_threads(const rx888_pool_t *pool);
+
+/* blocks while the queue is full */
+int rx888_pool_submit(rx888_pool_t *pool, rx888_pool_fn_t fn, void *arg);
+
+/* runs the queued jobs to completion and joins the workers */
+void rx888_pool_destroy(rx888_pool_t *pool);
+
+#endif /* RX888_POOL_H */
@@ -0,0 +1,196 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "replay.h"
+
+#define SIGMF_META ".sigmf-meta"
+#define SIGMF_DATA ".sigmf-data"
+#define MAX_META_SIZE (1024 * 1024)
+
+static int _replay_has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && !strcmp(s + n - m, suffix);
+}
+
+/* value of a top level "key": in the metadata, enough for core fields */
+static const char *_replay_meta_value(const char *meta, const char *key)
+{
+    const char *p = strstr(meta, key);
+
+    if (!p)
+        return NULL;
+
+    p = strchr(p + strlen(key), ':');
+    if (!p)
+        return NULL;
+
+    for (p++; *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'; p++)
+        ;
+
+    return p;
+}
+
+static int _replay_read_meta(struct rx888_replay_file *file, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    const char *v;
+    char *meta;
+    size_t n;
+
+    if (!f)
+        return -errno;
+
+    meta = malloc(MAX_META_SIZE + 1);
+    if (!meta) {
+        fclose(f);
+        return -ENOMEM;
+    }
+
+    n = fread(meta, 1, MAX_META_SIZE, f);
+    meta[n] = '\0';
+    fclose(f);
+
+    v = _replay_meta_value(meta, "\"core:datatype\"");
+    if (v && !strncmp(v, "\"ri16_le\"", 9)) {
+        file->format = RX888_REPLAY_RI16;
+    } else if (v && !strncmp(v, "\"cf32_le\"", 9)) {
+        file->format = RX888_REPLAY_CF32;
+    } else {
+        fprintf(stderr, "Unsupported SigMF datatype in %s\n", path);
+        free(meta);
+        return -EINVAL;
+    }
+
+    v = _replay_meta_value(meta, "\"core:sample_rate\"");
+    if (v)
+        file->sample_rate = (uint32_t)strtod(v, NULL);
+
+    free(meta);
+
+    return 0;
+}
+
+int rx888_replay_map(struct rx888_replay_file *file, const char *path)
+{
+#ifndef _WIN32
+    char *data_path = NULL;
+    struct stat st;
+    void *map;
+    int fd, r = 0;
+
+    memset(file, 0, sizeof(*file));
+    file->format = RX888_REPLAY_RI16;
+
+    if (_replay_has_suffix(path, SIGMF_META) ||
+        _replay_has_suffix(path, SIGMF_DATA)) {
+        size_t base = strlen(path) - strlen(SIGMF_META);
+
+        data_path = malloc(base + sizeof(SIGMF_META));
+        if (!data_path)
+            return -ENOMEM;
+
+        memcpy(data_path, path, base);
+        strcpy(data_path + base, SIGMF_META);
+        r = _replay_read_meta(file, data_path);
+        strcpy(data_path + base, SIGMF_DATA);
+        if (r < 0)
+            goto out;
+        path = data_path;
+    } else if (_replay_has_suffix(path, ".cf32")) {
+        file->format = RX888_REPLAY_CF32;
+    }
+
+    file->bytes_per_sample = file->format == RX888_REPLAY_CF32 ?
+                             2 * sizeof(float) : sizeof(int16_t);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        r = -errno;
+        goto out;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)file->bytes_per_sample) {
+        r = -EINVAL;
+        close(fd);
+        goto out;
+    }
+
+    /* private and writable: callbacks may work in place, the file stays */
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        r = -errno;
+        goto out;
+    }
+
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    file->data = map;
+    file->size = st.st_size - st.st_size % file->bytes_per_sample;
+    /* the mapping length is needed for munmap */
+    file->map_size = st.st_size;
+
+out:
+    free(data_path);
+    return r;
+#else
+    (void)file;
+    (void)path;
+    return -ENOSYS;
+#endif
+}
+
+void rx888_replay_unmap(struct rx888_replay_file *file)
+{
+#ifndef _WIN32
+    if (file->data)
+        munmap(file->data, file->map_size);
+#endif
+    file->data = NULL;
+}
+
+void rx888_replay_convert(const struct rx888_replay_file *file, size_t first,
+                          size_t count, int16_t *out)
+{
+    const float *iq = (const float *)file->data + 2 * first;
+
+    for (size_t i = 0; i < count; i++) {
+        float v = iq[2 * i] * 32768.0f;
+
+        if (v >= 32767.0f)
+            out[i] = 32767;
+        else if (v <= -32768.0f)
+            out[i] = -32768;
+        else
+            out[i] = (int16_t)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+}
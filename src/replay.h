@@ -0,0 +1,55 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RX888_REPLAY_H
+#define RX888_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Recorded captures mapped into memory for the replay device. Raw files
+ * hold the 16 bit ADC samples as streamed; SigMF recordings are read from
+ * their metadata, either as ri16_le or as the cf32_le written by rx888_rec.
+ */
+enum rx888_replay_format {
+    RX888_REPLAY_RI16 = 0,      /* int16 samples, delivered in place */
+    RX888_REPLAY_CF32           /* float I/Q pairs, I converted back */
+};
+
+struct rx888_replay_file {
+    unsigned char *data;        /* private writable mapping */
+    size_t size;                /* bytes, whole samples only */
+    size_t map_size;
+    size_t bytes_per_sample;
+    enum rx888_replay_format format;
+    uint32_t sample_rate;       /* from the metadata, 0 if unknown */
+};
+
+/* path may name a raw file (.cf32 for float pairs) or either half of a
+ * SigMF recording */
+int rx888_replay_map(struct rx888_replay_file *file, const char *path);
+
+void rx888_replay_unmap(struct rx888_replay_file *file);
+
+/* convert count samples starting at sample index first to int16 */
+void rx888_replay_convert(const struct rx888_replay_file *file, size_t first,
+                          size_t count, int16_t *out);
+
+#endif /* RX888_REPLAY_H */
@@ -0,0 +1,556 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "librx888_dsp.h"
+#include "kernels.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define DEFAULT_PASSBAND 0.9f
+#define DEFAULT_STOPBAND_DB 90.0f
+#define MIN_STOPBAND_DB 40.0f
+#define MAX_STOPBAND_DB 150.0f
+
+/* input samples per pass through the stages */
+#define CHUNK 4096
+/* phases of the interpolated filter bank for ratios that are not rational */
+#define ARB_PHASES 512
+/* largest interpolation factor resampled exactly */
+#define MAX_EXACT_PHASES 1024
+/* floats per filter bank */
+#define MAX_BANK (1U << 22)
+/* decimations from this on run an integer decimator first */
+#define TWO_STAGE_RATIO 4.0
+/* filter banks kept for reuse once no resampler holds them */
+#define CACHE_IDLE 4
+
+/*
+ * Polyphase filter bank, taps coefficients for each phase, stored reversed
+ * so a phase is a plain dot product with the history. The prototype is a
+ * Kaiser windowed sinc at phases times the input rate.
+ */
+struct rs_bank {
+    struct rs_bank *next;
+    unsigned refs;
+
+    /* cache key */
+    uint32_t phases;
+    uint32_t taps;
+    int extra;                  /* one more phase to interpolate towards */
+    double cutoff;              /* cycles per input sample */
+    double beta;
+
+    float *coef;
+};
+
+struct rs_stage {
+    struct rs_bank *bank;
+    int exact;
+    uint32_t up;                /* exact ratio up / down */
+    uint32_t down;
+    uint64_t step;              /* input samples per output, 32.32 */
+    /*
+     * position of the next output in the history, in 1 / up input samples
+     * for the exact ratio, 32.32 input samples otherwise
+     */
+    uint64_t t;
+    float *hist;                /* taps - 1 + CHUNK samples */
+    uint32_t fill;
+    double ratio;               /* out / in */
+    double delay;               /* input samples */
+};
+
+struct rx888_resampler {
+    struct rs_stage stage[2];
+    uint32_t stages;
+    double ratio;
+    float *mid;                 /* first stage output */
+    float *fin;                 /* int16 conversion */
+    float *fout;
+};
+
+static pthread_mutex_t rs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rs_bank *rs_cache;
+
+/* zeroth order modified Bessel function, for the Kaiser window */
+static double rs_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+
+    for (int k = 1; k < 64; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-17)
+            break;
+    }
+
+    return sum;
+}
+
+static double rs_beta(double db)
+{
+    if (db > 50.0)
+        return 0.1102 * (db - 8.7);
+
+    return 0.5842 * pow(db - 21.0, 0.4) + 0.07886 * (db - 21.0);
+}
+
+static void rs_bank_free(struct rs_bank *b)
+{
+    free(b->coef);
+    free(b);
+}
+
+static struct rs_bank *rs_bank_design(uint32_t phases, uint32_t taps,
+                                      int extra, double cutoff, double beta)
+{
+    uint32_t len = phases * taps + (extra ? 1 : 0);
+    uint32_t rows = phases + (extra ? 1 : 0);
+    double center = (len - 1) / 2.0, fc = cutoff / phases;
+    double i0beta = rs_i0(beta), sum = 0.0;
+    struct rs_bank *b;
+    double *h;
+
+    b = calloc(1, sizeof(struct rs_bank));
+    h = malloc(len * sizeof(double));
+    if (b)
+        b->coef = malloc((size_t)rows * taps * sizeof(float));
+    if (!b || !h || !b->coef) {
+        if (b)
+            rs_bank_free(b);
+        free(h);
+        return NULL;
+    }
+
+    b->phases = phases;
+    b->taps = taps;
+    b->extra = extra;
+    b->cutoff = cutoff;
+    b->beta = beta;
+
+    for (uint32_t i = 0; i < len; i++) {
+        double x = i - center;
+        double r = center > 0.0 ? x / center : 0.0;
+
+        h[i] = x == 0.0 ? 2.0 * fc :
+               sin(2.0 * M_PI * fc * x) / (M_PI * x);
+        h[i] *= rs_i0(beta * sqrt(1.0 - r * r)) / i0beta;
+        sum += h[i];
+    }
+
+    /* unity gain, the phases sum to one on average */
+    for (uint32_t p = 0; p < rows; p++) {
+        for (uint32_t j = 0; j < taps; j++) {
+            uint64_t i = p + (uint64_t)phases * (taps - 1 - j);
+
+            b->coef[(size_t)p * taps + j] =
+                i < len ? (float)(h[i] * phases / sum) : 0.0f;
+        }
+    }
+
+    free(h);
+
+    return b;
+}
+
+/* shared bank for these parameters, designed on first use */
+static struct rs_bank *rs_bank_get(uint32_t phases, uint32_t taps, int extra,
+                                   double cutoff, double beta)
+{
+    struct rs_bank *b;
+
+    pthread_mutex_lock(&rs_cache_lock);
+
+    for (b = rs_cache; b; b = b->next) {
+        if (b->phases == phases && b->taps == taps && b->extra == extra &&
+            b->cutoff == cutoff && b->beta == beta)
+            break;
+    }
+
+    if (!b) {
+        b = rs_bank_design(phases, taps, extra, cutoff, beta);
+        if (b) {
+            b->next = rs_cache;
+            rs_cache = b;
+        }
+    }
+
+    if (b)
+        b->refs++;
+
+    pthread_mutex_unlock(&rs_cache_lock);
+
+    return b;
+}
+
+static void rs_bank_put(struct rs_bank *bank)
+{
+    struct rs_bank **pb;
+    unsigned idle = 0;
+
+    if (!bank)
+        return;
+
+    pthread_mutex_lock(&rs_cache_lock);
+
+    /* the most recently released idle banks are kept */
+    if (--bank->refs == 0) {
+        for (pb = &rs_cache; *pb != bank; pb = &(*pb)->next)
+            ;
+        *pb = bank->next;
+        bank->next = rs_cache;
+        rs_cache = bank;
+    }
+
+    for (pb = &rs_cache; *pb; ) {
+        struct rs_bank *b = *pb;
+
+        if (b->refs == 0 && ++idle > CACHE_IDLE) {
+            *pb = b->next;
+            rs_bank_free(b);
+        } else {
+            pb = &b->next;
+        }
+    }
+
+    pthread_mutex_unlock(&rs_cache_lock);
+}
+
+static uint64_t rs_gcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t r = a % b;
+
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+/* reduced up / down for two integer rates, 0 otherwise */
+static int rs_ratio(double in_rate, double out_rate, uint32_t *up,
+                    uint32_t *down)
+{
+    uint64_t g, u, d;
+
+    if (in_rate != floor(in_rate) || out_rate != floor(out_rate) ||
+        in_rate >= 4294967296.0 || out_rate >= 4294967296.0)
+        return 0;
+
+    g = rs_gcd((uint64_t)in_rate, (uint64_t)out_rate);
+    u = (uint64_t)out_rate / g;
+    d = (uint64_t)in_rate / g;
+    if (u > MAX_EXACT_PHASES)
+        return 0;
+
+    *up = (uint32_t)u;
+    *down = (uint32_t)d;
+
+    return 1;
+}
+
+/*
+ * pass and stop are the band edges in Hz, up and down the exact ratio or
+ * 0 to interpolate between phases
+ */
+static int rs_stage_init(struct rs_stage *st, double in_rate, double out_rate,
+                         uint32_t up, uint32_t down, double pass,
+                         double stop, double db)
+{
+    double df = (stop - pass) / in_rate, beta = rs_beta(db);
+    double cutoff = (pass + stop) / 2.0 / in_rate;
+    uint32_t taps, phases;
+
+    if (df <= 0.0)
+        return -EINVAL;
+
+    /* Kaiser length estimate, at the input rate */
+    taps = (uint32_t)ceil((db - 8.0) / (2.285 * 2.0 * M_PI * df)) + 1;
+    if (taps > MAX_BANK)
+        return -ENOMEM;
+
+    st->ratio = out_rate / in_rate;
+    st->up = up;
+    st->down = down;
+    st->exact = up && (uint64_t)up * taps <= MAX_BANK;
+
+    if (st->exact) {
+        phases = st->up;
+        st->t = (uint64_t)(taps - 1) * st->up;
+        st->delay = (phases * taps - 1) / 2.0 / phases;
+    } else {
+        phases = ARB_PHASES;
+        if ((uint64_t)(phases + 1) * taps > MAX_BANK)
+            return -ENOMEM;
+        st->step = (uint64_t)llround(in_rate / out_rate * 4294967296.0);
+        st->t = (uint64_t)(taps - 1) << 32;
+        st->delay = taps / 2.0;
+    }
+
+    st->hist = calloc(taps - 1 + CHUNK, sizeof(float));
+    if (!st->hist)
+        return -ENOMEM;
+    st->fill = taps - 1;
+
+    st->bank = rs_bank_get(phases, taps, !st->exact, cutoff, beta);
+    if (!st->bank)
+        return -ENOMEM;
+
+    return 0;
+}
+
+/* count at most CHUNK */
+static uint32_t rs_stage_run(struct rs_stage *st, const float *in,
+                             uint32_t count, float *out)
+{
+    const uint32_t taps = st->bank->taps;
+    const float *coef = st->bank->coef;
+    uint64_t idx, first;
+    uint32_t n = 0;
+
+    memcpy(st->hist + st->fill, in, count * sizeof(float));
+    st->fill += count;
+
+    if (st->exact) {
+        while ((idx = st->t / st->up) < st->fill) {
+            uint32_t p = (uint32_t)(st->t % st->up);
+
+            out[n++] = rx888_kernel_dot(coef + (size_t)p * taps,
+                                        st->hist + idx + 1 - taps, taps);
+            st->t += st->down;
+        }
+        first = st->t / st->up + 1 - taps;
+    } else {
+        while ((idx = st->t >> 32) < st->fill) {
+            const float *h = st->hist + idx + 1 - taps;
+            uint64_t pos = (st->t & 0xffffffff) * ARB_PHASES;
+            const float *c = coef + (size_t)(pos >> 32) * taps;
+            float f = (float)(pos & 0xffffffff) * (1.0f / 4294967296.0f);
+            float a = rx888_kernel_dot(c, h, taps);
+            float b = rx888_kernel_dot(c + taps, h, taps);
+
+            out[n++] = a + f * (b - a);
+            st->t += st->step;
+        }
+        first = (st->t >> 32) + 1 - taps;
+    }
+
+    /* drop the samples no later output reaches back to */
+    if (first > st->fill)
+        first = st->fill;
+    memmove(st->hist, st->hist + first,
+            (st->fill - first) * sizeof(float));
+    st->fill -= (uint32_t)first;
+    st->t -= st->exact ? first * st->up : first << 32;
+
+    return n;
+}
+
+static uint32_t rs_max_output(double ratio, uint32_t count)
+{
+    return (uint32_t)ceil(count * ratio) + 1;
+}
+
+int rx888_resampler_create(rx888_resampler_t **rs,
+                           const rx888_resampler_config_t *config)
+{
+    double in, out, nyquist, pass, db;
+    uint32_t up = 0, down = 0;
+    rx888_resampler_t *r;
+    int ret;
+
+    if (!rs || !config)
+        return -EINVAL;
+
+    in = config->in_rate;
+    out = config->out_rate;
+    pass = config->passband ? config->passband : DEFAULT_PASSBAND;
+    db = config->stopband_db ? config->stopband_db : DEFAULT_STOPBAND_DB;
+
+    if (!(in > 0.0) || !(out > 0.0) || !(pass > 0.0) || !(pass < 1.0) ||
+        db < MIN_STOPBAND_DB || db > MAX_STOPBAND_DB)
+        return -EINVAL;
+
+    r = calloc(1, sizeof(rx888_resampler_t));
+    if (!r)
+        return -ENOMEM;
+
+    r->ratio = out / in;
+    nyquist = (in < out ? in : out) / 2.0;
+    pass *= nyquist;
+
+    if (in >= TWO_STAGE_RATIO * out) {
+        /* the decimator may alias into what the second stage removes */
+        double d = floor(in / (4.0 * out));
+
+        if (d < 2.0)
+            d = 2.0;
+        /* the passband ripple of both stages adds up */
+        db += 6.0;
+
+        ret = rs_stage_init(&r->stage[0], in, in / d, 1, (uint32_t)d, pass,
+                            in / d - nyquist, db);
+        if (ret < 0)
+            goto err;
+        rs_ratio(in, out * d, &up, &down);
+        ret = rs_stage_init(&r->stage[1], in / d, out, up, down, pass,
+                            nyquist, db);
+        if (ret < 0)
+            goto err;
+        r->stages = 2;
+
+        r->mid = malloc(rs_max_output(r->stage[0].ratio, CHUNK) *
+                        sizeof(float));
+        if (!r->mid) {
+            ret = -ENOMEM;
+            goto err;
+        }
+    } else {
+        rs_ratio(in, out, &up, &down);
+        ret = rs_stage_init(&r->stage[0], in, out, up, down, pass, nyquist,
+                            db);
+        if (ret < 0)
+            goto err;
+        r->stages = 1;
+    }
+
+    r->fin = malloc(CHUNK * sizeof(float));
+    r->fout = malloc(rx888_resampler_max_output(r, CHUNK) * sizeof(float));
+    if (!r->fin || !r->fout) {
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    *rs = r;
+
+    return 0;
+err:
+    rx888_resampler_destroy(r);
+
+    return ret;
+}
+
+uint32_t rx888_resampler_process_float(rx888_resampler_t *rs,
+                                       const float *in, uint32_t count,
+                                       float *out)
+{
+    uint32_t n = 0;
+
+    if (!rs || !in || !out)
+        return 0;
+
+    while (count) {
+        uint32_t len = count < CHUNK ? count : CHUNK;
+
+        if (rs->stages == 2) {
+            uint32_t mid = rs_stage_run(&rs->stage[0], in, len, rs->mid);
+
+            n += rs_stage_run(&rs->stage[1], rs->mid, mid, out + n);
+        } else {
+            n += rs_stage_run(&rs->stage[0], in, len, out + n);
+        }
+
+        in += len;
+        count -= len;
+    }
+
+    return n;
+}
+
+uint32_t rx888_resampler_process(rx888_resampler_t *rs, const int16_t *in,
+                                 uint32_t count, int16_t *out)
+{
+    uint32_t n = 0;
+
+    if (!rs || !in || !out)
+        return 0;
+
+    while (count) {
+        uint32_t len = count < CHUNK ? count : CHUNK, m;
+
+        for (uint32_t i = 0; i < len; i++)
+            rs->fin[i] = in[i];
+
+        m = rx888_resampler_process_float(rs, rs->fin, len, rs->fout);
+
+        for (uint32_t i = 0; i < m; i++) {
+            float v = rs->fout[i];
+
+            v = v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v;
+            out[n + i] = (int16_t)lrintf(v);
+        }
+
+        in += len;
+        count -= len;
+        n += m;
+    }
+
+    return n;
+}
+
+uint32_t rx888_resampler_max_output(rx888_resampler_t *rs, uint32_t count)
+{
+    if (!rs)
+        return 0;
+
+    for (uint32_t s = 0; s < rs->stages; s++)
+        count = rs_max_output(rs->stage[s].ratio, count);
+
+    return count;
+}
+
+double rx888_resampler_delay(rx888_resampler_t *rs)
+{
+    double delay = 0.0, ratio = 1.0;
+
+    if (!rs)
+        return 0.0;
+
+    /* in output samples of the last stage */
+    for (int s = (int)rs->stages - 1; s >= 0; s--) {
+        ratio *= rs->stage[s].ratio;
+        delay += rs->stage[s].delay * ratio;
+    }
+
+    return delay;
+}
+
+void rx888_resampler_destroy(rx888_resampler_t *rs)
+{
+    if (!rs)
+        return;
+
+    for (int s = 0; s < 2; s++) {
+        rs_bank_put(rs->stage[s].bank);
+        free(rs->stage[s].hist);
+    }
+
+    free(rs->mid);
+    free(rs->fin);
+    free(rs->fout);
+    free(rs);
+}
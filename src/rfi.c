@@ -0,0 +1,772 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "librx888_dsp.h"
+#include "fft.h"
+#include "kernels.h"
+#include "pool.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIN_FFT_SIZE (1U << 6)
+#define MAX_FFT_SIZE (1U << 16)
+#define MIN_FRAMES 8
+#define MAX_FRAMES 4096
+#define MIN_PULSE_BLOCK 8
+/* stored spectra per worker, 64 MB */
+#define MAX_SPECTRA_FLOATS (1U << 24)
+
+#define DEFAULT_FRAMES 64
+#define DEFAULT_SK_SIGMA 4.0f
+#define DEFAULT_PULSE_DB 10.0f
+
+enum slot_state {
+    SLOT_FREE = 0,
+    SLOT_FILLING,
+    SLOT_QUEUED,
+    SLOT_DONE
+};
+
+/*
+ * One chunk of the stream. The input carries fft_size / 2 samples of the
+ * neighbouring chunks on either side, so that the overlap-add of the
+ * spectra covering the chunk needs nothing from other slots.
+ */
+struct rfi_slot {
+    rx888_rfi_t *rfi;
+    uint64_t sample_index;
+    int16_t *input;             /* span samples */
+    uint32_t fill;
+    int16_t *output;            /* chunk samples */
+    float *kurtosis;            /* bins */
+    uint8_t *bin_mask;
+    uint8_t *block_mask;        /* blocks */
+    uint32_t flagged_bins;
+    uint32_t flagged_blocks;
+    atomic_int state;
+};
+
+/* per worker scratch */
+struct rfi_work {
+    float *re;
+    float *im;
+    float *spectra;             /* frames * fft_size, xr then xi */
+    double *s1;                 /* float sums of squared powers overflow */
+    double *s2;
+    float *frame;
+    float *acc;                 /* span */
+    float *power;               /* span blocks */
+    float *scratch;             /* max(frames, blocks) */
+};
+
+struct rx888_rfi {
+    rx888_rfi_config_t config;
+    rx888_fft_t *fft;
+    float *window;
+    uint32_t bins;
+    uint32_t hop;               /* fft_size / 2, 0 without spectral stage */
+    uint32_t frames;            /* spectra covering a chunk */
+    uint32_t sk_spectra;        /* disjoint ones of them, the even frames */
+    uint32_t chunk;
+    uint32_t span;              /* chunk plus one hop either side */
+    uint32_t blocks;            /* pulse blocks of a chunk */
+    uint32_t span_blocks;
+    float sk_limit;
+    float pulse_ratio;
+
+    rx888_pool_t *pool;
+    struct rfi_work *work;
+    unsigned int nworkers;
+
+    struct rfi_slot *slots;
+    unsigned int nslots;
+    uint64_t seq;
+    struct rfi_slot *cur;
+    uint64_t in_index;
+    uint64_t out_seq;
+    uint32_t out_pos;
+    uint32_t delay;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    rx888_rfi_cb_t cb;
+    void *cb_ctx;
+};
+
+/* k-th smallest of n values, reorders them */
+static float rfi_select(float *v, uint32_t n, uint32_t k)
+{
+    int32_t lo = 0, hi = (int32_t)n - 1;
+
+    while (lo < hi) {
+        float pivot = v[lo + (hi - lo) / 2];
+        int32_t i = lo, j = hi;
+
+        while (i <= j) {
+            while (v[i] < pivot)
+                i++;
+            while (v[j] > pivot)
+                j--;
+            if (i <= j) {
+                float t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        }
+
+        if ((int32_t)k <= j)
+            hi = j;
+        else if ((int32_t)k >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    return v[k];
+}
+
+static int16_t rfi_clip(float v)
+{
+    if (v >= 32767.0f)
+        return INT16_MAX;
+    if (v <= -32768.0f)
+        return INT16_MIN;
+
+    return (int16_t)lrintf(v);
+}
+
+/* compare every block against the median block power of the chunk */
+static void rfi_pulses(rx888_rfi_t *rfi, struct rfi_slot *slot,
+                       struct rfi_work *w)
+{
+    const uint32_t len = rfi->config.pulse_block;
+    const uint32_t first = rfi->hop / len;
+    int16_t *x = slot->input;
+
+    rx888_kernel_block_power(x, rfi->span_blocks, len, w->power);
+
+    memcpy(w->scratch, w->power + first, rfi->blocks * sizeof(float));
+    float median = rfi_select(w->scratch, rfi->blocks, rfi->blocks / 2);
+    float limit = median * rfi->pulse_ratio;
+
+    slot->flagged_blocks = 0;
+
+    /* the margins are cleaned too, they feed the spectra of the chunk */
+    for (uint32_t b = 0; b < rfi->span_blocks; b++) {
+        int hit = median > 0.0f && w->power[b] > limit;
+        int16_t *p = x + b * len;
+
+        if (b >= first && b < first + rfi->blocks) {
+            slot->block_mask[b - first] = (uint8_t)hit;
+            slot->flagged_blocks += hit;
+        }
+
+        if (!hit)
+            continue;
+
+        if (rfi->config.action == RX888_RFI_BLANK) {
+            memset(p, 0, len * sizeof(int16_t));
+        } else if (rfi->config.action == RX888_RFI_REPLACE) {
+            float g = sqrtf(median / w->power[b]);
+            for (uint32_t i = 0; i < len; i++)
+                p[i] = (int16_t)lrintf(p[i] * g);
+        }
+    }
+}
+
+/* continued fraction of the incomplete beta function */
+static double rfi_beta_cf(double a, double b, double x)
+{
+    double c = 1.0;
+    double d = 1.0 - (a + b) * x / (a + 1.0);
+    double h;
+
+    d = 1.0 / (fabs(d) < 1e-300 ? 1e-300 : d);
+    h = d;
+    for (int i = 1; i < 300; i++) {
+        double e[2];
+
+        e[0] = i * (b - i) * x / ((a + 2 * i - 1) * (a + 2 * i));
+        e[1] = -(a + i) * (a + b + i) * x / ((a + 2 * i) * (a + 2 * i + 1));
+        for (int j = 0; j < 2; j++) {
+            d = 1.0 + e[j] * d;
+            c = 1.0 + e[j] / c;
+            d = 1.0 / (fabs(d) < 1e-300 ? 1e-300 : d);
+            c = fabs(c) < 1e-300 ? 1e-300 : c;
+            h *= d * c;
+        }
+        if (fabs(d * c - 1.0) < 1e-12)
+            break;
+    }
+    return h;
+}
+
+/* regularized incomplete beta function I_x(a, b) */
+static double rfi_beta_inc(double a, double b, double x)
+{
+    if (x <= 0.0)
+        return 0.0;
+    if (x >= 1.0)
+        return 1.0;
+
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+                       a * log(x) + b * log1p(-x));
+
+    if (x < (a + 1.0) / (a + b + 2.0))
+        return front * rfi_beta_cf(a, b, x) / a;
+    return 1.0 - front * rfi_beta_cf(b, a, 1.0 - x) / b;
+}
+
+/*
+ * Kurtosis above which Gaussian noise lands with the probability of a normal
+ * variate above sigma, over m independent spectra. The estimator is skewed
+ * far beyond a normal tail for any practical m, the limit comes from the
+ * Pearson curve with its exact first four moments (Nita & Gary 2010).
+ */
+static float rfi_sk_limit(uint32_t spectra, float sigma)
+{
+    const double m = spectra;
+    const double p = 0.5 * erfc(sigma / sqrt(2.0));
+    /* the powers of one bin over their sum are uniform on the simplex,
+     * E[prod D_i^(2 k_i)] = (m - 1)! prod (2 k_i)! / (m - 1 + 2 sum k_i)! */
+    double r[9] = { 1.0 };
+    for (int i = 1; i < 9; i++)
+        r[i] = r[i - 1] * (m + i - 1);
+    double q1 = 2.0 * m / r[2];
+    double q2 = (24.0 * m + 4.0 * m * (m - 1)) / r[4];
+    double q3 = (720.0 * m + 144.0 * m * (m - 1) +
+                 8.0 * m * (m - 1) * (m - 2)) / r[6];
+    double q4 = (40320.0 * m + 5760.0 * m * (m - 1) +
+                 1728.0 * m * (m - 1) + 576.0 * m * (m - 1) * (m - 2) +
+                 16.0 * m * (m - 1) * (m - 2) * (m - 3)) / r[8];
+    double v = q2 - q1 * q1;
+    double u3 = q3 - 3.0 * q1 * q2 + 2.0 * q1 * q1 * q1;
+    double u4 = q4 - 4.0 * q1 * q3 + 6.0 * q1 * q1 * q2 -
+                3.0 * q1 * q1 * q1 * q1;
+    /* SK = (m + 1) / (m - 1) * (m * Q - 1) */
+    double s = (m + 1.0) / (m - 1.0) * m;
+    double mu2 = v * s * s;
+    double g = u3 / (v * sqrt(v));
+    double b1 = g * g;
+    double b2 = u4 / (v * v);
+    double den = 10.0 * b2 - 12.0 * b1 - 18.0;
+    /* Pearson curve, d ln f / dx = (x - c1) / (c0 + c1 x + c2 x^2) about
+     * the mean of one */
+    double c0 = -mu2 * (4.0 * b2 - 3.0 * b1) / den;
+    double c1 = -sqrt(mu2) * g * (b2 + 3.0) / den;
+    double c2 = -(2.0 * b2 - 3.0 * b1 - 6.0) / den;
+    double disc = c1 * c1 - 4.0 * c0 * c2;
+
+    if (disc < 0.0) {
+        /* type IV, with tan(t) = (2 c2 x + c1) / q the density is
+         * cos(t)^e exp(k t) and x falls with t */
+        const int steps = 1 << 14;
+        double q = sqrt(-disc);
+        double e = -1.0 / c2 - 2.0;
+        double k = -2.0 * c1 / q * (1.0 + 0.5 / c2);
+        double top = atan(k / e);
+        double peak = e * log(cos(top)) + k * top;
+        double h = M_PI / steps;
+        double total = 0.0, acc = 0.0, t;
+        int i;
+
+        for (i = 0; i < steps; i++) {
+            t = -0.5 * M_PI + (i + 0.5) * h;
+            total += exp(e * log(cos(t)) + k * t - peak);
+        }
+        for (i = 0; i < steps; i++) {
+            t = -0.5 * M_PI + (i + 0.5) * h;
+            double w = exp(e * log(cos(t)) + k * t - peak);
+            if (acc + w >= p * total) {
+                t = -0.5 * M_PI + (i + (p * total - acc) / w) * h;
+                break;
+            }
+            acc += w;
+        }
+        return (float)(1.0 + (q * tan(t) - c1) / (2.0 * c2));
+    }
+
+    /* roots xl < xh, the density is |x - xl|^el |x - xh|^eh where the
+     * denominator is negative: between the roots for type I, above them
+     * for type VI */
+    double xl = (-c1 + sqrt(disc)) / (2.0 * c2);
+    double xh = (-c1 - sqrt(disc)) / (2.0 * c2);
+    if (xl > xh) {
+        double x = xl;
+        xl = xh;
+        xh = x;
+    }
+    double el = (xl - c1) / (c2 * (xl - xh));
+    double eh = (xh - c1) / (c2 * (xh - xl));
+    double lo = 0.0, hi = c2 > 0.0 ? xh : 1.0;
+
+    if (c2 < 0.0)
+        while (rfi_beta_inc(-el - eh - 1.0, eh + 1.0,
+                            (xh - xl) / (hi - xl)) > p)
+            hi *= 2.0;
+    for (int i = 0; i < 60; i++) {
+        double x = 0.5 * (lo + hi);
+        double tail = c2 > 0.0 ?
+            rfi_beta_inc(eh + 1.0, el + 1.0, (xh - x) / (xh - xl)) :
+            rfi_beta_inc(-el - eh - 1.0, eh + 1.0, (xh - xl) / (x - xl));
+
+        if (tail > p)
+            lo = x;
+        else
+            hi = x;
+    }
+    return (float)(1.0 + hi);
+}
+
+static void rfi_kurtosis(rx888_rfi_t *rfi, struct rfi_slot *slot,
+                         struct rfi_work *w)
+{
+    const uint32_t m = rfi->bins;
+    const uint32_t n = 2 * m;
+    const uint32_t frames = rfi->frames;
+    const double f = rfi->sk_spectra;
+
+    memset(w->s1, 0, m * sizeof(double));
+    memset(w->s2, 0, m * sizeof(double));
+
+    for (uint32_t j = 0; j < frames; j++) {
+        float *xr = w->spectra + (size_t)j * n;
+        float *xi = xr + m;
+
+        rx888_fft_load(rfi->fft, slot->input + j * rfi->hop, rfi->window,
+                       w->re, w->im);
+        rx888_fft_execute(rfi->fft, w->re, w->im);
+        rx888_fft_spectrum(rfi->fft, w->re, w->im, xr, xi);
+
+        /* neighbouring frames share half their samples and would make
+         * the estimate correlated, the kurtosis uses every other one */
+        if (j & 1)
+            continue;
+        for (uint32_t k = 1; k < m; k++) {
+            double p = xr[k] * xr[k] + xi[k] * xi[k];
+            w->s1[k] += p;
+            w->s2[k] += p * p;
+        }
+    }
+
+    /* SK = (M + 1) / (M - 1) * (M * S2 / S1^2 - 1), 1 for Gaussian noise;
+     * DC is real valued and never flagged, nor are the bins next to DC and
+     * nyquist, the window leaks the real valued ends into them and they are
+     * not circular noise */
+    slot->kurtosis[0] = 0.0f;
+    slot->bin_mask[0] = 0;
+    slot->flagged_bins = 0;
+    for (uint32_t k = 1; k < m; k++) {
+        double s1 = w->s1[k];
+        float sk = s1 > 0.0 ?
+            (float)((f + 1.0) / (f - 1.0) * (f * w->s2[k] / (s1 * s1) - 1.0)) :
+            0.0f;
+        int hit = k > 1 && k < m - 1 && sk > rfi->sk_limit;
+
+        slot->kurtosis[k] = sk;
+        slot->bin_mask[k] = (uint8_t)hit;
+        slot->flagged_bins += hit;
+    }
+
+    /* nothing to excise, pass the chunk through bit exact */
+    if (!slot->flagged_bins || rfi->config.action == RX888_RFI_FLAG) {
+        memcpy(slot->output, slot->input + rfi->hop,
+               rfi->chunk * sizeof(int16_t));
+        return;
+    }
+
+    /* the spectra are turned into the change to apply: minus the removed
+     * part in flagged bins, nothing elsewhere */
+    for (uint32_t k = 1; k < m; k++) {
+        if (!slot->bin_mask[k])
+            continue;
+
+        if (rfi->config.action == RX888_RFI_BLANK) {
+            for (uint32_t j = 0; j < frames; j++) {
+                w->spectra[(size_t)j * n + k] *= -1.0f;
+                w->spectra[(size_t)j * n + m + k] *= -1.0f;
+            }
+            continue;
+        }
+
+        /* the median power is what the bin carries between pulses */
+        for (uint32_t j = 0; j < frames; j++) {
+            float *xr = w->spectra + (size_t)j * n;
+            w->scratch[j] = xr[k] * xr[k] + xr[m + k] * xr[m + k];
+        }
+        float floor = rfi_select(w->scratch, frames, frames / 2);
+
+        for (uint32_t j = 0; j < frames; j++) {
+            float *xr = w->spectra + (size_t)j * n;
+            float p = xr[k] * xr[k] + xr[m + k] * xr[m + k];
+            float g = p > floor ? sqrtf(floor / p) - 1.0f : 0.0f;
+
+            xr[k] *= g;
+            xr[m + k] *= g;
+        }
+    }
+
+    /* periodic Hann windows at half overlap add up to one, so the change
+     * synthesized from the flagged bins adds to the input as it is and
+     * samples it does not reach stay bit exact */
+    memset(w->acc, 0, rfi->span * sizeof(float));
+    for (uint32_t j = 0; j < frames; j++) {
+        float *xr = w->spectra + (size_t)j * n;
+        float *acc = w->acc + j * rfi->hop;
+
+        /* DC, with nyquist packed beside it, is never flagged */
+        xr[0] = 0.0f;
+        xr[m] = 0.0f;
+        for (uint32_t k = 1; k < m; k++) {
+            if (!slot->bin_mask[k]) {
+                xr[k] = 0.0f;
+                xr[m + k] = 0.0f;
+            }
+        }
+
+        rx888_fft_inverse(rfi->fft, xr, xr + m, w->re, w->im, w->frame);
+        for (uint32_t i = 0; i < n; i++)
+            acc[i] += w->frame[i];
+    }
+
+    for (uint32_t i = 0; i < rfi->chunk; i++)
+        slot->output[i] = rfi_clip(slot->input[rfi->hop + i] +
+                                   w->acc[rfi->hop + i]);
+}
+
+static void rfi_job(void *arg, unsigned int worker)
+{
+    struct rfi_slot *slot = arg;
+    rx888_rfi_t *rfi = slot->rfi;
+    struct rfi_work *w = &rfi->work[worker];
+
+    /* pulses go first, they would raise the kurtosis of every bin */
+    if (rfi->config.pulse_block)
+        rfi_pulses(rfi, slot, w);
+
+    if (rfi->fft)
+        rfi_kurtosis(rfi, slot, w);
+    else
+        memcpy(slot->output, slot->input, rfi->chunk * sizeof(int16_t));
+
+    pthread_mutex_lock(&rfi->lock);
+    atomic_store(&slot->state, SLOT_DONE);
+    pthread_cond_broadcast(&rfi->done);
+    pthread_mutex_unlock(&rfi->lock);
+}
+
+static struct rfi_slot *rfi_acquire(rx888_rfi_t *rfi)
+{
+    struct rfi_slot *slot = &rfi->slots[rfi->seq % rfi->nslots];
+
+    /* the output delay frees every slot just in time */
+    atomic_store(&slot->state, SLOT_FILLING);
+    slot->fill = 0;
+    slot->sample_index = rfi->seq * rfi->chunk;
+    rfi->seq++;
+
+    return slot;
+}
+
+/* wait for the oldest chunk and report its masks */
+static struct rfi_slot *rfi_output(rx888_rfi_t *rfi)
+{
+    struct rfi_slot *slot = &rfi->slots[rfi->out_seq % rfi->nslots];
+
+    if (rfi->out_pos)
+        return slot;
+
+    pthread_mutex_lock(&rfi->lock);
+    while (atomic_load(&slot->state) != SLOT_DONE)
+        pthread_cond_wait(&rfi->done, &rfi->lock);
+    pthread_mutex_unlock(&rfi->lock);
+
+    if (rfi->cb) {
+        rx888_rfi_mask_t mask = {
+            .sample_index = slot->sample_index,
+            .samples = rfi->chunk,
+            .bins = rfi->fft ? rfi->bins : 0,
+            .bin_mask = slot->bin_mask,
+            .kurtosis = slot->kurtosis,
+            .flagged_bins = slot->flagged_bins,
+            .blocks = rfi->config.pulse_block ? rfi->blocks : 0,
+            .block_len = rfi->config.pulse_block,
+            .block_mask = slot->block_mask,
+            .flagged_blocks = slot->flagged_blocks,
+        };
+        rfi->cb(&mask, rfi->cb_ctx);
+    }
+
+    return slot;
+}
+
+static void rfi_free_work(rx888_rfi_t *rfi)
+{
+    if (!rfi->work)
+        return;
+
+    for (unsigned int i = 0; i < rfi->nworkers; i++) {
+        struct rfi_work *w = &rfi->work[i];
+        free(w->re);
+        free(w->im);
+        free(w->spectra);
+        free(w->s1);
+        free(w->s2);
+        free(w->frame);
+        free(w->acc);
+        free(w->power);
+        free(w->scratch);
+    }
+    free(rfi->work);
+}
+
+int rx888_rfi_create(rx888_rfi_t **out, const rx888_rfi_config_t *config,
+                     rx888_rfi_cb_t cb, void *ctx)
+{
+    rx888_rfi_t *rfi;
+    uint32_t n, len, frames;
+
+    if (!out || !config)
+        return -EINVAL;
+
+    n = config->fft_size;
+    len = config->pulse_block;
+    frames = config->sk_frames ? config->sk_frames : DEFAULT_FRAMES;
+
+    if (!n && !len)
+        return -EINVAL;
+    if (n && (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1))))
+        return -EINVAL;
+    if (frames < MIN_FRAMES || frames > MAX_FRAMES)
+        return -EINVAL;
+    if (n && (uint64_t)(frames + 1) * n > MAX_SPECTRA_FLOATS)
+        return -EINVAL;
+    /* pulse blocks tile the chunk and its margins */
+    if (len && (len < MIN_PULSE_BLOCK || (len & (len - 1)) ||
+                (n && len > n / 2)))
+        return -EINVAL;
+    if (config->action > RX888_RFI_REPLACE)
+        return -EINVAL;
+
+    rfi = calloc(1, sizeof(rx888_rfi_t));
+    if (!rfi)
+        return -ENOMEM;
+
+    rfi->config = *config;
+    rfi->config.sk_frames = frames;
+    if (rfi->config.sk_sigma <= 0.0f)
+        rfi->config.sk_sigma = DEFAULT_SK_SIGMA;
+    if (rfi->config.pulse_db <= 0.0f)
+        rfi->config.pulse_db = DEFAULT_PULSE_DB;
+
+    rfi->cb = cb;
+    rfi->cb_ctx = ctx;
+    rfi->bins = n / 2;
+    rfi->hop = n / 2;
+    /* a chunk of M hops is covered by M + 1 half overlapping spectra */
+    rfi->frames = frames + 1;
+    rfi->chunk = n ? frames * rfi->hop : frames * len;
+    rfi->span = rfi->chunk + 2 * rfi->hop;
+    rfi->blocks = len ? rfi->chunk / len : 0;
+    rfi->span_blocks = len ? rfi->span / len : 0;
+    rfi->sk_spectra = (rfi->frames + 1) / 2;
+    rfi->sk_limit = rfi_sk_limit(rfi->sk_spectra, rfi->config.sk_sigma);
+    rfi->pulse_ratio = powf(10.0f, rfi->config.pulse_db / 10.0f);
+
+    pthread_mutex_init(&rfi->lock, NULL);
+    pthread_cond_init(&rfi->done, NULL);
+
+    rfi->pool = rx888_pool_create(config->threads, 0);
+    if (!rfi->pool)
+        goto err;
+
+    if (n) {
+        rfi->fft = rx888_fft_plan(n);
+        rfi->window = malloc(n * sizeof(float));
+        if (!rfi->fft || !rfi->window)
+            goto err;
+        rx888_fft_window(RX888_WINDOW_HANN, rfi->window, n);
+    }
+
+    rfi->nworkers = rx888_pool_threads(rfi->pool);
+    rfi->work = calloc(rfi->nworkers, sizeof(struct rfi_work));
+    if (!rfi->work)
+        goto err;
+    for (unsigned int i = 0; i < rfi->nworkers; i++) {
+        struct rfi_work *w = &rfi->work[i];
+        uint32_t scratch = rfi->frames > rfi->blocks ? rfi->frames
+                                                     : rfi->blocks;
+
+        w->scratch = malloc(scratch * sizeof(float));
+        if (!w->scratch)
+            goto err;
+        if (len) {
+            w->power = malloc(rfi->span_blocks * sizeof(float));
+            if (!w->power)
+                goto err;
+        }
+        if (n) {
+            w->re = malloc(rfi->bins * sizeof(float));
+            w->im = malloc(rfi->bins * sizeof(float));
+            w->spectra = malloc((size_t)rfi->frames * n * sizeof(float));
+            w->s1 = malloc(rfi->bins * sizeof(double));
+            w->s2 = malloc(rfi->bins * sizeof(double));
+            w->frame = malloc(n * sizeof(float));
+            w->acc = malloc(rfi->span * sizeof(float));
+            if (!w->re || !w->im || !w->spectra || !w->s1 || !w->s2 ||
+                !w->frame || !w->acc)
+                goto err;
+        }
+    }
+
+    /* one chunk per worker in flight, one filling and one being read */
+    rfi->nslots = rfi->nworkers + 2;
+    rfi->delay = (rfi->nslots - 1) * rfi->chunk + rfi->hop;
+    rfi->slots = calloc(rfi->nslots, sizeof(struct rfi_slot));
+    if (!rfi->slots)
+        goto err;
+    for (unsigned int i = 0; i < rfi->nslots; i++) {
+        struct rfi_slot *slot = &rfi->slots[i];
+
+        slot->rfi = rfi;
+        slot->input = malloc(rfi->span * sizeof(int16_t));
+        slot->output = malloc(rfi->chunk * sizeof(int16_t));
+        slot->kurtosis = calloc(rfi->bins + 1, sizeof(float));
+        slot->bin_mask = calloc(rfi->bins + 1, 1);
+        slot->block_mask = calloc(rfi->blocks + 1, 1);
+        if (!slot->input || !slot->output || !slot->kurtosis ||
+            !slot->bin_mask || !slot->block_mask)
+            goto err;
+    }
+
+    /* the first chunk starts after a hop of silence */
+    rfi->cur = rfi_acquire(rfi);
+    memset(rfi->cur->input, 0, rfi->hop * sizeof(int16_t));
+    rfi->cur->fill = rfi->hop;
+
+    *out = rfi;
+    return 0;
+err:
+    rx888_rfi_destroy(rfi);
+    return -ENOMEM;
+}
+
+int rx888_rfi_process(rx888_rfi_t *rfi, int16_t *samples, uint32_t count)
+{
+    if (!rfi || (!samples && count))
+        return -EINVAL;
+
+    while (count) {
+        struct rfi_slot *slot = rfi->cur;
+        struct rfi_slot *done = NULL;
+        uint32_t n = rfi->span - slot->fill;
+
+        if (n > count)
+            n = count;
+
+        /* stop at the end of the chunk being handed out */
+        if (rfi->in_index < rfi->delay) {
+            if (n > rfi->delay - rfi->in_index)
+                n = (uint32_t)(rfi->delay - rfi->in_index);
+        } else {
+            done = rfi_output(rfi);
+            if (n > rfi->chunk - rfi->out_pos)
+                n = rfi->chunk - rfi->out_pos;
+        }
+
+        memcpy(slot->input + slot->fill, samples, n * sizeof(int16_t));
+        slot->fill += n;
+        rfi->in_index += n;
+
+        if (done) {
+            memcpy(samples, done->output + rfi->out_pos,
+                   n * sizeof(int16_t));
+            rfi->out_pos += n;
+            if (rfi->out_pos == rfi->chunk) {
+                atomic_store(&done->state, SLOT_FREE);
+                rfi->out_seq++;
+                rfi->out_pos = 0;
+            }
+        } else {
+            memset(samples, 0, n * sizeof(int16_t));
+        }
+
+        samples += n;
+        count -= n;
+
+        if (slot->fill < rfi->span)
+            continue;
+
+        /* the margins overlap the next chunk */
+        uint32_t carry = rfi->span - rfi->chunk;
+        rfi->cur = rfi_acquire(rfi);
+        memcpy(rfi->cur->input, slot->input + rfi->chunk,
+               carry * sizeof(int16_t));
+        rfi->cur->fill = carry;
+
+        atomic_store(&slot->state, SLOT_QUEUED);
+        rx888_pool_submit(rfi->pool, rfi_job, slot);
+    }
+
+    return 0;
+}
+
+uint32_t rx888_rfi_delay(rx888_rfi_t *rfi)
+{
+    if (!rfi)
+        return 0;
+
+    return rfi->delay;
+}
+
+void rx888_rfi_destroy(rx888_rfi_t *rfi)
+{
+    if (!rfi)
+        return;
+
+    /* joins the workers, so no job touches the slots afterwards */
+    rx888_pool_destroy(rfi->pool);
+    rfi_free_work(rfi);
+
+    if (rfi->slots) {
+        for (unsigned int i = 0; i < rfi->nslots; i++) {
+            free(rfi->slots[i].input);
+            free(rfi->slots[i].output);
+            free(rfi->slots[i].kurtosis);
+            free(rfi->slots[i].bin_mask);
+            free(rfi->slots[i].block_mask);
+        }
+        free(rfi->slots);
+    }
+
+    rx888_fft_free(rfi->fft);
+    free(rfi->window);
+    pthread_cond_destroy(&rfi->done);
+    pthread_mutex_destroy(&rfi->lock);
+    free(rfi);
+}
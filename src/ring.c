@@ -0,0 +1,105 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "numa.h"
+#include "ring.h"
+
+#ifndef _WIN32
+int rx888_ring_map(struct rx888_ring *ring, size_t size, int node)
+{
+    static atomic_uint serial;
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char *base;
+    char name[64];
+    int fd, r = 0;
+
+    if (!size || page <= 0 || size % (size_t)page)
+        return -EINVAL;
+
+    /* an unlinked shared memory object backs both mappings */
+    snprintf(name, sizeof(name), "/rx888-ring-%ld-%u", (long)getpid(),
+             atomic_fetch_add(&serial, 1));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -errno;
+    shm_unlink(name);
+
+    if (ftruncate(fd, (off_t)size) < 0) {
+        r = -errno;
+        goto out;
+    }
+
+    /* reserve the address space, then map the object into both halves */
+    base = mmap(NULL, 2 * size, PROT_NONE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == base) {
+        r = -errno;
+        goto out;
+    }
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        r = -errno;
+        munmap(base, 2 * size);
+        goto out;
+    }
+
+    /* the policy is shared by the object, so it covers both halves */
+    if (node >= 0)
+        rx888_numa_bind(base, size, node);
+
+    ring->base = base;
+    ring->size = size;
+
+out:
+    close(fd);
+    return r;
+}
+
+void rx888_ring_unmap(struct rx888_ring *ring)
+{
+    if (ring->base)
+        munmap(ring->base, 2 * ring->size);
+    ring->base = NULL;
+    ring->size = 0;
+}
+#else
+int rx888_ring_map(struct rx888_ring *ring, size_t size, int node)
+{
+    (void)ring;
+    (void)size;
+    (void)node;
+    return -ENOSYS;
+}
+
+void rx888_ring_unmap(struct rx888_ring *ring)
+{
+    (void)ring;
+}
+#endif
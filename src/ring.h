@@ -0,0 +1,38 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_RING_H
+#define RX888_RING_H
+
+#include <stddef.h>
+
+/*
+ * The same pages mapped twice back to back, so that any window of up to
+ * size bytes starting inside the first mapping is contiguous in memory.
+ */
+struct rx888_ring {
+    unsigned char *base;        /* 2 * size bytes of address space */
+    size_t size;
+};
+
+/* size must be a multiple of the page size, node -1 for no placement */
+int rx888_ring_map(struct rx888_ring *ring, size_t size, int node);
+
+void rx888_ring_unmap(struct rx888_ring *ring);
+
+#endif /* RX888_RING_H */
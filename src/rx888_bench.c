@@ -0,0 +1,813 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * rx888_bench, offline benchmark of the library processing stages
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* vmsplice() and F_SETPIPE_SZ */
+#endif
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#else
+#include <windows.h>
+#include "getopt/getopt.h"
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+
+#include "librx888.h"
+#include "librx888_dsp.h"
+
+#define DEFAULT_SAMPLE_RATE		130000000
+#define DEFAULT_DURATION		2.0
+#define BENCH_BUF_LENGTH		(1024 * 16 * 8)
+#define BENCH_BUF_COUNT			64
+#define BENCH_PIPE_SIZE			(1024 * 1024)
+#define BENCH_PAGE_SIZE			4096
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+static double duration = DEFAULT_DURATION;
+static unsigned int threads = 0;
+
+/* synthetic ADC data: a few carriers on top of noise */
+static int16_t *bench_data;
+static uint32_t bench_samples;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_init(void)
+{
+	bench_samples = BENCH_BUF_COUNT * BENCH_BUF_LENGTH / sizeof(int16_t);
+	bench_data = malloc(bench_samples * sizeof(int16_t));
+	if (!bench_data)
+		return -ENOMEM;
+
+	srand(1);
+	for (uint32_t i = 0; i < bench_samples; i++) {
+		double v = 4000.0 * sin(2 * M_PI * 0.0123 * i) +
+			   2000.0 * sin(2 * M_PI * 0.2345 * i) +
+			   (rand() % 2001 - 1000);
+		bench_data[i] = (int16_t)v;
+	}
+
+	return 0;
+}
+
+/* print throughput as MS/s and as share of one core at the target rate */
+static void bench_report(const char *name, uint64_t samples, double wall,
+			 double cpu)
+{
+	double msps = samples / wall / 1e6;
+	double cpu_per_msps = cpu / (samples / 1e6);
+
+	printf("%-28s %9.1f MS/s  %7.3f ms CPU per MS  %6.1f%% CPU at %.0f MS/s\n",
+	       name, msps, cpu_per_msps * 1e3,
+	       100.0 * cpu_per_msps * samp_rate / 1e6, samp_rate / 1e6);
+}
+
+static void spectrum_bench_cb(const float *power_db, uint32_t bins,
+			      uint64_t sample_index, void *ctx)
+{
+	(void)power_db;
+	(void)bins;
+	(void)sample_index;
+	(*(uint64_t *)ctx)++;
+}
+
+static void bench_spectrum(void)
+{
+	for (uint32_t n = 1024; n <= 1048576; n *= 4) {
+		rx888_spectrum_t *spec;
+		uint64_t spectra = 0, samples = 0;
+		rx888_spectrum_config_t config = {
+			.fft_size = n,
+			.window = RX888_WINDOW_HANN,
+			.overlap = 0.5f,
+			.averages = 4,
+			.threads = threads,
+			.blocking = 1,
+		};
+		char name[64];
+
+		if (rx888_spectrum_create(&spec, &config, spectrum_bench_cb,
+					  &spectra) < 0)
+			continue;
+
+		double t0 = now(), c0 = cpu_now(), t1;
+		do {
+			for (uint32_t off = 0; off < bench_samples;
+			     off += BENCH_BUF_LENGTH / sizeof(int16_t)) {
+				rx888_spectrum_process(spec, bench_data + off,
+					BENCH_BUF_LENGTH / sizeof(int16_t));
+				samples += BENCH_BUF_LENGTH / sizeof(int16_t);
+			}
+			t1 = now();
+		} while (t1 - t0 < duration);
+		rx888_spectrum_flush(spec);
+		t1 = now();
+
+		snprintf(name, sizeof(name), "spectrum %u", n);
+		bench_report(name, samples, t1 - t0, cpu_now() - c0);
+
+		rx888_spectrum_destroy(spec);
+	}
+}
+
+static void bench_detector(void)
+{
+	static const uint32_t bands[] = { 0, 64, 1 };
+
+	for (size_t i = 0; i < sizeof(bands) / sizeof(bands[0]); i++) {
+		rx888_detector_t *det;
+		uint64_t samples = 0;
+		rx888_detector_config_t config = {
+			.fft_size = 4096,
+			.bands = bands[i],
+			.threshold_db = 10.0f,
+			.hysteresis_db = 3.0f,
+			.hold_blocks = 16,
+		};
+		char name[64];
+
+		if (rx888_detector_create(&det, &config, NULL, NULL) < 0)
+			continue;
+
+		double t0 = now(), c0 = cpu_now(), t1;
+		do {
+			for (uint32_t off = 0; off < bench_samples;
+			     off += BENCH_BUF_LENGTH / sizeof(int16_t)) {
+				rx888_detector_process(det, bench_data + off,
+					BENCH_BUF_LENGTH / sizeof(int16_t));
+				samples += BENCH_BUF_LENGTH / sizeof(int16_t);
+			}
+			t1 = now();
+		} while (t1 - t0 < duration);
+
+		if (bands[i])
+			snprintf(name, sizeof(name), "detector %u bands",
+				 bands[i]);
+		else
+			snprintf(name, sizeof(name), "detector per bin");
+		bench_report(name, samples, t1 - t0, cpu_now() - c0);
+
+		rx888_detector_destroy(det);
+	}
+}
+
+static void rfi_bench_cb(const rx888_rfi_mask_t *mask, void *ctx)
+{
+	*(uint64_t *)ctx += mask->flagged_bins + mask->flagged_blocks;
+}
+
+struct rfi_noise {
+	uint64_t chunks;
+	uint64_t flagged;
+	uint64_t flagged_chunks;
+	uint32_t bins;
+};
+
+static void rfi_noise_cb(const rx888_rfi_mask_t *mask, void *ctx)
+{
+	struct rfi_noise *r = ctx;
+
+	r->chunks++;
+	r->flagged += mask->flagged_bins;
+	r->flagged_chunks += mask->flagged_bins > 0;
+	r->bins = mask->bins;
+}
+
+/* false alarms of the kurtosis estimator on Gaussian noise, run until
+ * about a hundred are expected so that the rate is resolved to 10% */
+static void bench_rfi_noise(uint32_t fft_size)
+{
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+	int16_t *buf = malloc(BENCH_BUF_LENGTH);
+	int16_t *hist = NULL;
+	struct rfi_noise r = { 0 };
+	rx888_rfi_config_t config = {
+		.fft_size = fft_size,
+		.sk_sigma = 4.0f,
+		.action = RX888_RFI_BLANK,
+		.threads = threads,
+	};
+	rx888_rfi_t *rfi;
+	uint64_t altered = 0, compared = 0, g = 0;
+	uint32_t delay, size = 1;
+	char name[64];
+	/* DC and the bins beside DC and nyquist are never flagged */
+	const double rate = 0.5 * erfc(config.sk_sigma / sqrt(2.0));
+	double expected = 0.0;
+
+	if (!buf || rx888_rfi_create(&rfi, &config, rfi_noise_cb, &r) < 0) {
+		free(buf);
+		return;
+	}
+
+	/* the input since the oldest sample still inside the engine */
+	delay = rx888_rfi_delay(rfi);
+	while (size < delay + len)
+		size <<= 1;
+	hist = malloc(size * sizeof(int16_t));
+	if (!hist)
+		goto out;
+
+	srand(2);
+	double t0 = now();
+	do {
+		for (uint32_t i = 0; i < len; i += 2) {
+			double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+			double v = 2 * M_PI * rand() / (RAND_MAX + 1.0);
+			double a = 1000.0 * sqrt(-2.0 * log(u));
+
+			buf[i] = (int16_t)lrint(a * cos(v));
+			buf[i + 1] = (int16_t)lrint(a * sin(v));
+		}
+		for (uint32_t i = 0; i < len; i++)
+			hist[(g + i) & (size - 1)] = buf[i];
+
+		rx888_rfi_process(rfi, buf, len);
+		for (uint32_t i = 0; i < len; i++, g++) {
+			if (g < delay)
+				continue;
+			altered += buf[i] != hist[(g - delay) & (size - 1)];
+			compared++;
+		}
+		if (r.bins > 3)
+			expected = rate * (r.bins - 3);
+	} while (now() - t0 < duration ||
+		 (expected * r.chunks < 100.0 && now() - t0 < 30 * duration));
+
+	if (r.chunks && r.bins > 3) {
+		snprintf(name, sizeof(name), "rfi %u on noise", fft_size);
+		printf("%-28s %9.4f +- %.4f false bins per chunk of %u, "
+		       "%.4f expected\n", name, (double)r.flagged / r.chunks,
+		       2.0 * sqrt((double)r.flagged) / r.chunks, r.bins - 3,
+		       expected);
+		printf("%-28s %9.2f%% samples altered, %.2f%% of the chunks "
+		       "had a false bin\n", "", compared ?
+		       100.0 * altered / compared : 0.0,
+		       100.0 * r.flagged_chunks / r.chunks);
+	}
+
+out:
+	rx888_rfi_destroy(rfi);
+	free(hist);
+	free(buf);
+}
+
+static void bench_rfi(void)
+{
+	static const uint32_t sizes[] = { 0, 1024, 4096, 16384 };
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+	int16_t *buf = malloc(BENCH_BUF_LENGTH);
+
+	if (!buf)
+		return;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		rx888_rfi_t *rfi;
+		uint64_t flagged = 0, samples = 0;
+		rx888_rfi_config_t config = {
+			.fft_size = sizes[i],
+			.pulse_block = 64,
+			.action = RX888_RFI_BLANK,
+			.threads = threads,
+		};
+		char name[64];
+
+		if (rx888_rfi_create(&rfi, &config, rfi_bench_cb,
+				     &flagged) < 0)
+			continue;
+
+		double t0 = now(), c0 = cpu_now(), t1;
+		do {
+			for (uint32_t off = 0; off < bench_samples; off += len) {
+				/* processed in place, keep the input intact */
+				memcpy(buf, bench_data + off, BENCH_BUF_LENGTH);
+				rx888_rfi_process(rfi, buf, len);
+				samples += len;
+			}
+			t1 = now();
+		} while (t1 - t0 < duration);
+
+		if (sizes[i])
+			snprintf(name, sizeof(name), "rfi %u", sizes[i]);
+		else
+			snprintf(name, sizeof(name), "rfi pulses only");
+		bench_report(name, samples, t1 - t0, cpu_now() - c0);
+
+		rx888_rfi_destroy(rfi);
+	}
+
+	free(buf);
+
+	for (size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		bench_rfi_noise(sizes[i]);
+}
+
+static void demod_bench_cb(const float *audio, uint32_t channels,
+			   uint32_t frames, uint64_t sample_index, void *ctx)
+{
+	(void)audio;
+	(void)channels;
+	(void)sample_index;
+	*(uint64_t *)ctx += frames;
+}
+
+/* CPU seconds per second of stream for a demodulator of count channels */
+static double bench_demod_run(uint32_t count)
+{
+	static const enum rx888_demod_mode modes[] = {
+		RX888_DEMOD_AM, RX888_DEMOD_USB, RX888_DEMOD_LSB, RX888_DEMOD_FM
+	};
+	static const float widths[] = { 8000.0f, 2700.0f, 2700.0f, 12000.0f };
+	rx888_channel_t *ch = calloc(count, sizeof(rx888_channel_t));
+	rx888_demod_config_t config = { .sample_rate = samp_rate };
+	rx888_demod_t *demod;
+	uint64_t frames = 0, samples = 0;
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+	char name[64];
+
+	if (!ch)
+		return -1.0;
+
+	/* spread over the HF range */
+	for (uint32_t c = 0; c < count; c++) {
+		ch[c].frequency = 1e6 + (samp_rate / 2 - 2e6) * c / count;
+		ch[c].mode = modes[c % 4];
+		ch[c].bandwidth = widths[c % 4];
+	}
+
+	if (rx888_demod_create(&demod, &config, ch, count, demod_bench_cb,
+			       &frames) < 0) {
+		free(ch);
+		return -1.0;
+	}
+
+	double t0 = now(), c0 = cpu_now(), t1;
+	do {
+		for (uint32_t off = 0; off < bench_samples; off += len) {
+			rx888_demod_process(demod, bench_data + off, len);
+			samples += len;
+		}
+		t1 = now();
+	} while (t1 - t0 < duration);
+	double cpu = cpu_now() - c0;
+
+	snprintf(name, sizeof(name), "demod %u channels", count);
+	bench_report(name, samples, t1 - t0, cpu);
+
+	rx888_demod_destroy(demod);
+	free(ch);
+
+	return cpu / samples * samp_rate;
+}
+
+static void bench_demod(void)
+{
+	double one = bench_demod_run(1);
+	double many = bench_demod_run(256);
+
+	if (one < 0 || many < 0)
+		return;
+
+	/* the shared front end is whatever one channel does not explain */
+	double channel = (many - one) / 255;
+	double front = one - channel;
+
+	printf("%-28s %9.1f%% CPU shared front end, %.3f%% CPU and %.0f "
+	       "channels per core on top\n", "demod", 100.0 * front,
+	       100.0 * channel, channel > 0 ? 1.0 / channel : 0.0);
+}
+
+/* resampled pure tone against the ideal one, in dB */
+static double bench_resample_snr(rx888_resampler_t *rs, double in_rate,
+				 double out_rate)
+{
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+	const double f = 0.31 * (in_rate < out_rate ? in_rate : out_rate);
+	double delay = rx888_resampler_delay(rs), sig = 0.0, err = 0.0;
+	uint32_t skip = (uint32_t)(2 * delay) + 16, measure = 1 << 15;
+	float *in = malloc(len * sizeof(float));
+	float *out = malloc(rx888_resampler_max_output(rs, len) *
+			    sizeof(float));
+	uint64_t i = 0, k = 0;
+
+	if (!in || !out) {
+		free(in);
+		free(out);
+		return 0.0;
+	}
+
+	while (k < skip + measure) {
+		for (uint32_t j = 0; j < len; j++, i++)
+			in[j] = (float)(8000.0 * sin(2 * M_PI * f * i / in_rate));
+
+		uint32_t n = rx888_resampler_process_float(rs, in, len, out);
+
+		for (uint32_t j = 0; j < n; j++, k++) {
+			double ref = 8000.0 * sin(2 * M_PI * f * (k - delay) /
+						  out_rate);
+
+			if (k < skip || k >= skip + measure)
+				continue;
+			sig += ref * ref;
+			err += (out[j] - ref) * (out[j] - ref);
+		}
+	}
+
+	free(in);
+	free(out);
+
+	return 10.0 * log10(sig / err);
+}
+
+static void bench_resample(void)
+{
+	/* audio rates, an exact rational ratio and one that is not */
+	const double rates[] = { 48000.0, 44100.0, 2400000.0,
+				 samp_rate * M_PI / 16 };
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+
+	for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		rx888_resampler_config_t config = {
+			.in_rate = samp_rate,
+			.out_rate = rates[i],
+		};
+		rx888_resampler_t *rs;
+		uint64_t samples = 0;
+		int16_t *out;
+		char name[64];
+
+		if (rx888_resampler_create(&rs, &config) < 0)
+			continue;
+		out = malloc(rx888_resampler_max_output(rs, len) *
+			     sizeof(int16_t));
+		if (!out) {
+			rx888_resampler_destroy(rs);
+			continue;
+		}
+
+		double t0 = now(), c0 = cpu_now(), t1;
+		do {
+			for (uint32_t off = 0; off < bench_samples; off += len) {
+				rx888_resampler_process(rs, bench_data + off,
+							len, out);
+				samples += len;
+			}
+			t1 = now();
+		} while (t1 - t0 < duration);
+
+		snprintf(name, sizeof(name), "resample to %.0f", rates[i]);
+		bench_report(name, samples, t1 - t0, cpu_now() - c0);
+
+		rx888_resampler_destroy(rs);
+		free(out);
+
+		/* a fresh resampler reuses the cached filters */
+		if (rx888_resampler_create(&rs, &config) < 0)
+			continue;
+		printf("%-28s %9.1f dB SNR of a tone at 0.31 of the output "
+		       "rate, %.1f samples delay\n", name,
+		       bench_resample_snr(rs, samp_rate, rates[i]),
+		       rx888_resampler_delay(rs));
+		rx888_resampler_destroy(rs);
+	}
+}
+
+static void bench_health(void)
+{
+	rx888_adc_health_t health;
+	uint64_t samples = 0;
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+
+	double t0 = now(), c0 = cpu_now(), t1;
+	do {
+		for (uint32_t off = 0; off < bench_samples; off += len) {
+			rx888_adc_health(bench_data + off, len, &health);
+			samples += len;
+		}
+		t1 = now();
+	} while (t1 - t0 < duration);
+
+	bench_report("adc health", samples, t1 - t0, cpu_now() - c0);
+}
+
+static void bench_derandomize(void)
+{
+	uint64_t samples = 0;
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+
+	/* decoding twice restores the data, so it is safe to loop over it */
+	double t0 = now(), c0 = cpu_now(), t1;
+	do {
+		for (uint32_t off = 0; off < bench_samples; off += len) {
+			rx888_adc_derandomize(bench_data + off, len);
+			samples += len;
+		}
+		t1 = now();
+	} while (t1 - t0 < duration);
+
+	bench_report("derandomize", samples, t1 - t0, cpu_now() - c0);
+}
+
+#ifndef _WIN32
+enum output_mode { OUTPUT_STDIO, OUTPUT_WRITE, OUTPUT_VMSPLICE };
+
+/* a block of float I/Q as rx888_rec writes it */
+static void output_convert(float *out, const int16_t *in, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++) {
+		out[2 * i] = in[i] / 32768.0f;
+		out[2 * i + 1] = 0.0f;
+	}
+}
+
+static int output_write(int fd, const unsigned char *p, size_t len, int flags)
+{
+	while (len) {
+		ssize_t r;
+
+#ifdef __linux__
+		if (flags >= 0) {
+			struct iovec iov = { (void *)p, len };
+
+			r = vmsplice(fd, &iov, 1, (unsigned int)flags);
+		} else
+#endif
+		r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * The samples go through a pipe to a child that reads and drops them, the
+ * way rx888_rec feeds a consumer on stdout. Only the writer is timed: the
+ * CPU figure is that of this process, the wall time includes the reader
+ * keeping up.
+ */
+static void bench_output_run(const char *name, enum output_mode mode)
+{
+	const uint32_t len = BENCH_BUF_LENGTH / sizeof(int16_t);
+	const size_t block = (size_t)len * 2 * sizeof(float);
+	unsigned char *pool = NULL;
+	uint64_t *pool_end = NULL;
+	size_t pool_num = 1, next = 0;
+	uint64_t samples = 0, total = 0;
+	FILE *f = NULL;
+	int fds[2], r = 0;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return;
+	}
+#ifdef __linux__
+	fcntl(fds[1], F_SETPIPE_SZ, BENCH_PIPE_SIZE);
+	if (mode == OUTPUT_VMSPLICE)
+		pool_num = (fcntl(fds[1], F_GETPIPE_SZ) + block - 1) / block + 1;
+#endif
+
+	pid = fork();
+	if (pid == 0) {
+		static unsigned char sink[65536];
+
+		close(fds[1]);
+		while (read(fds[0], sink, sizeof(sink)) > 0)
+			;
+		_exit(0);
+	}
+	close(fds[0]);
+	if (pid < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		close(fds[1]);
+		return;
+	}
+
+	pool_end = calloc(pool_num, sizeof(uint64_t));
+#ifdef __linux__
+	pool = mmap(NULL, pool_num * block, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pool == MAP_FAILED)
+		pool = NULL;
+#else
+	pool = malloc(pool_num * block);
+#endif
+	if (mode == OUTPUT_STDIO)
+		f = fdopen(fds[1], "w");
+	if (!pool || !pool_end || (mode == OUTPUT_STDIO && !f)) {
+		fprintf(stderr, "%s: out of memory\n", name);
+		r = -1;
+	}
+
+	double t0 = now(), c0 = cpu_now(), t1 = t0;
+	while (!r && t1 - t0 < duration) {
+		for (uint32_t off = 0; !r && off < bench_samples; off += len) {
+			const int16_t *in = bench_data + off;
+			unsigned char *p = pool + next * block;
+
+			switch (mode) {
+			case OUTPUT_STDIO:
+				/* rx888_rec -F, a sample at a time */
+				for (uint32_t i = 0; i < len; i++) {
+					float I = in[i] / 32768.0f;
+					float Q = 0.0f;
+
+					fwrite(&I, sizeof(float), 1, f);
+					fwrite(&Q, sizeof(float), 1, f);
+				}
+				r = ferror(f) ? -1 : 0;
+				break;
+			case OUTPUT_WRITE:
+				output_convert((float *)p, in, len);
+				r = output_write(fds[1], p, block, -1);
+				break;
+			case OUTPUT_VMSPLICE:
+#ifdef __linux__
+				/* reuse a block once the reader is past it */
+				for (int queued = 0; !r; sched_yield()) {
+					r = ioctl(fds[1], FIONREAD, &queued);
+					if (total - (uint64_t)queued >=
+					    pool_end[next])
+						break;
+				}
+				output_convert((float *)p, in, len);
+				if (!r)
+					r = output_write(fds[1], p, block, 0);
+				pool_end[next] = total + block;
+				next = (next + 1) % pool_num;
+#else
+				r = -1;
+#endif
+				break;
+			}
+			total += block;
+			samples += len;
+		}
+		t1 = now();
+	}
+	if (f)
+		fflush(f);
+	double cpu = cpu_now() - c0;
+
+	if (f)
+		fclose(f);
+	else
+		close(fds[1]);
+	waitpid(pid, NULL, 0);
+	t1 = now();
+
+	if (r < 0)
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+	else
+		printf("%-28s %9.1f MB/s   %7.3f ms CPU per MB  %6.1f%% CPU "
+		       "at %.0f MS/s\n", name, total / (t1 - t0) / 1e6,
+		       cpu / (total / 1e6) * 1e3,
+		       100.0 * cpu / samples * samp_rate, samp_rate / 1e6);
+
+#ifdef __linux__
+	if (pool)
+		munmap(pool, pool_num * block);
+#else
+	free(pool);
+#endif
+	free(pool_end);
+}
+#endif
+
+static void bench_output(void)
+{
+#ifndef _WIN32
+	bench_output_run("output stdio", OUTPUT_STDIO);
+	bench_output_run("output write", OUTPUT_WRITE);
+#ifdef __linux__
+	bench_output_run("output vmsplice", OUTPUT_VMSPLICE);
+#endif
+#endif
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} benches[] = {
+	{ "spectrum", bench_spectrum },
+	{ "detector", bench_detector },
+	{ "rfi", bench_rfi },
+	{ "demod", bench_demod },
+	{ "resample", bench_resample },
+	{ "health", bench_health },
+	{ "derandomize", bench_derandomize },
+	{ "output", bench_output },
+};
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rx888_bench, offline benchmark of the rx888 library processing\n\n"
+		"Usage:\t[-s target samplerate (default: 130000000 Hz)]\n"
+		"\t[-T seconds per benchmark (default: 2)]\n"
+		"\t[-t worker threads (default: 0, one per CPU)]\n"
+		"\t[benchmark ...] (default: all)\n\n"
+		"Benchmarks:");
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		fprintf(stderr, " %s", benches[i].name);
+	fprintf(stderr, "\n\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:T:t:h")) != -1) {
+		switch (opt) {
+		case 's':
+			samp_rate = (uint32_t)atof(optarg);
+			break;
+		case 'T':
+			duration = atof(optarg);
+			break;
+		case 't':
+			threads = (unsigned int)atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (bench_init() < 0) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		int selected = optind >= argc;
+
+		for (int a = optind; a < argc; a++)
+			selected |= !strcmp(argv[a], benches[i].name);
+
+		if (selected)
+			benches[i].run();
+	}
+
+	free(bench_data);
+
+	return 0;
+}
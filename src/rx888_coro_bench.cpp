@@ -0,0 +1,174 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * rx888_coro_bench, per buffer cost of the coroutine interface against the
+ * C callback
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <unistd.h>
+
+#include "librx888_coro.hpp"
+
+#define DEFAULT_SAMPLE_RATE		64000000
+#define DEFAULT_DURATION		5.0
+
+static double duration = DEFAULT_DURATION;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct result {
+	uint64_t buffers = 0;
+	uint64_t samples = 0;
+	int64_t sink = 0;	/* keeps the sample reads */
+	double wall = 0;
+	double cpu = 0;
+};
+
+static void report(const char *name, const result &r, const result *base)
+{
+	double us = r.cpu / r.buffers * 1e6;
+
+	printf("%-10s %9llu buffers %7.1f MS/s %8.3f us CPU per buffer",
+	       name, (unsigned long long)r.buffers,
+	       r.samples / r.wall / 1e6, us);
+	if (base)
+		printf("  %+6.1f%%", 100.0 * (us / (base->cpu / base->buffers *
+						     1e6) - 1.0));
+	printf("\n");
+}
+
+static result run_callback(rx888::device &dev, uint32_t buf_len)
+{
+	result r;
+	double stop = now() + duration;
+	double t0 = now(), c0 = cpu_now();
+
+	dev.read_async([&](rx888::samples s) {
+		r.buffers++;
+		r.samples += s.size();
+		r.sink += s.front();
+		if (now() >= stop)
+			dev.cancel();
+	}, 0, buf_len);
+
+	r.wall = now() - t0;
+	r.cpu = cpu_now() - c0;
+
+	return r;
+}
+
+static rx888::task consume(rx888::stream<> &s, result &r)
+{
+	double stop = now() + duration;
+
+	while (now() < stop) {
+		rx888::buffer b = co_await s.next();
+
+		r.buffers++;
+		r.samples += b.data.size();
+		r.sink += b.data.front();
+	}
+}
+
+static result run_coroutine(rx888::device &dev, uint32_t buf_len)
+{
+	result r;
+	double t0 = now(), c0 = cpu_now();
+	{
+		rx888::stream<> s(dev, {}, 0, buf_len);
+		rx888::task t = consume(s, r);
+
+		s.run();
+		t.get();
+	}
+	r.wall = now() - t0;
+	r.cpu = cpu_now() - c0;
+
+	return r;
+}
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rx888_coro_bench, coroutine against callback streaming cost\n\n"
+		"Usage:\t[-d device_index (default: 0)]\n"
+		"\t[-s samplerate (default: 64000000 Hz)]\n"
+		"\t[-b transfer length (default: 131072)]\n"
+		"\t[-T seconds per run (default: 5)]\n\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t dev_index = 0;
+	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+	uint32_t buf_len = 1024 * 16 * 8;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:b:T:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_index = (uint32_t)atoi(optarg);
+			break;
+		case 's':
+			samp_rate = (uint32_t)atof(optarg);
+			break;
+		case 'b':
+			buf_len = (uint32_t)atof(optarg);
+			break;
+		case 'T':
+			duration = atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+
+	try {
+		rx888::device dev(dev_index);
+
+		dev.set_sample_rate(samp_rate);
+
+		result cb = run_callback(dev, buf_len);
+		result co = run_coroutine(dev, buf_len);
+
+		report("callback", cb, nullptr);
+		report("coroutine", co, &cb);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,455 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * rx888_demod, multi channel AM, FM and SSB audio recorder
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include "getopt/getopt.h"
+#endif
+
+#include "librx888.h"
+#include "librx888_dsp.h"
+
+#define DEFAULT_SAMPLE_RATE		64000000
+#define MAX_CHANNELS			4096
+
+static int do_exit = 0;
+static rx888_dev_t *dev = NULL;
+
+struct demod_output {
+	FILE **files;			/* one per channel, or stdout alone */
+	uint32_t nfiles;
+	int pcm16;
+	void *scratch;			/* one channel of a callback */
+	size_t scratch_len;
+	uint64_t frames_written;
+};
+
+int verbose_set_sample_rate(rx888_dev_t *dev, uint32_t samp_rate)
+{
+	int r;
+	r = rx888_set_sample_rate(dev, samp_rate);
+	if (r < 0) {
+		fprintf(stderr, "WARNING: Failed to set sample rate.\n");
+	} else {
+		fprintf(stderr, "Sampling at %u S/s.\n", samp_rate);
+	}
+	return r;
+}
+
+int verbose_device_search(char *s)
+{
+	int i, device_count, device;
+	char *s2;
+	char vendor[256], product[256], serial[256];
+	device_count = rx888_get_device_count();
+	if (!device_count) {
+		fprintf(stderr, "No supported devices found.\n");
+		return -1;
+	}
+	fprintf(stderr, "Found %d device(s):\n", device_count);
+	for (i = 0; i < device_count; i++) {
+		rx888_get_device_usb_strings(i, vendor, product, serial);
+		fprintf(stderr, "  %d:  %s, %s, SN: %s\n", i, vendor, product, serial);
+	}
+	fprintf(stderr, "\n");
+	/* does string look like raw id number */
+	device = (int)strtol(s, &s2, 0);
+	if (s2[0] == '\0' && device >= 0 && device < device_count) {
+		fprintf(stderr, "Using device %d: %s\n",
+			device, rx888_get_device_name((uint32_t)device));
+		return device;
+	}
+	/* does string exact match a serial */
+	device = rx888_get_index_by_serial(s);
+	if (device >= 0) {
+		fprintf(stderr, "Using device %d: %s\n",
+			device, rx888_get_device_name((uint32_t)device));
+		return device;
+	}
+	fprintf(stderr, "No matching devices found.\n");
+	return -1;
+}
+
+double atofs(char *s)
+/* standard suffixes */
+{
+	char last;
+	int len;
+	double suff = 1.0;
+	len = strlen(s);
+	last = s[len-1];
+	s[len-1] = '\0';
+	switch (last) {
+		case 'g':
+		case 'G':
+			suff *= 1e3;
+			/* fall-through */
+		case 'm':
+		case 'M':
+			suff *= 1e3;
+			/* fall-through */
+		case 'k':
+		case 'K':
+			suff *= 1e3;
+			suff *= atof(s);
+			s[len-1] = last;
+			return suff;
+	}
+	s[len-1] = last;
+	return atof(s);
+}
+
+static const char *mode_names[] = { "am", "fm", "usb", "lsb" };
+static const float mode_widths[] = { 8000.0f, 12000.0f, 2700.0f, 2700.0f };
+
+/* frequency:mode[:bandwidth] */
+static int parse_channel(char *s, rx888_channel_t *ch)
+{
+	char *mode = strchr(s, ':');
+	char *width;
+	unsigned int m;
+
+	if (!mode || mode == s)
+		return -1;
+	*mode++ = '\0';
+	width = strchr(mode, ':');
+	if (width)
+		*width++ = '\0';
+
+	for (m = 0; m < sizeof(mode_names) / sizeof(mode_names[0]); m++)
+		if (!strcmp(mode, mode_names[m]))
+			break;
+	if (m == sizeof(mode_names) / sizeof(mode_names[0]))
+		return -1;
+
+	ch->frequency = atofs(s);
+	ch->mode = (enum rx888_demod_mode)m;
+	ch->bandwidth = width && *width ? (float)atofs(width) : mode_widths[m];
+
+	return ch->frequency > 0.0 && ch->bandwidth > 0.0f ? 0 : -1;
+}
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rx888_demod, a multi channel AM, FM and SSB audio recorder for the rx888\n"
+		"receiver\n\n"
+		"Usage:\t-f frequency:mode[:bandwidth], a channel, repeat for more\n"
+		"\t    (mode: am, fm, usb, lsb; bandwidth default: 8k, 12k,\n"
+		"\t    2.7k, 2.7k)\n"
+		"\t[-s samplerate (default: 64000000 Hz)]\n"
+		"\t[-d device_index or serial (default: 0)]\n"
+		"\t[-a lowest audio rate (default: 48000 Hz)]\n"
+		"\t[-n front end fft_size, power of two (default: 262144)]\n"
+		"\t[-i write 16 bit PCM instead of float]\n"
+		"\t[-R replay a raw or SigMF recording instead of a device]\n"
+		"\t[-A replay as fast as possible instead of in real time]\n"
+		"\t[-L loop the replay]\n"
+		"\tprefix (a '-' writes interleaved frames to stdout)\n\n"
+		"Every channel is written to prefix.<channel>.f32 as native floats\n"
+		"around +-1.0, or to prefix.<channel>.s16 with -i.\n\n");
+	exit(1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI
+sighandler(int signum)
+{
+	if (CTRL_C_EVENT == signum) {
+		fprintf(stderr, "Signal caught, exiting!\n");
+		do_exit = 1;
+		rx888_cancel_async(dev);
+		return TRUE;
+	}
+	return FALSE;
+}
+#else
+static void sighandler(int signum)
+{
+	(void)signum;
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Signal caught, exiting!\n");
+	do_exit = 1;
+	rx888_cancel_async(dev);
+}
+#endif
+
+/* convert in place, float to 16 bit PCM */
+static void to_pcm16(void *buf, size_t n)
+{
+	const float *in = buf;
+	int16_t *out = buf;
+
+	for (size_t i = 0; i < n; i++) {
+		float v = in[i] * 32767.0f;
+
+		v = v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v;
+		out[i] = (int16_t)lrintf(v);
+	}
+}
+
+static void audio_callback(const float *audio, uint32_t channels,
+			   uint32_t frames, uint64_t sample_index, void *ctx)
+{
+	struct demod_output *out = ctx;
+	size_t size = out->pcm16 ? sizeof(int16_t) : sizeof(float);
+	size_t n = out->nfiles == 1 ? (size_t)frames * channels : frames;
+	(void)sample_index;
+
+	if (do_exit)
+		return;
+
+	if (n > out->scratch_len) {
+		void *p = realloc(out->scratch, n * sizeof(float));
+		if (!p) {
+			fprintf(stderr, "Out of memory, exiting...\n");
+			goto fail;
+		}
+		out->scratch = p;
+		out->scratch_len = n;
+	}
+
+	for (uint32_t f = 0; f < out->nfiles; f++) {
+		float *s = out->scratch;
+
+		if (out->nfiles == 1)
+			memcpy(s, audio, n * sizeof(float));
+		else
+			for (uint32_t i = 0; i < frames; i++)
+				s[i] = audio[(size_t)i * channels + f];
+		if (out->pcm16)
+			to_pcm16(s, n);
+
+		if (fwrite(s, size, n, out->files[f]) != n) {
+			fprintf(stderr, "Short write, samples lost, exiting!\n");
+			goto fail;
+		}
+	}
+
+	out->frames_written += frames;
+	return;
+
+fail:
+	do_exit = 1;
+	rx888_cancel_async(dev);
+}
+
+static void rx888_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+	if (do_exit)
+		return;
+
+	rx888_demod_process((rx888_demod_t *)ctx, (const int16_t *)buf,
+			    len / sizeof(int16_t));
+}
+
+int main(int argc, char **argv)
+{
+#ifndef _WIN32
+	struct sigaction sigact;
+#endif
+	char *prefix = NULL;
+	int r, opt;
+	int dev_index = 0;
+	int dev_given = 0;
+	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+	rx888_demod_t *demod = NULL;
+	rx888_demod_config_t config = { 0 };
+	rx888_channel_t *channels = NULL;
+	uint32_t count = 0;
+	struct demod_output out = { 0 };
+	char *replay = NULL;
+	rx888_replay_config_t replay_config = { 0 };
+	int samp_rate_given = 0;
+
+	channels = calloc(MAX_CHANNELS, sizeof(rx888_channel_t));
+	if (!channels)
+		exit(1);
+
+	while ((opt = getopt(argc, argv, "d:s:f:a:n:iR:AL")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_index = verbose_device_search(optarg);
+			dev_given = 1;
+			break;
+		case 's':
+			samp_rate = (uint32_t)atofs(optarg);
+			samp_rate_given = 1;
+			break;
+		case 'f':
+			if (count == MAX_CHANNELS) {
+				fprintf(stderr, "At most %u channels.\n",
+					MAX_CHANNELS);
+				exit(1);
+			}
+			if (parse_channel(optarg, &channels[count]) < 0)
+				usage();
+			count++;
+			break;
+		case 'a':
+			config.audio_rate = (uint32_t)atofs(optarg);
+			break;
+		case 'n':
+			config.fft_size = (uint32_t)atofs(optarg);
+			break;
+		case 'i':
+			out.pcm16 = 1;
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'A':
+			replay_config.fast = 1;
+			break;
+		case 'L':
+			replay_config.loop = 1;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (argc <= optind || !count) {
+		usage();
+	} else {
+		prefix = argv[optind];
+	}
+
+	if (replay) {
+		/* the recording knows its rate, -s is only needed for raw files */
+		if (samp_rate_given)
+			replay_config.sample_rate = samp_rate;
+		if (rx888_open_replay(&dev, replay, &replay_config) < 0)
+			exit(1);
+		samp_rate = rx888_get_sample_rate(dev);
+	}
+
+	config.sample_rate = samp_rate;
+	r = rx888_demod_create(&demod, &config, channels, count,
+			       audio_callback, &out);
+	if (r < 0) {
+		fprintf(stderr, "Invalid demodulator configuration, channels "
+			"have to lie within 0 - %u Hz.\n", samp_rate / 2);
+		exit(1);
+	}
+	fprintf(stderr, "Audio at %.1f Hz.\n", rx888_demod_rate(demod));
+
+	if (!dev_given && !replay) {
+		dev_index = verbose_device_search("0");
+	}
+
+	if (dev_index < 0) {
+		exit(1);
+	}
+
+	if (!replay) {
+		r = rx888_open(&dev, (uint32_t)dev_index);
+		if (r < 0) {
+			fprintf(stderr, "Failed to open rx888 device #%d.\n",
+				dev_index);
+			exit(1);
+		}
+	}
+#ifndef _WIN32
+	sigact.sa_handler = sighandler;
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_flags = 0;
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGPIPE, &sigact, NULL);
+#else
+	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sighandler, TRUE );
+#endif
+	/* Set the sample rate */
+	if (!replay)
+		verbose_set_sample_rate(dev, samp_rate);
+
+	out.files = calloc(count, sizeof(FILE *));
+	if (!out.files) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	if(strcmp(prefix, "-") == 0) { /* Write interleaved frames to stdout */
+		out.files[0] = stdout;
+		out.nfiles = 1;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	} else {
+		for (uint32_t c = 0; c < count; c++) {
+			char name[4096];
+
+			snprintf(name, sizeof(name), "%s.%u.%s", prefix, c,
+				 out.pcm16 ? "s16" : "f32");
+			out.files[c] = fopen(name, "wb");
+			if (!out.files[c]) {
+				r = -errno;
+				fprintf(stderr, "Failed to open %s\n", name);
+				goto out;
+			}
+			out.nfiles++;
+			fprintf(stderr, "Channel %u: %.0f Hz %s, %.0f Hz wide "
+				"to %s\n", c, channels[c].frequency,
+				mode_names[channels[c].mode],
+				channels[c].bandwidth, name);
+		}
+	}
+
+	fprintf(stderr, "Reading samples in async mode...\n");
+	r = rx888_read_async(dev, rx888_callback, (void *)demod, 0, 0);
+
+	if (do_exit)
+		fprintf(stderr, "\nUser cancel, exiting...\n");
+	else if (replay && r == 0)
+		fprintf(stderr, "\nEnd of replay.\n");
+	else
+		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
+
+	fprintf(stderr, "%llu frames written.\n",
+		(unsigned long long)out.frames_written);
+
+out:
+	for (uint32_t f = 0; f < out.nfiles; f++)
+		if (out.files[f] != stdout)
+			fclose(out.files[f]);
+	free(out.files);
+	free(out.scratch);
+	rx888_close(dev);
+	rx888_demod_destroy(demod);
+	free(channels);
+
+	return r >= 0 ? r : -r;
+}
@@ -0,0 +1,421 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * rx888_fft, averaged power spectrum recorder
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include "getopt/getopt.h"
+#endif
+
+#include "librx888.h"
+#include "librx888_dsp.h"
+#include "trace.h"
+
+#define DEFAULT_SAMPLE_RATE		64000000
+#define DEFAULT_FFT_SIZE		65536
+#define DEFAULT_FRAME_RATE		10.0
+
+static int do_exit = 0;
+static rx888_dev_t *dev = NULL;
+
+struct fft_output {
+	FILE *file;
+	int csv;
+	uint32_t samp_rate;
+	uint32_t frames_to_write;
+	uint32_t frames_written;
+};
+
+int verbose_set_sample_rate(rx888_dev_t *dev, uint32_t samp_rate)
+{
+	int r;
+	r = rx888_set_sample_rate(dev, samp_rate);
+	if (r < 0) {
+		fprintf(stderr, "WARNING: Failed to set sample rate.\n");
+	} else {
+		fprintf(stderr, "Sampling at %u S/s.\n", samp_rate);
+	}
+	return r;
+}
+
+int verbose_device_search(char *s)
+{
+	int i, device_count, device;
+	char *s2;
+	char vendor[256], product[256], serial[256];
+	device_count = rx888_get_device_count();
+	if (!device_count) {
+		fprintf(stderr, "No supported devices found.\n");
+		return -1;
+	}
+	fprintf(stderr, "Found %d device(s):\n", device_count);
+	for (i = 0; i < device_count; i++) {
+		rx888_get_device_usb_strings(i, vendor, product, serial);
+		fprintf(stderr, "  %d:  %s, %s, SN: %s\n", i, vendor, product, serial);
+	}
+	fprintf(stderr, "\n");
+	/* does string look like raw id number */
+	device = (int)strtol(s, &s2, 0);
+	if (s2[0] == '\0' && device >= 0 && device < device_count) {
+		fprintf(stderr, "Using device %d: %s\n",
+			device, rx888_get_device_name((uint32_t)device));
+		return device;
+	}
+	/* does string exact match a serial */
+	device = rx888_get_index_by_serial(s);
+	if (device >= 0) {
+		fprintf(stderr, "Using device %d: %s\n",
+			device, rx888_get_device_name((uint32_t)device));
+		return device;
+	}
+	fprintf(stderr, "No matching devices found.\n");
+	return -1;
+}
+
+double atofs(char *s)
+/* standard suffixes */
+{
+	char last;
+	int len;
+	double suff = 1.0;
+	len = strlen(s);
+	last = s[len-1];
+	s[len-1] = '\0';
+	switch (last) {
+		case 'g':
+		case 'G':
+			suff *= 1e3;
+			/* fall-through */
+		case 'm':
+		case 'M':
+			suff *= 1e3;
+			/* fall-through */
+		case 'k':
+		case 'K':
+			suff *= 1e3;
+			suff *= atof(s);
+			s[len-1] = last;
+			return suff;
+	}
+	s[len-1] = last;
+	return atof(s);
+}
+
+static int parse_window(const char *s, enum rx888_window *window)
+{
+	if (!strcmp(s, "rect"))
+		*window = RX888_WINDOW_RECT;
+	else if (!strcmp(s, "hann"))
+		*window = RX888_WINDOW_HANN;
+	else if (!strcmp(s, "hamming"))
+		*window = RX888_WINDOW_HAMMING;
+	else if (!strcmp(s, "blackman"))
+		*window = RX888_WINDOW_BLACKMAN;
+	else if (!strcmp(s, "bh"))
+		*window = RX888_WINDOW_BLACKMAN_HARRIS;
+	else
+		return -1;
+	return 0;
+}
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rx888_fft, an averaged power spectrum recorder for the rx888 receiver\n\n"
+		"Usage:\t[-s samplerate (default: 64000000 Hz)]\n"
+		"\t[-d device_index or serial (default: 0)]\n"
+		"\t[-n fft_size, power of two 1024 - 1048576 (default: 65536)]\n"
+		"\t[-w window: rect, hann, hamming, blackman, bh (default: hann)]\n"
+		"\t[-o segment overlap 0.0 - 0.9 (default: 0.5)]\n"
+		"\t[-r spectra per second (default: 10)]\n"
+		"\t[-t worker threads (default: 0, one per CPU)]\n"
+		"\t[-c write CSV instead of binary]\n"
+		"\t[-N number of spectra to write (default: 0, infinite)]\n"
+		"\t[-R replay a raw or SigMF recording instead of a device]\n"
+		"\t[-A replay as fast as possible instead of in real time]\n"
+		"\t[-L loop the replay]\n"
+		"\t[-T trace.json, write a Chrome trace of the data path]\n"
+		"\tfilename (a '-' dumps spectra to stdout)\n\n"
+		"Binary output is fft_size / 2 native float dBFS values per spectrum,\n"
+		"CSV output starts every line with the time offset in seconds.\n\n");
+	exit(1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI
+sighandler(int signum)
+{
+	if (CTRL_C_EVENT == signum) {
+		fprintf(stderr, "Signal caught, exiting!\n");
+		do_exit = 1;
+		rx888_cancel_async(dev);
+		return TRUE;
+	}
+	return FALSE;
+}
+#else
+static void sighandler(int signum)
+{
+	(void)signum;
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Signal caught, exiting!\n");
+	do_exit = 1;
+	rx888_cancel_async(dev);
+}
+#endif
+
+static void spectrum_callback(const float *power_db, uint32_t bins,
+			      uint64_t sample_index, void *ctx)
+{
+	struct fft_output *out = ctx;
+
+	if (do_exit)
+		return;
+
+	RX888_TRACE_BEGIN("write", bins);
+	if (out->csv) {
+		fprintf(out->file, "%.6f", (double)sample_index / out->samp_rate);
+		for (uint32_t k = 0; k < bins; k++)
+			fprintf(out->file, ",%.2f", power_db[k]);
+		fputc('\n', out->file);
+	} else {
+		fwrite(power_db, sizeof(float), bins, out->file);
+	}
+	RX888_TRACE_END("write", bins);
+
+	out->frames_written++;
+	if (out->frames_to_write && out->frames_written >= out->frames_to_write) {
+		do_exit = 1;
+		rx888_cancel_async(dev);
+	}
+}
+
+static void rx888_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+	if (do_exit)
+		return;
+
+	rx888_spectrum_process((rx888_spectrum_t *)ctx, (const int16_t *)buf,
+			       len / sizeof(int16_t));
+}
+
+int main(int argc, char **argv)
+{
+#ifndef _WIN32
+	struct sigaction sigact;
+#endif
+	char *filename = NULL;
+	int r, opt;
+	int dev_index = 0;
+	int dev_given = 0;
+	double frame_rate = DEFAULT_FRAME_RATE;
+	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+	rx888_spectrum_t *spec = NULL;
+	rx888_spectrum_config_t config = {
+		.fft_size = DEFAULT_FFT_SIZE,
+		.window = RX888_WINDOW_HANN,
+		.overlap = 0.5f,
+		.averages = 1,
+		.threads = 0,
+	};
+	struct fft_output out = { 0 };
+	char *replay = NULL;
+	rx888_replay_config_t replay_config = { 0 };
+	int samp_rate_given = 0;
+	char *trace_path = NULL;
+
+	while ((opt = getopt(argc, argv, "d:s:n:w:o:r:t:cN:R:ALT:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_index = verbose_device_search(optarg);
+			dev_given = 1;
+			break;
+		case 's':
+			samp_rate = (uint32_t)atofs(optarg);
+			samp_rate_given = 1;
+			break;
+		case 'n':
+			config.fft_size = (uint32_t)atofs(optarg);
+			break;
+		case 'w':
+			if (parse_window(optarg, &config.window) < 0)
+				usage();
+			break;
+		case 'o':
+			config.overlap = (float)atof(optarg);
+			break;
+		case 'r':
+			frame_rate = atof(optarg);
+			break;
+		case 't':
+			config.threads = (unsigned int)atoi(optarg);
+			break;
+		case 'c':
+			out.csv = 1;
+			break;
+		case 'N':
+			out.frames_to_write = (uint32_t)atof(optarg);
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'A':
+			replay_config.fast = 1;
+			break;
+		case 'L':
+			replay_config.loop = 1;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (argc <= optind) {
+		usage();
+	} else {
+		filename = argv[optind];
+	}
+
+	if (frame_rate <= 0.0) {
+		fprintf(stderr, "Invalid spectrum rate.\n");
+		exit(1);
+	}
+
+	if (replay) {
+		/* the recording knows its rate, -s is only needed for raw files */
+		if (samp_rate_given)
+			replay_config.sample_rate = samp_rate;
+		if (rx888_open_replay(&dev, replay, &replay_config) < 0)
+			exit(1);
+		samp_rate = rx888_get_sample_rate(dev);
+		/* nothing is lost by waiting for the workers */
+		config.blocking = replay_config.fast;
+	}
+
+	/* average every segment that fits into one output period */
+	double hop = config.fft_size * (1.0 - config.overlap);
+	double averages = samp_rate / (frame_rate * (hop > 1.0 ? hop : 1.0));
+	config.averages = averages >= 1.0 ? (uint32_t)(averages + 0.5) : 1;
+
+	out.samp_rate = samp_rate;
+	r = rx888_spectrum_create(&spec, &config, spectrum_callback, &out);
+	if (r < 0) {
+		fprintf(stderr, "Invalid spectrum configuration.\n");
+		exit(1);
+	}
+	fprintf(stderr, "FFT size %u, %u averages per spectrum.\n",
+		config.fft_size, config.averages);
+
+	if (!dev_given && !replay) {
+		dev_index = verbose_device_search("0");
+	}
+
+	if (dev_index < 0) {
+		exit(1);
+	}
+
+	if (!replay) {
+		r = rx888_open(&dev, (uint32_t)dev_index);
+		if (r < 0) {
+			fprintf(stderr, "Failed to open rx888 device #%d.\n",
+				dev_index);
+			exit(1);
+		}
+	}
+#ifndef _WIN32
+	sigact.sa_handler = sighandler;
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_flags = 0;
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGPIPE, &sigact, NULL);
+#else
+	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sighandler, TRUE );
+#endif
+	/* Set the sample rate */
+	if (!replay)
+		verbose_set_sample_rate(dev, samp_rate);
+
+	if(strcmp(filename, "-") == 0) { /* Write spectra to stdout */
+		out.file = stdout;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	} else {
+		out.file = fopen(filename, out.csv ? "w" : "wb");
+		if (!out.file) {
+			fprintf(stderr, "Failed to open %s\n", filename);
+			goto out;
+		}
+	}
+
+	if (trace_path && rx888_trace_enable(1) < 0) {
+		fprintf(stderr, "WARNING: Tracing not compiled in, rebuild "
+			"with -DENABLE_TRACING=ON.\n");
+		trace_path = NULL;
+	}
+
+	fprintf(stderr, "Reading samples in async mode...\n");
+	r = rx888_read_async(dev, rx888_callback, (void *)spec, 0, 0);
+
+	rx888_spectrum_flush(spec);
+
+	if (do_exit)
+		fprintf(stderr, "\nUser cancel, exiting...\n");
+	else if (replay && r == 0)
+		fprintf(stderr, "\nEnd of replay.\n");
+	else
+		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
+
+	if (rx888_spectrum_dropped(spec))
+		fprintf(stderr, "Workers fell behind, %llu samples skipped.\n",
+			(unsigned long long)rx888_spectrum_dropped(spec));
+
+	if (out.file != stdout)
+		fclose(out.file);
+
+	if (trace_path) {
+		rx888_trace_enable(0);
+		if (rx888_trace_dump(trace_path) < 0)
+			fprintf(stderr, "Failed to write %s\n", trace_path);
+	}
+
+out:
+	rx888_close(dev);
+	rx888_spectrum_destroy(spec);
+
+	return r >= 0 ? r : -r;
+}
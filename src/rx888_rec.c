@@ -15,6 +15,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* vmsplice() and F_SETPIPE_SZ */
+#endif
 #define _POSIX_C_SOURCE 200112L
 
 #include <errno.h>
@@ -22,6 +25,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -32,17 +37,70 @@
 #include "getopt/getopt.h"
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
 #include "librx888.h"
+#include "librx888_dsp.h"
+#include "trace.h"
 
 #define DEFAULT_SAMPLE_RATE		2048000
 #define DEFAULT_BUF_LENGTH		(16 * 16384)
 #define MINIMAL_BUF_LENGTH		512
 #define MAXIMAL_BUF_LENGTH		(256 * 16384)
+#define DETECT_FFT_SIZE			4096
+#define DETECT_HOLD_BLOCKS		16
+#define OUT_PIPE_SIZE			(1024 * 1024)
+#define OUT_PAGE_SIZE			4096
+#define RFI_PULSE_BLOCK			64
 
 static int do_exit = 0;
 static uint32_t samples_to_read = 0;
 static rx888_dev_t *dev = NULL;
 
+/* activity gating */
+static rx888_detector_t *detector = NULL;
+static int16_t *preroll = NULL;
+static uint32_t preroll_len = 0;
+static uint32_t preroll_pos = 0;
+static uint32_t postroll_len = 0;
+static uint64_t stream_index = 0;
+static uint64_t written_until = 0;
+static uint64_t write_until = 0;
+static int gate_start = 0;
+
+/* RFI excision ahead of everything else */
+static rx888_rfi_t *rfi = NULL;
+static FILE *rfi_masks = NULL;
+
+/* resampling to the output rate, after RFI excision */
+static rx888_resampler_t *resampler = NULL;
+static int16_t *resampled = NULL;
+static double out_ratio = 1.0;	/* output samples per ADC sample */
+
+/* output, converted a block at a time and passed on in one call */
+static int out_fd = -1;
+static int out_stdio = 0;	/* per sample fwrite(), for comparison */
+static int out_splice = 0;	/* stdout is a pipe, vmsplice() the blocks */
+static unsigned char *out_mem = NULL;
+static unsigned char *out_page = NULL;	/* page aligned block for write() */
+static unsigned char *out_pool = NULL;	/* blocks for vmsplice() */
+static uint64_t *out_pool_end = NULL;	/* out_total once spliced */
+static size_t out_pool_num = 0;
+static size_t out_pool_next = 0;
+static size_t out_block = 0;
+static uint64_t out_total = 0;
+
+/* metrics, written by the callback only */
+static rx888_metrics_t *metrics = NULL;
+static atomic_uint_least64_t writer_ns;
+static atomic_uint_least64_t bytes_written;
+
 int verbose_set_sample_rate(rx888_dev_t *dev, uint32_t samp_rate)
 {
 	int r;
@@ -153,8 +211,21 @@ void usage(void)
 		"\t[-d device_index (default: 0)]\n"
 		"\t[-g gain (default: 0 for auto)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
-		"\t[-b output_block_size (default: 16 * 16384)]\n"
+		"\t[-b output_block_size, multiple of 512 (default: 16 * 16384)]\n"
 		"\t[-n number of samples to read (default: 0, infinite)]\n"
+		"\t[-D detection threshold in dB, only record active segments]\n"
+		"\t[-B detection bands (default: 0, one per FFT bin)]\n"
+		"\t[-P seconds recorded before activity (default: 0)]\n"
+		"\t[-Q seconds recorded after activity (default: 0)]\n"
+		"\t[-M serve Prometheus metrics on [host:]port or unix:path]\n"
+		"\t[-t trace.json, write a Chrome trace of the data path]\n"
+		"\t[-F write through stdio a sample at a time, for comparison]\n"
+		"\t[-R seconds to wait for a lost device to come back (default: 0)]\n"
+		"\t[-X fft size, blank impulsive RFI by spectral kurtosis and pulse\n"
+		"\t    power (delays the samples by a few chunks)]\n"
+		"\t[-x mask file, store the RFI masks of every chunk]\n"
+		"\t[-r output rate in Hz, any ratio to the sample rate\n"
+		"\t    (default: 0, the sample rate)]\n"
 		"\tfilename (a '-' dumps samples to stdout)\n\n");
 	exit(1);
 }
@@ -182,6 +253,329 @@ static void sighandler(int signum)
 }
 #endif
 
+static int output_setup(FILE *file, uint32_t max_len_int16)
+{
+	out_fd = fileno(file);
+	out_block = ((size_t)max_len_int16 * 2 * sizeof(float) +
+		     OUT_PAGE_SIZE - 1) / OUT_PAGE_SIZE * OUT_PAGE_SIZE;
+
+#ifdef __linux__
+	struct stat st;
+
+	if (!out_stdio && !fstat(out_fd, &st) && S_ISFIFO(st.st_mode)) {
+		int pipe_size;
+		void *p;
+
+		/* a larger pipe if allowed, else the current one */
+		fcntl(out_fd, F_SETPIPE_SZ, OUT_PIPE_SIZE);
+		pipe_size = fcntl(out_fd, F_GETPIPE_SZ);
+
+		/* enough blocks for a full pipe plus the one being filled */
+		if (pipe_size > 0) {
+			out_pool_num = (pipe_size + out_block - 1) / out_block + 1;
+			out_pool_end = calloc(out_pool_num, sizeof(uint64_t));
+			if (!out_pool_end)
+				return -1;
+			p = mmap(NULL, out_pool_num * out_block,
+				 PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				return -1;
+			out_pool = p;
+			out_splice = 1;
+		}
+	}
+#endif
+
+	out_mem = malloc(out_block + OUT_PAGE_SIZE);
+	if (!out_mem)
+		return -1;
+	out_page = out_mem + (OUT_PAGE_SIZE -
+		   (uintptr_t)out_mem % OUT_PAGE_SIZE) % OUT_PAGE_SIZE;
+
+	return 0;
+}
+
+static void output_free(void)
+{
+#ifdef __linux__
+	if (out_pool)
+		munmap(out_pool, out_pool_num * out_block);
+	free(out_pool_end);
+#endif
+	free(out_mem);
+}
+
+/*
+ * The pipe references vmspliced pages instead of copying them, so a pool
+ * block is only written again once the reader has taken everything spliced
+ * from it: bytes written minus the bytes still queued (FIONREAD) must have
+ * passed the end of the block. The pool covers a full pipe, so that only
+ * waits after short blocks. A reader that splices the data on rather than
+ * reading it keeps referencing the pages and has to tee(2) or copy them.
+ */
+static unsigned char *output_get(void)
+{
+#ifdef __linux__
+	while (out_splice) {
+		const struct timespec pause = { 0, 100000 };
+		int queued;
+
+		if (ioctl(out_fd, FIONREAD, &queued) < 0)
+			return NULL;
+		if (out_total - (uint64_t)queued >= out_pool_end[out_pool_next])
+			return out_pool + out_pool_next * out_block;
+		if (do_exit) {
+			errno = EINTR;
+			return NULL;
+		}
+		nanosleep(&pause, NULL);
+	}
+#endif
+	return out_page;
+}
+
+static void output_put(unsigned char *p)
+{
+#ifdef __linux__
+	if (p != out_page) {
+		out_pool_end[out_pool_next] = out_total;
+		out_pool_next = (out_pool_next + 1) % out_pool_num;
+	}
+#else
+	(void)p;
+#endif
+}
+
+static int output_block(const unsigned char *p, size_t len)
+{
+	while (len) {
+		ssize_t r;
+
+#ifdef __linux__
+		if (out_splice) {
+			struct iovec iov = { (void *)p, len };
+
+			r = vmsplice(out_fd, &iov, 1, 0);
+			if (r < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				out_splice = 0;
+				continue;
+			}
+		} else
+#endif
+#ifdef _WIN32
+		r = _write(out_fd, p, (unsigned int)len);
+#else
+		r = write(out_fd, p, len);
+#endif
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+		out_total += r;
+	}
+
+	return 0;
+}
+
+static void write_samples(FILE *file, const int16_t *buf_int16,
+			  uint32_t len_int16)
+{
+	if ((samples_to_read > 0) && (samples_to_read < len_int16)) {
+		len_int16 = samples_to_read;
+		do_exit = 1;
+		rx888_cancel_async(dev);
+	}
+
+	if (out_stdio) {
+		for (uint32_t i = 0; i < len_int16; ++i) {
+			// Convert the I component to a float and write it
+			float I = buf_int16[i] / 32768.0f;
+			fwrite(&I, sizeof(float), 1, file);
+
+			// Write the Q component as zero
+			float Q = 0.0f;
+			fwrite(&Q, sizeof(float), 1, file);
+		}
+		out_total += (uint64_t)len_int16 * 2 * sizeof(float);
+	}
+
+	for (uint32_t done = 0; !out_stdio && done < len_int16; ) {
+		float *out = (float *)output_get();
+		uint32_t n = len_int16 - done;
+		int r;
+
+		if (!out) {
+			if (!do_exit)
+				fprintf(stderr, "Output error: %s\n",
+					strerror(errno));
+			do_exit = 1;
+			rx888_cancel_async(dev);
+			return;
+		}
+
+		if (n > out_block / (2 * sizeof(float)))
+			n = out_block / (2 * sizeof(float));
+
+		for (uint32_t i = 0; i < n; ++i) {
+			out[2 * i] = buf_int16[done + i] / 32768.0f;
+			out[2 * i + 1] = 0.0f;
+		}
+
+		r = output_block((unsigned char *)out, n * 2 * sizeof(float));
+		output_put((unsigned char *)out);
+		if (r < 0) {
+			if (!do_exit)
+				fprintf(stderr, "Output error: %s\n",
+					strerror(errno));
+			do_exit = 1;
+			rx888_cancel_async(dev);
+			return;
+		}
+
+		done += n;
+	}
+
+	if (samples_to_read > 0)
+		samples_to_read -= len_int16;
+
+	if (metrics)
+		atomic_store_explicit(&bytes_written,
+			atomic_load_explicit(&bytes_written, memory_order_relaxed) +
+			len_int16 * 2 * sizeof(float), memory_order_relaxed);
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void metrics_callback(rx888_metrics_t *m, void *ctx)
+{
+	(void)ctx;
+
+	rx888_metrics_value(m, "rx888_rec_writer_stall_seconds_total",
+		"counter", "Time the stream callback spent writing output.",
+		atomic_load_explicit(&writer_ns, memory_order_relaxed) * 1e-9);
+	rx888_metrics_value(m, "rx888_rec_written_bytes_total", "counter",
+		"Bytes written to the output.",
+		atomic_load_explicit(&bytes_written, memory_order_relaxed));
+}
+
+/*
+ * One record per chunk: uint64 first sample in the recording (ungated, at
+ * the output rate),
+ * uint32 samples, bins, pulse blocks and pulse block length, all in host
+ * byte order, then a byte per bin and a byte per block, 1 if contaminated.
+ */
+static void rfi_callback(const rx888_rfi_mask_t *mask, void *ctx)
+{
+	uint64_t index = (uint64_t)((mask->sample_index +
+				     rx888_rfi_delay(rfi)) * out_ratio);
+	uint32_t head[4] = { mask->samples, mask->bins, mask->blocks,
+			     mask->block_len };
+
+	(void)ctx;
+
+	if (!rfi_masks)
+		return;
+
+	fwrite(&index, sizeof(index), 1, rfi_masks);
+	fwrite(head, sizeof(head), 1, rfi_masks);
+	fwrite(mask->bin_mask, 1, mask->bins, rfi_masks);
+	fwrite(mask->block_mask, 1, mask->blocks, rfi_masks);
+}
+
+static void detector_callback(enum rx888_detector_event event,
+			      uint64_t sample_index, float level_db,
+			      uint32_t band, void *ctx)
+{
+	(void)ctx;
+
+	if (event == RX888_DETECT_START) {
+		fprintf(stderr, "Activity at sample %llu, band %u, %.1f dB\n",
+			(unsigned long long)sample_index, band, level_db);
+		gate_start = 1;
+	} else {
+		fprintf(stderr, "Quiet at sample %llu\n",
+			(unsigned long long)sample_index);
+		write_until = sample_index + postroll_len;
+	}
+}
+
+/* write the part of the pre-roll history that is not on disk yet */
+static void write_preroll(FILE *file)
+{
+	uint64_t first = stream_index > preroll_len ?
+			 stream_index - preroll_len : 0;
+	if (first < written_until)
+		first = written_until;
+
+	uint32_t count = (uint32_t)(stream_index - first);
+	uint32_t pos = (preroll_pos + preroll_len - count) % preroll_len;
+
+	while (count && !do_exit) {
+		uint32_t n = preroll_len - pos;
+		if (n > count)
+			n = count;
+		write_samples(file, preroll + pos, n);
+		pos = (pos + n) % preroll_len;
+		count -= n;
+	}
+}
+
+static void store_preroll(const int16_t *buf_int16, uint32_t len_int16)
+{
+	if (len_int16 > preroll_len) {
+		buf_int16 += len_int16 - preroll_len;
+		len_int16 = preroll_len;
+	}
+
+	while (len_int16) {
+		uint32_t n = preroll_len - preroll_pos;
+		if (n > len_int16)
+			n = len_int16;
+		memcpy(preroll + preroll_pos, buf_int16, n * sizeof(int16_t));
+		preroll_pos = (preroll_pos + n) % preroll_len;
+		buf_int16 += n;
+		len_int16 -= n;
+	}
+}
+
+static void gated_write(FILE *file, const int16_t *buf_int16,
+			uint32_t len_int16)
+{
+	uint32_t n = 0;
+
+	rx888_detector_process(detector, buf_int16, len_int16);
+
+	if (gate_start) {
+		gate_start = 0;
+		if (preroll_len)
+			write_preroll(file);
+	}
+
+	if (rx888_detector_active(detector))
+		n = len_int16;
+	else if (write_until > stream_index)
+		n = (uint32_t)(write_until - stream_index < len_int16 ?
+			       write_until - stream_index : len_int16);
+
+	if (n) {
+		write_samples(file, buf_int16, n);
+		written_until = stream_index + n;
+	}
+
+	if (preroll_len)
+		store_preroll(buf_int16, len_int16);
+	stream_index += len_int16;
+}
+
 static void rx888_callback(unsigned char *buf, uint32_t len, void *ctx)
 {
     if (ctx) {
@@ -190,28 +584,46 @@ static void rx888_callback(unsigned char *buf, uint32_t len, void *ctx)
 
         int16_t* buf_int16 = (int16_t*)buf;
         uint32_t len_int16 = len / sizeof(int16_t);
+        uint64_t t0 = metrics ? monotonic_ns() : 0;
 
-        if ((samples_to_read > 0) && (samples_to_read < len_int16)) {
-            len_int16 = samples_to_read;
-            do_exit = 1;
-            rx888_cancel_async(dev);
-        }
-
-        for (uint32_t i = 0; i < len_int16; ++i) {
-            // Convert the I component to a float and write it
-            float I = buf_int16[i] / 32768.0f;
-            fwrite(&I, sizeof(float), 1, (FILE*)ctx);
+        if (rfi)
+            rx888_rfi_process(rfi, buf_int16, len_int16);
 
-            // Write the Q component as zero
-            float Q = 0.0f;
-            fwrite(&Q, sizeof(float), 1, (FILE*)ctx);
+        if (resampler) {
+            len_int16 = rx888_resampler_process(resampler, buf_int16,
+                                                len_int16, resampled);
+            buf_int16 = resampled;
         }
 
-        if (samples_to_read > 0)
-            samples_to_read -= len_int16;
+        RX888_TRACE_BEGIN("write", len);
+        if (detector)
+            gated_write((FILE*)ctx, buf_int16, len_int16);
+        else
+            write_samples((FILE*)ctx, buf_int16, len_int16);
+        RX888_TRACE_END("write", len);
+
+        if (metrics)
+            atomic_store_explicit(&writer_ns,
+                atomic_load_explicit(&writer_ns, memory_order_relaxed) +
+                monotonic_ns() - t0, memory_order_relaxed);
     }
 }
 
+static void rx888_callback_ex(unsigned char *buf, uint32_t len,
+			      const rx888_buffer_info_t *info, void *ctx)
+{
+	if (info->flags & RX888_BUF_DISCONTINUITY) {
+		fprintf(stderr, "Device recovered, about %llu samples lost at "
+			"sample %llu.\n",
+			(unsigned long long)info->lost_samples,
+			(unsigned long long)info->sample_index);
+		/* keep the post-roll in stream time */
+		stream_index += (uint64_t)(info->lost_samples * out_ratio);
+	}
+
+	rx888_callback(buf, len, ctx);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -226,8 +638,27 @@ int main(int argc, char **argv)
 	int dev_given = 0; 
 	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
 	uint32_t out_block_size = DEFAULT_BUF_LENGTH;
-
-	while ((opt = getopt(argc, argv, "d:f:g:s:b:n:p:S")) != -1) {
+	double preroll_time = 0.0, postroll_time = 0.0;
+	char *metrics_addr = NULL;
+	char *trace_path = NULL;
+	double recover_time = 0.0;
+	char *rfi_mask_path = NULL;
+	double out_rate = 0.0, rec_rate;
+	rx888_rfi_config_t rfi_config = {
+		.pulse_block = RFI_PULSE_BLOCK,
+		.action = RX888_RFI_BLANK,
+	};
+	uint64_t start_ns;
+	double elapsed;
+	rx888_detector_config_t detect = {
+		.fft_size = DETECT_FFT_SIZE,
+		.bands = 0,
+		.threshold_db = 0.0f,
+		.hysteresis_db = 3.0f,
+		.hold_blocks = DETECT_HOLD_BLOCKS,
+	};
+
+	while ((opt = getopt(argc, argv, "d:f:g:s:b:n:p:D:B:P:Q:M:t:R:X:x:r:FS")) != -1) {
 		switch (opt) {
 		case 'd':
 			dev_index = verbose_device_search(optarg);
@@ -242,6 +673,39 @@ int main(int argc, char **argv)
 		case 'n':
 			samples_to_read = (uint32_t)atof(optarg) * 2;
 			break;
+		case 'D':
+			detect.threshold_db = (float)atof(optarg);
+			break;
+		case 'B':
+			detect.bands = (uint32_t)atoi(optarg);
+			break;
+		case 'P':
+			preroll_time = atof(optarg);
+			break;
+		case 'Q':
+			postroll_time = atof(optarg);
+			break;
+		case 'M':
+			metrics_addr = optarg;
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'F':
+			out_stdio = 1;
+			break;
+		case 'R':
+			recover_time = atof(optarg);
+			break;
+		case 'X':
+			rfi_config.fft_size = (uint32_t)atoi(optarg);
+			break;
+		case 'x':
+			rfi_mask_path = optarg;
+			break;
+		case 'r':
+			out_rate = atofs(optarg);
+			break;
 		default:
 			usage();
 			break;
@@ -265,8 +729,79 @@ int main(int argc, char **argv)
 		out_block_size = DEFAULT_BUF_LENGTH;
 	}
 
+	/* the library takes whole 512 byte units only and would fall back to
+	 * its own default, larger than the buffers sized from this below */
+	if (out_block_size % MINIMAL_BUF_LENGTH) {
+		out_block_size -= out_block_size % MINIMAL_BUF_LENGTH;
+		fprintf(stderr, "Output block size rounded down to %u\n",
+			out_block_size);
+	}
+
 	buffer = malloc(out_block_size * sizeof(uint8_t));
 
+	rec_rate = samp_rate;
+	if (out_rate > 0.0 && out_rate != samp_rate) {
+		rx888_resampler_config_t rs_config = {
+			.in_rate = samp_rate,
+			.out_rate = out_rate,
+		};
+
+		if (rx888_resampler_create(&resampler, &rs_config) < 0) {
+			fprintf(stderr, "Invalid output rate.\n");
+			exit(1);
+		}
+		resampled = malloc(rx888_resampler_max_output(resampler,
+				   out_block_size / sizeof(int16_t)) *
+				   sizeof(int16_t));
+		if (!resampled) {
+			fprintf(stderr, "Failed to allocate resampler "
+				"buffer\n");
+			exit(1);
+		}
+		rec_rate = out_rate;
+		out_ratio = out_rate / samp_rate;
+		fprintf(stderr, "Resampling to %.3f S/s, delayed by %.1f "
+			"samples.\n", out_rate,
+			rx888_resampler_delay(resampler));
+	}
+
+	if (detect.threshold_db > 0.0f) {
+		if (detect.hysteresis_db >= detect.threshold_db)
+			detect.hysteresis_db = detect.threshold_db / 2;
+		if (rx888_detector_create(&detector, &detect,
+					  detector_callback, NULL) < 0) {
+			fprintf(stderr, "Invalid detector configuration.\n");
+			exit(1);
+		}
+		preroll_len = (uint32_t)(preroll_time * rec_rate);
+		postroll_len = (uint32_t)(postroll_time * rec_rate);
+		if (preroll_len) {
+			preroll = malloc(preroll_len * sizeof(int16_t));
+			if (!preroll) {
+				fprintf(stderr, "Pre-roll too long.\n");
+				exit(1);
+			}
+		}
+	}
+
+	if (rfi_config.fft_size) {
+		if (rx888_rfi_create(&rfi, &rfi_config, rfi_callback,
+				     NULL) < 0) {
+			fprintf(stderr, "Invalid RFI excision FFT size.\n");
+			exit(1);
+		}
+		fprintf(stderr, "RFI excision delays the samples by %u.\n",
+			rx888_rfi_delay(rfi));
+		if (rfi_mask_path) {
+			rfi_masks = fopen(rfi_mask_path, "wb");
+			if (!rfi_masks) {
+				fprintf(stderr, "Failed to open %s\n",
+					rfi_mask_path);
+				exit(1);
+			}
+		}
+	}
+
 	if (!dev_given) {
 		dev_index = verbose_device_search("0");
 	}
@@ -294,6 +829,21 @@ int main(int argc, char **argv)
 	/* Set the sample rate */
 	verbose_set_sample_rate(dev, samp_rate);
 
+	if (recover_time > 0 &&
+	    rx888_set_auto_recovery(dev, (unsigned int)(recover_time * 1000)) < 0)
+		fprintf(stderr, "WARNING: Failed to enable device recovery.\n");
+
+	if (metrics_addr) {
+		r = rx888_metrics_start(&metrics, dev, metrics_addr,
+					metrics_callback, NULL);
+		if (r < 0)
+			fprintf(stderr, "WARNING: Failed to serve metrics on %s: "
+				"%s\n", metrics_addr, strerror(-r));
+		else
+			/* exported as the callback latency summary */
+			rx888_set_latency_stats(dev, 1);
+	}
+
 	if(strcmp(filename, "-") == 0) { /* Write samples to stdout */
 		file = stdout;
 #ifdef _WIN32
@@ -307,25 +857,60 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (output_setup(file, out_block_size / sizeof(int16_t)) < 0) {
+		fprintf(stderr, "Failed to allocate output buffers\n");
+		goto out;
+	}
+
 	/* Reset endpoint before we start reading from it (mandatory) */
 	//verbose_reset_buffer(dev);
 
 	
+	if (trace_path && rx888_trace_enable(1) < 0) {
+		fprintf(stderr, "WARNING: Tracing not compiled in, rebuild "
+			"with -DENABLE_TRACING=ON.\n");
+		trace_path = NULL;
+	}
+
 	fprintf(stderr, "Reading samples in async mode...\n");
-	r = rx888_read_async(dev, rx888_callback, (void *)file,
+	start_ns = monotonic_ns();
+	r = rx888_read_async_ex(dev, rx888_callback_ex, (void *)file,
 				      0, out_block_size);
-	
+	elapsed = (monotonic_ns() - start_ns) * 1e-9;
 
 	if (do_exit)
 		fprintf(stderr, "\nUser cancel, exiting...\n");
 	else
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
 
+	if (elapsed > 0)
+		fprintf(stderr, "Wrote %.1f MB in %.1f s, %.1f MB/s through "
+			"%s.\n", out_total / 1e6, elapsed,
+			out_total / 1e6 / elapsed,
+			out_stdio ? "stdio" : out_splice ? "vmsplice" : "write");
+
 	if (file != stdout)
 		fclose(file);
 
+	if (trace_path) {
+		rx888_trace_enable(0);
+		r = rx888_trace_dump(trace_path);
+		if (r < 0)
+			fprintf(stderr, "Failed to write %s: %s\n", trace_path,
+				strerror(-r));
+	}
+
+	rx888_metrics_stop(metrics);
 	rx888_close(dev);
 	free (buffer);
 out:
+	output_free();
+	rx888_detector_destroy(detector);
+	rx888_rfi_destroy(rfi);
+	if (rfi_masks)
+		fclose(rfi_masks);
+	rx888_resampler_destroy(resampler);
+	free(resampled);
+	free(preroll);
 	return r >= 0 ? r : -r;
 }
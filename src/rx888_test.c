@@ -46,6 +46,10 @@
 #include "getopt.h"
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "librx888.h"
 
 #define DEFAULT_SAMPLE_RATE		64000000
@@ -58,6 +62,14 @@
 #define PPM_DURATION			10
 #define PPM_DUMP_TIME			5
 
+#define LATENCY_DURATION		5
+#define LATENCY_HEADROOM_MS		32
+
+#define RESTART_CYCLES			100
+
+#define NUMA_DURATION			5
+#define NUMA_MAX_NODES			64
+
 struct time_generic
 /* holds all the platform specific values */
 {
@@ -76,13 +88,17 @@ struct time_generic
 static enum {
     NO_BENCHMARK,
     TUNER_BENCHMARK,
-    PPM_BENCHMARK
+    PPM_BENCHMARK,
+    LATENCY_BENCHMARK,
+    RESTART_BENCHMARK,
+    NUMA_BENCHMARK
 } test_mode = NO_BENCHMARK;
 
 uint64_t total_bytes_received = 0;
 struct timeval start_time;
 
 static int do_exit = 0;
+static int benchmark_done = 0;	/* a benchmark ran to its end */
 static rx888_dev_t *dev = NULL;
 
 static uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
@@ -91,6 +107,28 @@ static uint32_t total_samples = 0;
 static uint32_t dropped_samples = 0;
 
 static unsigned int ppm_duration = PPM_DURATION;
+static int sync_mode = 0;
+static int epoll_mode = 0;
+static int batch_mode = 0;
+static uint32_t max_batch = 0;
+static uint64_t burst_samples = 0;
+static uint32_t ring_frame = 0;
+static uint32_t ring_xfer_len = 0;
+static uint64_t ring_pos = 0;
+static uint64_t ring_frames = 0;
+static uint64_t ring_straddled = 0;
+static uint32_t ring_misplaced = 0;
+static int ring_peak = 0;
+
+static double latency_duration = LATENCY_DURATION;
+static double latency_stop_time = 0;
+
+static int restart_cycles = RESTART_CYCLES;
+static double restart_first = 0;
+
+static double numa_duration = NUMA_DURATION;
+static double numa_cpu = 0;
+static uint64_t numa_bytes = 0;
 
 int verbose_set_sample_rate(rx888_dev_t *dev, uint32_t samp_rate)
 {
@@ -174,6 +212,19 @@ void usage(void)
         "\t[-d device_index (default: 0)]\n"
         "\t[-b output_block_size (default: 16 * 16384)]\n"
         "\t[-n number of samples to read (default: 0, infinite)]\n"
+        "\t[-S read with buffered rx888_read_sync() instead of a callback]\n"
+        "\t[-E read with rx888_read_next() from an epoll loop]\n"
+        "\t[-B[max_batch] read with one callback per batch of transfers\n"
+        "\t    (default: half of the transfers)]\n"
+        "\t[-c samples, capture back to back bursts with rx888_burst_wait()]\n"
+        "\t[-g samples, read frames of this size in place from the transfer\n"
+        "\t    ring with rx888_ring_peek()]\n"
+        "\t[-l[seconds] sweep ADC to callback latency over transfer sizes\n"
+        "\t    and event loop modes (default: 5 s per point)]\n"
+        "\t[-r[cycles] stop to restart time with and without a session\n"
+        "\t    (default: 100 cycles)]\n"
+        "\t[-N[seconds] buffer and thread placement on the device NUMA node\n"
+        "\t    against another one (default: 5 s per point)]\n"
         "\tfilename (a '-' dumps samples to stdout)\n\n");
     exit(1);
 }
@@ -221,6 +272,363 @@ static void rx888_callback(unsigned char *buf, uint32_t len, void *ctx)
     }
 }
 
+static void batch_callback(const rx888_iovec_t *iov, uint32_t count,
+                           void *ctx)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        len += iov[i].len;
+
+    rx888_callback(NULL, len, ctx);
+}
+
+static double seconds_now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void latency_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    (void)buf;
+    (void)len;
+    (void)ctx;
+
+    if (!do_exit && seconds_now(CLOCK_MONOTONIC) >= latency_stop_time)
+        rx888_cancel_async(dev);
+}
+
+static void restart_callback(unsigned char *buf, uint32_t len,
+                             const rx888_buffer_info_t *info, void *ctx)
+{
+    (void)buf;
+    (void)len;
+    (void)info;
+    (void)ctx;
+
+    if (!restart_first)
+        restart_first = seconds_now(CLOCK_MONOTONIC);
+    rx888_cancel_async(dev);
+}
+
+/* streams of one buffer each, allocating per stream against a session */
+static int restart_benchmark(uint32_t buf_len)
+{
+    rx888_session_t *session = NULL;
+    int r = 0;
+
+    printf("%-8s %7s %10s %10s %10s %10s\n", "pool", "cycles", "start us",
+           "stop us", "restart us", "max us");
+
+    for (int mode = 0; mode <= 1 && !do_exit && r >= 0; mode++) {
+        double start = 0, stop = 0, worst = 0;
+        int n;
+
+        if (mode) {
+            r = rx888_session_open(&session, dev, 0, buf_len);
+            if (r < 0)
+                break;
+        }
+
+        for (n = 0; n < restart_cycles && !do_exit; n++) {
+            double t0 = seconds_now(CLOCK_MONOTONIC);
+
+            restart_first = 0;
+            if (mode)
+                r = rx888_session_run(session, restart_callback, NULL);
+            else
+                r = rx888_read_async_ex(dev, restart_callback, NULL, 0,
+                                        buf_len);
+            if (r < 0 || !restart_first)
+                break;
+
+            double t1 = seconds_now(CLOCK_MONOTONIC);
+            start += restart_first - t0;
+            stop += t1 - restart_first;
+            if (t1 - t0 > worst)
+                worst = t1 - t0;
+        }
+
+        if (n)
+            printf("%-8s %7d %10.0f %10.0f %10.0f %10.0f\n",
+                   mode ? "session" : "stream", n, start / n * 1e6,
+                   stop / n * 1e6, (start + stop) / n * 1e6, worst * 1e6);
+
+        rx888_session_close(session);
+        session = NULL;
+    }
+
+    benchmark_done = 1;
+
+    return r;
+}
+
+/* reads every sample, as any processing of the buffer would */
+static void numa_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    rx888_adc_health_t health;
+    double c0 = seconds_now(CLOCK_THREAD_CPUTIME_ID);
+
+    (void)ctx;
+
+    rx888_adc_health((const int16_t *)buf, len / sizeof(int16_t), &health);
+    numa_cpu += seconds_now(CLOCK_THREAD_CPUTIME_ID) - c0;
+    numa_bytes += len;
+
+    if (!do_exit && seconds_now(CLOCK_MONOTONIC) >= latency_stop_time)
+        rx888_cancel_async(dev);
+}
+
+/* transfer buffers and the event thread on the node of the host controller
+ * or on another one */
+static int numa_benchmark(uint32_t buf_len)
+{
+    int local = rx888_get_numa_node(dev), remote = -1;
+    int r = 0;
+
+    for (int node = 0; node < NUMA_MAX_NODES && local >= 0; node++) {
+        if (node != local && rx888_pin_thread_to_node(node) == 0) {
+            remote = node;
+            break;
+        }
+    }
+
+    if (local < 0 || remote < 0) {
+        fprintf(stderr, "The device is not on a NUMA node of its own.\n");
+        benchmark_done = 1;
+        return 0;
+    }
+
+    printf("device on node %d, remote node %d\n", local, remote);
+    printf("%-8s %-8s %9s %12s\n", "buffers", "thread", "MB/s",
+           "CPU us/MB");
+
+    for (int i = 0; i < 4 && !do_exit && r >= 0; i++) {
+        int buf_node = i & 2 ? remote : local;
+        int cpu_node = i & 1 ? remote : local;
+
+        rx888_set_numa_node(dev, buf_node);
+        rx888_pin_thread_to_node(cpu_node);
+        numa_cpu = 0;
+        numa_bytes = 0;
+
+        double t0 = seconds_now(CLOCK_MONOTONIC);
+        latency_stop_time = t0 + numa_duration;
+        r = rx888_read_async(dev, numa_callback, NULL, 0, buf_len);
+        double wall = seconds_now(CLOCK_MONOTONIC) - t0;
+
+        if (numa_bytes)
+            printf("%-8s %-8s %9.1f %12.2f\n",
+                   buf_node == local ? "local" : "remote",
+                   cpu_node == local ? "local" : "remote",
+                   numa_bytes / wall / 1e6, numa_cpu * 1e12 / numa_bytes);
+    }
+
+    rx888_set_numa_node(dev, local);
+    benchmark_done = 1;
+
+    return r;
+}
+
+/* whole frames in place from the ring, whatever transfers they span */
+static void ring_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    const unsigned char *data;
+    uint32_t avail, used = 0;
+    uint32_t bytes = ring_frame * sizeof(int16_t);
+    (void)ctx;
+
+    if (rx888_ring_peek(dev, &data, &avail) < 0)
+        return;
+
+    /* the newest transfer is preceded by the unconsumed data, the cursor
+     * may sit in the other mapping of the same pages */
+    if (avail < len || memcmp(data, buf + len - avail, avail))
+        ring_misplaced++;
+
+    while (avail - used >= bytes) {
+        const int16_t *frame = (const int16_t *)(data + used);
+
+        for (uint32_t i = 0; i < ring_frame; i++)
+            if (abs(frame[i]) > ring_peak)
+                ring_peak = abs(frame[i]);
+
+        if (ring_pos / ring_xfer_len !=
+            (ring_pos + bytes - 1) / ring_xfer_len)
+            ring_straddled++;
+        ring_pos += bytes;
+        ring_frames++;
+        used += bytes;
+    }
+
+    rx888_ring_consume(dev, used);
+    rx888_callback(NULL, used, NULL);
+}
+
+static int ring_read(uint32_t out_block_size)
+{
+    int r;
+
+    if (ring_frame * sizeof(int16_t) > out_block_size) {
+        fprintf(stderr, "Frames take up to %u samples.\n",
+                out_block_size / (uint32_t)sizeof(int16_t));
+        return -EINVAL;
+    }
+
+    r = rx888_set_ring_buffer(dev, 1);
+    if (r < 0) {
+        fprintf(stderr, "Failed to enable the transfer ring.\n");
+        return r;
+    }
+
+    ring_xfer_len = out_block_size;
+    r = rx888_read_async(dev, ring_callback, NULL, 0, out_block_size);
+    rx888_set_ring_buffer(dev, 0);
+
+    fprintf(stderr, "%llu frames, %llu across transfer boundaries, "
+            "%u out of place, peak %d\n", (unsigned long long)ring_frames,
+            (unsigned long long)ring_straddled, ring_misplaced, ring_peak);
+
+    return r;
+}
+
+/* double buffered bursts, each queued right behind the other */
+static int burst_read(void)
+{
+    int16_t *bufs[2];
+    rx888_burst_info_t info;
+    uint64_t next_index = 0;
+    int r;
+
+    bufs[0] = rx888_burst_alloc(dev, burst_samples);
+    bufs[1] = rx888_burst_alloc(dev, burst_samples);
+    if (!bufs[0] || !bufs[1]) {
+        r = -ENOMEM;
+        goto out;
+    }
+
+    r = rx888_burst_start(dev, 0, 0);
+    for (int i = 0; i < 2 && r >= 0; i++)
+        r = rx888_burst_queue(dev, bufs[i], burst_samples, RX888_BURST_NEXT);
+
+    while (!do_exit && r >= 0) {
+        r = rx888_burst_wait(dev, &info, 0);
+        if (r < 0)
+            break;
+
+        if (next_index && info.sample_index != next_index)
+            fprintf(stderr, "Burst starts %lld samples late\n",
+                    (long long)(info.sample_index - next_index));
+        if (info.gaps)
+            fprintf(stderr, "Burst at %llu: %u gaps, %llu samples lost\n",
+                    (unsigned long long)info.sample_index, info.gaps,
+                    (unsigned long long)info.lost_samples);
+        next_index = info.sample_index + info.samples;
+
+        rx888_callback(NULL, info.samples * sizeof(int16_t), NULL);
+        r = rx888_burst_queue(dev, info.data, burst_samples,
+                              RX888_BURST_NEXT);
+    }
+
+    rx888_burst_stop(dev);
+out:
+    rx888_burst_free(dev, bufs[0]);
+    rx888_burst_free(dev, bufs[1]);
+
+    return r;
+}
+
+#ifdef __linux__
+/* the device as one more descriptor of an application's epoll loop */
+static int epoll_read(void)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int epfd, r;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+        return -errno;
+
+    r = rx888_start_readahead(dev, 0, 0);
+    if (r >= 0) {
+        ev.data.fd = rx888_get_poll_fd(dev);
+        r = epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+    }
+
+    while (!do_exit && r >= 0) {
+        unsigned char *buf;
+        uint32_t len;
+
+        if (epoll_wait(epfd, &ev, 1, 1000) < 0 && errno != EINTR) {
+            r = -errno;
+            break;
+        }
+
+        while ((r = rx888_read_next(dev, &buf, &len, NULL)) > 0) {
+            rx888_callback(buf, len, NULL);
+            rx888_release_buffer(dev);
+        }
+    }
+
+    rx888_stop_readahead(dev);
+    close(epfd);
+
+    return r;
+}
+#endif
+
+/* latency against CPU cost, for transfer sizes and both event loop modes */
+static int latency_benchmark(void)
+{
+    static const uint32_t lengths[] = {
+        16 * 1024, 32 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 1024 * 1024
+    };
+    uint64_t bytes_per_ms = (uint64_t)samp_rate * 2 / 1000;
+    int r = 0;
+
+    rx888_set_latency_stats(dev, 1);
+
+    printf("%9s %5s %5s %9s %9s %9s %9s %7s\n", "xfer", "num", "busy",
+           "p50 us", "p99 us", "p99.9 us", "max us", "CPU %");
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        for (int busy = 0; busy <= 1 && !do_exit; busy++) {
+            rx888_latency_stats_t lat;
+            uint32_t num = (uint32_t)(bytes_per_ms * LATENCY_HEADROOM_MS /
+                                      lengths[i]);
+            if (num < 4)
+                num = 4;
+
+            rx888_set_busy_poll(dev, busy);
+            rx888_reset_latency_stats(dev);
+
+            double c0 = seconds_now(CLOCK_PROCESS_CPUTIME_ID);
+            double t0 = seconds_now(CLOCK_MONOTONIC);
+            latency_stop_time = t0 + latency_duration;
+
+            r = rx888_read_async(dev, latency_callback, NULL, num,
+                                 lengths[i]);
+            if (r < 0 || do_exit)
+                return r;
+
+            double wall = seconds_now(CLOCK_MONOTONIC) - t0;
+            double cpu = seconds_now(CLOCK_PROCESS_CPUTIME_ID) - c0;
+
+            rx888_get_latency_stats(dev, &lat);
+            printf("%9u %5u %5s %9u %9u %9u %9u %7.1f\n", lengths[i], num,
+                   busy ? "yes" : "no", lat.p50_us, lat.p99_us, lat.p999_us,
+                   lat.max_us, 100.0 * cpu / wall);
+        }
+    }
+
+    rx888_set_busy_poll(dev, 0);
+    benchmark_done = 1;
+
+    return r;
+}
+
 int main(int argc, char **argv)
 {
 #ifndef _WIN32
@@ -232,7 +640,7 @@ int main(int argc, char **argv)
     int dev_given = 0;
     uint32_t out_block_size = DEFAULT_BUF_LENGTH;
 
-    while ((opt = getopt(argc, argv, "d:s:b:tp::Sh")) != -1) {
+    while ((opt = getopt(argc, argv, "d:s:b:tp::l::r::N::SEB::c:g:h")) != -1) {
         switch (opt) {
         case 'd':
             dev_index = verbose_device_search(optarg);
@@ -252,6 +660,38 @@ int main(int argc, char **argv)
             if (optarg)
                 ppm_duration = atoi(optarg);
             break;
+        case 'S':
+            sync_mode = 1;
+            break;
+        case 'E':
+            epoll_mode = 1;
+            break;
+        case 'c':
+            burst_samples = (uint64_t)atof(optarg);
+            break;
+        case 'g':
+            ring_frame = (uint32_t)atof(optarg);
+            break;
+        case 'B':
+            batch_mode = 1;
+            if (optarg)
+                max_batch = (uint32_t)atoi(optarg);
+            break;
+        case 'l':
+            test_mode = LATENCY_BENCHMARK;
+            if (optarg)
+                latency_duration = atof(optarg);
+            break;
+        case 'r':
+            test_mode = RESTART_BENCHMARK;
+            if (optarg)
+                restart_cycles = atoi(optarg);
+            break;
+        case 'N':
+            test_mode = NUMA_BENCHMARK;
+            if (optarg)
+                numa_duration = atof(optarg);
+            break;
         case 'h':
         default:
             usage();
@@ -302,13 +742,57 @@ int main(int argc, char **argv)
 
     gettimeofday(&start_time, NULL);
 
-    fprintf(stderr, "Reading samples in async mode...\n");
-    r = rx888_read_async(dev, rx888_callback, NULL,
-                      0, out_block_size);
-    
-    if (do_exit) {
+    if (test_mode == LATENCY_BENCHMARK) {
+        r = latency_benchmark();
+    } else if (test_mode == RESTART_BENCHMARK) {
+        r = restart_benchmark(out_block_size);
+    } else if (test_mode == NUMA_BENCHMARK) {
+        r = numa_benchmark(out_block_size);
+#ifdef __linux__
+    } else if (epoll_mode) {
+        fprintf(stderr, "Reading samples from an epoll loop...\n");
+        r = epoll_read();
+#endif
+    } else if (sync_mode) {
+        rx888_stream_stats_t stats;
+        int n_read;
+
+        fprintf(stderr, "Reading samples in sync mode...\n");
+        r = rx888_start_readahead(dev, 0, out_block_size);
+        while (!do_exit && r >= 0) {
+            r = rx888_read_sync(dev, buffer, out_block_size, &n_read);
+            if (r < 0)
+                break;
+            rx888_callback(buffer, n_read, NULL);
+        }
+        rx888_get_stream_stats(dev, &stats);
+        fprintf(stderr, "Overruns: %u, samples lost (estimated): %llu\n",
+                stats.overruns, (unsigned long long)stats.lost_samples);
+        rx888_stop_readahead(dev);
+    } else if (burst_samples) {
+        fprintf(stderr, "Capturing bursts of %llu samples...\n",
+                (unsigned long long)burst_samples);
+        r = burst_read();
+    } else if (ring_frame) {
+        fprintf(stderr, "Reading frames of %u samples from the ring...\n",
+                ring_frame);
+        r = ring_read(out_block_size);
+    } else if (batch_mode) {
+        fprintf(stderr, "Reading samples in batched async mode...\n");
+        r = rx888_read_async_batch(dev, batch_callback, NULL,
+                                   0, out_block_size, max_batch);
+    } else {
+        fprintf(stderr, "Reading samples in async mode...\n");
+        r = rx888_read_async(dev, rx888_callback, NULL,
+                          0, out_block_size);
+    }
+
+    if (benchmark_done && r >= 0) {
+        fprintf(stderr, "\nBenchmark done, exiting...\n");
+    } else if (do_exit) {
         fprintf(stderr, "\nUser cancel, exiting...\n");
-        fprintf(stderr, "Samples per million lost (minimum): %i\n", (int)(1000000L * dropped_samples / total_samples));
+        if (total_samples)
+            fprintf(stderr, "Samples per million lost (minimum): %i\n", (int)(1000000L * dropped_samples / total_samples));
     }
     else
         fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
@@ -0,0 +1,341 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "librx888_dsp.h"
+#include "fft.h"
+#include "pool.h"
+
+#define MIN_FFT_SIZE (1U << 10)
+#define MAX_FFT_SIZE (1U << 20)
+#define FULL_SCALE 32768.0
+
+enum slot_state {
+    SLOT_FREE = 0,
+    SLOT_FILLING,
+    SLOT_QUEUED,
+    SLOT_DONE
+};
+
+/*
+ * One output spectrum. Slots are used round robin, so spectra are delivered
+ * in stream order no matter which worker finished first.
+ */
+struct spectrum_slot {
+    rx888_spectrum_t *spec;
+    uint64_t sample_index;
+    int16_t *input;             /* span samples */
+    uint32_t fill;
+    float *power;               /* bins */
+    atomic_int state;
+};
+
+struct rx888_spectrum {
+    rx888_spectrum_config_t config;
+    rx888_fft_t *fft;
+    float *window;
+    float scale;
+    uint32_t bins;
+    uint32_t hop;               /* samples between segments */
+    uint32_t advance;           /* samples between spectra */
+    uint32_t span;              /* samples covered by one spectrum */
+
+    rx888_pool_t *pool;
+    float **work;               /* per worker fft arrays and power scratch */
+
+    struct spectrum_slot *slots;
+    unsigned int nslots;
+    uint64_t seq;
+    uint64_t deliver_seq;
+    struct spectrum_slot *cur;
+    uint64_t next_index;
+    uint64_t dropped;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    rx888_spectrum_cb_t cb;
+    void *cb_ctx;
+};
+
+static void spectrum_job(void *arg, unsigned int worker)
+{
+    struct spectrum_slot *slot = arg;
+    rx888_spectrum_t *spec = slot->spec;
+    uint32_t m = spec->bins;
+    float *re = spec->work[worker];
+    float *im = re + m;
+    float *pw = im + m;
+    float *acc = slot->power;
+
+    memset(acc, 0, m * sizeof(float));
+
+    for (uint32_t a = 0; a < spec->config.averages; a++) {
+        rx888_fft_load(spec->fft, slot->input + a * spec->hop,
+                       spec->window, re, im);
+        rx888_fft_execute(spec->fft, re, im);
+        rx888_fft_power(spec->fft, re, im, pw);
+
+        for (uint32_t k = 0; k < m; k++)
+            acc[k] += pw[k];
+    }
+
+    for (uint32_t k = 0; k < m; k++)
+        acc[k] = 10.0f * log10f(acc[k] * spec->scale + 1e-20f);
+
+    pthread_mutex_lock(&spec->lock);
+    atomic_store(&slot->state, SLOT_DONE);
+    pthread_cond_broadcast(&spec->done);
+    pthread_mutex_unlock(&spec->lock);
+}
+
+/* hand finished spectra to the user, oldest first */
+static void spectrum_deliver(rx888_spectrum_t *spec)
+{
+    for (;;) {
+        struct spectrum_slot *slot =
+            &spec->slots[spec->deliver_seq % spec->nslots];
+
+        if (atomic_load(&slot->state) != SLOT_DONE)
+            break;
+
+        if (spec->cb)
+            spec->cb(slot->power, spec->bins, slot->sample_index,
+                     spec->cb_ctx);
+
+        atomic_store(&slot->state, SLOT_FREE);
+        spec->deliver_seq++;
+    }
+}
+
+static struct spectrum_slot *spectrum_acquire(rx888_spectrum_t *spec)
+{
+    struct spectrum_slot *slot = &spec->slots[spec->seq % spec->nslots];
+
+    if (spec->config.blocking) {
+        pthread_mutex_lock(&spec->lock);
+        while (atomic_load(&slot->state) == SLOT_QUEUED)
+            pthread_cond_wait(&spec->done, &spec->lock);
+        pthread_mutex_unlock(&spec->lock);
+    }
+
+    spectrum_deliver(spec);
+
+    if (atomic_load(&slot->state) != SLOT_FREE)
+        return NULL;
+
+    atomic_store(&slot->state, SLOT_FILLING);
+    slot->fill = 0;
+    slot->sample_index = spec->next_index;
+    spec->seq++;
+
+    return slot;
+}
+
+int rx888_spectrum_create(rx888_spectrum_t **out,
+                          const rx888_spectrum_config_t *config,
+                          rx888_spectrum_cb_t cb, void *ctx)
+{
+    rx888_spectrum_t *spec;
+    uint32_t n;
+    double sum;
+
+    if (!out || !config)
+        return -EINVAL;
+
+    n = config->fft_size;
+    if (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1)))
+        return -EINVAL;
+    if (config->overlap < 0.0f || config->overlap > 0.9f)
+        return -EINVAL;
+
+    spec = calloc(1, sizeof(rx888_spectrum_t));
+    if (!spec)
+        return -ENOMEM;
+
+    spec->config = *config;
+    if (!spec->config.averages)
+        spec->config.averages = 1;
+
+    spec->cb = cb;
+    spec->cb_ctx = ctx;
+    spec->bins = n / 2;
+    spec->hop = (uint32_t)(n * (1.0f - config->overlap));
+    if (!spec->hop)
+        spec->hop = 1;
+    spec->advance = spec->hop * spec->config.averages;
+    spec->span = (spec->config.averages - 1) * spec->hop + n;
+
+    pthread_mutex_init(&spec->lock, NULL);
+    pthread_cond_init(&spec->done, NULL);
+
+    spec->fft = rx888_fft_plan(n);
+    spec->window = malloc(n * sizeof(float));
+    spec->pool = rx888_pool_create(config->threads, 0);
+    if (!spec->fft || !spec->window || !spec->pool)
+        goto err;
+
+    sum = rx888_fft_window(config->window, spec->window, n);
+    /* a full scale sine of amplitude A peaks at A * sum(w) / 2 */
+    spec->scale = (float)(4.0 / (sum * sum * FULL_SCALE * FULL_SCALE *
+                                 spec->config.averages));
+
+    unsigned int threads = rx888_pool_threads(spec->pool);
+    spec->work = calloc(threads, sizeof(float *));
+    if (!spec->work)
+        goto err;
+    for (unsigned int i = 0; i < threads; i++) {
+        spec->work[i] = malloc(3 * spec->bins * sizeof(float));
+        if (!spec->work[i])
+            goto err;
+    }
+
+    /* enough spectra in flight to keep every worker busy */
+    spec->nslots = 2 * threads + 1;
+    spec->slots = calloc(spec->nslots, sizeof(struct spectrum_slot));
+    if (!spec->slots)
+        goto err;
+    for (unsigned int i = 0; i < spec->nslots; i++) {
+        spec->slots[i].spec = spec;
+        spec->slots[i].input = malloc(spec->span * sizeof(int16_t));
+        spec->slots[i].power = malloc(spec->bins * sizeof(float));
+        if (!spec->slots[i].input || !spec->slots[i].power)
+            goto err;
+    }
+
+    *out = spec;
+    return 0;
+err:
+    rx888_spectrum_destroy(spec);
+    return -ENOMEM;
+}
+
+int rx888_spectrum_process(rx888_spectrum_t *spec, const int16_t *samples,
+                           uint32_t count)
+{
+    if (!spec || (!samples && count))
+        return -EINVAL;
+
+    while (count) {
+        struct spectrum_slot *slot = spec->cur;
+
+        if (!slot) {
+            slot = spec->cur = spectrum_acquire(spec);
+            if (!slot) {
+                /* all workers busy, skip ahead */
+                spec->dropped += count;
+                spec->next_index += count;
+                return 0;
+            }
+        }
+
+        uint32_t n = spec->span - slot->fill;
+        if (n > count)
+            n = count;
+
+        memcpy(slot->input + slot->fill, samples, n * sizeof(int16_t));
+        slot->fill += n;
+        samples += n;
+        count -= n;
+        spec->next_index += n;
+
+        if (slot->fill < spec->span)
+            continue;
+
+        /* the overlapping tail starts the next spectrum */
+        spec->cur = spectrum_acquire(spec);
+        if (spec->cur) {
+            uint32_t carry = spec->span - spec->advance;
+            memcpy(spec->cur->input, slot->input + spec->advance,
+                   carry * sizeof(int16_t));
+            spec->cur->fill = carry;
+            spec->cur->sample_index = slot->sample_index + spec->advance;
+        }
+
+        atomic_store(&slot->state, SLOT_QUEUED);
+        rx888_pool_submit(spec->pool, spectrum_job, slot);
+    }
+
+    spectrum_deliver(spec);
+
+    return 0;
+}
+
+int rx888_spectrum_flush(rx888_spectrum_t *spec)
+{
+    if (!spec)
+        return -EINVAL;
+
+    pthread_mutex_lock(&spec->lock);
+    for (unsigned int i = 0; i < spec->nslots; i++) {
+        while (atomic_load(&spec->slots[i].state) == SLOT_QUEUED)
+            pthread_cond_wait(&spec->done, &spec->lock);
+    }
+    pthread_mutex_unlock(&spec->lock);
+
+    spectrum_deliver(spec);
+
+    return 0;
+}
+
+uint64_t rx888_spectrum_dropped(rx888_spectrum_t *spec)
+{
+    if (!spec)
+        return 0;
+
+    return spec->dropped;
+}
+
+void rx888_spectrum_destroy(rx888_spectrum_t *spec)
+{
+    if (!spec)
+        return;
+
+    /* joins the workers, so no job touches the slots afterwards */
+    if (spec->pool) {
+        unsigned int threads = rx888_pool_threads(spec->pool);
+
+        rx888_pool_destroy(spec->pool);
+
+        if (spec->work) {
+            for (unsigned int i = 0; i < threads; i++)
+                free(spec->work[i]);
+        }
+    }
+    free(spec->work);
+
+    if (spec->slots) {
+        for (unsigned int i = 0; i < spec->nslots; i++) {
+            free(spec->slots[i].input);
+            free(spec->slots[i].power);
+        }
+        free(spec->slots);
+    }
+
+    rx888_fft_free(spec->fft);
+    free(spec->window);
+    pthread_cond_destroy(&spec->done);
+    pthread_mutex_destroy(&spec->lock);
+    free(spec);
+}
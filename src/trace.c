@@ -0,0 +1,177 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "librx888.h"
+#include "trace.h"
+
+#ifdef RX888_TRACE
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_RING_BITS 16
+#define TRACE_RING_SIZE (1U << TRACE_RING_BITS)
+
+struct trace_event {
+    uint64_t tsc;
+    const char *name;
+    uint32_t arg;
+    char phase;
+};
+
+/* written by its own thread only, read racily by the dump */
+struct trace_ring {
+    struct trace_ring *next;
+    uint32_t tid;
+    atomic_uint_least64_t head;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+atomic_bool rx888_trace_on;
+
+static _Atomic(struct trace_ring *) rings;
+static atomic_uint next_tid;
+static _Thread_local struct trace_ring *ring;
+
+/* TSC and monotonic clock at enable time, for the conversion to us */
+static uint64_t base_tsc;
+static uint64_t base_ns;
+
+static uint64_t _trace_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t _trace_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return _trace_ns();
+#endif
+}
+
+static struct trace_ring *_trace_ring_create(void)
+{
+    struct trace_ring *r = calloc(1, sizeof(*r));
+
+    if (!r)
+        return NULL;
+
+    r->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    r->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+        ;
+
+    return r;
+}
+
+void rx888_trace_event(const char *name, char phase, uint32_t arg)
+{
+    struct trace_event *ev;
+    uint64_t head;
+
+    if (!ring) {
+        ring = _trace_ring_create();
+        if (!ring)
+            return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ev = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    ev->tsc = _trace_tsc();
+    ev->name = name;
+    ev->arg = arg;
+    ev->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int rx888_trace_enable(int on)
+{
+    if (on && !atomic_load(&rx888_trace_on)) {
+        base_ns = _trace_ns();
+        base_tsc = _trace_tsc();
+    }
+
+    atomic_store(&rx888_trace_on, on != 0);
+
+    return 0;
+}
+
+int rx888_trace_dump(const char *path)
+{
+    uint64_t now_tsc = _trace_tsc(), now_ns = _trace_ns();
+    double us_per_tick;
+    const char *sep = "";
+    FILE *f;
+
+    if (!base_tsc)
+        return -EINVAL;
+
+    /* calibrate the TSC against the monotonic clock since enable */
+    us_per_tick = now_tsc > base_tsc ?
+                  (now_ns - base_ns) / 1e3 / (now_tsc - base_tsc) : 0.0;
+
+    f = fopen(path, "w");
+    if (!f)
+        return -errno;
+
+    fprintf(f, "{\"traceEvents\":[");
+    for (struct trace_ring *r = atomic_load(&rings); r; r = r->next) {
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        for (uint64_t i = first; i < head; i++) {
+            const struct trace_event *ev =
+                &r->events[i & (TRACE_RING_SIZE - 1)];
+
+            if (ev->tsc < base_tsc)
+                continue;
+
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%u,%s\"args\":{\"v\":%u}}", sep,
+                    ev->name, ev->phase, (ev->tsc - base_tsc) * us_per_tick,
+                    r->tid, ev->phase == 'i' ? "\"s\":\"t\"," : "", ev->arg);
+            sep = ",";
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    return fclose(f) ? -errno : 0;
+}
+#else
+int rx888_trace_enable(int on)
+{
+    (void)on;
+    return -ENOSYS;
+}
+
+int rx888_trace_dump(const char *path)
+{
+    (void)path;
+    return -ENOSYS;
+}
+#endif
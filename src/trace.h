@@ -0,0 +1,52 @@
+/*
+ * rx888, a SDR receiver driver for the RX888 hardware, based on rtl-sdr project
+ * Copyright (C) 2022-2023 by Ruslan Migirov <trapi78@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RX888_TRACE_H
+#define RX888_TRACE_H
+
+/*
+ * Hot path trace points, compiled in with -DENABLE_TRACING=ON. Events go to
+ * a lock-free ring per thread with TSC timestamps and are written out as
+ * Chrome/Perfetto trace JSON by rx888_trace_dump(). Disabled at run time a
+ * trace point costs one relaxed load and a predicted branch; compiled out
+ * it costs nothing.
+ */
+
+#ifdef RX888_TRACE
+#include <stdatomic.h>
+#include <stdint.h>
+
+extern atomic_bool rx888_trace_on;
+
+void rx888_trace_event(const char *name, char phase, uint32_t arg);
+
+#define RX888_TRACE_EVENT(name, phase, arg) do { \
+        if (__builtin_expect(atomic_load_explicit(&rx888_trace_on, \
+                                 memory_order_relaxed), 0)) \
+            rx888_trace_event(name, phase, arg); \
+    } while (0)
+#else
+#define RX888_TRACE_EVENT(name, phase, arg) do { } while (0)
+#endif
+
+/* name must be a string literal, arg shows up as args.v */
+#define RX888_TRACE_BEGIN(name, arg) RX888_TRACE_EVENT(name, 'B', arg)
+#define RX888_TRACE_END(name, arg) RX888_TRACE_EVENT(name, 'E', arg)
+#define RX888_TRACE_INSTANT(name, arg) RX888_TRACE_EVENT(name, 'i', arg)
+
+#endif /* RX888_TRACE_H */